@@ -17,6 +17,38 @@ options ctl_parameters;
 
 long parse_port(char * port_name, char *optarg) ;
 
+/**
+ * Recibe un mensaje completo del servidor y lo imprime a medida que llega.
+ * Los mensajes pueden ser mas grandes que el buffer (ej: SESSIONS o TRACE),
+ * por lo que se lee hasta encontrar el fin de registro.
+ *
+ * Retorna la cantidad de bytes recibidos (0 si se cerro la conexion) y deja
+ * en `first' el comienzo del mensaje.
+ */
+ssize_t recv_message(int fd, char * first, size_t size) {
+    char    chunk[MAX_BUFFER + 1];
+    ssize_t total = 0;
+    int     flags;
+
+    first[0] = '\0';
+    do {
+        flags = 0;
+        const int ret = sctp_recvmsg(fd, (void *) chunk, MAX_BUFFER, NULL, 0, 0, &flags);
+        if (ret <= 0) {
+            return total;
+        }
+        chunk[ret] = '\0';
+        if (total == 0) {
+            strncpy(first, chunk, size - 1);
+            first[size - 1] = '\0';
+        }
+        total += ret;
+        printf("%s", chunk);
+    } while ((flags & MSG_EOR) == 0);
+
+    return total;
+}
+
 void resolv_addr() {
 
     ctl_parameters->managementaddrinfo = 0;
@@ -116,11 +148,9 @@ main (int argc, char* argv[]){
         exit(1);
     }
 
-    char  recv_buffer[MAX_BUFFER] = {0};
+    char  recv_buffer[MAX_BUFFER + 1] = {0};
     /* Receive hello */
-    sctp_recvmsg(connection_socket,
-                 (void *) recv_buffer, MAX_BUFFER, NULL, 0, 0, 0);
-    printf("%s", recv_buffer);
+    recv_message(connection_socket, recv_buffer, sizeof(recv_buffer));
 
     while(true){
 
@@ -145,18 +175,11 @@ main (int argc, char* argv[]){
         }
 
 
-        ret = sctp_recvmsg(connection_socket,
-                           (void *) recv_buffer, MAX_BUFFER, NULL, 0, 0, 0);
-
-        if (ret == 0){
+        if (recv_message(connection_socket, recv_buffer, sizeof(recv_buffer)) == 0){
             close(connection_socket);
             exit(0);
         }
 
-        recv_buffer[ret] = '\0';
-
-        printf("%s", recv_buffer);
-
         if (strcmp(recv_buffer,"+OK: Goodbye.\n") == 0){
             close(connection_socket);
             exit(0);
@@ -0,0 +1,121 @@
+/**
+ * arena.c - alocador de objetos chicos de una sesion
+ */
+#include <stdlib.h>
+
+#include "arena.h"
+#include "memory.h"
+
+struct arena_chunk {
+    struct arena_chunk  *next;
+    /** alinea los datos a 8 bytes */
+    uint64_t             data[(ARENA_CHUNK_SIZE - sizeof(void *)) / sizeof(uint64_t)];
+};
+
+/** indice del tamaño que corresponde a `size' */
+static unsigned
+size_class(size_t size) {
+    unsigned i    = 0;
+    size_t   slot = 16;
+    while (slot < size) {
+        slot <<= 1;
+        i++;
+    }
+    return i;
+}
+
+void
+arena_init(struct arena *a, void *buffer, size_t size) {
+    a->base      = buffer;
+    a->base_size = size;
+    a->current   = NULL;
+    a->used      = 0;
+    a->chunks    = NULL;
+    for (unsigned i = 0; i < ARENA_CLASSES; i++) {
+        a->free_lists[i] = NULL;
+    }
+}
+
+/** toma `size' bytes del bloque actual, pasando al siguiente si no entran */
+static void *
+bump(struct arena *a, size_t size) {
+    uint8_t *data = a->current == NULL ? a->base : (uint8_t *) a->current->data;
+    size_t   len  = a->current == NULL ? a->base_size : sizeof(a->current->data);
+
+    if (a->used + size > len) {
+        struct arena_chunk *next = a->current == NULL ? a->chunks : a->current->next;
+        if (next == NULL) {
+            next = malloc(sizeof(*next));
+            if (next == NULL) {
+                return NULL;
+            }
+            memory_charge(sizeof(*next));
+            next->next = NULL;
+            if (a->current == NULL) {
+                a->chunks = next;
+            } else {
+                a->current->next = next;
+            }
+        }
+        a->current = next;
+        a->used    = 0;
+        data       = (uint8_t *) next->data;
+    }
+
+    void *ret = data + a->used;
+    a->used += size;
+    return ret;
+}
+
+void *
+arena_alloc(struct arena *a, size_t size) {
+    if (size > ARENA_MAX_OBJECT) {
+        void *p = malloc(size);
+        if (p != NULL) {
+            memory_charge(size);
+        }
+        return p;
+    }
+    const unsigned c = size_class(size);
+    void *ret = a->free_lists[c];
+    if (ret != NULL) {
+        a->free_lists[c] = *(void **) ret;
+        return ret;
+    }
+    return bump(a, (size_t) 16 << c);
+}
+
+void
+arena_free(struct arena *a, void *p, size_t size) {
+    if (p == NULL) {
+        return;
+    }
+    if (size > ARENA_MAX_OBJECT) {
+        memory_release(size);
+        free(p);
+        return;
+    }
+    const unsigned c = size_class(size);
+    *(void **) p     = a->free_lists[c];
+    a->free_lists[c] = p;
+}
+
+void
+arena_reset(struct arena *a) {
+    a->current = NULL;
+    a->used    = 0;
+    for (unsigned i = 0; i < ARENA_CLASSES; i++) {
+        a->free_lists[i] = NULL;
+    }
+}
+
+void
+arena_destroy(struct arena *a) {
+    struct arena_chunk *next;
+    for (struct arena_chunk *c = a->chunks; c != NULL; c = next) {
+        next = c->next;
+        memory_release(sizeof(*c));
+        free(c);
+    }
+    arena_init(a, a->base, a->base_size);
+}
@@ -0,0 +1,65 @@
+#ifndef TPE_PROTOS_ARENA_H
+#define TPE_PROTOS_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * arena.c - alocador de objetos chicos de una sesion.
+ *
+ * Los argumentos de las requests de una sesion se alocan incrementando un
+ * puntero sobre un bloque propio de la sesion. Lo que se libera va a una
+ * lista por tamaño y se reusa, por lo que un pipeline largo no crece sin
+ * limite. Cuando la sesion no tiene objetos vivos (se vacio el anillo de
+ * requests) `arena_reset' recupera todo el espacio.
+ *
+ * Si el bloque inicial no alcanza se alocan bloques adicionales, que se
+ * conservan hasta `arena_destroy'.
+ */
+
+/** cantidad de tamaños distintos: 16, 32, 64, 128 y 256 bytes */
+#define ARENA_CLASSES       5
+#define ARENA_MAX_OBJECT    256
+
+/** tamaño de los bloques adicionales */
+#define ARENA_CHUNK_SIZE    4096
+
+struct arena_chunk;
+
+struct arena {
+    /** bloque inicial, provisto por el usuario */
+    uint8_t             *base;
+    size_t               base_size;
+
+    /** bloque actual (NULL es el inicial) y cuanto se uso de el */
+    struct arena_chunk  *current;
+    size_t               used;
+
+    /** bloques adicionales */
+    struct arena_chunk  *chunks;
+
+    /** objetos liberados, por tamaño */
+    void                *free_lists[ARENA_CLASSES];
+};
+
+/** inicializa la arena sobre `buffer' (alineado a 8 bytes) */
+void
+arena_init(struct arena *a, void *buffer, size_t size);
+
+/** aloca `size' bytes alineados a 8. NULL si no hay memoria */
+void *
+arena_alloc(struct arena *a, size_t size);
+
+/** libera un objeto alocado con `arena_alloc' de `size' bytes */
+void
+arena_free(struct arena *a, void *p, size_t size);
+
+/** descarta todos los objetos de la arena, conservando los bloques */
+void
+arena_reset(struct arena *a);
+
+/** libera los bloques adicionales */
+void
+arena_destroy(struct arena *a);
+
+#endif //TPE_PROTOS_ARENA_H
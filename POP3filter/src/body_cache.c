@@ -0,0 +1,711 @@
+/**
+ * body_cache.c - cache en disco de las respuestas a RETR
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "body_cache.h"
+#include "memory.h"
+
+#define INDEX_NAME      "index"
+#define INDEX_MAGIC     0x31434250u
+
+#define KEY_MAX         BODY_CACHE_KEY_MAX
+/** una ranura del indice cada SLOT_BYTES de cache, entre MIN_SLOTS y MAX_SLOTS */
+#define SLOT_BYTES      (16 * 1024)
+#define MIN_SLOTS       256
+#define MAX_SLOTS       65536
+/** una respuesta no puede ocupar mas que esta fraccion de la cache */
+#define MAX_FRACTION    8
+#define WORKERS         2
+#define CAPTURE_BLOCK   (16 * 1024)
+
+#define NONE            UINT32_MAX
+
+struct index_header {
+    uint32_t    magic;
+    uint32_t    slots;
+    /** ultimo numero de serie usado para nombrar un archivo */
+    uint64_t    serial;
+    /** reloj de los usos, para el orden LRU */
+    uint64_t    clock;
+};
+
+/** ranura del indice, libre si `hash' es 0 */
+struct index_slot {
+    uint64_t    hash;
+    uint64_t    serial;
+    uint64_t    size;
+    uint64_t    used;
+    char        key[KEY_MAX];
+};
+
+enum slot_state {
+    SLOT_FREE,
+    /** reservada, la respuesta se esta escribiendo */
+    SLOT_PENDING,
+    SLOT_READY,
+};
+
+/** estado en memoria de cada ranura */
+struct slot_info {
+    enum slot_state state;
+    uint32_t        chain;
+    uint32_t        lru_prev, lru_next;
+};
+
+struct body_capture {
+    char        key[KEY_MAX];
+    uint8_t    *data;
+    size_t      len, size;
+};
+
+enum job_type {
+    JOB_WRITE,
+    JOB_UNLINK,
+};
+
+struct job {
+    enum job_type   type;
+    uint32_t        slot;
+    uint64_t        serial;
+    uint8_t        *data;
+    size_t          len;
+    /** memoria de la captura, que se devuelve desde el hilo del selector */
+    size_t          charged;
+    bool            ok;
+    struct job     *next;
+};
+
+static struct {
+    char                   *dir;
+    int                     fd;
+    struct index_header    *header;
+    struct index_slot      *slots;
+    size_t                  mapped;
+
+    struct slot_info       *info;
+    uint32_t               *buckets;
+    uint32_t                n_buckets;
+    /** ranuras libres, como pila */
+    uint32_t               *free_slots;
+    uint32_t                n_free;
+    /** mas reciente primero */
+    uint32_t                lru_head, lru_tail;
+
+    pthread_t               workers[WORKERS];
+    unsigned                n_workers;
+    pthread_mutex_t         mutex;
+    pthread_cond_t          cond;
+    struct job             *todo_head, *todo_tail;
+    struct job             *done;
+    bool                    stop;
+
+    struct body_cache_stats stats;
+} cache = {
+    .fd = -1,
+};
+
+/** FNV-1a, sin el 0 que marca las ranuras libres */
+static uint64_t
+hash_key(const char *key) {
+    uint64_t h = 14695981039346656037ull;
+    for (const char *c = key; *c != 0; c++) {
+        h = (h ^ (uint8_t) *c) * 1099511628211ull;
+    }
+    return h == 0 ? 1 : h;
+}
+
+/** `<dir>/<serial>.<ext>' en `path', de al menos strlen(dir) + 32 bytes */
+static void
+slot_path(char *path, size_t size, uint64_t serial, const char *ext) {
+    snprintf(path, size, "%s/%llu.%s", cache.dir, (unsigned long long) serial, ext);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// hilos de escritura
+
+static void
+job_push(struct job *j) {
+    j->next = NULL;
+    pthread_mutex_lock(&cache.mutex);
+    if (cache.todo_tail != NULL) {
+        cache.todo_tail->next = j;
+    } else {
+        cache.todo_head = j;
+    }
+    cache.todo_tail = j;
+    pthread_cond_signal(&cache.cond);
+    pthread_mutex_unlock(&cache.mutex);
+}
+
+/** escribe a un temporal y lo renombra, para que no quede un archivo a medias */
+static bool
+job_write(struct job *j) {
+    char tmp[strlen(cache.dir) + 32], path[strlen(cache.dir) + 32];
+    slot_path(tmp,  sizeof(tmp),  j->serial, "tmp");
+    slot_path(path, sizeof(path), j->serial, "msg");
+
+    const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    size_t done = 0;
+    while (done < j->len) {
+        const ssize_t n = write(fd, j->data + done, j->len - done);
+        if (n < 0 && errno != EINTR) {
+            break;
+        }
+        done += n < 0 ? 0 : (size_t) n;
+    }
+    if (close(fd) < 0 || done < j->len || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+static void *
+worker(void *arg) {
+    pthread_mutex_lock(&cache.mutex);
+    for (;;) {
+        while (cache.todo_head == NULL && !cache.stop) {
+            pthread_cond_wait(&cache.cond, &cache.mutex);
+        }
+        struct job *j = cache.todo_head;
+        if (j == NULL) {
+            break;
+        }
+        cache.todo_head = j->next;
+        if (cache.todo_head == NULL) {
+            cache.todo_tail = NULL;
+        }
+        pthread_mutex_unlock(&cache.mutex);
+
+        if (j->type == JOB_UNLINK) {
+            char path[strlen(cache.dir) + 32];
+            slot_path(path, sizeof(path), j->serial, "msg");
+            unlink(path);
+            free(j);
+            pthread_mutex_lock(&cache.mutex);
+            continue;
+        }
+        j->ok = job_write(j);
+        free(j->data);
+        j->data = NULL;
+
+        pthread_mutex_lock(&cache.mutex);
+        j->next    = cache.done;
+        cache.done = j;
+    }
+    pthread_mutex_unlock(&cache.mutex);
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ranuras
+
+static uint32_t
+bucket_of(uint64_t hash) {
+    return (uint32_t) (hash & (cache.n_buckets - 1));
+}
+
+static void
+lru_unlink(uint32_t i) {
+    struct slot_info *s = &cache.info[i];
+    if (s->lru_prev != NONE) {
+        cache.info[s->lru_prev].lru_next = s->lru_next;
+    } else {
+        cache.lru_head = s->lru_next;
+    }
+    if (s->lru_next != NONE) {
+        cache.info[s->lru_next].lru_prev = s->lru_prev;
+    } else {
+        cache.lru_tail = s->lru_prev;
+    }
+    s->lru_prev = s->lru_next = NONE;
+}
+
+static void
+lru_push(uint32_t i) {
+    struct slot_info *s = &cache.info[i];
+    s->lru_prev = NONE;
+    s->lru_next = cache.lru_head;
+    if (cache.lru_head != NONE) {
+        cache.info[cache.lru_head].lru_prev = i;
+    } else {
+        cache.lru_tail = i;
+    }
+    cache.lru_head = i;
+}
+
+static void
+slot_touch(uint32_t i) {
+    cache.slots[i].used = ++cache.header->clock;
+    lru_unlink(i);
+    lru_push(i);
+}
+
+static uint32_t
+slot_find(const char *key) {
+    const uint64_t h = hash_key(key);
+    for (uint32_t i = cache.buckets[bucket_of(h)]; i != NONE; i = cache.info[i].chain) {
+        if (cache.slots[i].hash == h && strcmp(cache.slots[i].key, key) == 0) {
+            return i;
+        }
+    }
+    return NONE;
+}
+
+static void
+slot_link(uint32_t i) {
+    const uint32_t b    = bucket_of(cache.slots[i].hash);
+    cache.info[i].chain = cache.buckets[b];
+    cache.buckets[b]    = i;
+}
+
+/** saca la ranura de la tabla y la deja libre */
+static void
+slot_free(uint32_t i) {
+    uint32_t *p = &cache.buckets[bucket_of(cache.slots[i].hash)];
+    while (*p != i) {
+        p = &cache.info[*p].chain;
+    }
+    *p = cache.info[i].chain;
+    if (cache.info[i].state == SLOT_READY) {
+        lru_unlink(i);
+        cache.stats.entries--;
+    }
+    cache.stats.bytes -= cache.slots[i].size;
+    cache.slots[i].hash     = 0;
+    cache.info[i].state     = SLOT_FREE;
+    cache.free_slots[cache.n_free++] = i;
+}
+
+/** descarta la respuesta de la ranura, borrando su archivo desde los hilos */
+static void
+slot_evict(uint32_t i) {
+    struct job *j = calloc(1, sizeof(*j));
+    if (j != NULL) {
+        j->type   = JOB_UNLINK;
+        j->serial = cache.slots[i].serial;
+        job_push(j);
+    }
+    slot_free(i);
+    cache.stats.evictions++;
+}
+
+/**
+ * reserva una ranura para `size' bytes descartando las respuestas menos
+ * usadas. NONE si no hay lugar
+ */
+static uint32_t
+slot_reserve(const char *key, size_t size) {
+    while ((cache.n_free == 0 || cache.stats.bytes + size > cache.stats.limit)
+           && cache.lru_tail != NONE) {
+        slot_evict(cache.lru_tail);
+    }
+    if (cache.n_free == 0 || cache.stats.bytes + size > cache.stats.limit) {
+        return NONE;
+    }
+    const uint32_t i     = cache.free_slots[--cache.n_free];
+    struct index_slot *s = &cache.slots[i];
+    s->hash   = hash_key(key);
+    s->serial = ++cache.header->serial;
+    s->size   = size;
+    s->used   = ++cache.header->clock;
+    strcpy(s->key, key);
+    cache.info[i].state = SLOT_PENDING;
+    slot_link(i);
+    cache.stats.bytes += size;
+    cache.stats.pending++;
+    return i;
+}
+
+/** publica las escrituras que terminaron los hilos */
+static void
+drain(void) {
+    pthread_mutex_lock(&cache.mutex);
+    struct job *j = cache.done;
+    cache.done    = NULL;
+    pthread_mutex_unlock(&cache.mutex);
+
+    while (j != NULL) {
+        struct job *next = j->next;
+        memory_release(j->charged);
+        cache.stats.pending--;
+        if (j->ok) {
+            cache.info[j->slot].state = SLOT_READY;
+            lru_push(j->slot);
+            cache.stats.entries++;
+            cache.stats.stores++;
+        } else {
+            slot_free(j->slot);
+            cache.stats.dropped++;
+        }
+        free(j);
+        j = next;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// apertura
+
+/** mapea el indice, creandolo de nuevo si no es de este tamaño */
+static int
+index_open(uint32_t slots) {
+    char path[strlen(cache.dir) + sizeof(INDEX_NAME) + 1];
+    sprintf(path, "%s/%s", cache.dir, INDEX_NAME);
+
+    cache.fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (cache.fd < 0) {
+        return -1;
+    }
+    const size_t size = sizeof(struct index_header) + (size_t) slots * sizeof(struct index_slot);
+    struct stat st;
+    if (fstat(cache.fd, &st) < 0) {
+        return -1;
+    }
+    bool fresh = (size_t) st.st_size != size;
+    if (fresh && (ftruncate(cache.fd, 0) < 0 || ftruncate(cache.fd, (off_t) size) < 0)) {
+        return -1;
+    }
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, cache.fd, 0);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+    cache.mapped = size;
+    cache.header = p;
+    cache.slots  = (struct index_slot *) (cache.header + 1);
+    if (!fresh && (cache.header->magic != INDEX_MAGIC || cache.header->slots != slots)) {
+        memset(p, 0, size);
+        fresh = true;
+    }
+    if (fresh) {
+        cache.header->magic = INDEX_MAGIC;
+        cache.header->slots = slots;
+    }
+    return 0;
+}
+
+static int
+cmp_used(const void *a, const void *b) {
+    const uint64_t x = cache.slots[*(const uint32_t *) a].used;
+    const uint64_t y = cache.slots[*(const uint32_t *) b].used;
+    return x < y ? -1 : x > y;
+}
+
+static int
+cmp_serial(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * reconstruye la tabla y el LRU con las ranuras cuyo archivo esta completo, y
+ * borra del directorio los archivos que no son de ninguna ranura
+ */
+static int
+index_load(void) {
+    const uint32_t slots = cache.header->slots;
+    uint32_t *ready  = malloc(slots * sizeof(*ready));
+    uint64_t *serials = malloc(slots * sizeof(*serials));
+    if (ready == NULL || serials == NULL) {
+        free(ready);
+        free(serials);
+        return -1;
+    }
+    uint32_t n = 0;
+    for (uint32_t i = slots; i-- > 0; ) {
+        struct index_slot *s = &cache.slots[i];
+        char path[strlen(cache.dir) + 32];
+        struct stat st;
+        slot_path(path, sizeof(path), s->serial, "msg");
+        if (s->hash != 0 && memchr(s->key, 0, KEY_MAX) != NULL && stat(path, &st) == 0
+            && (uint64_t) st.st_size == s->size && s->size <= cache.stats.limit) {
+            ready[n++] = i;
+        } else {
+            s->hash = 0;
+            cache.free_slots[cache.n_free++] = i;
+        }
+    }
+    qsort(ready, n, sizeof(*ready), cmp_used);
+    for (uint32_t k = 0; k < n; k++) {
+        const uint32_t i = ready[k];
+        cache.info[i].state = SLOT_READY;
+        slot_link(i);
+        lru_push(i);
+        cache.stats.bytes += cache.slots[i].size;
+        cache.stats.entries++;
+    }
+    // si el indice se achico lo guardado puede no entrar
+    while (cache.stats.bytes > cache.stats.limit) {
+        slot_evict(cache.lru_tail);
+    }
+    n = 0;
+    for (uint32_t i = cache.lru_head; i != NONE; i = cache.info[i].lru_next) {
+        serials[n++] = cache.slots[i].serial;
+    }
+    qsort(serials, n, sizeof(*serials), cmp_serial);
+
+    DIR *d = opendir(cache.dir);
+    struct dirent *ent;
+    while (d != NULL && (ent = readdir(d)) != NULL) {
+        char *end;
+        const uint64_t serial = strtoull(ent->d_name, &end, 10);
+        const bool msg = strcmp(end, ".msg") == 0, tmp = strcmp(end, ".tmp") == 0;
+        if (end == ent->d_name || !(msg || tmp)) {
+            continue;
+        }
+        if (tmp || bsearch(&serial, serials, n, sizeof(*serials), cmp_serial) == NULL) {
+            char path[strlen(cache.dir) + strlen(ent->d_name) + 2];
+            sprintf(path, "%s/%s", cache.dir, ent->d_name);
+            unlink(path);
+        }
+    }
+    if (d != NULL) {
+        closedir(d);
+    }
+    free(ready);
+    free(serials);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// API
+
+int
+body_cache_init(const char *dir, size_t limit) {
+    if (dir == NULL || limit == 0) {
+        return 0;
+    }
+    uint32_t slots = (uint32_t) (limit / SLOT_BYTES > MAX_SLOTS ? MAX_SLOTS : limit / SLOT_BYTES);
+    if (slots < MIN_SLOTS) {
+        slots = MIN_SLOTS;
+    }
+    cache.stats.limit = limit;
+    cache.lru_head    = cache.lru_tail = NONE;
+    for (cache.n_buckets = 1; cache.n_buckets < slots; cache.n_buckets *= 2) {
+        // potencia de 2
+    }
+    cache.dir        = malloc(strlen(dir) + 1);
+    cache.info       = malloc(slots * sizeof(*cache.info));
+    cache.buckets    = malloc(cache.n_buckets * sizeof(*cache.buckets));
+    cache.free_slots = malloc(slots * sizeof(*cache.free_slots));
+    if (cache.dir == NULL || cache.info == NULL || cache.buckets == NULL
+        || cache.free_slots == NULL) {
+        goto fail;
+    }
+    strcpy(cache.dir, dir);
+    for (uint32_t i = 0; i < slots; i++) {
+        cache.info[i] = (struct slot_info) {
+            .state    = SLOT_FREE,
+            .chain    = NONE,
+            .lru_prev = NONE,
+            .lru_next = NONE,
+        };
+    }
+    for (uint32_t i = 0; i < cache.n_buckets; i++) {
+        cache.buckets[i] = NONE;
+    }
+    if ((mkdir(dir, 0700) < 0 && errno != EEXIST) || index_open(slots) < 0) {
+        goto fail;
+    }
+
+    pthread_mutex_init(&cache.mutex, NULL);
+    pthread_cond_init(&cache.cond, NULL);
+    for (; cache.n_workers < WORKERS; cache.n_workers++) {
+        if (pthread_create(&cache.workers[cache.n_workers], NULL, worker, NULL) != 0) {
+            body_cache_destroy();
+            return -1;
+        }
+    }
+    // con los hilos andando, para que puedan borrar lo que no entra
+    if (index_load() < 0) {
+        body_cache_destroy();
+        return -1;
+    }
+    return 0;
+
+fail:
+    if (cache.header != NULL) {
+        munmap(cache.header, cache.mapped);
+    }
+    if (cache.fd >= 0) {
+        close(cache.fd);
+    }
+    free(cache.dir);
+    free(cache.info);
+    free(cache.buckets);
+    free(cache.free_slots);
+    memset(&cache, 0, sizeof(cache));
+    cache.fd = -1;
+    return -1;
+}
+
+void
+body_cache_destroy(void) {
+    if (cache.header == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&cache.mutex);
+    cache.stop = true;
+    pthread_cond_broadcast(&cache.cond);
+    pthread_mutex_unlock(&cache.mutex);
+    for (unsigned i = 0; i < cache.n_workers; i++) {
+        pthread_join(cache.workers[i], NULL);
+    }
+    drain();
+    pthread_mutex_destroy(&cache.mutex);
+    pthread_cond_destroy(&cache.cond);
+
+    msync(cache.header, cache.mapped, MS_SYNC);
+    munmap(cache.header, cache.mapped);
+    close(cache.fd);
+    free(cache.dir);
+    free(cache.info);
+    free(cache.buckets);
+    free(cache.free_slots);
+    memset(&cache, 0, sizeof(cache));
+    cache.fd = -1;
+}
+
+void
+body_cache_stats(struct body_cache_stats *st) {
+    if (cache.header != NULL) {
+        drain();
+    }
+    *st = cache.stats;
+}
+
+int
+body_cache_open(const char *key, size_t *len) {
+    if (cache.header == NULL) {
+        return -1;
+    }
+    drain();
+    const uint32_t i = slot_find(key);
+    if (i == NONE || cache.info[i].state != SLOT_READY) {
+        return -1;
+    }
+    char path[strlen(cache.dir) + 32];
+    slot_path(path, sizeof(path), cache.slots[i].serial, "msg");
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        // lo borraron por fuera del proxy
+        slot_free(i);
+        return -1;
+    }
+    slot_touch(i);
+    cache.stats.hits++;
+    *len = (size_t) cache.slots[i].size;
+    return fd;
+}
+
+struct body_capture *
+body_capture_start(const char *key) {
+    if (cache.header == NULL || strlen(key) >= KEY_MAX) {
+        return NULL;
+    }
+    drain();
+    cache.stats.misses++;
+    if (slot_find(key) != NONE) {
+        return NULL;
+    }
+    struct body_capture *c = malloc(sizeof(*c));
+    if (c != NULL) {
+        strcpy(c->key, key);
+        c->data = NULL;
+        c->len  = c->size = 0;
+        memory_charge(sizeof(*c));
+    }
+    return c;
+}
+
+void
+body_capture_discard(struct body_capture *c) {
+    if (c == NULL) {
+        return;
+    }
+    memory_release(sizeof(*c) + c->size);
+    free(c->data);
+    free(c);
+}
+
+void
+body_capture_append(struct body_capture *c, const uint8_t *data, size_t n) {
+    if (c == NULL || n == 0 || c->len == SIZE_MAX) {
+        return;
+    }
+    if (c->len + n > cache.stats.limit / MAX_FRACTION) {
+        // no se guarda: se marca y se suelta lo copiado
+        memory_release(c->size);
+        free(c->data);
+        c->data = NULL;
+        c->size = 0;
+        c->len  = SIZE_MAX;
+        return;
+    }
+    if (c->len + n > c->size) {
+        size_t size = c->size == 0 ? CAPTURE_BLOCK : c->size;
+        while (size < c->len + n) {
+            size *= 2;
+        }
+        uint8_t *tmp = realloc(c->data, size);
+        if (tmp == NULL) {
+            memory_release(c->size);
+            free(c->data);
+            c->data = NULL;
+            c->size = 0;
+            c->len  = SIZE_MAX;
+            return;
+        }
+        memory_charge(size - c->size);
+        c->data = tmp;
+        c->size = size;
+    }
+    memcpy(c->data + c->len, data, n);
+    c->len += n;
+}
+
+void
+body_capture_end(struct body_capture *c) {
+    if (c == NULL) {
+        return;
+    }
+    uint32_t slot = NONE;
+    struct job *j = NULL;
+    if (cache.header == NULL) {
+        // la cache se cerro mientras pasaba la respuesta (ver upgrade.h)
+    } else if (c->len == SIZE_MAX || c->len < 3 || memcmp(c->data, "+OK", 3) != 0) {
+        if (c->len == SIZE_MAX) {
+            cache.stats.dropped++;
+        }
+    } else if (slot_find(c->key) != NONE) {
+        // otra sesion la guardo mientras tanto
+    } else if ((j = calloc(1, sizeof(*j))) == NULL
+               || (slot = slot_reserve(c->key, c->len)) == NONE) {
+        cache.stats.dropped++;
+    } else {
+        j->type    = JOB_WRITE;
+        j->slot    = slot;
+        j->serial  = cache.slots[slot].serial;
+        j->data    = c->data;
+        j->len     = c->len;
+        j->charged = c->size;
+        c->data    = NULL;
+        c->size    = 0;
+        job_push(j);
+        j = NULL;
+    }
+    free(j);
+    body_capture_discard(c);
+}
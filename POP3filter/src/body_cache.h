@@ -0,0 +1,94 @@
+#ifndef TPE_PROTOS_BODY_CACHE_H
+#define TPE_PROTOS_BODY_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * body_cache.c - cache en disco de las respuestas a RETR.
+ *
+ * Cada respuesta se guarda completa (linea +OK, cuerpo y terminador) tal como
+ * paso hacia el cliente, en un archivo `<serie>.msg' del directorio de la
+ * cache. La clave es usuario, origin y UID del mensaje (ver
+ * `mailbox_view_message_key'), asi que solo se guardan y se responden RETR de
+ * sesiones que conocen el UIDL de su buzon.
+ *
+ * El indice es un archivo `index' mapeado en memoria con una ranura por
+ * respuesta guardada: sobrevive a un reinicio del proxy. Al abrir la cache se
+ * reconstruyen a partir de el la tabla de hash y la lista LRU, y se borran los
+ * archivos que no figuran (escrituras a medias, ranuras descartadas).
+ *
+ * Las escrituras y los borrados los hace un pool de hilos: el hilo del
+ * selector solo copia la respuesta en memoria mientras la envia y al
+ * terminarla se la pasa a los hilos. Una respuesta se publica en el indice
+ * cuando el hilo termino de escribirla; hasta entonces no se puede leer. Si
+ * la cache supera su tamaño se descartan las respuestas menos usadas.
+ *
+ * Salvo los hilos de escritura, solo se usa desde el hilo del selector.
+ */
+
+/** largo maximo de una clave, con su terminador */
+#define BODY_CACHE_KEY_MAX  256
+
+struct body_capture;
+
+struct body_cache_stats {
+    size_t          limit;
+    /** bytes de las respuestas guardadas y de las que se estan escribiendo */
+    size_t          bytes;
+    unsigned        entries;
+    unsigned        pending;
+    /** RETR respondidos desde el disco y enviados al origin (con UID conocido) */
+    unsigned long   hits;
+    unsigned long   misses;
+    unsigned long   stores;
+    /** respuestas que no se guardaron: muy grandes, sin lugar o error de escritura */
+    unsigned long   dropped;
+    unsigned long   evictions;
+};
+
+/**
+ * abre (o crea) la cache en `dir' con `limit' bytes. `dir' NULL o `limit' 0
+ * la desactivan. Retorna -1 ante error.
+ */
+int
+body_cache_init(const char *dir, size_t limit);
+
+/** espera las escrituras pendientes y cierra el indice */
+void
+body_cache_destroy(void);
+
+void
+body_cache_stats(struct body_cache_stats *st);
+
+/**
+ * abre la respuesta guardada para `key'. Retorna el descriptor (que cierra el
+ * que lo usa) y deja su largo en `len', o -1 si no esta.
+ */
+int
+body_cache_open(const char *key, size_t *len);
+
+/**
+ * empieza a guardar la respuesta para `key'. NULL si la cache esta
+ * desactivada o la respuesta ya esta guardada o escribiendose.
+ */
+struct body_capture *
+body_capture_start(const char *key);
+
+/** bytes de la respuesta, tal como se envian al cliente. Acepta NULL */
+void
+body_capture_append(struct body_capture *c, const uint8_t *data, size_t n);
+
+/**
+ * termino la respuesta: si fue +OK y entro completa se pasa a los hilos de
+ * escritura, si no se descarta. Acepta NULL
+ */
+void
+body_capture_end(struct body_capture *c);
+
+/** descarta una captura sin terminar. Acepta NULL */
+void
+body_capture_discard(struct body_capture *c);
+
+#endif //TPE_PROTOS_BODY_CACHE_H
@@ -0,0 +1,206 @@
+/**
+ * capa_cache.c - cache de las capacidades de cada origin
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "capa_cache.h"
+#include "utils.h"
+
+/** direcciones distintas del origin que se recuerdan */
+#define CAPA_ENTRIES    16
+
+struct capa_entry {
+    struct sockaddr_storage addr;
+    socklen_t               len;
+    /** en microsegundos de monotonic_usec */
+    uint64_t                expires;
+    bool                    pipelining;
+    /** respuesta para el cliente, sin y con STLS */
+    struct mailbox_blob    *answers[2];
+};
+
+static struct {
+    uint64_t                ttl;
+    struct capa_entry       entries[CAPA_ENTRIES];
+    struct capa_cache_stats stats;
+} cache;
+
+void
+capa_cache_init(unsigned ttl) {
+    memset(&cache, 0, sizeof(cache));
+    cache.ttl       = (uint64_t) ttl * 1000000;
+    cache.stats.ttl = ttl;
+}
+
+static void
+entry_drop(struct capa_entry *e) {
+    if (e->len != 0) {
+        cache.stats.entries--;
+    }
+    mailbox_blob_release(e->answers[0]);
+    mailbox_blob_release(e->answers[1]);
+    memset(e, 0, sizeof(*e));
+}
+
+void
+capa_cache_destroy(void) {
+    for (unsigned i = 0; i < CAPA_ENTRIES; i++) {
+        entry_drop(&cache.entries[i]);
+    }
+}
+
+void
+capa_cache_stats(struct capa_cache_stats *st) {
+    *st = cache.stats;
+}
+
+/** entrada vigente de `addr', NULL si no hay (las vencidas se descartan) */
+static struct capa_entry *
+entry_find(const struct sockaddr *addr, socklen_t len) {
+    if (cache.ttl == 0) {
+        return NULL;
+    }
+    for (unsigned i = 0; i < CAPA_ENTRIES; i++) {
+        struct capa_entry *e = &cache.entries[i];
+        if (e->len != len || memcmp(&e->addr, addr, len) != 0) {
+            continue;
+        }
+        if (e->expires <= monotonic_usec()) {
+            cache.stats.expirations++;
+            entry_drop(e);
+            return NULL;
+        }
+        return e;
+    }
+    return NULL;
+}
+
+bool
+capa_cache_lookup(const struct sockaddr *addr, socklen_t len, bool *pipelining) {
+    const struct capa_entry *e = entry_find(addr, len);
+    if (e == NULL) {
+        if (cache.ttl != 0) {
+            cache.stats.misses++;
+        }
+        return false;
+    }
+    cache.stats.hits++;
+    *pipelining = e->pipelining;
+    return true;
+}
+
+/** copia de `s' en mayusculas, para buscar capacidades. NULL ante error */
+static char *
+upper_copy(const char *s) {
+    const size_t len = strlen(s);
+    char *ret        = malloc(len + 1);
+    if (ret != NULL) {
+        for (size_t i = 0; i <= len; i++) {
+            ret[i] = (char) toupper((unsigned char) s[i]);
+        }
+    }
+    return ret;
+}
+
+size_t
+capa_rewrite(const char *body, bool stls, char *out) {
+    const size_t len = strlen(body);
+    char *upper      = upper_copy(body);
+
+    if (upper == NULL || len < 3) {
+        free(upper);
+        memcpy(out, body, len);
+        return len;
+    }
+    // la linea STLS puede ser la primera del cuerpo
+    const char *line = strncmp(upper, "STLS\r\n", 6) == 0 ? upper
+                                                           : strstr(upper, "\r\nSTLS\r\n");
+    const bool has_stls   = line != NULL;
+    const size_t at       = !has_stls ? 0 : (size_t) (line - upper) + (line == upper ? 0 : 2);
+    const bool pipelining = strstr(upper, "PIPELINING") != NULL;
+    free(upper);
+
+    // se copia el cuerpo sin el terminador y se agrega lo que falte
+    const size_t end = len - 3;
+    size_t n;
+    if (has_stls && !stls) {
+        memcpy(out, body, at);
+        memcpy(out + at, body + at + 6, end - at - 6);
+        n = end - 6;
+    } else {
+        memcpy(out, body, end);
+        n = end;
+    }
+    if (!pipelining) {
+        memcpy(out + n, "PIPELINING\r\n", 12);
+        n += 12;
+    }
+    if (!has_stls && stls) {
+        memcpy(out + n, "STLS\r\n", 6);
+        n += 6;
+    }
+    memcpy(out + n, ".\r\n", 3);
+    return n + 3;
+}
+
+static struct mailbox_blob *
+answer_new(const uint8_t *status, size_t status_len, const char *body, bool stls) {
+    struct mailbox_blob *b = malloc(sizeof(*b) + status_len + strlen(body)
+                                    + CAPA_REWRITE_EXTRA);
+    if (b != NULL) {
+        b->refs = 1;
+        memcpy(b->data, status, status_len);
+        b->len  = status_len + capa_rewrite(body, stls, (char *) b->data + status_len);
+    }
+    return b;
+}
+
+void
+capa_cache_store(const struct sockaddr *addr, socklen_t len,
+                 const uint8_t *status, size_t status_len, const char *body) {
+    if (cache.ttl == 0 || len > sizeof(struct sockaddr_storage)) {
+        return;
+    }
+    // la misma direccion, un lugar libre o la que vence antes
+    struct capa_entry *e = NULL;
+    for (unsigned i = 0; i < CAPA_ENTRIES; i++) {
+        struct capa_entry *c = &cache.entries[i];
+        if (c->len == len && memcmp(&c->addr, addr, len) == 0) {
+            e = c;
+            break;
+        }
+        if (e == NULL || (e->len != 0 && (c->len == 0 || c->expires < e->expires))) {
+            e = c;
+        }
+    }
+    entry_drop(e);
+
+    char *upper   = upper_copy(body);
+    e->answers[0] = answer_new(status, status_len, body, false);
+    e->answers[1] = answer_new(status, status_len, body, true);
+    if (upper == NULL || e->answers[0] == NULL || e->answers[1] == NULL) {
+        free(upper);
+        entry_drop(e);
+        return;
+    }
+    memcpy(&e->addr, addr, len);
+    e->len        = len;
+    e->expires    = monotonic_usec() + cache.ttl;
+    e->pipelining = strstr(upper, "PIPELINING") != NULL;
+    cache.stats.entries++;
+    free(upper);
+}
+
+struct mailbox_blob *
+capa_cache_answer(const struct sockaddr *addr, socklen_t len, bool stls) {
+    struct capa_entry *e = entry_find(addr, len);
+    if (e == NULL) {
+        return NULL;
+    }
+    struct mailbox_blob *b = e->answers[stls ? 1 : 0];
+    b->refs++;
+    cache.stats.answers++;
+    return b;
+}
@@ -0,0 +1,80 @@
+#ifndef TPE_PROTOS_CAPA_CACHE_H
+#define TPE_PROTOS_CAPA_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+
+#include "mailbox_cache.h"
+
+/**
+ * capa_cache.c - cache de las capacidades de cada origin.
+ *
+ * Por direccion del origin se guarda, durante el TTL configurado, si soporta
+ * pipelining y la respuesta a CAPA ya reescrita para el cliente (ver
+ * capa_rewrite) en sus dos versiones, con y sin STLS. Mientras la entrada
+ * este vigente las sesiones nuevas no le piden CAPA al origin al conectarse,
+ * y el CAPA de los clientes antes de autenticarse se responde desde aca.
+ *
+ * Las entradas las llena el CAPA que cada sesion le hace al origin al
+ * conectarse; al vencer, la sesion siguiente lo vuelve a hacer. Solo se usa
+ * desde el hilo del selector.
+ */
+
+struct capa_cache_stats {
+    unsigned        ttl;
+    unsigned        entries;
+    /** sesiones que usaron capacidades guardadas y que se las pidieron al origin */
+    unsigned long   hits;
+    unsigned long   misses;
+    /** CAPA de clientes respondidos desde la cache */
+    unsigned long   answers;
+    unsigned long   expirations;
+};
+
+/** lugar extra que necesita capa_rewrite: PIPELINING y STLS agregados */
+#define CAPA_REWRITE_EXTRA  (sizeof("PIPELINING\r\nSTLS\r\n") - 1)
+
+/** las entradas vencen a los `ttl' segundos. 0 desactiva la cache */
+void
+capa_cache_init(unsigned ttl);
+
+void
+capa_cache_destroy(void);
+
+void
+capa_cache_stats(struct capa_cache_stats *st);
+
+/**
+ * si hay capacidades vigentes de `addr' deja en `pipelining' si las
+ * soporta y cuenta un acierto; si no, un fallo.
+ */
+bool
+capa_cache_lookup(const struct sockaddr *addr, socklen_t len, bool *pipelining);
+
+/**
+ * guarda la respuesta a CAPA de `addr': `status' es su linea de estado (con
+ * el CRLF) y `body' lo que sigue hasta el terminador inclusive.
+ */
+void
+capa_cache_store(const struct sockaddr *addr, socklen_t len,
+                 const uint8_t *status, size_t status_len, const char *body);
+
+/**
+ * respuesta al CAPA de un cliente, anunciando STLS segun `stls', con una
+ * referencia para el que la envia. NULL si no hay entrada vigente.
+ */
+struct mailbox_blob *
+capa_cache_answer(const struct sockaddr *addr, socklen_t len, bool stls);
+
+/**
+ * Reescribe el cuerpo de una respuesta a CAPA (sin la linea de estado, hasta
+ * el terminador) para el cliente: agrega PIPELINING si no esta, ya que el
+ * proxy lo hace por su cuenta, y deja STLS solo si `stls'. `out' debe tener
+ * lugar para strlen(body) + CAPA_REWRITE_EXTRA bytes. Retorna la longitud.
+ */
+size_t
+capa_rewrite(const char *body, bool stls, char *out);
+
+#endif //TPE_PROTOS_CAPA_CACHE_H
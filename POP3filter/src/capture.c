@@ -0,0 +1,218 @@
+/**
+ * capture.c - captura de los bytes de cada sesion
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "utils.h"
+
+/** buffer de cada archivo: se escribe al disco de a bloques */
+#define CAPTURE_BUFFER  (16 * 1024)
+
+struct capture {
+    FILE       *f;
+    /** instante del registro anterior, en microsegundos */
+    uint64_t    last;
+    char        buff[CAPTURE_BUFFER];
+};
+
+static const char  *capture_dir = NULL;
+static unsigned     sessions    = 0;
+
+static uint64_t
+now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static void
+put_varint(FILE *f, uint64_t v) {
+    while (v >= 0x80) {
+        putc((int) (v & 0x7F) | 0x80, f);
+        v >>= 7;
+    }
+    putc((int) v, f);
+}
+
+int
+capture_init(const char *dir) {
+    capture_dir = dir;
+    return dir == NULL ? 0 : mkdir_private(dir);
+}
+
+struct capture *
+capture_open(void) {
+    if (capture_dir == NULL) {
+        return NULL;
+    }
+    struct capture *c = malloc(sizeof(*c));
+    char *path = malloc(strlen(capture_dir) + 48);
+    if (c == NULL || path == NULL) {
+        goto fail;
+    }
+    sprintf(path, "%s/session-%ld-%u.cap", capture_dir, (long) getpid(), ++sessions);
+    // solo para el usuario del proxy: tiene los PASS y los mails
+    const int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    c->f = fd == -1 ? NULL : fdopen(fd, "wb");
+    if (c->f == NULL) {
+        fprintf(stderr, "capture %s: %s\n", path, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        goto fail;
+    }
+    setvbuf(c->f, c->buff, _IOFBF, sizeof(c->buff));
+    fputs(CAPTURE_MAGIC, c->f);
+    c->last = now_usec();
+    free(path);
+    return c;
+
+fail:
+    free(path);
+    free(c);
+    return NULL;
+}
+
+static void
+capture_record(struct capture *c, unsigned type, const void *data, size_t n) {
+    const uint64_t now = now_usec();
+    putc((int) type, c->f);
+    put_varint(c->f, now - c->last);
+    put_varint(c->f, n);
+    if (data != NULL) {
+        fwrite(data, 1, n, c->f);
+    }
+    c->last = now;
+}
+
+void
+capture_bytes(struct capture *c, enum record_dir dir, const void *data, ssize_t n) {
+    if (c == NULL || n <= 0) {
+        return;
+    }
+    const bool in = dir == RECORD_CLIENT_IN || dir == RECORD_ORIGIN_IN;
+    capture_record(c, dir, in ? data : NULL, (size_t) n);
+}
+
+void
+capture_close(struct capture *c) {
+    if (c == NULL) {
+        return;
+    }
+    capture_record(c, CAPTURE_END, NULL, 0);
+    if (fclose(c->f) != 0) {
+        perror("capture");
+    }
+    free(c);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// lectura
+
+static int
+get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+    *v = 0;
+    for (unsigned shift = 0; *p < end && shift < 64; shift += 7) {
+        const uint8_t b = *(*p)++;
+        *v |= (uint64_t) (b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int
+capture_file_load(struct capture_file *f, const char *path) {
+    memset(f, 0, sizeof(*f));
+
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        return -1;
+    }
+    size_t len = 0, size = 0;
+    for (;;) {
+        if (len == size) {
+            size = size == 0 ? 64 * 1024 : size * 2;
+            uint8_t *tmp = realloc(f->raw, size);
+            if (tmp == NULL) {
+                fclose(in);
+                goto fail;
+            }
+            f->raw = tmp;
+        }
+        const size_t n = fread(f->raw + len, 1, size - len, in);
+        if (n == 0) {
+            break;
+        }
+        len += n;
+    }
+    const bool error = ferror(in);
+    fclose(in);
+    const size_t magic = sizeof(CAPTURE_MAGIC) - 1;
+    if (error || len < magic || memcmp(f->raw, CAPTURE_MAGIC, magic) != 0) {
+        errno = error ? errno : EINVAL;
+        goto fail;
+    }
+
+    const uint8_t *p = f->raw + magic, *end = f->raw + len;
+    uint64_t at = 0;
+    size_t records_size = 0;
+    while (p < end) {
+        const unsigned type = *p++;
+        uint64_t delta, n;
+        if (get_varint(&p, end, &delta) < 0 || get_varint(&p, end, &n) < 0) {
+            goto invalid;
+        }
+        at += delta;
+        if (type == CAPTURE_END) {
+            break;
+        } else if (type >= RECORD_DIRS) {
+            goto invalid;
+        }
+        const bool in = type == RECORD_CLIENT_IN || type == RECORD_ORIGIN_IN;
+        if (in && n > (uint64_t) (end - p)) {
+            goto invalid;
+        }
+        if (f->count == records_size) {
+            records_size = records_size == 0 ? 256 : records_size * 2;
+            struct capture_record *tmp = realloc(f->records, records_size * sizeof(*tmp));
+            if (tmp == NULL) {
+                goto fail;
+            }
+            f->records = tmp;
+        }
+        f->records[f->count++] = (struct capture_record) {
+            .dir  = (enum record_dir) type,
+            .at   = at,
+            .len  = (size_t) n,
+            .data = in ? p : NULL,
+        };
+        if (in) {
+            p += n;
+        }
+    }
+    // una sesion que seguia viva al cortar el proxy no tiene fin: se usa lo leido
+    return 0;
+
+invalid:
+    errno = EINVAL;
+fail:
+    capture_file_free(f);
+    return -1;
+}
+
+void
+capture_file_free(struct capture_file *f) {
+    free(f->raw);
+    free(f->records);
+    memset(f, 0, sizeof(*f));
+}
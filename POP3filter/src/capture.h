@@ -0,0 +1,83 @@
+#ifndef TPE_PROTOS_CAPTURE_H
+#define TPE_PROTOS_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "session_record.h"
+
+/**
+ * capture.c - captura de los bytes de cada sesion, para reproducirlas con
+ * pop3replay.
+ *
+ * Con un directorio de captura configurado cada sesion escribe un archivo
+ * `session-<pid>-<n>.cap' con todo lo que entra y sale por ambos extremos:
+ *
+ *      "P3CAP1\n"
+ *      registro*
+ *      fin
+ *
+ * Cada registro es
+ *
+ *      [sentido: 1 byte][delta: varint][largo: varint][datos]
+ *
+ * donde el sentido es un `enum record_dir', delta son los microsegundos desde
+ * el registro anterior (o desde el inicio de la sesion) y los datos solo estan
+ * en los sentidos de entrada (RECORD_CLIENT_IN y RECORD_ORIGIN_IN): lo que
+ * envia el proxy se reproduce, no se guarda, y alcanza con su largo. El fin
+ * es un registro con sentido CAPTURE_END, delta y largo 0.
+ *
+ * Los varint son de 7 bits por byte, el menos significativo primero.
+ * Solo se escribe desde el hilo del selector.
+ */
+
+#define CAPTURE_MAGIC   "P3CAP1\n"
+#define CAPTURE_END     RECORD_DIRS
+
+struct capture;
+
+/**
+ * configura el directorio de captura (NULL la desactiva) y lo crea si no
+ * existe. Las capturas tienen las credenciales en claro: el directorio es
+ * 0700 y los archivos 0600. -1 si no se pudo crear.
+ */
+int
+capture_init(const char *dir);
+
+/** abre la captura de una sesion nueva. NULL si no hay captura o fallo */
+struct capture *
+capture_open(void);
+
+/** registra `n' bytes transferidos en el sentido `dir'. Ignora n <= 0 */
+void
+capture_bytes(struct capture *c, enum record_dir dir, const void *data, ssize_t n);
+
+/** escribe el fin y cierra. Acepta NULL */
+void
+capture_close(struct capture *c);
+
+/** registro de una captura leida */
+struct capture_record {
+    enum record_dir dir;
+    /** microsegundos desde el inicio de la sesion */
+    uint64_t        at;
+    size_t          len;
+    /** NULL en los sentidos de salida */
+    const uint8_t  *data;
+};
+
+struct capture_file {
+    uint8_t                *raw;
+    struct capture_record  *records;
+    size_t                  count;
+};
+
+/** carga una captura entera en memoria. Retorna -1 ante error */
+int
+capture_file_load(struct capture_file *f, const char *path);
+
+void
+capture_file_free(struct capture_file *f);
+
+#endif //TPE_PROTOS_CAPTURE_H
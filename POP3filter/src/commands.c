@@ -8,6 +8,16 @@
 #include "parameters.h"
 #include "media_types.h"
 #include "metrics.h"
+#include "memory.h"
+#include "mailbox_cache.h"
+#include "capa_cache.h"
+#include "body_cache.h"
+#include "spill.h"
+#include "prefetch.h"
+#include "tls.h"
+#include "pop3.h"
+#include "config.h"
+#include "utils.h"
 
 enum comm_status{
     COMM_OK                 = 0,
@@ -19,25 +29,32 @@ enum comm_status{
 struct command{
     const char * comm;
     int          args;
+    /** argumentos opcionales, a continuacion de los obligatorios */
+    int          optional;
     enum comm_status (*handler)(struct management * data);
 };
 
 enum comm_status hand_cmd(struct management * data){
-    char ** cmd = data->cmd;
-    char * str = malloc(sizeof(char) * strlen(cmd[1]) + 1);
-    strcpy(str, cmd[1]);
-    if (str == NULL)
+    struct config * c = config_copy();
+    if (c == NULL)
+        return COMM_ERR_MALLOC;
+    if (config_set_string(&c->filter_command, data->cmd[1]) < 0){
+        config_release(c);
         return COMM_ERR_MALLOC;
-    if (parameters->filter_command != NULL)
-        free(parameters->filter_command);
-    parameters->filter_command = str;
+    }
+    config_publish(c);
     send_ok(data, "Done.");
     return COMM_OK;
 }
 
 enum comm_status hand_ext(struct management * data){
-    parameters->et_activated = !parameters->et_activated;
-    if (parameters->et_activated) {
+    struct config * c = config_copy();
+    if (c == NULL)
+        return COMM_ERR_MALLOC;
+    c->et_activated = !c->et_activated;
+    const bool activated = c->et_activated;
+    config_publish(c);
+    if (activated) {
         send_ok(data, "External transformations activated.");
     } else {
         send_ok(data, "External transformations deactivated.");
@@ -46,43 +63,43 @@ enum comm_status hand_ext(struct management * data){
 }
 
 enum comm_status hand_msg(struct management * data){
-    char ** cmd = data->cmd;
-    char * str = malloc(sizeof(char) * strlen(cmd[1]) + 1);
-    if (str == NULL)
+    struct config * c = config_copy();
+    if (c == NULL)
+        return COMM_ERR_MALLOC;
+    if (config_set_string(&c->replacement_msg, data->cmd[1]) < 0){
+        config_release(c);
         return COMM_ERR_MALLOC;
-    strcpy(str, cmd[1]);
-    parameters->replacement_msg = cmd[1];
+    }
+    config_publish(c);
     send_ok(data, "Done.");
     return COMM_OK;
 }
 
 enum comm_status hand_list(struct management * data){
-    char * msg = get_types_list(parameters->filtered_media_types, '\n');
-    if (msg == NULL)
+    struct config * c = config_get();
+    const char * msg = get_types_list(c->filtered_media_types, '\n');
+    if (msg == NULL){
+        config_release(c);
         return COMM_ERR_MALLOC;
+    }
     send_ok(data, msg);
-    free(msg);
+    config_release(c);
     return COMM_OK;
 }
 
 enum comm_status hand_ban(struct management * data){
     char ** cmd = data->cmd;
-    char * str = malloc(sizeof(char) * strlen(cmd[1]) + 1);
-    if (str == NULL)
-        return COMM_ERR_MALLOC;
-    strcpy(str, cmd[1]);
     char * type, * subtype;
-    if (is_mime(str, &type, &subtype) < 0)
+    if (is_mime(cmd[1], &type, &subtype) < 0)
         return COMM_ERR_WRONGARGS;
-    char * s = malloc(sizeof(char) * strlen(subtype) + 1);
-    if (s == NULL){
-        free(str);
+    struct config * c = config_copy();
+    if (c == NULL)
         return COMM_ERR_MALLOC;
-    }
-    strcpy(s, subtype);
-    if (add_media_type(parameters->filtered_media_types, type, s) < 0){
+    if (add_media_type(c->filtered_media_types, type, subtype) < 0){
+        config_release(c);
         send_error(data, "could not ban type");
     }else{
+        config_publish(c);
         send_ok(data, "type banned");
     }
     return COMM_OK;
@@ -93,31 +110,177 @@ enum comm_status hand_unban(struct management * data){
     char * type, * subtype;
     if (is_mime(cmd[1], &type, &subtype) < 0)
         return COMM_ERR_WRONGARGS;
-    if (delete_media_type(parameters->filtered_media_types, type, subtype) < 0){
+    struct config * c = config_copy();
+    if (c == NULL)
+        return COMM_ERR_MALLOC;
+    if (delete_media_type(c->filtered_media_types, type, subtype) < 0){
+        config_release(c);
         send_error(data, "could not unban type");
     }else{
+        config_publish(c);
         send_ok(data, "type unbanned");
     }
     return COMM_OK;
 }
 
 enum comm_status hand_stats(struct management * data){
-    char msg[300];
+    // crece con cada linea nueva: no tiene un tamaño fijo que actualizar
+    struct strbuf msg = { 0 };
+    struct slab_stats pool;
+    pop3_pool_stats(&pool);
+    struct memory_stats mem;
+    memory_stats(&mem);
+    struct mailbox_cache_stats mc;
+    mailbox_cache_stats(&mc);
+    const unsigned long lookups = mc.hits + mc.misses;
+    struct body_cache_stats bc;
+    body_cache_stats(&bc);
+    const unsigned long retrs = bc.hits + bc.misses;
+    struct prefetch_stats pf;
+    prefetch_stats(&pf);
+    struct tls_stats tls;
+    tls_stats(&tls);
+    struct capa_cache_stats cc;
+    capa_cache_stats(&cc);
+    struct spill_stats sp;
+    spill_stats(&sp);
     char cbuff[32] = {0};
     time_t now = 0;
     time(&now);
     strftime(cbuff, 32, "%FT%TZ\t", gmtime(&now));
     printf("%s", cbuff);
-    sprintf(msg, " Metrics\n"
+    const int n = strbuf_printf(&msg, " Metrics\n"
                     "Date: %s\n"
                     "Concurrent connections: %u\n"
                     "Historical Access: %u\n"
                     "Transferred Bytes: %lld\n"
-                    "Retrieved Messages: %u",
+                    "Retrieved Messages: %u\n"
+                    "Deferred Events: %lu\n"
+                    "Session pool: %u slots, %u free, %u overflow, %zu KB%s\n"
+                    "Session memory: %zu KB used, %zu KB peak, "
+                    "soft %zu KB (%lu hits, %lu origin pauses), hard %zu KB (%lu rejected)\n"
+                    "Mailbox cache: %zu KB used of %zu KB, %u users, %lu hits, "
+                    "%lu misses (%.1f%% hit ratio), STAT %lu valid %lu stale, "
+                    "%lu invalidations, %lu evictions\n"
+                    "Body cache: %zu KB used of %zu KB, %u messages (%u being written), "
+                    "%lu hits, %lu misses (%.1f%% hit ratio), %lu stored, %lu dropped, "
+                    "%lu evictions\n"
+                    "Prefetch: %lu issued, %lu hits (%.1f%% used), %lu discarded "
+                    "(%lu over budget)\n"
+                    "Warmup: %lu sessions, %lu requests, %lld bytes, %lu answers from cache\n"
+                    "CAPA cache: %u origins, TTL %u s, %lu sessions skipped CAPA, %lu asked "
+                    "the origin, %lu client CAPA answered, %lu expired "
+                    "(%lu round trips saved)\n"
+                    "Spill: %lu responses (%lu to disk), %llu KB in memory, %llu KB on disk, "
+                    "%zu KB used of %zu KB (%zu KB peak), %lu refused, origin done first "
+                    "%lu times (%llu KB ahead)\n"
+                    "Parking: %lu parked, %lu parks (%lu while spilling), %lu resumed, "
+                    "%lu failed, reconnect avg %.1f ms max %.1f ms\n"
+                    "TLS: %lu handshakes (%lu resumed), %lu failed, kTLS %lu send %lu receive",
             cbuff,
             metricas->concurrent_connections,
             metricas->historical_access, metricas->transferred_bytes,
-            metricas->retrieved_messages);
+            metricas->retrieved_messages, metricas->deferred_events,
+            pool.capacity, pool.free, pool.overflow, pool.mapped / 1024,
+            pool.hugepages ? " (huge pages)" : "",
+            mem.used / 1024, mem.peak / 1024, mem.soft / 1024, mem.soft_hits,
+            mem.throttled, mem.hard / 1024, mem.hard_hits,
+            mc.bytes / 1024, mc.limit / 1024, mc.entries, mc.hits, mc.misses,
+            lookups == 0 ? 0.0 : 100.0 * mc.hits / lookups, mc.validations,
+            mc.mismatches, mc.invalidations, mc.evictions,
+            bc.bytes / 1024, bc.limit / 1024, bc.entries, bc.pending, bc.hits, bc.misses,
+            retrs == 0 ? 0.0 : 100.0 * bc.hits / retrs, bc.stores, bc.dropped, bc.evictions,
+            pf.issued, pf.hits, pf.issued == 0 ? 0.0 : 100.0 * pf.hits / pf.issued,
+            pf.discarded, pf.overflows,
+            metricas->warmup_sessions, metricas->warmup_requests, metricas->warmup_bytes,
+            metricas->warmup_hits,
+            cc.entries, cc.ttl, cc.hits, cc.misses, cc.answers, cc.expirations,
+            cc.hits + cc.answers,
+            sp.responses, sp.to_disk, sp.mem_bytes / 1024, sp.disk_bytes / 1024,
+            sp.disk_used / 1024, sp.disk_limit / 1024, sp.disk_peak / 1024, sp.refused,
+            sp.origin_first, sp.origin_ahead / 1024,
+            metricas->parked_sessions, metricas->parks, metricas->spill_parks,
+            metricas->resumes,
+            metricas->resume_failures,
+            metricas->resumes == 0 ? 0.0 : metricas->resume_usec / 1000.0 / metricas->resumes,
+            metricas->resume_usec_max / 1000.0,
+            tls.handshakes, tls.resumed, tls.failures, tls.ktls_send, tls.ktls_recv);
+    if (n < 0){
+        free(msg.s);
+        return COMM_ERR_MALLOC;
+    }
+    send_ok(data, msg.s);
+    free(msg.s);
+    return COMM_OK;
+}
+
+enum comm_status hand_sessions(struct management * data){
+    char ** cmd = data->cmd;
+    enum pop3_sessions_order order = POP3_SESSIONS_BY_BYTES;
+    unsigned long page = 1;
+    if (data->argc > 1){
+        if (strcasecmp(cmd[1], "bytes") == 0)
+            order = POP3_SESSIONS_BY_BYTES;
+        else if (strcasecmp(cmd[1], "age") == 0)
+            order = POP3_SESSIONS_BY_AGE;
+        else
+            return COMM_ERR_WRONGARGS;
+    }
+    if (data->argc > 2){
+        char * end;
+        page = strtoul(cmd[2], &end, 10);
+        if (end == cmd[2] || *end != '\0' || page == 0)
+            return COMM_ERR_WRONGARGS;
+    }
+    char * msg = pop3_sessions_dump(order, (unsigned) page);
+    if (msg == NULL)
+        return COMM_ERR_MALLOC;
+    send_ok(data, msg);
+    free(msg);
+    return COMM_OK;
+}
+
+enum comm_status hand_trace(struct management * data){
+    char ** cmd = data->cmd;
+    char * end;
+    unsigned long id = strtoul(cmd[1], &end, 10);
+    if (end == cmd[1] || *end != '\0')
+        return COMM_ERR_WRONGARGS;
+    char * msg;
+    if (pop3_trace_dump((unsigned) id, &msg) < 0){
+        send_error(data, "no such session.");
+        return COMM_OK;
+    }
+    if (msg == NULL)
+        return COMM_ERR_MALLOC;
+    send_ok(data, msg);
+    free(msg);
+    return COMM_OK;
+}
+
+enum comm_status hand_kill(struct management * data){
+    char ** cmd = data->cmd;
+    char * end;
+    unsigned long id = strtoul(cmd[1], &end, 10);
+    if (end == cmd[1] || *end != '\0')
+        return COMM_ERR_WRONGARGS;
+    switch (pop3_kill((unsigned) id)){
+        case 0:
+            send_ok(data, "session killed.");
+            break;
+        case -1:
+            send_error(data, "no such session.");
+            break;
+        default:
+            send_error(data, "session is resolving the origin. Try again later.");
+            break;
+    }
+    return COMM_OK;
+}
+
+enum comm_status hand_killuser(struct management * data){
+    char msg[64];
+    sprintf(msg, "%d sessions killed.", pop3_kill_user(data->cmd[1]));
     send_ok(data, msg);
     return COMM_OK;
 }
@@ -164,6 +327,31 @@ static struct command comm_stats = {
         .handler     = &hand_stats,
 };
 
+static struct command comm_sessions = {
+        .comm        = "SESSIONS",
+        .args        = 0,
+        .optional    = 2,
+        .handler     = &hand_sessions,
+};
+
+static struct command comm_trace = {
+        .comm        = "TRACE",
+        .args        = 1,
+        .handler     = &hand_trace,
+};
+
+static struct command comm_kill = {
+        .comm        = "KILL",
+        .args        = 1,
+        .handler     = &hand_kill,
+};
+
+static struct command comm_killuser = {
+        .comm        = "KILLUSER",
+        .args        = 1,
+        .handler     = &hand_killuser,
+};
+
 static struct command * command_list[] = {
         &comm_cmd,
         &comm_ext,
@@ -172,6 +360,10 @@ static struct command * command_list[] = {
         &comm_stats,
         &comm_ban,
         &comm_unban,
+        &comm_sessions,
+        &comm_trace,
+        &comm_kill,
+        &comm_killuser,
 };
 
 int parse_config(struct management *data){
@@ -181,7 +373,7 @@ int parse_config(struct management *data){
         for (size_t i = 0; i < sizeof(command_list)/ sizeof(*command_list); i++){
             struct command * c = command_list[i];
             if (strcasecmp(c->comm, cmd[0]) == 0){
-                if(c->args == data->argc - 1){
+                if(c->args <= data->argc - 1 && data->argc - 1 <= c->args + c->optional){
                     st = c->handler(data);
                 }else{
                     send_error(data, "wrong number of arguments.");
@@ -0,0 +1,141 @@
+/**
+ * config.c - snapshots inmutables de la configuracion de runtime
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "parameters.h"
+
+/** configuracion vigente */
+static struct config *current = NULL;
+
+/**
+ * cantidad de lectores entre que leen `current' y toman su referencia.
+ * `config_publish' espera a que no haya ninguno antes de soltar la
+ * configuracion reemplazada, de forma que nadie incremente el contador de
+ * una configuracion ya liberada.
+ *
+ * Cada lado escribe una variable y despues lee la otra: el lector incrementa
+ * `pinning' y lee `current', el que publica reemplaza `current' y lee
+ * `pinning'. Con acquire/release ambos pueden leer el valor viejo (el lector
+ * la configuracion anterior, el que publica `pinning' en 0) y liberarla en
+ * uso. Las cuatro operaciones son secuencialmente consistentes: en su orden
+ * total, o el lector lee `current' despues del reemplazo y toma la nueva, o
+ * lo lee antes, y entonces su incremento precede a la lectura de `pinning'
+ * del que publica, que espera.
+ */
+static unsigned pinning = 0;
+
+static char *
+copy_string(const char *s) {
+    if (s == NULL) {
+        return NULL;
+    }
+    char *ret = malloc(strlen(s) + 1);
+    if (ret != NULL) {
+        strcpy(ret, s);
+    }
+    return ret;
+}
+
+static void
+config_free(struct config *c) {
+    free(c->filter_command);
+    free(c->replacement_msg);
+    if (c->filtered_media_types != NULL) {
+        delete_media_types(c->filtered_media_types);
+    }
+    free(c);
+}
+
+/** nueva configuracion a partir de los valores dados, con una referencia */
+static struct config *
+config_new(bool et_activated, const char *filter_command, const char *replacement_msg,
+           struct media_types *media_types) {
+    struct config *c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        return NULL;
+    }
+    c->references           = 1;
+    c->et_activated         = et_activated;
+    c->filter_command       = copy_string(filter_command);
+    c->replacement_msg      = copy_string(replacement_msg);
+    c->filtered_media_types = copy_media_types(media_types);
+
+    if ((filter_command != NULL && c->filter_command == NULL)
+        || c->replacement_msg == NULL || c->filtered_media_types == NULL) {
+        config_free(c);
+        return NULL;
+    }
+    return c;
+}
+
+int
+config_init(void) {
+    struct config *c = config_new(parameters->et_activated, parameters->filter_command,
+                                  parameters->replacement_msg,
+                                  parameters->filtered_media_types);
+    if (c == NULL) {
+        return -1;
+    }
+    config_publish(c);
+    return 0;
+}
+
+void
+config_destroy(void) {
+    struct config *c = __atomic_exchange_n(&current, NULL, __ATOMIC_ACQ_REL);
+    if (c != NULL) {
+        config_release(c);
+    }
+}
+
+struct config *
+config_get(void) {
+    __atomic_add_fetch(&pinning, 1, __ATOMIC_SEQ_CST);
+    struct config *c = __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&c->references, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&pinning, 1, __ATOMIC_RELEASE);
+    return c;
+}
+
+void
+config_release(struct config *c) {
+    if (c != NULL && __atomic_sub_fetch(&c->references, 1, __ATOMIC_ACQ_REL) == 0) {
+        config_free(c);
+    }
+}
+
+struct config *
+config_copy(void) {
+    struct config *c   = config_get();
+    struct config *ret = config_new(c->et_activated, c->filter_command,
+                                    c->replacement_msg, c->filtered_media_types);
+    config_release(c);
+    return ret;
+}
+
+int
+config_set_string(char **field, const char *value) {
+    char *s = copy_string(value);
+    if (value != NULL && s == NULL) {
+        return -1;
+    }
+    free(*field);
+    *field = s;
+    return 0;
+}
+
+void
+config_publish(struct config *c) {
+    // una vez publicada no se modifica, ni siquiera las listas cacheadas
+    get_types_list(c->filtered_media_types, ',');
+    get_types_list(c->filtered_media_types, '\n');
+
+    struct config *old = __atomic_exchange_n(&current, c, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&pinning, __ATOMIC_SEQ_CST) != 0) {
+        // un lector puede estar por tomar una referencia a `old'
+    }
+    config_release(old);
+}
@@ -0,0 +1,63 @@
+#ifndef TPE_PROTOS_CONFIG_H
+#define TPE_PROTOS_CONFIG_H
+
+#include <stdbool.h>
+
+#include "media_types.h"
+
+/**
+ * config.c - configuracion modificable en tiempo de ejecucion.
+ *
+ * Lo que se puede cambiar desde management (comando de transformacion
+ * externa, mensaje de reemplazo, media types filtrados) vive en snapshots
+ * inmutables con contador de referencias. Una sesion toma una referencia al
+ * comenzar cada RETR y la usa hasta terminarlo, aunque mientras tanto se
+ * publique una configuracion nueva.
+ *
+ * Para modificarla se obtiene una copia con `config_copy', se la modifica y
+ * se la publica con `config_publish', que la reemplaza atomicamente. La
+ * configuracion anterior se libera cuando la suelta su ultimo usuario.
+ */
+struct config {
+    /** referencias vivas, incluyendo la de la configuracion vigente */
+    unsigned                references;
+
+    bool                    et_activated;
+    /** comando de la transformacion externa, NULL si no hay */
+    char                   *filter_command;
+    char                   *replacement_msg;
+    struct media_types     *filtered_media_types;
+};
+
+/** crea la configuracion inicial a partir de los parametros de la linea de comandos */
+int
+config_init(void);
+
+/** libera la configuracion vigente */
+void
+config_destroy(void);
+
+/** toma una referencia a la configuracion vigente */
+struct config *
+config_get(void);
+
+/** suelta una referencia, liberando la configuracion si era la ultima */
+void
+config_release(struct config *c);
+
+/**
+ * copia privada de la configuracion vigente, para ser modificada y luego
+ * publicada (o descartada con `config_release'). NULL si no hay memoria.
+ */
+struct config *
+config_copy(void);
+
+/** reemplaza `*field' por una copia de `value' (que puede ser NULL) */
+int
+config_set_string(char **field, const char *value);
+
+/** publica `c' como configuracion vigente, tomando su referencia */
+void
+config_publish(struct config *c);
+
+#endif //TPE_PROTOS_CONFIG_H
@@ -7,6 +7,9 @@
 
 #define N(x) (sizeof(x)/sizeof((x)[0]))
 
+/** destino de los registros de sesion, NULL es stdout */
+static FILE *access_log = NULL;
+
 /** loguea la conexion a stdout */
 void
 log_connection(bool opened, const struct sockaddr* clientaddr,
@@ -35,4 +38,98 @@ void log_request(struct pop3_request *r) {
 
 void log_response(const struct pop3_response *r) {
     fprintf(stdout, "response: %s\n", r == NULL ? "" : r->name);
-}
\ No newline at end of file
+}
+
+int log_open_access(const char *path) {
+    if (path == NULL) {
+        access_log = stdout;
+        return 0;
+    }
+    FILE *f = fopen(path, "a");
+    if (f == NULL) {
+        return -1;
+    }
+    // cada registro es una linea completa, no queremos registros partidos
+    setvbuf(f, NULL, _IOLBF, 0);
+    access_log = f;
+    return 0;
+}
+
+/** escribe un string JSON escapando lo necesario */
+static void
+json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; s != NULL && *s != 0; s++) {
+        const unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\') {
+            fputc('\\', f);
+            fputc(c, f);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+void log_session(const struct session_record *r, const char * const *state_names,
+                 const struct sockaddr* clientaddr, const struct sockaddr* originaddr,
+                 const char *user) {
+    FILE *f = access_log == NULL ? stdout : access_log;
+    char cbuff[SOCKADDR_TO_HUMAN_MIN] = { 0 };
+    char tbuff[32] = { 0 };
+    time_t now = 0;
+    time(&now);
+    strftime(tbuff, N(tbuff), "%FT%TZ", gmtime(&now));
+
+    fprintf(f, "{\"ts\":\"%s\",\"client\":", tbuff);
+    json_string(f, sockaddr_to_human(cbuff, N(cbuff), clientaddr));
+    fprintf(f, ",\"origin\":");
+    json_string(f, sockaddr_to_human(cbuff, N(cbuff), originaddr));
+    fprintf(f, ",\"user\":");
+    json_string(f, user);
+    fprintf(f, ",\"duration_us\":%llu", (unsigned long long)(r->state_since - r->started));
+
+    // por estado: [primer arribo, tiempo total, arribos]
+    fprintf(f, ",\"phases\":{");
+    bool first = true;
+    for (unsigned i = 0; i < RECORD_MAX_STATES && state_names[i] != NULL; i++) {
+        const struct record_state *st = &r->states[i];
+        if (st->arrivals == 0) {
+            continue;
+        }
+        fprintf(f, "%s\"%s\":[%llu,%llu,%u]", first ? "" : ",", state_names[i],
+                (unsigned long long) st->first_at, (unsigned long long) st->total,
+                st->arrivals);
+        first = false;
+    }
+
+    fprintf(f, "},\"bytes\":{\"client_in\":%llu,\"client_out\":%llu,"
+               "\"origin_in\":%llu,\"origin_out\":%llu}",
+            (unsigned long long) r->bytes[RECORD_CLIENT_IN],
+            (unsigned long long) r->bytes[RECORD_CLIENT_OUT],
+            (unsigned long long) r->bytes[RECORD_ORIGIN_IN],
+            (unsigned long long) r->bytes[RECORD_ORIGIN_OUT]);
+
+    fprintf(f, ",\"filter\":[%u,%llu]", r->filter_count,
+            (unsigned long long) r->filter_total);
+
+    // por comando: [cantidad, latencia origin, rtt total, rtt maximo, bytes]
+    fprintf(f, ",\"cmds\":{");
+    first = true;
+    for (unsigned i = 0; i < RECORD_MAX_CMDS; i++) {
+        const struct record_cmd *c = &r->cmds[i];
+        const struct pop3_request_cmd *cmd = get_cmd_by_id((enum pop3_cmd_id) i);
+        if (c->count == 0 || cmd == NULL) {
+            continue;
+        }
+        fprintf(f, "%s\"%s\":[%u,%llu,%llu,%llu,%llu]", first ? "" : ",", cmd->name,
+                c->count, (unsigned long long) c->origin_total,
+                (unsigned long long) c->rtt_total, (unsigned long long) c->rtt_max,
+                (unsigned long long) c->bytes);
+        first = false;
+    }
+    fprintf(f, "}}\n");
+    fflush(f);
+}
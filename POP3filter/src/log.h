@@ -5,6 +5,7 @@
 #include <stdbool.h>
 #include "request.h"
 #include "response.h"
+#include "session_record.h"
 
 /** loguea cuando se abre o cierra una conexion a stdout */
 void log_connection(bool opened, const struct sockaddr* clientaddr, const struct sockaddr* originaddr);
@@ -15,4 +16,18 @@ void log_request(struct pop3_request *r);
 /** loguea la respuesta a un comando valido pop3 */
 void log_response(const struct pop3_response *r);
 
+/**
+ * abre el archivo donde se emiten los registros de sesion. Si `path' es NULL
+ * se utiliza stdout. Retorna -1 si no se pudo abrir.
+ */
+int log_open_access(const char *path);
+
+/**
+ * emite el registro de una sesion terminada como una unica linea JSON.
+ * `state_names' tiene un nombre por cada estado registrado, terminado en NULL.
+ */
+void log_session(const struct session_record *r, const char * const *state_names,
+                 const struct sockaddr* clientaddr, const struct sockaddr* originaddr,
+                 const char *user);
+
 #endif //TPE_PROTOS_LOG_H
@@ -0,0 +1,712 @@
+/**
+ * mailbox_cache.c - cache de los listados de cada buzon
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "mailbox_cache.h"
+#include "memory.h"
+
+#define INITIAL_BUCKETS 64
+#define CAPTURE_BLOCK   1024
+
+enum listing {
+    LISTING_LIST,
+    LISTING_UIDL,
+    LISTINGS,
+};
+
+/** UID de un mensaje dentro de la respuesta a UIDL */
+struct uid_ref {
+    uint32_t    offset;
+    uint32_t    len;
+};
+
+struct mailbox_entry {
+    char                   *key;
+    uint32_t                hash;
+    /** cambia cada vez que se invalida la entrada */
+    uint64_t                generation;
+
+    bool                    stat_known;
+    unsigned long           count;
+    uint64_t                size;
+
+    struct mailbox_blob    *listings[LISTINGS];
+    /** por numero de mensaje (desde 1), NULL si el listado no es 1..count */
+    uint64_t               *sizes;
+    struct uid_ref         *uids;
+    unsigned long           n_sizes, n_uids;
+    /** identifica el UIDL guardado (unico en toda la cache), 0 si no hay */
+    uint64_t                uidl_stamp;
+
+    /** memoria que ocupa, contra el limite de la cache */
+    size_t                  bytes;
+
+    struct mailbox_entry   *chain;
+    struct mailbox_entry   *lru_prev, *lru_next;
+};
+
+static struct {
+    struct mailbox_entry  **buckets;
+    size_t                  n_buckets;
+    /** mas reciente primero */
+    struct mailbox_entry   *lru_head, *lru_tail;
+    uint64_t                generations;
+    uint64_t                uidl_stamps;
+    struct mailbox_cache_stats stats;
+} cache;
+
+/** FNV-1a */
+static uint32_t
+hash_key(const char *key) {
+    uint32_t h = 2166136261u;
+    for (const char *c = key; *c != 0; c++) {
+        h = (h ^ (uint8_t) *c) * 16777619u;
+    }
+    return h;
+}
+
+void
+mailbox_blob_release(struct mailbox_blob *b) {
+    if (b != NULL && --b->refs == 0) {
+        free(b);
+    }
+}
+
+static struct mailbox_blob *
+blob_new(const uint8_t *data, size_t len) {
+    struct mailbox_blob *b = malloc(sizeof(*b) + len);
+    if (b != NULL) {
+        b->refs = 1;
+        b->len  = len;
+        memcpy(b->data, data, len);
+    }
+    return b;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// entradas
+
+static void
+lru_unlink(struct mailbox_entry *e) {
+    if (e->lru_prev != NULL) {
+        e->lru_prev->lru_next = e->lru_next;
+    } else {
+        cache.lru_head = e->lru_next;
+    }
+    if (e->lru_next != NULL) {
+        e->lru_next->lru_prev = e->lru_prev;
+    } else {
+        cache.lru_tail = e->lru_prev;
+    }
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void
+lru_push(struct mailbox_entry *e) {
+    e->lru_prev = NULL;
+    e->lru_next = cache.lru_head;
+    if (cache.lru_head != NULL) {
+        cache.lru_head->lru_prev = e;
+    } else {
+        cache.lru_tail = e;
+    }
+    cache.lru_head = e;
+}
+
+static void
+entry_account(struct mailbox_entry *e, size_t bytes) {
+    cache.stats.bytes = cache.stats.bytes - e->bytes + bytes;
+    e->bytes          = bytes;
+}
+
+/** memoria de la entrada segun lo que tiene guardado */
+static size_t
+entry_size(const struct mailbox_entry *e) {
+    size_t n = sizeof(*e) + strlen(e->key) + 1;
+    for (unsigned i = 0; i < LISTINGS; i++) {
+        n += e->listings[i] == NULL ? 0 : sizeof(*e->listings[i]) + e->listings[i]->len;
+    }
+    n += e->sizes == NULL ? 0 : e->n_sizes * sizeof(*e->sizes);
+    n += e->uids  == NULL ? 0 : e->n_uids  * sizeof(*e->uids);
+    return n;
+}
+
+static void
+entry_drop_listing(struct mailbox_entry *e, enum listing l) {
+    mailbox_blob_release(e->listings[l]);
+    e->listings[l] = NULL;
+    if (l == LISTING_LIST) {
+        free(e->sizes);
+        e->sizes   = NULL;
+        e->n_sizes = 0;
+    } else {
+        free(e->uids);
+        e->uids       = NULL;
+        e->n_uids     = 0;
+        e->uidl_stamp = 0;
+    }
+}
+
+/** descarta lo guardado; las sesiones que confiaban en la entrada dejan de hacerlo */
+static void
+entry_clear(struct mailbox_entry *e) {
+    entry_drop_listing(e, LISTING_LIST);
+    entry_drop_listing(e, LISTING_UIDL);
+    e->stat_known = false;
+    e->generation = ++cache.generations;
+    entry_account(e, entry_size(e));
+}
+
+/** el buzon cambio (DELE, RSET) */
+static void
+entry_invalidate(struct mailbox_entry *e) {
+    entry_clear(e);
+    cache.stats.invalidations++;
+}
+
+static bool
+entry_empty(const struct mailbox_entry *e) {
+    return !e->stat_known && e->listings[LISTING_LIST] == NULL
+           && e->listings[LISTING_UIDL] == NULL;
+}
+
+static struct mailbox_entry *
+entry_find(const char *key) {
+    if (cache.buckets == NULL) {
+        return NULL;
+    }
+    const uint32_t h = hash_key(key);
+    for (struct mailbox_entry *e = cache.buckets[h & (cache.n_buckets - 1)]; e != NULL;
+         e = e->chain) {
+        if (e->hash == h && strcmp(e->key, key) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void
+entry_free(struct mailbox_entry *e) {
+    struct mailbox_entry **p = &cache.buckets[e->hash & (cache.n_buckets - 1)];
+    while (*p != e) {
+        p = &(*p)->chain;
+    }
+    *p = e->chain;
+    lru_unlink(e);
+    entry_drop_listing(e, LISTING_LIST);
+    entry_drop_listing(e, LISTING_UIDL);
+    cache.stats.bytes -= e->bytes;
+    cache.stats.entries--;
+    free(e->key);
+    free(e);
+}
+
+/** descarta las entradas menos usadas hasta entrar en el limite, salvo `keep' */
+static void
+evict(const struct mailbox_entry *keep) {
+    struct mailbox_entry *e = cache.lru_tail;
+    while (cache.stats.bytes > cache.stats.limit && e != NULL) {
+        struct mailbox_entry *prev = e->lru_prev;
+        if (e != keep) {
+            entry_free(e);
+            cache.stats.evictions++;
+        }
+        e = prev;
+    }
+}
+
+static int
+grow_buckets(void) {
+    const size_t n = cache.n_buckets * 2;
+    struct mailbox_entry **buckets = calloc(n, sizeof(*buckets));
+    if (buckets == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < cache.n_buckets; i++) {
+        struct mailbox_entry *e = cache.buckets[i];
+        while (e != NULL) {
+            struct mailbox_entry *next = e->chain;
+            e->chain = buckets[e->hash & (n - 1)];
+            buckets[e->hash & (n - 1)] = e;
+            e = next;
+        }
+    }
+    free(cache.buckets);
+    cache.buckets   = buckets;
+    cache.n_buckets = n;
+    return 0;
+}
+
+static struct mailbox_entry *
+entry_get(const char *key) {
+    struct mailbox_entry *e = entry_find(key);
+    if (e != NULL) {
+        lru_unlink(e);
+        lru_push(e);
+        return e;
+    }
+    if (cache.stats.entries >= cache.n_buckets && grow_buckets() < 0) {
+        return NULL;
+    }
+    e = calloc(1, sizeof(*e));
+    if (e == NULL || (e->key = malloc(strlen(key) + 1)) == NULL) {
+        free(e);
+        return NULL;
+    }
+    strcpy(e->key, key);
+    e->hash       = hash_key(key);
+    e->generation = ++cache.generations;
+    e->chain      = cache.buckets[e->hash & (cache.n_buckets - 1)];
+    cache.buckets[e->hash & (cache.n_buckets - 1)] = e;
+    lru_push(e);
+    cache.stats.entries++;
+    entry_account(e, entry_size(e));
+    evict(e);
+    return e;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// parseo de las respuestas
+
+/** "+OK" al comienzo de la respuesta */
+static bool
+is_ok(const uint8_t *data, size_t len) {
+    return len >= 3 && memcmp(data, "+OK", 3) == 0;
+}
+
+/** numero decimal en `*p', avanzando. -1 si no hay */
+static int
+parse_number(const uint8_t **p, const uint8_t *end, uint64_t *n) {
+    const uint8_t *s = *p;
+    *n = 0;
+    while (*p < end && isdigit(**p)) {
+        *n = *n * 10 + (uint64_t) (**p - '0');
+        (*p)++;
+    }
+    return *p == s ? -1 : 0;
+}
+
+static void
+skip_spaces(const uint8_t **p, const uint8_t *end) {
+    while (*p < end && **p == ' ') {
+        (*p)++;
+    }
+}
+
+/** "+OK count size" */
+static int
+parse_stat(const uint8_t *data, size_t len, unsigned long *count, uint64_t *size) {
+    const uint8_t *p = data + 3, *end = data + len;
+    uint64_t n;
+    skip_spaces(&p, end);
+    if (parse_number(&p, end, &n) < 0) {
+        return -1;
+    }
+    *count = (unsigned long) n;
+    skip_spaces(&p, end);
+    return parse_number(&p, end, size);
+}
+
+/**
+ * recorre las lineas de un listado ("n valor") y arma el indice por numero
+ * de mensaje. Para LIST deja tambien la cantidad y la suma de tamaños.
+ * Retorna -1 si el listado no tiene la forma esperada.
+ */
+static int
+parse_listing(struct mailbox_entry *e, enum listing l, unsigned long *count,
+              uint64_t *size) {
+    const struct mailbox_blob *b = e->listings[l];
+    const uint8_t *p = b->data, *end = b->data + b->len;
+    const uint8_t *nl = memchr(p, '\n', b->len);
+    if (nl == NULL) {
+        return -1;
+    }
+    p = nl + 1;
+
+    unsigned long n = 0, slots = 0;
+    uint64_t *sizes = NULL, total = 0;
+    struct uid_ref *uids = NULL;
+    while (p < end && *p != '.') {
+        uint64_t number, value = 0;
+        if (parse_number(&p, end, &number) < 0 || number != n + 1 || p == end || *p != ' ') {
+            goto fail;
+        }
+        skip_spaces(&p, end);
+        const uint8_t *value_start = p;
+        while (p < end && *p != '\r' && *p != '\n' && *p != ' ') {
+            p++;
+        }
+        if (l == LISTING_LIST) {
+            const uint8_t *q = value_start;
+            if (parse_number(&q, p, &value) < 0 || q != p) {
+                goto fail;
+            }
+        }
+        nl = memchr(p, '\n', end - p);
+        if (nl == NULL) {
+            goto fail;
+        }
+        if (n == slots) {
+            slots = slots == 0 ? 64 : slots * 2;
+            void *tmp = l == LISTING_LIST ? realloc(sizes, slots * sizeof(*sizes))
+                                          : realloc(uids, slots * sizeof(*uids));
+            if (tmp == NULL) {
+                goto fail;
+            }
+            if (l == LISTING_LIST) {
+                sizes = tmp;
+            } else {
+                uids = tmp;
+            }
+        }
+        if (l == LISTING_LIST) {
+            sizes[n] = value;
+            total   += value;
+        } else {
+            uids[n].offset = (uint32_t) (value_start - b->data);
+            uids[n].len    = (uint32_t) (p - value_start);
+        }
+        n++;
+        p = nl + 1;
+    }
+    if (l == LISTING_LIST) {
+        e->sizes   = sizes;
+        e->n_sizes = n;
+        *count     = n;
+        *size      = total;
+    } else {
+        e->uids    = uids;
+        e->n_uids  = n;
+    }
+    return 0;
+
+fail:
+    free(sizes);
+    free(uids);
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// API
+
+void
+mailbox_cache_init(size_t limit) {
+    memset(&cache, 0, sizeof(cache));
+    cache.stats.limit = limit;
+    if (limit == 0) {
+        return;
+    }
+    cache.buckets = calloc(INITIAL_BUCKETS, sizeof(*cache.buckets));
+    if (cache.buckets != NULL) {
+        cache.n_buckets = INITIAL_BUCKETS;
+    }
+}
+
+void
+mailbox_cache_destroy(void) {
+    while (cache.lru_head != NULL) {
+        entry_free(cache.lru_head);
+    }
+    free(cache.buckets);
+    cache.buckets   = NULL;
+    cache.n_buckets = 0;
+}
+
+void
+mailbox_cache_stats(struct mailbox_cache_stats *st) {
+    *st = cache.stats;
+}
+
+void
+mailbox_view_init(struct mailbox_view *v) {
+    memset(v, 0, sizeof(*v));
+    v->capturing = error;
+}
+
+void
+mailbox_view_open(struct mailbox_view *v, const char *user, const char *origin) {
+    if (cache.buckets == NULL || user == NULL || v->key != NULL) {
+        return;
+    }
+    // el usuario no puede tener un salto de linea
+    v->key = malloc(strlen(user) + strlen(origin) + 2);
+    if (v->key != NULL) {
+        sprintf(v->key, "%s\n%s", user, origin);
+    }
+}
+
+static void
+capture_reset(struct mailbox_view *v) {
+    memory_release(v->capture_size);
+    free(v->capture);
+    v->capture      = NULL;
+    v->capture_len  = 0;
+    v->capture_size = 0;
+    v->capturing    = error;
+}
+
+void
+mailbox_view_close(struct mailbox_view *v) {
+    capture_reset(v);
+    mailbox_blob_release(v->serving);
+    free(v->key);
+    mailbox_view_init(v);
+}
+
+void
+mailbox_view_forget(struct mailbox_view *v) {
+    v->generation = 0;
+    v->uidl_stamp = 0;
+}
+
+void
+mailbox_view_request(struct mailbox_view *v, const struct pop3_request *r) {
+    if (v->key == NULL) {
+        return;
+    }
+    struct mailbox_entry *e;
+    switch (r->cmd->id) {
+        case stat:
+        case list:
+        case uidl:
+            // no se pudo responder desde la cache
+            cache.stats.misses++;
+            return;
+        case dele:
+            v->dirty = true;
+            break;
+        case rset:
+            v->dirty = false;
+            break;
+        case quit:
+            if (!v->dirty) {
+                v->generation = 0;
+                return;
+            }
+            break;
+        default:
+            return;
+    }
+    e = entry_find(v->key);
+    if (e != NULL) {
+        entry_invalidate(e);
+    }
+    v->generation = 0;
+}
+
+/** el argumento de LIST/UIDL como numero de mensaje, 0 si no es valido */
+static unsigned long
+message_number(const char *args) {
+    char *end;
+    const unsigned long n = strtoul(args, &end, 10);
+    while (*end == ' ') {
+        end++;
+    }
+    return end == args || *end != 0 ? 0 : n;
+}
+
+/** respuesta de una linea para un mensaje */
+static struct mailbox_blob *
+single_line(const struct mailbox_entry *e, enum pop3_cmd_id cmd, unsigned long n) {
+    char line[128];
+    int len;
+    if (cmd == list) {
+        if (e->sizes == NULL || n == 0 || n > e->n_sizes) {
+            return NULL;
+        }
+        len = snprintf(line, sizeof(line), "+OK %lu %llu\r\n", n,
+                       (unsigned long long) e->sizes[n - 1]);
+    } else {
+        if (e->uids == NULL || n == 0 || n > e->n_uids) {
+            return NULL;
+        }
+        const struct uid_ref *u = &e->uids[n - 1];
+        len = snprintf(line, sizeof(line), "+OK %lu %.*s\r\n", n, (int) u->len,
+                       (const char *) e->listings[LISTING_UIDL]->data + u->offset);
+    }
+    return len < 0 || (size_t) len >= sizeof(line) ? NULL
+                                                   : blob_new((const uint8_t *) line, (size_t) len);
+}
+
+/** respuesta a STAT */
+static struct mailbox_blob *
+stat_line(const struct mailbox_entry *e) {
+    char line[64];
+    const int len = snprintf(line, sizeof(line), "+OK %lu %llu\r\n", e->count,
+                             (unsigned long long) e->size);
+    return len < 0 || (size_t) len >= sizeof(line) ? NULL
+                                                   : blob_new((const uint8_t *) line, (size_t) len);
+}
+
+struct mailbox_blob *
+mailbox_view_answer(struct mailbox_view *v, const struct pop3_request *r) {
+    if (v->key == NULL || r->cmd == NULL
+        || (r->cmd->id != stat && r->cmd->id != list && r->cmd->id != uidl)) {
+        return NULL;
+    }
+    struct mailbox_entry *e = v->dirty || v->generation == 0 ? NULL : entry_find(v->key);
+    struct mailbox_blob *ret = NULL;
+    if (e != NULL && e->generation == v->generation && r->cmd->id == stat) {
+        // el buzon esta bloqueado mientras dure la sesion: no cambio
+        ret = r->args != NULL || !e->stat_known ? NULL : stat_line(e);
+        lru_unlink(e);
+        lru_push(e);
+    } else if (e != NULL && e->generation == v->generation) {
+        const enum listing l = r->cmd->id == list ? LISTING_LIST : LISTING_UIDL;
+        if (r->args == NULL) {
+            ret = e->listings[l];
+            if (ret != NULL) {
+                ret->refs++;
+            }
+        } else {
+            ret = single_line(e, r->cmd->id, message_number(r->args));
+        }
+        lru_unlink(e);
+        lru_push(e);
+    }
+    if (ret != NULL) {
+        cache.stats.hits++;
+    }
+    return ret;
+}
+
+int
+mailbox_view_message_key(const struct mailbox_view *v, const char *args, char *out,
+                         size_t size) {
+    if (v->key == NULL || v->dirty || v->generation == 0 || args == NULL) {
+        return -1;
+    }
+    const struct mailbox_entry *e = entry_find(v->key);
+    const unsigned long n = message_number(args);
+    // un STAT igual no garantiza la misma numeracion: solo vale el UIDL que
+    // el origin le respondio a esta sesion
+    if (e == NULL || e->generation != v->generation || e->uids == NULL || n == 0
+        || n > e->n_uids || v->uidl_stamp == 0 || e->uidl_stamp != v->uidl_stamp) {
+        return -1;
+    }
+    const struct uid_ref *u = &e->uids[n - 1];
+    const int len = snprintf(out, size, "%s\n%.*s", v->key, (int) u->len,
+                             (const char *) e->listings[LISTING_UIDL]->data + u->offset);
+    return len < 0 || (size_t) len >= size ? -1 : 0;
+}
+
+void
+mailbox_view_capture_start(struct mailbox_view *v, const struct pop3_request *r) {
+    capture_reset(v);
+    if (v->key != NULL && !v->dirty && r->args == NULL
+        && (r->cmd->id == stat || r->cmd->id == list || r->cmd->id == uidl)) {
+        v->capturing = r->cmd->id;
+    }
+}
+
+void
+mailbox_view_capture(struct mailbox_view *v, const uint8_t *data, size_t n) {
+    if (v->capturing == error || n == 0) {
+        return;
+    }
+    if (v->capture_len + n > cache.stats.limit) {
+        // no entraria en la cache
+        capture_reset(v);
+        return;
+    }
+    if (v->capture_len + n > v->capture_size) {
+        size_t size = v->capture_size == 0 ? CAPTURE_BLOCK : v->capture_size;
+        while (size < v->capture_len + n) {
+            size *= 2;
+        }
+        uint8_t *tmp = realloc(v->capture, size);
+        if (tmp == NULL) {
+            capture_reset(v);
+            return;
+        }
+        memory_charge(size - v->capture_size);
+        v->capture      = tmp;
+        v->capture_size = size;
+    }
+    memcpy(v->capture + v->capture_len, data, n);
+    v->capture_len += n;
+}
+
+/** STAT del origin: valida la entrada o descarta sus listados */
+static void
+store_stat(struct mailbox_view *v, struct mailbox_entry *e) {
+    unsigned long count;
+    uint64_t size;
+    if (parse_stat(v->capture, v->capture_len, &count, &size) < 0) {
+        return;
+    }
+    if (e->stat_known && e->count == count && e->size == size) {
+        cache.stats.validations++;
+    } else {
+        if (e->stat_known) {
+            cache.stats.mismatches++;
+        }
+        if (!entry_empty(e)) {
+            entry_clear(e);
+        }
+        e->stat_known = true;
+        e->count      = count;
+        e->size       = size;
+    }
+    v->generation = e->generation;
+}
+
+static void
+store_listing(struct mailbox_view *v, struct mailbox_entry *e) {
+    if (e->generation != v->generation) {
+        // lo guardado no es de esta sesion ni lo valido
+        if (!entry_empty(e)) {
+            entry_clear(e);
+        }
+        v->generation = e->generation;
+    }
+    const enum listing l = v->capturing == list ? LISTING_LIST : LISTING_UIDL;
+    entry_drop_listing(e, l);
+    e->listings[l] = blob_new(v->capture, v->capture_len);
+    if (e->listings[l] == NULL) {
+        return;
+    }
+
+    unsigned long count = 0;
+    uint64_t size = 0;
+    if (parse_listing(e, l, &count, &size) == 0 && l == LISTING_LIST) {
+        if (e->stat_known && (e->count != count || e->size != size)) {
+            // el UIDL guardado puede ser de otro estado del buzon
+            entry_drop_listing(e, LISTING_UIDL);
+        }
+        e->stat_known = true;
+        e->count      = count;
+        e->size       = size;
+    } else if (l == LISTING_UIDL && e->stat_known && e->uids != NULL && e->n_uids != e->count) {
+        entry_drop_listing(e, LISTING_LIST);
+        e->stat_known = false;
+    }
+    if (l == LISTING_UIDL && e->uids != NULL) {
+        e->uidl_stamp = v->uidl_stamp = ++cache.uidl_stamps;
+    }
+}
+
+void
+mailbox_view_capture_end(struct mailbox_view *v) {
+    if (v->capturing == error) {
+        return;
+    }
+    struct mailbox_entry *e = NULL;
+    if (is_ok(v->capture, v->capture_len) && (e = entry_get(v->key)) != NULL) {
+        if (v->capturing == stat) {
+            store_stat(v, e);
+        } else {
+            store_listing(v, e);
+        }
+        entry_account(e, entry_size(e));
+        evict(e);
+        if (e->bytes > cache.stats.limit) {
+            entry_clear(e);
+        }
+    }
+    capture_reset(v);
+}
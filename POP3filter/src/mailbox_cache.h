@@ -0,0 +1,138 @@
+#ifndef TPE_PROTOS_MAILBOX_CACHE_H
+#define TPE_PROTOS_MAILBOX_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "request.h"
+
+/**
+ * mailbox_cache.c - cache de los listados de cada buzon.
+ *
+ * Por usuario y origin se guardan las respuestas a LIST y UIDL sin
+ * argumentos tal como pasaron hacia el cliente, los tamaños y UIDs de cada
+ * mensaje y el resultado de STAT (el de la respuesta o el que se deduce de
+ * LIST).
+ *
+ * Una sesion responde desde la cache solo si confia en la entrada: la lleno
+ * ella misma o un STAT suyo coincidio con el guardado. En ese caso tambien se
+ * responde STAT, ya que el buzon queda bloqueado mientras dura la sesion. Un STAT distinto
+ * descarta los listados. DELE y RSET invalidan la entrada y la sesion deja
+ * de confiar en ella; despues de un DELE la sesion no guarda ni responde
+ * nada hasta un RSET, y si llega al QUIT se vuelve a invalidar la entrada
+ * (los borrados se hacen efectivos).
+ *
+ * Las entradas se descartan de la menos usada a la mas usada cuando los
+ * listados superan el limite de memoria configurado. Solo se usa desde el
+ * hilo del selector.
+ */
+
+/** respuesta guardada, compartida entre la cache y las sesiones que la envian */
+struct mailbox_blob {
+    unsigned    refs;
+    size_t      len;
+    uint8_t     data[];
+};
+
+/** estado de la cache de una sesion */
+struct mailbox_view {
+    /** usuario y origin, NULL sin cache o antes de autenticarse */
+    char                   *key;
+    /** generacion de la entrada en la que confia la sesion, 0 si ninguna */
+    uint64_t                generation;
+    /** la sesion borro mensajes: no guarda ni responde hasta un RSET */
+    bool                    dirty;
+    /** UIDL que el origin le respondio a la sesion, 0 si no pidio ninguno */
+    uint64_t                uidl_stamp;
+
+    /** respuesta del origin que se esta guardando (`error' si ninguna) */
+    enum pop3_cmd_id        capturing;
+    uint8_t                *capture;
+    size_t                  capture_len, capture_size;
+
+    /** respuesta que se esta enviando desde la cache */
+    struct mailbox_blob    *serving;
+    size_t                  offset;
+};
+
+struct mailbox_cache_stats {
+    size_t          limit;
+    size_t          bytes;
+    unsigned        entries;
+    /** STAT, LIST y UIDL respondidos desde la cache y enviados al origin */
+    unsigned long   hits;
+    unsigned long   misses;
+    /** STAT que coincidieron y que no con lo guardado */
+    unsigned long   validations;
+    unsigned long   mismatches;
+    unsigned long   invalidations;
+    unsigned long   evictions;
+};
+
+/** `limit' bytes para los listados. 0 desactiva la cache */
+void
+mailbox_cache_init(size_t limit);
+
+void
+mailbox_cache_destroy(void);
+
+void
+mailbox_cache_stats(struct mailbox_cache_stats *st);
+
+/** deja `v' vacia. No aloca */
+void
+mailbox_view_init(struct mailbox_view *v);
+
+/** la sesion se autentico como `user' contra `origin' */
+void
+mailbox_view_open(struct mailbox_view *v, const char *user, const char *origin);
+
+/** libera lo que tenga la sesion */
+void
+mailbox_view_close(struct mailbox_view *v);
+
+/**
+ * la sesion abrio otra conexion con el origin (ver -k): deja de confiar en
+ * lo que valido con la anterior hasta su proximo STAT o listado
+ */
+void
+mailbox_view_forget(struct mailbox_view *v);
+
+/** `r' se envia al origin: DELE, RSET y QUIT invalidan, STAT, LIST y UIDL son fallos */
+void
+mailbox_view_request(struct mailbox_view *v, const struct pop3_request *r);
+
+/**
+ * respuesta a `r' desde la cache, con una referencia para el que la envia.
+ * NULL si hay que preguntarle al origin (el fallo se cuenta al enviarla).
+ */
+struct mailbox_blob *
+mailbox_view_answer(struct mailbox_view *v, const struct pop3_request *r);
+
+/**
+ * clave del mensaje `args' (el argumento de RETR) para la cache de cuerpos:
+ * usuario, origin y UID segun el UIDL que el origin le respondio a la sesion
+ * (si sigue siendo el guardado). Retorna -1 si no se conoce el UID o no entra
+ * en `size' bytes.
+ */
+int
+mailbox_view_message_key(const struct mailbox_view *v, const char *args, char *out,
+                         size_t size);
+
+/** empieza a responderse `r': si es STAT, LIST o UIDL se guarda la respuesta */
+void
+mailbox_view_capture_start(struct mailbox_view *v, const struct pop3_request *r);
+
+/** bytes de la respuesta en curso, tal como se envian al cliente */
+void
+mailbox_view_capture(struct mailbox_view *v, const uint8_t *data, size_t n);
+
+/** termino la respuesta en curso: si fue +OK se actualiza la entrada */
+void
+mailbox_view_capture_end(struct mailbox_view *v);
+
+void
+mailbox_blob_release(struct mailbox_blob *b);
+
+#endif //TPE_PROTOS_MAILBOX_CACHE_H
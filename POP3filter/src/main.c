@@ -10,9 +10,20 @@
 
 #include "selector.h"
 #include "parameters.h"
+#include "config.h"
 #include "pop3.h"
 #include "management.h"
 #include "metrics.h"
+#include "memory.h"
+#include "log.h"
+#include "capture.h"
+#include "mailbox_cache.h"
+#include "capa_cache.h"
+#include "body_cache.h"
+#include "spill.h"
+#include "prefetch.h"
+#include "tls.h"
+#include "upgrade.h"
 
 #define PENDING_CONNECTIONS 10
 
@@ -49,10 +60,61 @@ int main (int argc, char ** argv) {
 
     parse_options(argc,argv);
 
+    // antes de abrir la cache de RETR, que la instancia vieja cierra al pasar los sockets
+    int inherited[UPGRADE_SOCKETS];
+    if (upgrade_takeover(parameters->upgrade_socket, inherited) == 0) {
+        printf("Took over the listening sockets of the running instance\n");
+    }
+
     metricas = calloc(1, sizeof(*metricas));
 
-    int master_tcp_socket = create_master_socket(
-            IPPROTO_TCP, parameters->listenadddrinfo);
+    if (config_init() < 0) {
+        fprintf(stderr, "Memory error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pop3_pool_init(parameters->pool_max, parameters->pool_prewarm,
+                       parameters->pool_hugepages) < 0) {
+        fprintf(stderr, "Memory error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memory_init((size_t) parameters->memory_soft << 20,
+                (size_t) parameters->memory_hard << 20);
+
+    if (capture_init(parameters->capture_dir) < 0) {
+        perror("capture");
+        exit(EXIT_FAILURE);
+    }
+    mailbox_cache_init((size_t) parameters->mailbox_cache << 20);
+    capa_cache_init(parameters->capa_ttl);
+    prefetch_configure(parameters->prefetch);
+    if (body_cache_init(parameters->body_cache_dir,
+                        (size_t) parameters->body_cache << 20) < 0) {
+        perror("body cache");
+        exit(EXIT_FAILURE);
+    }
+    if (spill_init(parameters->spill_dir, (size_t) parameters->spill_memory << 10,
+                   (size_t) parameters->spill_disk << 20) < 0) {
+        perror("spill");
+        exit(EXIT_FAILURE);
+    }
+
+    if (tls_init(parameters->tls_cert, parameters->tls_key) < 0) {
+        fprintf(stderr, "Unable to load the TLS certificate\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (log_open_access(parameters->access_log) < 0) {
+        perror("access log");
+        exit(EXIT_FAILURE);
+    }
+
+    int master_tcp_socket = upgrade_adopt(inherited[UPGRADE_POP3],
+                                          parameters->listenadddrinfo);
+    if (master_tcp_socket < 0) {
+        master_tcp_socket = create_master_socket(IPPROTO_TCP, parameters->listenadddrinfo);
+    }
 
     //try to specify maximum of 3 pending connections for the master socket
     if (listen(master_tcp_socket, PENDING_CONNECTIONS) < 0) {
@@ -62,8 +124,25 @@ int main (int argc, char ** argv) {
 
     printf("Listening on TCP %s:%d \n", parameters->listen_address, parameters->port);
 
-    int master_sctp_socket = create_master_socket(
-            IPPROTO_SCTP, parameters->managementaddrinfo);
+    int master_pop3s_socket = upgrade_adopt(inherited[UPGRADE_POP3S],
+                                            parameters->pop3saddrinfo);
+    if (master_pop3s_socket < 0 && parameters->pop3saddrinfo != NULL) {
+        master_pop3s_socket = create_master_socket(IPPROTO_TCP, parameters->pop3saddrinfo);
+    }
+    if (master_pop3s_socket >= 0) {
+        if (listen(master_pop3s_socket, PENDING_CONNECTIONS) < 0) {
+            perror("listen");
+            exit(EXIT_FAILURE);
+        }
+        printf("Listening on TCP %s:%d (POP3S)\n", parameters->listen_address,
+               parameters->pop3s_port);
+    }
+
+    int master_sctp_socket = upgrade_adopt(inherited[UPGRADE_MANAGEMENT],
+                                           parameters->managementaddrinfo);
+    if (master_sctp_socket < 0) {
+        master_sctp_socket = create_master_socket(IPPROTO_SCTP, parameters->managementaddrinfo);
+    }
 
     //try to specify maximum of 3 pending connections for the master socket
     if (listen(master_sctp_socket, PENDING_CONNECTIONS) < 0) {
@@ -74,6 +153,16 @@ int main (int argc, char ** argv) {
     printf("Listening on SCTP %s:%d \n", parameters->management_address,
            parameters->management_port);
 
+    // no bloqueantes: durante una actualizacion (-u) las dos instancias esperan
+    // en las mismas colas y la que pierde la carrera no debe quedar en accept()
+    const int masters[] = { master_tcp_socket, master_pop3s_socket, master_sctp_socket };
+    for (unsigned i = 0; i < sizeof(masters) / sizeof(masters[0]); i++) {
+        if (masters[i] >= 0 && selector_fd_set_nio(masters[i]) == -1) {
+            perror("listening socket");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     //accept the incoming connection
     puts("Waiting for connections ...");
 
@@ -86,9 +175,13 @@ int main (int argc, char ** argv) {
 
     const struct selector_init conf = {
             .signal = SIGALRM,
+            // con -k las sesiones inactivas se revisan una vez por segundo, y
+            // con -b los origin pausados por contrapresion cada decima de
+            // segundo (POP3_PAUSE_USEC en pop3.c)
             .select_timeout = {
-                    .tv_sec  = 10,
-                    .tv_nsec = 0,
+                    .tv_sec  = parameters->memory_soft > 0 ? 0
+                               : parameters->park_idle > 0 ? 1 : 10,
+                    .tv_nsec = parameters->memory_soft > 0 ? 100000000 : 0,
             },
     };
     if(0 != selector_init(&conf)) {
@@ -108,6 +201,12 @@ int main (int argc, char ** argv) {
             .handle_close      = NULL, // nada que liberar
     };
 
+    const struct fd_handler pop3s_handler = {
+            .handle_read       = &pop3s_passive_accept,
+            .handle_write      = NULL,
+            .handle_close      = NULL,
+    };
+
     const struct fd_handler management_handler = {
             .handle_read       = &management_accept_connection,
             .handle_write      = NULL,
@@ -120,11 +219,27 @@ int main (int argc, char ** argv) {
     selector_status ss_manag = selector_register(
             selector, master_sctp_socket, &management_handler, OP_READ, NULL);
 
+    if(master_pop3s_socket != -1 && SELECTOR_SUCCESS != selector_register(
+            selector, master_pop3s_socket, &pop3s_handler, OP_READ, NULL)) {
+        err_msg = "registering fd";
+        goto finally;
+    }
+
     if(ss_pop3 != SELECTOR_SUCCESS || ss_manag != SELECTOR_SUCCESS) {
         err_msg = "registering fd";
         goto finally;
     }
 
+    const int listening[UPGRADE_SOCKETS] = {
+            [UPGRADE_POP3]       = master_tcp_socket,
+            [UPGRADE_POP3S]      = master_pop3s_socket,
+            [UPGRADE_MANAGEMENT] = master_sctp_socket,
+    };
+    if(upgrade_listen(selector, parameters->upgrade_socket, listening) < 0) {
+        err_msg = "upgrade socket";
+        goto finally;
+    }
+
     for(;;) {
         err_msg  = NULL;
         ss  = selector_select(selector);
@@ -132,9 +247,15 @@ int main (int argc, char ** argv) {
             err_msg = "serving";
             break;
         }
+        pop3_backpressure_resume();
+        pop3_park_idle();
+        if(upgrade_draining() && pop3_live_empty()) {
+            // la instancia nueva ya acepta y no quedan sesiones
+            break;
+        }
     }
 
-    if(err_msg == NULL) {
+    if(err_msg == NULL && !upgrade_draining()) {
         err_msg = "closing";
     }
 
@@ -157,10 +278,20 @@ int main (int argc, char ** argv) {
     selector_close();
 
     pop3_pool_destroy();
-
-    if(master_tcp_socket >= 0) {
+    body_cache_destroy();
+    mailbox_cache_destroy();
+    capa_cache_destroy();
+    tls_destroy();
+    config_destroy();
+    upgrade_close();
+
+    // si se entregaron a la instancia nueva ya estan cerrados
+    if(master_tcp_socket >= 0 && !upgrade_draining()) {
         close(master_tcp_socket);
     }
+    if(master_pop3s_socket >= 0 && !upgrade_draining()) {
+        close(master_pop3s_socket);
+    }
     return ret;
 
 }
\ No newline at end of file
@@ -4,216 +4,231 @@
 #include <ctype.h>
 #include "media_types.h"
 
-#define STR_GROWTH 40
+#define INITIAL_SLOTS 16
+#define EMPTY_SLOT    0
 
 struct media_types * new_media_types(){
-    struct media_types * ret = malloc(sizeof(struct media_types));
+    struct media_types * ret = calloc(1, sizeof(struct media_types));
     if (ret == NULL)
         return NULL;
-    ret->first = NULL;
-    ret->end   = NULL;
-    ret->size  = 0;
+    ret->lists[0].separator = ',';
+    ret->lists[1].separator = '\n';
     return ret;
 }
 
-void empty_type(media_node * n);
+static void invalidate_lists(struct media_types * mt){
+    for (size_t i = 0; i < sizeof(mt->lists) / sizeof(*mt->lists); i++){
+        free(mt->lists[i].str);
+        mt->lists[i].str = NULL;
+    }
+}
 
-int delete_type(struct media_types *mt, char *type);
+void delete_media_types(struct media_types * mt){
+    if (mt == NULL)
+        return;
+    for (size_t i = 0; i < mt->size; i++){
+        free(mt->entries[i].type);
+        free(mt->entries[i].subtype);
+    }
+    invalidate_lists(mt);
+    free(mt->entries);
+    free(mt->slots);
+    free(mt);
+}
+
+/** FNV-1a sobre "type/subtype" en minusculas */
+static uint32_t hash_type(const char * type, const char * subtype){
+    uint32_t h = 2166136261u;
+    for (const char * c = type; *c != 0; c++)
+        h = (h ^ (uint8_t) tolower((unsigned char) *c)) * 16777619u;
+    h = (h ^ '/') * 16777619u;
+    for (const char * c = subtype; *c != 0; c++)
+        h = (h ^ (uint8_t) tolower((unsigned char) *c)) * 16777619u;
+    return h;
+}
 
-int check_media_type(struct media_types * mt, char * type, char * subtype){
-    media_node * node = mt->first;
-    while(node != NULL){
-        if (strcasecmp(node->type, type) == 0)
+/**
+ * slot de la tabla donde esta el tipo, o el slot vacio donde deberia ir.
+ * La tabla nunca esta llena (ver `ensure_slots').
+ */
+static size_t find_slot(const struct media_types * mt, const char * type,
+                        const char * subtype, uint32_t hash){
+    const size_t mask = mt->slots_size - 1;
+    size_t i = hash & mask;
+    while (mt->slots[i] != EMPTY_SLOT){
+        const struct media_type * e = &mt->entries[mt->slots[i] - 1];
+        if (e->hash == hash && strcasecmp(e->type, type) == 0
+            && strcasecmp(e->subtype, subtype) == 0)
             break;
-        node = node->next;
+        i = (i + 1) & mask;
     }
-    if (node != NULL){
-        subtype_node * n = node->first;
-        while (n != NULL){
-            if (strcasecmp(n->subtype, subtype) == 0)
-                return 1;
-            n = n->next;
-        }
+    return i;
+}
+
+/** reconstruye el indice con `size' slots */
+static int rebuild_slots(struct media_types * mt, size_t size){
+    uint32_t * slots = calloc(size, sizeof(*slots));
+    if (slots == NULL)
+        return -1;
+    free(mt->slots);
+    mt->slots      = slots;
+    mt->slots_size = size;
+    for (size_t i = 0; i < mt->size; i++){
+        const struct media_type * e = &mt->entries[i];
+        mt->slots[find_slot(mt, e->type, e->subtype, e->hash)] = (uint32_t) i + 1;
     }
     return 0;
 }
 
-int add_media_type(struct media_types * mt, char * type, char * subtype){
-    media_node * node = mt->first;
-    while(node != NULL){
-        if (strcasecmp(node->type, type) == 0)
-            break;
-        node = node->next;
-    }
-    if (node == NULL){
-        node = malloc(sizeof(struct media_node));
-        if (node == NULL){
+/** garantiza lugar para un tipo mas, con un factor de carga de a lo sumo 1/2 */
+static int ensure_slots(struct media_types * mt){
+    if (mt->size == mt->capacity){
+        size_t capacity = mt->capacity == 0 ? INITIAL_SLOTS / 2 : mt->capacity * 2;
+        void * tmp = realloc(mt->entries, capacity * sizeof(*mt->entries));
+        if (tmp == NULL)
             return -1;
-        }
-        node->type = type;
-        node->next = NULL;
-        node->first = NULL;
-        node->end = NULL;
-        node->wildcard = false;
-        if (mt->first == NULL){
-            mt->first = node;
-            mt->end = node;
-        }else{
-            mt->end->next = node;
-            mt->end = node;
-        }
-    }else if(node->wildcard){
-        return -1;
+        mt->entries  = tmp;
+        mt->capacity = capacity;
     }
-
-    if (strcasecmp(subtype, "*") == 0){
-        empty_type(node);
-        node->wildcard = true;
+    if ((mt->size + 1) * 2 > mt->slots_size){
+        return rebuild_slots(mt, mt->slots_size == 0 ? INITIAL_SLOTS : mt->slots_size * 2);
     }
+    return 0;
+}
 
-    subtype_node * n = node->first;
+static const struct media_type * find(const struct media_types * mt, const char * type,
+                                      const char * subtype){
+    if (mt->size == 0)
+        return NULL;
+    const uint32_t slot = mt->slots[find_slot(mt, type, subtype, hash_type(type, subtype))];
+    return slot == EMPTY_SLOT ? NULL : &mt->entries[slot - 1];
+}
 
-    while(n != NULL){
-        if (strcasecmp(n->subtype, subtype) == 0)
-            return -1;
-        n = n->next;
-    }
+int check_media_type(const struct media_types * mt, const char * type, const char * subtype){
+    return find(mt, type, subtype) != NULL || find(mt, type, "*") != NULL;
+}
 
-    n = malloc(sizeof(subtype_node));
-    if (n == NULL){
-        if (node->first == NULL)
-            delete_type(mt, type);
+static char * copy_str(const char * s){
+    char * ret = malloc(strlen(s) + 1);
+    if (ret != NULL)
+        strcpy(ret, s);
+    return ret;
+}
+
+/** elimina la entrada `i' conservando el orden. No actualiza el indice */
+static void remove_entry(struct media_types * mt, size_t i){
+    free(mt->entries[i].type);
+    free(mt->entries[i].subtype);
+    memmove(mt->entries + i, mt->entries + i + 1, (mt->size - i - 1) * sizeof(*mt->entries));
+    mt->size--;
+}
+
+int add_media_type(struct media_types * mt, const char * type, const char * subtype){
+    if (find(mt, type, subtype) != NULL || find(mt, type, "*") != NULL)
+        return -1;
+    if (ensure_slots(mt) < 0)
+        return -1;
+
+    struct media_type e = {
+            .type    = copy_str(type),
+            .subtype = copy_str(subtype),
+            .hash    = hash_type(type, subtype),
+    };
+    if (e.type == NULL || e.subtype == NULL){
+        free(e.type);
+        free(e.subtype);
         return -1;
     }
-    n->subtype = subtype;
-    n->next = NULL;
-    if (node->first == NULL){
-        node->first = n;
-        node->end = n;
-    }else{
-        node->end->next = n;
-        node->end = n;
-    }
-    return 1;
-}
 
-int delete_type(struct media_types *mt, char *type){
-    media_node * node = mt->first;
-    media_node * aux  = NULL;
-    media_node * prev = NULL;
-    while(node != NULL){
-        aux = node->next;
-        if (strcasecmp(node->type, type) == 0){
-            if (aux == NULL){
-                mt->end = NULL;
+    if (strcmp(subtype, "*") == 0){
+        // el wildcard reemplaza los subtipos del tipo
+        bool removed = false;
+        for (size_t i = mt->size; i > 0; i--){
+            if (strcasecmp(mt->entries[i - 1].type, type) == 0){
+                remove_entry(mt, i - 1);
+                removed = true;
             }
-            if (prev == NULL){
-                mt->first = aux;
-            }
-            free(node->type);
-            free(node);
         }
-        prev = node;
-        node = aux;
+        if (removed && rebuild_slots(mt, mt->slots_size) < 0){
+            free(e.type);
+            free(e.subtype);
+            return -1;
+        }
     }
+
+    mt->entries[mt->size] = e;
+    mt->slots[find_slot(mt, type, subtype, e.hash)] = (uint32_t) ++mt->size;
+    invalidate_lists(mt);
     return 1;
 }
 
-int delete_media_type(struct media_types * mt, char * type, char * subtype){
-    media_node * node = mt->first;
-    while(node != NULL){
-        if (strcasecmp(node->type, type) == 0){
-            break;
-        }
-        node = node->next;
-    }
-    if (node == NULL)
+int delete_media_type(struct media_types * mt, const char * type, const char * subtype){
+    const struct media_type * e = find(mt, type, subtype);
+    if (e == NULL)
         return -1;
-    subtype_node * n = node->first;
-    subtype_node * a = NULL;
-    subtype_node * p = NULL;
-    while(n != NULL){
-        a = n->next;
-        if (strcasecmp(n->subtype, subtype) == 0) {
-            if (a == NULL){
-                node->end = NULL;
-            }
-            if (p == NULL){
-                node->first = a;
-            }
-            if (strcmp("*", subtype) == 0)
-                node->wildcard = false;
-            free(n->subtype);
-            free(n);
-            return 1;
-        }
-        n = a;
-        p = n;
-    }
-    return -1;
+    remove_entry(mt, (size_t) (e - mt->entries));
+    invalidate_lists(mt);
+    // las entradas siguientes cambiaron de posicion
+    if (rebuild_slots(mt, mt->slots_size) < 0)
+        return -1;
+    return 1;
 }
 
-void empty_type(media_node * n){
-    subtype_node * node = n->first;
-    subtype_node * aux = NULL;
-    while(node != NULL){
-        aux = node->next;
-        free(node->subtype);
-        free(node);
-        node = aux;
+struct media_types * copy_media_types(const struct media_types * mt){
+    struct media_types * ret = new_media_types();
+    if (ret == NULL)
+        return NULL;
+    for (size_t i = 0; i < mt->size; i++){
+        if (add_media_type(ret, mt->entries[i].type, mt->entries[i].subtype) < 0){
+            delete_media_types(ret);
+            return NULL;
+        }
     }
-    n->first = NULL;
-    n->end   = NULL;
+    return ret;
 }
 
-void delete_media_types(struct media_types * mt){
-    media_node * node = mt->first;
-    media_node * aux  = NULL;
-    while(node != NULL){
-        empty_type(node);
-        aux = node->next;
-        free(node->type);
-        free(node);
-        node = aux;
-    }
-    free(mt);
-}
+static char * serialize(const struct media_types * mt, char separator){
+    size_t size = 1;
+    for (size_t i = 0; i < mt->size; i++)
+        size += strlen(mt->entries[i].type) + strlen(mt->entries[i].subtype) + 2;
 
-char * get_types_list(struct media_types * mt, char separator){
-    char * str = malloc(STR_GROWTH * sizeof(char));
-    size_t size = STR_GROWTH;
+    char * str = malloc(size);
+    if (str == NULL)
+        return NULL;
     size_t index = 0;
-    media_node * node = mt->first;
-    while(node != NULL){
-        subtype_node * n = node->first;
-        size_t type_length = strlen(node->type);
-        while (n != NULL){
-            size_t subtype_length = strlen(n->subtype);
-            if (size <= index + type_length + subtype_length + 2){
-                size_t growth = ((size - index) / STR_GROWTH + 2) * STR_GROWTH;
-                void * aux = realloc(str, size + growth);
-                if (aux == NULL)
-                    return NULL;
-                str = aux;
-                size += growth;
-            }
-            strcpy(str + index, node->type);
-            index += type_length;
-            str[index++] = '/';
-            strcpy(str + index, n->subtype);
-            index += subtype_length;
+    for (size_t i = 0; i < mt->size; i++){
+        const size_t type_length    = strlen(mt->entries[i].type);
+        const size_t subtype_length = strlen(mt->entries[i].subtype);
+        if (i != 0)
             str[index++] = separator;
-            n = n->next;
-        }
-        node = node->next;
+        memcpy(str + index, mt->entries[i].type, type_length);
+        index += type_length;
+        str[index++] = '/';
+        memcpy(str + index, mt->entries[i].subtype, subtype_length);
+        index += subtype_length;
     }
-    if (index != 0)
-        str[index-1] = '\0';
-    else
-        str[index] = '\0';
+    str[index] = '\0';
     return str;
 }
 
+const char * get_types_list(struct media_types * mt, char separator){
+    struct media_types_list * l = NULL;
+    for (size_t i = 0; i < sizeof(mt->lists) / sizeof(*mt->lists); i++){
+        if (mt->lists[i].separator == separator)
+            l = &mt->lists[i];
+    }
+    if (l == NULL){
+        // separador no previsto: se reusa la ultima posicion
+        l = &mt->lists[sizeof(mt->lists) / sizeof(*mt->lists) - 1];
+        free(l->str);
+        l->str       = NULL;
+        l->separator = separator;
+    }
+    if (l->str == NULL)
+        l->str = serialize(mt, separator);
+    return l->str;
+}
+
 int is_mime(char * str, char ** type, char ** subtype){
     bool slash = false;
     *type = str;
@@ -233,4 +248,4 @@ int is_mime(char * str, char ** type, char ** subtype){
         return 1;
     else
         return -1;
-}
\ No newline at end of file
+}
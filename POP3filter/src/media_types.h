@@ -2,32 +2,68 @@
 #define TPE_PROTOS_MEDIA_TYPES_H
 
 #include <unistd.h>
+#include <stdint.h>
 #include <stdbool.h>
 
-typedef struct subtype_node{
-    struct subtype_node  * next;
-    char              * subtype;
-}subtype_node;
+/**
+ * media_types.c - conjunto de media types filtrados.
+ *
+ * Los pares "type/subtype" se guardan en un arreglo en orden de insercion y
+ * se indexan con una tabla hash de direccionamiento abierto sobre la forma
+ * en minusculas, por lo que las consultas no dependen de la cantidad de
+ * tipos. Un subtipo "*" marca el tipo completo (wildcard).
+ *
+ * Las formas serializadas que se envian a las transformaciones externas y a
+ * management se calculan una unica vez y se invalidan con cada cambio.
+ */
 
-typedef struct media_node{
-    char              * type;
-    struct media_node * next;
-    subtype_node      * first;
-    subtype_node      * end;
-    bool                wildcard;
-}media_node;
+struct media_type {
+    char      * type;
+    char      * subtype;
+    uint32_t    hash;
+};
+
+/** serializacion cacheada para un separador */
+struct media_types_list {
+    char        separator;
+    char      * str;
+};
 
 struct media_types{
-    size_t       size;
-    media_node * first;
-    media_node * end;
+    /** tipos en orden de insercion */
+    struct media_type       * entries;
+    size_t                    size;
+    size_t                    capacity;
+
+    /** indices a `entries' (+1, 0 es vacio). Potencia de 2 */
+    uint32_t                * slots;
+    size_t                    slots_size;
+
+    struct media_types_list   lists[2];
 };
 
 struct media_types * new_media_types();
-int check_media_type(struct media_types * mt, char * type, char * subtype);
-int add_media_type(struct media_types * mt, char * type, char * subtype);
-char * get_types_list(struct media_types * mt, char separator);
+void delete_media_types(struct media_types * mt);
+struct media_types * copy_media_types(const struct media_types * mt);
+
+/** 1 si el tipo esta filtrado, explicitamente o por un wildcard */
+int check_media_type(const struct media_types * mt, const char * type, const char * subtype);
+
+/**
+ * agrega un tipo (se copian los strings). Agregar el subtipo "*" reemplaza
+ * los demas subtipos del tipo. Retorna -1 si ya estaba o si no hay memoria.
+ */
+int add_media_type(struct media_types * mt, const char * type, const char * subtype);
+
+/** elimina un tipo. Retorna -1 si no estaba */
+int delete_media_type(struct media_types * mt, const char * type, const char * subtype);
+
+/**
+ * tipos separados por `separator'. El string pertenece a `mt' y es valido
+ * hasta la proxima modificacion. NULL si no hay memoria.
+ */
+const char * get_types_list(struct media_types * mt, char separator);
+
 int is_mime(char * str, char ** type, char ** subtype);
-int delete_media_type(struct media_types * mt, char * type, char * subtype);
 
 #endif //TPE_PROTOS_MEDIA_TYPES_H
@@ -0,0 +1,63 @@
+/**
+ * memory.c - contabilidad global de la memoria de las sesiones
+ */
+#include "memory.h"
+
+static struct memory_stats memory;
+
+/** si el uso esta por encima del umbral blando */
+static bool above_soft = false;
+
+void
+memory_init(size_t soft, size_t hard) {
+    memory.soft = soft;
+    memory.hard = hard;
+}
+
+void
+memory_charge(size_t n) {
+    memory.used += n;
+    if (memory.used > memory.peak) {
+        memory.peak = memory.used;
+    }
+    if (!above_soft && memory.soft != 0 && memory.used > memory.soft) {
+        above_soft = true;
+        memory.soft_hits++;
+    }
+}
+
+void
+memory_release(size_t n) {
+    memory.used = n > memory.used ? 0 : memory.used - n;
+    if (above_soft && memory.used <= memory.soft) {
+        above_soft = false;
+    }
+}
+
+enum memory_level
+memory_level(void) {
+    if (memory.hard != 0 && memory.used > memory.hard) {
+        return MEMORY_HARD;
+    }
+    return above_soft ? MEMORY_SOFT : MEMORY_OK;
+}
+
+bool
+memory_fits(size_t n) {
+    return memory.hard == 0 || memory.used + n <= memory.hard;
+}
+
+void
+memory_reject(void) {
+    memory.hard_hits++;
+}
+
+void
+memory_throttle(void) {
+    memory.throttled++;
+}
+
+void
+memory_stats(struct memory_stats *st) {
+    *st = memory;
+}
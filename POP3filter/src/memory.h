@@ -0,0 +1,69 @@
+#ifndef TPE_PROTOS_MEMORY_H
+#define TPE_PROTOS_MEMORY_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * memory.c - contabilidad global de la memoria de las sesiones.
+ *
+ * Cada sesion descuenta de un presupuesto global su estructura y lo que
+ * aloca mientras vive (bloques extra de la arena, la respuesta a CAPA). Hay
+ * dos umbrales:
+ *
+ *  - blando: el proxy aplica contrapresion, dejando de leer de los origin
+ *    las respuestas pedidas por adelantado hasta que el uso baje.
+ *  - duro: se rechazan las conexiones nuevas.
+ *
+ * Un umbral en 0 esta desactivado. Solo se usa desde el hilo del selector.
+ */
+
+enum memory_level {
+    MEMORY_OK,
+    MEMORY_SOFT,
+    MEMORY_HARD,
+};
+
+struct memory_stats {
+    size_t          used;
+    size_t          peak;
+    size_t          soft;
+    size_t          hard;
+    /** veces que se paso el umbral blando */
+    unsigned long   soft_hits;
+    /** conexiones rechazadas por el umbral duro */
+    unsigned long   hard_hits;
+    /** sockets de origin pausados por contrapresion */
+    unsigned long   throttled;
+};
+
+void
+memory_init(size_t soft, size_t hard);
+
+/** descuenta `n' bytes del presupuesto */
+void
+memory_charge(size_t n);
+
+/** devuelve `n' bytes al presupuesto */
+void
+memory_release(size_t n);
+
+enum memory_level
+memory_level(void);
+
+/** si se pueden descontar `n' bytes sin pasar el umbral duro */
+bool
+memory_fits(size_t n);
+
+/** registra una conexion rechazada por el umbral duro */
+void
+memory_reject(void);
+
+/** registra un socket de origin pausado por contrapresion */
+void
+memory_throttle(void);
+
+void
+memory_stats(struct memory_stats *st);
+
+#endif //TPE_PROTOS_MEMORY_H
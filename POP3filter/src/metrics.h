@@ -6,6 +6,26 @@ struct metrics {
     unsigned int historical_access;
     long long int transferred_bytes;
     unsigned int retrieved_messages;
+    /** eventos postergados por sesiones que agotaron su cuota */
+    unsigned long deferred_events;
+    /** sesiones precalentadas al autenticarse, sus requests y bytes del origin */
+    unsigned long warmup_sessions;
+    unsigned long warmup_requests;
+    long long int warmup_bytes;
+    /** STAT, LIST y UIDL respondidos desde la cache en sesiones precalentadas */
+    unsigned long warmup_hits;
+    /**
+     * sesiones estacionadas ahora y en total, las reanudadas, las que no
+     * llegaron a reanudarse y la demora de las reconexiones
+     */
+    unsigned long parked_sessions;
+    unsigned long parks;
+    /** estacionadas mientras el cliente recibia lo acumulado de un RETR (ver -x) */
+    unsigned long spill_parks;
+    unsigned long resumes;
+    unsigned long resume_failures;
+    unsigned long long resume_usec;
+    unsigned long long resume_usec_max;
 };
 
 typedef struct metrics * metrics;
@@ -26,11 +26,49 @@ void print_help(){
     printf("Proxy POP3 que filtra mensajes de <origin-server>.\n");
     printf("\n");
     printf("Opciones:\n");
+    printf("%-30s","\t-a archivo-de-registro");
+    printf("especifica el archivo donde se emite un registro JSON por cada "
+                   "sesion (por defecto stdout)\n");
+    printf("%-30s","\t-A segundos");
+    printf("recuerda las capacidades (CAPA) de cada origin: las sesiones "
+                   "nuevas no se las piden (por defecto 0, desactivado)\n");
+    printf("%-30s","\t-b megabytes");
+    printf("umbral blando de memoria de las sesiones: por encima se lee "
+                   "menos de los origin (por defecto 0, desactivado)\n");
+    printf("%-30s","\t-B megabytes");
+    printf("umbral duro de memoria de las sesiones: por encima se rechazan "
+                   "conexiones nuevas (por defecto 0, desactivado)\n");
+    printf("%-30s","\t-c megabytes");
+    printf("cache de STAT, LIST y UIDL por usuario: memoria para los "
+                   "listados (por defecto 0, desactivada)\n");
+    printf("%-30s","\t-C directorio");
+    printf("captura los bytes de cada sesion en el directorio, para "
+                   "reproducirlas con pop3replay\n");
+    printf("%-30s","\t-d directorio");
+    printf("cache en disco de las respuestas a RETR, por usuario y UID "
+                   "(requiere -c)\n");
+    printf("%-30s","\t-D megabytes");
+    printf("tamaño de la cache de RETR (por defecto 64)\n");
     printf("%-30s","\t-e archivo-de-error");
     printf("especifica el archivo de error donde se redirecciona stderr de las "
                    "ejecuciones de los filtros\n");
+    printf("%-30s","\t-f mensajes");
+    printf("RETR pedidos por adelantado en descargas secuenciales, ventana "
+                   "maxima (por defecto 0, desactivado; hasta 16)\n");
+    printf("%-30s", "\t-g");
+    printf("saluda al cliente al aceptarlo, sin esperar al origin: sus "
+                   "primeros comandos se encolan hasta conectarse\n");
     printf("%-30s", "\t-h");
     printf("imprime la ayuda y termina\n");
+    printf("%-30s", "\t-H");
+    printf("usa huge pages para el pool de sesiones\n");
+    printf("%-30s", "\t-k segundos");
+    printf("estaciona las sesiones autenticadas inactivas: cierra la conexion "
+                   "con el origin y la retoma, repitiendo USER y PASS, al "
+                   "llegar otro comando (por defecto 0, desactivado)\n");
+    printf("%-30s", "\t-K clave");
+    printf("clave privada del certificado de -T en PEM (por defecto, el mismo "
+                   "archivo)\n");
     printf("%-30s", "\t-l direccion_pop3");
     printf("establece la dirección donde servirá el proxy\n");
     printf("%-30s", "\t-L direccion_management");
@@ -46,10 +84,37 @@ void print_help(){
     printf("puerto TCP donde escuchará conexiones entrantes POP3\n");
     printf("%-30s", "\t-P puerto_origen");
     printf("puerto TCP donde se encuentra el servidor POP3 origen\n");
+    printf("%-30s", "\t-s puerto_pop3s");
+    printf("puerto TCP donde escuchará conexiones POP3 sobre TLS (requiere "
+                   "-T)\n");
+    printf("%-30s", "\t-S techo_pool");
+    printf("cantidad maxima de sesiones que se reusan desde el pool (por "
+                   "defecto 50, 0 lo desactiva)\n");
     printf("%-30s", "\t-t cmd");
     printf("comando utilizado para las transofmraciones externas\n");
+    printf("%-30s", "\t-u archivo");
+    printf("socket Unix para actualizar el proxy en caliente: una instancia "
+                   "nueva con el mismo archivo recibe los sockets de la que "
+                   "corre\n");
+    printf("%-30s", "\t-x directorio");
+    printf("si un cliente lento no recibe un RETR al ritmo del origin, lo "
+                   "que sigue se lee igual y se guarda en archivos temporales "
+                   "del directorio\n");
+    printf("%-30s", "\t-X megabytes");
+    printf("presupuesto de disco de -x (por defecto 256)\n");
+    printf("%-30s", "\t-y kilobytes");
+    printf("lo que guarda -x en memoria por sesion antes de pasar a disco "
+                   "(por defecto 64)\n");
+    printf("%-30s", "\t-T certificado");
+    printf("certificado (cadena en PEM) para TLS con los clientes: habilita "
+                   "STLS\n");
     printf("%-30s", "\t-v");
     printf("imprime la versión y termina\n");
+    printf("%-30s", "\t-w");
+    printf("al autenticarse una sesion pide STAT, LIST y UIDL al origin para "
+                   "responderlos desde la cache (requiere -c)\n");
+    printf("%-30s", "\t-W sesiones");
+    printf("sesiones pre-alocadas en el pool al iniciar\n");
 }
 
 /**
@@ -69,6 +134,8 @@ int parse_media_types(struct media_types *mt_struct, const char *mt_string);
 
 long parse_port(char * port_name, char *optarg) ;
 
+unsigned parse_count(char * name, char *optarg);
+
 void parse_options(int argc, char **argv) {
 
     /* Initialize default values */
@@ -86,6 +153,29 @@ void parse_options(int argc, char **argv) {
     parameters->version             = "0.0";
     parameters->listenadddrinfo     = 0;
     parameters->managementaddrinfo  = 0;
+    parameters->tls_cert            = NULL;
+    parameters->tls_key             = NULL;
+    parameters->pop3s_port          = 0;
+    parameters->pop3saddrinfo       = 0;
+    parameters->access_log          = NULL;
+    parameters->pool_max            = 50;
+    parameters->pool_prewarm        = 0;
+    parameters->pool_hugepages      = false;
+    parameters->memory_soft         = 0;
+    parameters->memory_hard         = 0;
+    parameters->mailbox_cache       = 0;
+    parameters->capture_dir         = NULL;
+    parameters->body_cache_dir      = NULL;
+    parameters->body_cache          = 64;
+    parameters->prefetch            = 0;
+    parameters->capa_ttl            = 0;
+    parameters->warmup              = false;
+    parameters->upgrade_socket      = NULL;
+    parameters->early_greeting      = false;
+    parameters->spill_dir           = NULL;
+    parameters->spill_disk          = 256;
+    parameters->spill_memory        = 64;
+    parameters->park_idle           = 0;
 
     parameters->filtered_media_types = new_media_types();
 
@@ -101,17 +191,69 @@ void parse_options(int argc, char **argv) {
     }
 
     /* e: option e requires argument e:: optional argument */
-    while ((c = getopt (argc, argv, "e:hl:L:m:M:o:p:P:t:v")) != -1){
+    while ((c = getopt (argc, argv, "a:A:b:B:c:C:d:D:e:f:ghHk:K:l:L:m:M:o:p:P:s:S:t:T:u:vwW:x:X:y:")) != -1){
         switch (c) {
+            /* Session records file */
+            case 'a':
+                parameters->access_log = optarg;
+                break;
+            /* Origin capabilities cache TTL */
+            case 'A':
+                parameters->capa_ttl = parse_count("CAPA cache TTL", optarg);
+                break;
+            /* Soft memory watermark */
+            case 'b':
+                parameters->memory_soft = parse_count("Soft memory limit", optarg);
+                break;
+            /* Hard memory watermark */
+            case 'B':
+                parameters->memory_hard = parse_count("Hard memory limit", optarg);
+                break;
+            /* Mailbox metadata cache */
+            case 'c':
+                parameters->mailbox_cache = parse_count("Mailbox cache size", optarg);
+                break;
+            /* Session capture directory */
+            case 'C':
+                parameters->capture_dir = optarg;
+                break;
+            /* Message body cache directory */
+            case 'd':
+                parameters->body_cache_dir = optarg;
+                break;
+            /* Message body cache size */
+            case 'D':
+                parameters->body_cache = parse_count("Body cache size", optarg);
+                break;
             /* Error file */
             case 'e':
                 parameters->error_file = optarg;
                 break;
+            /* Sequential RETR prefetch window */
+            case 'f':
+                parameters->prefetch = parse_count("Prefetch window", optarg);
+                break;
+            /* Greet the client before connecting to the origin */
+            case 'g':
+                parameters->early_greeting = true;
+                break;
                 /* Print help and quit */
             case 'h':
                 print_help();
                 exit(0);
                 break;
+                /* Huge pages for the session pool */
+            case 'H':
+                parameters->pool_hugepages = true;
+                break;
+                /* park idle sessions */
+            case 'k':
+                parameters->park_idle = parse_count("Park timeout", optarg);
+                break;
+                /* TLS private key */
+            case 'K':
+                parameters->tls_key = optarg;
+                break;
                 /* Listen address */
             case 'l':
                 parameters->listen_address = optarg;
@@ -126,8 +268,17 @@ void parse_options(int argc, char **argv) {
                 if (messages == 1){
                     parameters->replacement_msg = optarg;
                 }else{
-                    strcat(parameters->replacement_msg, "\n");
-                    strcat(parameters->replacement_msg, optarg);
+                    // optarg no tiene lugar para los mensajes siguientes
+                    size_t len = strlen(parameters->replacement_msg);
+                    char * msg = malloc(len + 1 + strlen(optarg) + 1);
+                    if (msg == NULL)
+                        exit(0);
+                    strcpy(msg, parameters->replacement_msg);
+                    msg[len] = '\n';
+                    strcpy(msg + len + 1, optarg);
+                    if (messages > 2)
+                        free(parameters->replacement_msg);
+                    parameters->replacement_msg = msg;
                 }
 
                 break;
@@ -146,6 +297,18 @@ void parse_options(int argc, char **argv) {
             case 'P':
                 parameters->origin_port = (uint16_t) parse_port("Origin server", optarg);
                 break;
+                /* POP3S port */
+            case 's':
+                parameters->pop3s_port = (uint16_t) parse_port("POP3S", optarg);
+                break;
+                /* session pool ceiling */
+            case 'S':
+                parameters->pool_max = parse_count("Pool size", optarg);
+                break;
+                /* TLS certificate */
+            case 'T':
+                parameters->tls_cert = optarg;
+                break;
                 /* filter command */
             case 't': {
                 int size = sizeof(char) * strlen(optarg) + 1;
@@ -157,14 +320,43 @@ void parse_options(int argc, char **argv) {
                 parameters->et_activated   = true;
             }
                 break;
+                /* hot upgrade socket */
+            case 'u':
+                parameters->upgrade_socket = optarg;
+                break;
             case 'v':
                 print_version();
                 exit(0);
                 break;
+                /* mailbox warmup after PASS */
+            case 'w':
+                parameters->warmup = true;
+                break;
+                /* pre-allocated sessions */
+            case 'W':
+                parameters->pool_prewarm = parse_count("Pool prewarm", optarg);
+                break;
+                /* spill directory for slow clients */
+            case 'x':
+                parameters->spill_dir = optarg;
+                break;
+                /* spill disk budget */
+            case 'X':
+                parameters->spill_disk = parse_count("Spill disk budget", optarg);
+                break;
+                /* spill memory per session */
+            case 'y':
+                parameters->spill_memory = parse_count("Spill memory", optarg);
+                break;
             case '?':
-                if (optopt == 'e' || optopt == 'l' || optopt == 'L'
+                if (optopt == 'a' || optopt == 'c' || optopt == 'C' || optopt == 'd'
+                    || optopt == 'D' || optopt == 'e' || optopt == 'f'
+                    || optopt == 'k' || optopt == 'K' || optopt == 'l' || optopt == 'L'
                     || optopt == 'm' || optopt == 'M' || optopt == 'o'
-                    || optopt == 'p' || optopt == 'P' || optopt == 'v')
+                    || optopt == 'p' || optopt == 'P' || optopt == 'v'
+                    || optopt == 's' || optopt == 'S' || optopt == 'T'
+                    || optopt == 'u' || optopt == 'W' || optopt == 'x'
+                    || optopt == 'X' || optopt == 'y')
                     fprintf (stderr, "Option -%c requires an argument.\n",
                              optopt);
                 else if (isprint (optopt))
@@ -189,8 +381,29 @@ void parse_options(int argc, char **argv) {
         exit(1);
     }
 
+    // los UIDs de los mensajes salen de la cache de listados
+    if (parameters->body_cache_dir != NULL && parameters->mailbox_cache == 0) {
+        fprintf(stderr, "Option -d requires a mailbox cache (-c)\n");
+        exit(1);
+    }
+    // lo pedido al autenticarse se guarda en la cache de listados
+    if (parameters->warmup && parameters->mailbox_cache == 0) {
+        fprintf(stderr, "Option -w requires a mailbox cache (-c)\n");
+        exit(1);
+    }
+
+    // STLS y POP3S usan el mismo certificado
+    if (parameters->pop3s_port != 0 && parameters->tls_cert == NULL) {
+        fprintf(stderr, "Option -s requires a certificate (-T)\n");
+        exit(1);
+    }
+
     resolv_addr(parameters->listen_address, parameters->port,
                 &parameters->listenadddrinfo);
+    if (parameters->pop3s_port != 0) {
+        resolv_addr(parameters->listen_address, parameters->pop3s_port,
+                    &parameters->pop3saddrinfo);
+    }
     resolv_addr(parameters->management_address, parameters->management_port,
                 &parameters->managementaddrinfo);
 
@@ -211,6 +424,21 @@ long parse_port(char * port_name, char *optarg) {
     return sl;
 }
 
+unsigned parse_count(char * name, char *optarg) {
+
+    char *end     = 0;
+    const long sl = strtol(optarg, &end, 10);
+
+    if (end == optarg|| '\0' != *end
+        || ((LONG_MIN == sl || LONG_MAX == sl) && ERANGE == errno)
+        || sl < 0 || sl > UINT_MAX) {
+        fprintf(stderr, "%s should be a positive integer: %s\n", name, optarg);
+        exit(1);
+    }
+
+    return (unsigned) sl;
+}
+
 #define MEDIA_BLOCK_SIZE 20
 
 int parse_media_types(struct media_types *mt_struct, const char *mt_string) {
@@ -240,7 +468,9 @@ int parse_media_types(struct media_types *mt_struct, const char *mt_string) {
                 }
                 used_str[str_size] = '\0';
                 if (add_media_type(mt_struct, str_type, used_str) < 0)
-                    return -1;
+                    goto fail;
+                free(str_type);
+                free(used_str);
                 str_type = NULL;
                 used_str = NULL;
                 block_size = 0;
@@ -289,14 +519,14 @@ int parse_media_types(struct media_types *mt_struct, const char *mt_string) {
 
     used_str[str_size] = '\0';
     if (add_media_type(mt_struct, str_type, used_str) < 0)
-        return -1;
+        goto fail;
+    free(str_type);
+    free(used_str);
 
     return 0;
     fail:
-    if (str_type == NULL)
-        free(str_type);
-    if (used_str == NULL)
-        free(used_str);
+    free(str_type);
+    free(used_str);
     return -1;
 }
 
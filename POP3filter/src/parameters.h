@@ -11,6 +11,10 @@ struct options {
     char * listen_address;
     char * management_address;
     uint16_t management_port;
+    /**
+     * valores iniciales de la configuracion de runtime. Una vez creada
+     * (ver config.h) se debe usar `config_get'.
+     */
     char * replacement_msg;
     struct media_types * filtered_media_types;
     char * origin_server;
@@ -20,8 +24,48 @@ struct options {
     char * version;
     struct addrinfo * listenadddrinfo;
     struct addrinfo * managementaddrinfo;
+    /** TLS con los clientes: certificado y clave (PEM) y puerto POP3S (0, sin POP3S) */
+    char * tls_cert;
+    char * tls_key;
+    uint16_t pop3s_port;
+    struct addrinfo * pop3saddrinfo;
     char * user;
     char * pass;
+    char * access_log;
+    /** pool de sesiones: techo, sesiones pre-alocadas y si usa huge pages */
+    unsigned pool_max;
+    unsigned pool_prewarm;
+    bool pool_hugepages;
+    /** umbrales de memoria de las sesiones en MB (0 los desactiva) */
+    unsigned memory_soft;
+    unsigned memory_hard;
+    /** memoria de la cache de listados de buzones en MB (0 la desactiva) */
+    unsigned mailbox_cache;
+    /** mensajes a pedir por adelantado en descargas secuenciales (0, sin prefetch) */
+    unsigned prefetch;
+    /** segundos que se recuerdan las capacidades de cada origin (0, sin cache) */
+    unsigned capa_ttl;
+    /** pedir STAT, LIST y UIDL al origin apenas se autentica una sesion */
+    bool warmup;
+    /** directorio y tamaño en MB de la cache de RETR en disco (NULL, sin cache) */
+    char * body_cache_dir;
+    unsigned body_cache;
+    /** directorio donde se capturan las sesiones (NULL, sin captura) */
+    char * capture_dir;
+    /** socket Unix de la actualizacion en caliente (NULL, desactivada) */
+    char * upgrade_socket;
+    /** saludar al cliente al aceptarlo, conectandose al origin en paralelo */
+    bool early_greeting;
+    /**
+     * directorio de las respuestas a RETR que se leen del origin antes que
+     * las reciba el cliente (NULL, sin spill), presupuesto de disco en MB y
+     * memoria por sesion en KB
+     */
+    char * spill_dir;
+    unsigned spill_disk;
+    unsigned spill_memory;
+    /** segundos sin actividad tras los que se estaciona una sesion (0, nunca) */
+    unsigned park_idle;
 };
 
 typedef struct options * options;
@@ -38,6 +38,8 @@ char ** sctp_parse_cmd(buffer *b, struct management *data, int *args, int *st_er
         length = sctp_recvmsg(data->client_fd, ptr, count, NULL, 0, &sndrcvinfo, &flags);
         if (length <= 0){
             *st_err = ERROR_DISCONNECT;
+            if (!error)
+                free_cmd(cmd, (int) (copying ? current_arg + 1 : current_arg));
             return NULL;
         }
 
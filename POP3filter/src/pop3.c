@@ -4,11 +4,13 @@
 #include <stdio.h>
 #include <stdlib.h>  // malloc
 #include <string.h>  // memset
+#include <stddef.h>  // offsetof
 #include <assert.h>  // assert
 #include <errno.h>
 #include <unistd.h>  // close
 
 #include <arpa/inet.h>
+#include <sys/sendfile.h>
 #include <pthread.h>
 #include <ctype.h>
 #include <memory.h>
@@ -25,6 +27,19 @@
 #include "log.h"
 #include "pop3_multi.h"
 #include "metrics.h"
+#include "session_record.h"
+#include "trace.h"
+#include "config.h"
+#include "utils.h"
+#include "slab.h"
+#include "memory.h"
+#include "capture.h"
+#include "mailbox_cache.h"
+#include "body_cache.h"
+#include "prefetch.h"
+#include "spill.h"
+#include "tls.h"
+#include "capa_cache.h"
 
 #define N(x) (sizeof(x)/sizeof((x)[0]))
 
@@ -62,8 +77,10 @@ enum pop3_state {
      *  Le pregunta las capacidades al origin server, nos interesa
      *  saber si el server soporta pipelining o no.
      *
-     *      - CAPA          mientras la respuesta no este completa
-     *      - REQUEST       cuando está completa
+     *      - CAPA          mientras la respuesta no este completa, o con -g
+     *                      mientras falte enviar el saludo
+     *      - REQUEST       cuando está completa (con -g, o a donde lleven
+     *                      los comandos que el cliente mando antes)
      *      - ERROR         ante cualquier error (IO/parseo)
      */
 
@@ -94,12 +111,51 @@ enum pop3_state {
      *      - ERROR                     ante cualquier error (IO/parseo)
      */
             EXTERNAL_TRANSFORMATION,
+    /**
+     *  Envia al cliente una respuesta de la cache de buzones (ver
+     *  mailbox_cache.h), de la cache de RETR en disco (ver body_cache.h) o
+     *  pedida por adelantado (ver prefetch.h), sin pasar por el origin
+     *
+     *  Transiciones:
+     *      - CACHED        mientras la respuesta no se termine de enviar
+     *      - REQUEST       cuando se envio completa
+     *      - ERROR         ante cualquier error (IO)
+     */
+            CACHED,
+    /**
+     *  Negocia TLS con el cliente (ver tls.h): al aceptar una conexion en el
+     *  puerto POP3S, antes de conectarse al origin, o despues de responder
+     *  al STLS del cliente
+     *
+     *  Transiciones:
+     *      - TLS_HANDSHAKE mientras no termine
+     *      - ORIGIN_RESOLV al terminar, si todavia no hay origin (POP3S)
+     *      - REQUEST       al terminar, despues de STLS
+     *      - ERROR         si fallo
+     */
+            TLS_HANDSHAKE,
 
     // estados terminales
             DONE,
             ERROR,
 };
 
+/** nombres de los estados, usados en los registros de sesion */
+static const char * const pop3_state_names[] = {
+        "ORIGIN_RESOLV",
+        "CONNECTING",
+        "HELLO",
+        "CAPA",
+        "REQUEST",
+        "RESPONSE",
+        "EXTERNAL_TRANSFORMATION",
+        "CACHED",
+        "TLS_HANDSHAKE",
+        "DONE",
+        "ERROR",
+        NULL,
+};
+
 ////////////////////////////////////////////////////////////////////
 // Definición de variables para cada estado
 
@@ -127,6 +183,15 @@ struct response_st {
 
     struct pop3_request         *request;
     struct response_parser      response_parser;
+
+    /** request propia del proxy (CAPA), no pasa por el anillo de la sesion */
+    struct pop3_request         own_request;
+
+    /** bytes de la respuesta actual entregados al cliente */
+    uint64_t                    bytes;
+
+    /** configuracion tomada al comenzar un RETR, se suelta con la request siguiente */
+    struct config               *config;
 };
 
 /** usado por EXTERNAL_TRANSFORMATION */
@@ -159,9 +224,16 @@ struct external_transformation {
 
     size_t                      send_bytes_write;
     size_t                      send_bytes_read;
+
+    /** bytes desde el puntero de lectura de cada buffer que ya vio su parser */
+    size_t                      scanned_write;
+    size_t                      scanned_read;
 };
 
 
+/** tamaño del bloque inicial de la arena de cada sesion */
+#define POP3_ARENA_SIZE 2048
+
 /** Tamanio de los buffers de I/O */
 #define BUFFER_SIZE 2048
 
@@ -172,8 +244,15 @@ struct external_transformation {
  *
  * Se utiliza un contador de referencias (references) para saber cuando debemos
  * liberarlo finalmente, y un pool para reusar alocaciones previas.
+ *
+ * Al reusar una estructura del pool solo se ponen en cero los campos
+ * anteriores a `session' (ver POP3_HEADER_SIZE); los siguientes, que son la
+ * mayor parte del tamaño, se inicializan explicitamente en pop3_new.
  */
 struct pop3 {
+    /** identificador de la sesion, usado desde management */
+    unsigned                      id;
+
     /** información del cliente */
     struct sockaddr_storage       client_addr;
     socklen_t                     client_addr_len;
@@ -189,12 +268,12 @@ struct pop3 {
     socklen_t                     origin_addr_len;
     int                           origin_domain;
     int                           origin_fd;
+    /** socket que se esta conectando al origin (CONNECTING), -1 si ninguno */
+    int                           connecting_fd;
 
     int                           extern_read_fd;
     int                           extern_write_fd;
 
-    struct pop3_session           session;
-
     /** maquinas de estados */
     struct state_machine          stm;
 
@@ -211,63 +290,175 @@ struct pop3 {
     struct external_transformation  et;
 
     /** buffers para ser usados read_buffer, write_buffer.*/
-    uint8_t raw_buff_a[BUFFER_SIZE], raw_buff_b[BUFFER_SIZE];
     buffer read_buffer, write_buffer;
 
     //TODO rename
-    uint8_t raw_super_buffer[BUFFER_SIZE];
     buffer super_buffer;
 
-    uint8_t raw_extern_read_buffer[BUFFER_SIZE];
     buffer extern_read_buffer;
 
+    /** argumentos de las requests de la sesion */
+    struct arena arena;
+
     /** cantidad de referencias a este objeto. si es uno se debe destruir */
     unsigned references;
 
-    /** siguiente en el pool */
-    struct pop3 *next;
+    /** selector donde esta registrada la sesion */
+    fd_selector s;
+
+    /** sesiones vivas */
+    struct pop3 *live_prev, *live_next;
+
+    /** cuota de la sesion en la iteracion `budget_round' del selector */
+    unsigned long budget_round;
+    int64_t       budget_bytes;
+    uint64_t      budget_usec;
+
+    /** captura de los bytes de la sesion (ver -C), NULL si no hay */
+    struct capture *capture;
+
+    /** cache de los listados del buzon (ver -c) */
+    struct mailbox_view mailbox;
+
+    /** respuesta a RETR que se guarda en la cache en disco (ver -d), NULL si no */
+    struct body_capture *body;
+    /** respuesta a RETR que se envia desde la cache en disco, -1 si ninguna */
+    int           body_fd;
+    off_t         body_offset;
+    size_t        body_len;
+
+    /** RETR pedidos por adelantado (ver -f) */
+    struct prefetch prefetch;
+
+    /** respuesta a RETR leida del origin antes que la reciba el cliente (ver -x) */
+    struct spill  spill;
+
+    /** se pidieron STAT, LIST y UIDL al autenticarse (ver -w) */
+    bool          warmed;
+
+    /** TLS con el cliente (POP3S o STLS), NULL si la conexion es en claro */
+    struct tls   *tls;
+    /** llego STLS con requests en vuelo: se atiende al terminar de responderlas */
+    bool          stls_waiting;
+
+    /** saludo anticipado (ver -g) y bytes del saludo ya enviados al cliente */
+    bool          early;
+    size_t        greeted;
+    /** ya se lanzo la resolucion del origin */
+    bool          resolving;
+    /** el origin termino CAPA antes de que se enviara todo el saludo */
+    bool          origin_ready;
+    /** el cliente se fue antes de que hubiera origin: se termina al avanzar este */
+    bool          client_gone;
+
+    /** estacionada (ver -k): sin conexion con el origin hasta el proximo comando */
+    bool          parked;
+    /** reconectandose para reanudar, desde `resume_at' */
+    bool          resuming;
+    uint64_t      resume_at;
+    /**
+     * desde cuando el origin no tiene nada pendiente: la sesion espera al
+     * cliente, o le envia lo acumulado (ver -x) de una respuesta terminada
+     */
+    uint64_t      idle_since;
+    /** hubo un DELE sin RSET: el QUIT lo aplicaria, no se estaciona */
+    bool          deleted;
+
+    /* a partir de aca no se pone en cero al reusar */
+
+    struct pop3_session           session;
+
+    /** registro de tiempos y bytes de la sesion */
+    struct session_record         record;
+
+    /** ultimos eventos de la sesion, ver TRACE en management */
+    struct trace_ring             trace;
+
+    uint8_t raw_buff_a[BUFFER_SIZE], raw_buff_b[BUFFER_SIZE];
+    uint8_t raw_super_buffer[BUFFER_SIZE];
+    uint8_t raw_extern_read_buffer[BUFFER_SIZE];
+    uint64_t arena_buffer[POP3_ARENA_SIZE / sizeof(uint64_t)];
 };
 
+/** campos que se ponen en cero al crear una sesion */
+#define POP3_HEADER_SIZE offsetof(struct pop3, session)
+
 
 /**
- * Pool de `struct pop3', para ser reusados.
+ * Pool de `struct pop3', para ser reusados. Las estructuras se cortan de
+ * bloques grandes (ver slab.h) y se reusa primero la ultima liberada.
  *
  * Como tenemos un unico hilo que emite eventos no necesitamos barreras de
  * contención.
  */
+static struct slab     *pool     = NULL;
+
+/** sesiones vivas, para ser inspeccionadas desde management */
+static struct pop3     *live     = NULL;
+static unsigned        last_id   = 0;
+
+static void
+live_add(struct pop3 *s) {
+    s->live_prev = NULL;
+    s->live_next = live;
+    if (live != NULL) {
+        live->live_prev = s;
+    }
+    live = s;
+}
 
-static const unsigned  max_pool  = 50; // tamaño máximo
-static unsigned        pool_size = 0;  // tamaño actual
-static struct pop3     *pool     = 0;  // pool propiamente dicho
+bool
+pop3_live_empty(void) {
+    return live == NULL;
+}
+
+static void
+live_remove(struct pop3 *s) {
+    if (s->live_prev == NULL && live != s) {
+        // no esta en la lista
+        return;
+    }
+    if (s->live_prev != NULL) {
+        s->live_prev->live_next = s->live_next;
+    } else {
+        live = s->live_next;
+    }
+    if (s->live_next != NULL) {
+        s->live_next->live_prev = s->live_prev;
+    }
+    s->live_prev = s->live_next = NULL;
+}
 
 static const struct state_definition *
 pop3_describe_states(void);
 
-/** crea un nuevo `struct pop3' */
+/** crea un nuevo `struct pop3'. Con `tls' la sesion empieza negociando TLS */
 static struct pop3 *
-pop3_new(int client_fd) {
-    struct pop3 *ret;
+pop3_new(int client_fd, bool tls) {
+    struct pop3 *ret = pool == NULL ? malloc(sizeof(*ret)) : slab_alloc(pool);
 
-    if(pool == NULL) {
-        ret = malloc(sizeof(*ret));
-    } else {
-        ret       = pool;
-        pool      = pool->next;
-        ret->next = 0;
-    }
     if(ret == NULL) {
         goto finally;
     }
-    memset(ret, 0x00, sizeof(*ret));
+    memory_charge(sizeof(*ret));
+    memset(ret, 0x00, POP3_HEADER_SIZE);
+    ret->trace.count     = 0;
 
     ret->origin_fd       = -1;
+    ret->connecting_fd   = -1;
     ret->client_fd       = client_fd;
     ret->client_addr_len = sizeof(ret->client_addr);
 
-    ret->stm    .initial   = ORIGIN_RESOLV;
+    ret->stm    .initial   = tls ? TLS_HANDSHAKE : ORIGIN_RESOLV;
     ret->stm    .max_state = ERROR;
     ret->stm    .states    = pop3_describe_states();
     stm_init(&ret->stm);
+    session_record_init(&ret->record, ret->stm.initial);
+    ret->capture = capture_open();
+    mailbox_view_init(&ret->mailbox);
+    ret->body_fd = -1;
+    prefetch_init(&ret->prefetch);
+    ret->early   = parameters->early_greeting;
 
     buffer_init(&ret->read_buffer,  N(ret->raw_buff_a), ret->raw_buff_a);
     buffer_init(&ret->write_buffer, N(ret->raw_buff_b), ret->raw_buff_b);
@@ -275,22 +466,17 @@ pop3_new(int client_fd) {
     buffer_init(&ret->super_buffer,  N(ret->raw_super_buffer), ret->raw_super_buffer);
     buffer_init(&ret->extern_read_buffer,  N(ret->raw_extern_read_buffer), ret->raw_extern_read_buffer);
 
+    arena_init(&ret->arena, ret->arena_buffer, sizeof(ret->arena_buffer));
     pop3_session_init(&ret->session, false);
 
+    ret->client.request.request_parser.request = &ret->client.request.request;
+    request_parser_init(&ret->client.request.request_parser);
+
     ret->references = 1;
     finally:
     return ret;
 }
 
-/** realmente destruye */
-static void
-pop3_destroy_(struct pop3 *s) {
-    if(s->origin_resolution != NULL) {
-        freeaddrinfo(s->origin_resolution);
-        s->origin_resolution = 0;
-    }
-    free(s);
-}
 
 /**
  * destruye un  `struct pop3', tiene en cuenta las referencias
@@ -302,12 +488,28 @@ pop3_destroy(struct pop3 *s) {
         // nada para hacer
     } else if(s->references == 1) {
         if(s != NULL) {
-            if(pool_size < max_pool) {
-                s->next = pool;
-                pool    = s;
-                pool_size++;
+            live_remove(s);
+            pop3_session_close(&s->session);
+            arena_destroy(&s->arena);
+            response_parser_destroy(&s->orig.response.response_parser);
+            capture_close(s->capture);
+            mailbox_view_close(&s->mailbox);
+            body_capture_discard(s->body);
+            prefetch_close(&s->prefetch);
+            spill_close(&s->spill);
+            tls_free(s->tls);
+            if (s->body_fd != -1) {
+                close(s->body_fd);
+            }
+            memory_release(sizeof(*s));
+            if(s->origin_resolution != NULL) {
+                freeaddrinfo(s->origin_resolution);
+                s->origin_resolution = 0;
+            }
+            if(pool == NULL) {
+                free(s);
             } else {
-                pop3_destroy_(s);
+                slab_free(pool, s);
             }
         }
     } else {
@@ -315,18 +517,180 @@ pop3_destroy(struct pop3 *s) {
     }
 }
 
+int
+pop3_pool_init(unsigned max, unsigned prewarm, bool hugepages) {
+    pool = slab_new(sizeof(struct pop3), max, hugepages);
+    if(pool == NULL) {
+        return -1;
+    }
+    return slab_reserve(pool, prewarm);
+}
+
 void
-pop3_pool_destroy(void) {
-    struct pop3 *next, *s;
-    for(s = pool; s != NULL ; s = next) {
-        next = s->next;
-        free(s);
+pop3_pool_stats(struct slab_stats *st) {
+    if(pool == NULL) {
+        memset(st, 0, sizeof(*st));
+    } else {
+        slab_stats(pool, st);
     }
 }
 
+void
+pop3_pool_destroy(void) {
+    slab_destroy(pool);
+    pool = NULL;
+}
+
 /** obtiene el struct (pop3 *) desde la llave de selección  */
 #define ATTACHMENT(key) ( (struct pop3 *)(key)->data)
 
+/** contabiliza (y si hay captura, registra) bytes transferidos por la sesion */
+#define ACCOUNT(key, dir, data, n) pop3_account(ATTACHMENT(key), (dir), (data), (n))
+
+/**
+ * Cuota de cada sesion por iteracion del selector. Una transferencia grande
+ * que la agota se posterga a la iteracion siguiente, para que las sesiones
+ * interactivas no esperen detras de ella.
+ */
+#define POP3_ROUND_BYTES    BUFFER_SIZE
+#define POP3_ROUND_USEC     1000
+
+/**
+ * Bytes por llamada a sendfile. Lo que pase de la cuota de la iteracion se
+ * descuenta de las siguientes (ver pop3_budget_available).
+ */
+#define POP3_SENDFILE_CHUNK (8 * BUFFER_SIZE)
+
+/**
+ * Contrapresion por encima del umbral blando de memoria: no se atiende la
+ * lectura de un origin que llega y el selector deja de esperar lecturas
+ * en ese socket, sin tocar sus intereses, hasta que pop3_backpressure_resume
+ * vea el uso por debajo del umbral. Solo se pausan los origin que estan
+ * mandando respuestas adelantadas (-f), que son las que crecen en memoria sin
+ * que el cliente las pida; mientras tanto las sesiones vacian hacia los
+ * clientes lo que ya tienen y envian comandos a los origin. Si el cliente
+ * pasa a esperar al origin, la sesion se reanuda en la iteracion siguiente.
+ *
+ * Parte de la memoria no baja sin leer del origin (la estructura de cada
+ * sesion, una respuesta adelantada que el cliente recien puede tomar cuando
+ * llega entera): si el uso sigue arriba pasados POP3_PAUSE_USEC, cada origin
+ * pausado lee en la iteracion siguiente y se vuelve a pausar, para que las
+ * sesiones avancen despacio en lugar de trabarse.
+ */
+#define POP3_PAUSE_USEC     100000
+
+static bool          origins_paused = false;
+static uint64_t      paused_since;
+/** iteracion del selector en la que los origin leen antes de pausarse */
+static unsigned long paused_retry;
+
+/**
+ * el origin esta mandando una respuesta adelantada que se guarda en memoria.
+ * Las demas las espera el cliente (o se descartan): pausarlas no libera nada.
+ */
+static bool
+pop3_reading_ahead(struct pop3 *p) {
+    const struct pop3_request *r = request_ring_current(&p->session.requests);
+    return r != NULL && r->prefetch && p->prefetch.discarding == 0;
+}
+
+static bool
+pop3_backpressure(struct selector_key *key) {
+    struct pop3 *p = ATTACHMENT(key);
+    if (key->fd != p->origin_fd || memory_level() == MEMORY_OK || !pop3_reading_ahead(p)) {
+        return false;
+    }
+    if (SELECTOR_SUCCESS != selector_pause_read(key->s, key->fd, true)) {
+        return false;
+    }
+    if (!origins_paused) {
+        origins_paused = true;
+        paused_since   = monotonic_usec();
+    }
+    memory_throttle();
+    return selector_round(key->s) != paused_retry;
+}
+
+void
+pop3_backpressure_resume(void) {
+    if (!origins_paused) {
+        return;
+    }
+    const bool all = memory_level() == MEMORY_OK
+                     || monotonic_usec() - paused_since >= POP3_PAUSE_USEC;
+    bool paused = false;
+    // las que se pausaron y cerraron el origin ya no estan en el selector
+    for (struct pop3 *s = live; s != NULL; s = s->live_next) {
+        if (s->origin_fd == -1) {
+            continue;
+        }
+        // una sesion cuyo cliente paso a esperar al origin no sigue pausada
+        if (all || !pop3_reading_ahead(s)) {
+            selector_pause_read(s->s, s->origin_fd, false);
+            if (all) {
+                paused_retry = selector_round(s->s) + 1;
+            }
+        } else {
+            paused = true;
+        }
+    }
+    origins_paused = paused;
+}
+
+static void
+pop3_account(struct pop3 *p, enum record_dir dir, const void *data, ssize_t n) {
+    session_record_bytes(&p->record, dir, n);
+    capture_bytes(p->capture, dir, data, n);
+    if (n > 0) {
+        p->budget_bytes -= n;
+    }
+}
+
+/** envia al cliente, cifrando si la sesion usa TLS */
+static ssize_t
+client_send(struct pop3 *p, const void *data, size_t n) {
+    return p->tls == NULL ? send(p->client_fd, data, n, MSG_NOSIGNAL)
+                          : tls_send(p->tls, data, n);
+}
+
+/** lee del cliente, descifrando si la sesion usa TLS */
+static ssize_t
+client_recv(struct pop3 *p, void *data, size_t n) {
+    return p->tls == NULL ? recv(p->client_fd, data, n, 0) : tls_recv(p->tls, data, n);
+}
+
+/** la operacion no avanzo pero no fallo: TLS espera al socket */
+static bool
+client_would_block(ssize_t n) {
+    return n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/**
+ * Determina si la sesion puede atenderse en esta iteracion. Al comenzar cada
+ * iteracion se suma POP3_ROUND_BYTES a la cuota de bytes (sin pasar de ese
+ * valor) y se reinicia el tiempo usado. Lo que se pase de la cuota se
+ * descuenta de las iteraciones siguientes.
+ */
+static bool
+pop3_budget_available(struct selector_key *key) {
+    struct pop3 *p            = ATTACHMENT(key);
+    const unsigned long round = selector_round(key->s);
+
+    if (p->budget_round != round) {
+        p->budget_round  = round;
+        p->budget_usec   = 0;
+        p->budget_bytes += POP3_ROUND_BYTES;
+        if (p->budget_bytes > POP3_ROUND_BYTES) {
+            p->budget_bytes = POP3_ROUND_BYTES;
+        }
+    }
+    if (p->budget_bytes > 0 && p->budget_usec < POP3_ROUND_USEC) {
+        return true;
+    }
+    metricas->deferred_events++;
+    return false;
+}
+
 /* declaración forward de los handlers de selección de una conexión
  * establecida entre un cliente y el proxy.
  */
@@ -341,9 +705,9 @@ static const struct fd_handler pop3_handler = {
         .handle_block  = pop3_block,
 };
 
-/** Intenta aceptar la nueva conexión entrante*/
-void
-pop3_passive_accept(struct selector_key *key) {
+/** Intenta aceptar la nueva conexión entrante. Con `tls' es POP3S */
+static void
+pop3_accept(struct selector_key *key, bool tls) {
     struct sockaddr_storage       client_addr;
     socklen_t                     client_addr_len = sizeof(client_addr);
     struct pop3                *state           = NULL;
@@ -352,16 +716,25 @@ pop3_passive_accept(struct selector_key *key) {
                               &client_addr_len);
 
     //printf("client socket: %d\n", client);
-    metricas->concurrent_connections++;
-    metricas->historical_access++;
-
     if(client == -1) {
-        goto fail;
+        // con EAGAIN la acepto la otra instancia durante una actualizacion
+        // (ver -u) o el cliente ya se fue: no hay nada que contar
+        return;
     }
+    metricas->historical_access++;
     if(selector_fd_set_nio(client) == -1) {
         goto fail;
     }
-    state = pop3_new(client);
+    if(!memory_fits(sizeof(*state))) {
+        // por encima del umbral duro de memoria no se aceptan sesiones
+        const char *msg = "-ERR Proxy overloaded, try again later.\r\n";
+        if (!tls) {
+            send(client, msg, strlen(msg), MSG_NOSIGNAL);
+        }
+        memory_reject();
+        goto fail;
+    }
+    state = pop3_new(client, tls);
     if(state == NULL) {
         // sin un estado, nos es imposible manejaro.
         // tal vez deberiamos apagar accept() hasta que detectemos
@@ -370,11 +743,20 @@ pop3_passive_accept(struct selector_key *key) {
     }
     memcpy(&state->client_addr, &client_addr, client_addr_len);
     state->client_addr_len = client_addr_len;
+    if(tls && (state->tls = tls_new(client)) == NULL) {
+        goto fail;
+    }
 
+    // con TLS el cliente habla primero
     if(SELECTOR_SUCCESS != selector_register(key->s, client, &pop3_handler,
-                                             OP_WRITE, state)) {
+                                             tls ? OP_READ : OP_WRITE, state)) {
         goto fail;
     }
+    state->id = ++last_id;
+    state->s  = key->s;
+    live_add(state);
+    // se descuenta en pop3_done; las rechazadas arriba no llegan ahi
+    metricas->concurrent_connections++;
     return ;
     fail:
     if(client != -1) {
@@ -383,6 +765,16 @@ pop3_passive_accept(struct selector_key *key) {
     pop3_destroy(state);
 }
 
+void
+pop3_passive_accept(struct selector_key *key) {
+    pop3_accept(key, false);
+}
+
+void
+pop3s_passive_accept(struct selector_key *key) {
+    pop3_accept(key, true);
+}
+
 /** Used before changing state to set the interests of both ends (client_fd, origin_fd) */
 selector_status set_interests(fd_selector s, int client_fd, int origin_fd, enum pop3_state state) {
     fd_interest client_interest = OP_NOOP, origin_interest = OP_NOOP;
@@ -416,6 +808,119 @@ selector_status set_interests(fd_selector s, int client_fd, int origin_fd, enum
     return status;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// EARLY GREETING
+////////////////////////////////////////////////////////////////////////////////
+
+/** saludo del proxy al cliente */
+static const char proxy_greeting[] = "+OK Proxy server POP3 ready.\r\n";
+
+#define GREETING_LEN (sizeof(proxy_greeting) - 1)
+
+static void request_init(const unsigned state, struct selector_key *key);
+static unsigned request_parse(struct selector_key *key);
+static int park_replay(struct pop3 *p);
+
+/**
+ * Con -g se saluda al cliente apenas se acepta (o termina el handshake de
+ * POP3S) y la conexion con el origin se establece en paralelo. Lo que manda
+ * el cliente de ORIGIN_RESOLV a CAPA queda sin parsear en el buffer de
+ * lectura y se atiende al pasar a REQUEST, como si recien llegara.
+ *
+ * Interes del cliente en esos estados: escribir mientras falte saludo, leer
+ * mientras haya lugar, y si no nada.
+ */
+static fd_interest
+early_interest(struct pop3 *p) {
+    if (!p->early || p->client_gone) {
+        return OP_NOOP;
+    }
+    if (p->greeted < GREETING_LEN) {
+        return OP_WRITE;
+    }
+    return buffer_can_write(&p->read_buffer) ? OP_READ : OP_NOOP;
+}
+
+/**
+ * El cliente se fue o fallo. Sin origin conectado hay quien referencia la
+ * sesion (el hilo que resuelve, el socket que conecta): se deja de atender al
+ * cliente y se termina cuando el origin avance.
+ */
+static unsigned
+early_fail(struct selector_key *key) {
+    struct pop3 *p = ATTACHMENT(key);
+
+    if (p->origin_fd != -1) {
+        return ERROR;
+    }
+    p->client_gone = true;
+    selector_set_interest_key(key, OP_NOOP);
+    return stm_state(&p->stm);
+}
+
+/** el origin esta listo: se atiende lo que encolo el cliente */
+static unsigned
+early_done(struct selector_key *key) {
+    struct pop3 *p = ATTACHMENT(key);
+
+    if (p->greeted < GREETING_LEN) {
+        // ninguna respuesta sale antes que el saludo
+        p->origin_ready    = true;
+        selector_status ss = SELECTOR_SUCCESS;
+        ss |= selector_set_interest(key->s, p->client_fd, OP_WRITE);
+        ss |= selector_set_interest(key->s, p->origin_fd, OP_NOOP);
+        return SELECTOR_SUCCESS == ss ? stm_state(&p->stm) : ERROR;
+    }
+    request_init(REQUEST, key);
+    if (p->resuming && park_replay(p) < 0) {
+        return ERROR;
+    }
+    return request_parse(key);
+}
+
+/** Envia al cliente lo que falta del saludo */
+static unsigned
+early_write(struct selector_key *key) {
+    struct pop3 *p    = ATTACHMENT(key);
+    const char  *ptr  = proxy_greeting + p->greeted;
+    const ssize_t n   = client_send(p, ptr, GREETING_LEN - p->greeted);
+    ACCOUNT(key, RECORD_CLIENT_OUT, ptr, n);
+
+    if (client_would_block(n)) {
+        return stm_state(&p->stm);
+    } else if (n == -1) {
+        return early_fail(key);
+    }
+    p->greeted += n;
+    if (p->origin_ready && p->greeted == GREETING_LEN) {
+        return early_done(key);
+    }
+    return SELECTOR_SUCCESS == selector_set_interest_key(key, early_interest(p))
+           ? stm_state(&p->stm) : ERROR;
+}
+
+/** Encola lo que manda el cliente antes de que el origin este listo */
+static unsigned
+early_read(struct selector_key *key) {
+    struct pop3 *p = ATTACHMENT(key);
+    buffer *b      = &p->read_buffer;
+    uint8_t *ptr;
+    size_t  count;
+    ssize_t  n;
+
+    ptr = buffer_write_ptr(b, &count);
+    n = client_recv(p, ptr, count);
+    ACCOUNT(key, RECORD_CLIENT_IN, ptr, n);
+
+    if (n > 0) {
+        buffer_write_adv(b, n);
+    } else if (!client_would_block(n)) {
+        return early_fail(key);
+    }
+    return SELECTOR_SUCCESS == selector_set_interest_key(key, early_interest(p))
+           ? stm_state(&p->stm) : ERROR;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // ORIGIN_RESOLV
 ////////////////////////////////////////////////////////////////////////////////
@@ -428,8 +933,13 @@ unsigned
 origin_resolv(struct selector_key *key){
 
     pthread_t tid;
-    struct selector_key* k = malloc(sizeof(*key));
+    struct selector_key* k;
 
+    if(ATTACHMENT(key)->resolving) {
+        // el cliente solo espera el resto del saludo anticipado
+        return early_write(key);
+    }
+    k = malloc(sizeof(*key));
     if(k == NULL) {
         return ERROR;
     } else {
@@ -437,7 +947,8 @@ origin_resolv(struct selector_key *key){
         if(-1 == pthread_create(&tid, 0, origin_resolv_blocking, k)) {
             return ERROR;
         } else{
-            selector_set_interest_key(key, OP_NOOP);
+            ATTACHMENT(key)->resolving = true;
+            selector_set_interest_key(key, early_interest(ATTACHMENT(key)));
         }
     }
 
@@ -487,9 +998,12 @@ static unsigned
 origin_resolv_done(struct selector_key *key) {
     struct pop3 *s      =  ATTACHMENT(key);
 
+    if(s->client_gone) {
+        return ERROR;
+    }
     if(s->origin_resolution == 0) {
         char * msg = "-ERR Invalid domain.\r\n";
-        send(ATTACHMENT(key)->client_fd, msg, strlen(msg), 0);
+        ACCOUNT(key, RECORD_CLIENT_OUT, msg, client_send(ATTACHMENT(key), msg, strlen(msg)));
         return ERROR;
     } else {
         s->origin_domain   = s->origin_resolution->ai_family;
@@ -532,8 +1046,9 @@ origin_connect(struct selector_key *key) {
         if(errno == EINPROGRESS) {
             // es esperable,  tenemos que esperar a la conexión
 
-            // dejamos de pollear el socket del cliente
-            selector_status st = selector_set_interest_key(key, OP_NOOP);
+            // dejamos de pollear el socket del cliente (salvo el saludo anticipado)
+            selector_status st = selector_set_interest_key(key,
+                                                           early_interest(ATTACHMENT(key)));
             if(SELECTOR_SUCCESS != st) {
                 goto error;
             }
@@ -545,6 +1060,7 @@ origin_connect(struct selector_key *key) {
                 goto error;
             }
             ATTACHMENT(key)->references += 1;
+            ATTACHMENT(key)->connecting_fd = sock;
         } else {
             goto error;
         }
@@ -572,8 +1088,9 @@ connecting_init(const unsigned state, struct selector_key *key) {
     // nada por hacer
 }
 
-void send_error_(int fd, const char * error) {
-    send(fd, error, strlen(error), 0);
+static void
+send_error_(struct pop3 *p, const char * error) {
+    client_send(p, error, strlen(error));
 }
 
 unsigned
@@ -582,13 +1099,20 @@ connecting(struct selector_key *key) {
     socklen_t len = sizeof(error);
     struct pop3 *d = ATTACHMENT(key);
 
-    d->origin_fd = key->fd;
+    if (key->fd == d->client_fd) {
+        return early_write(key);
+    }
+    d->origin_fd     = key->fd;
+    d->connecting_fd = -1;
+    if (d->client_gone) {
+        return ERROR;
+    }
 
     log_connection(true, (const struct sockaddr *)&ATTACHMENT(key)->client_addr,
                    (const struct sockaddr *)&ATTACHMENT(key)->origin_addr);
 
     if (getsockopt(key->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
-        send_error_(d->client_fd, "-ERR Connection refused.\r\n");
+        send_error_(d, "-ERR Connection refused.\r\n");
         fprintf(stderr, "Connection to origin server failed\n");
         selector_set_interest_key(key, OP_NOOP);
         return ERROR;
@@ -596,24 +1120,159 @@ connecting(struct selector_key *key) {
         if(error == 0) {
             d->origin_fd = key->fd;
         } else {
-            send_error_(d->client_fd, "-ERR Connection refused.\r\n");
+            send_error_(d, "-ERR Connection refused.\r\n");
             fprintf(stderr, "Connection to origin server failed\n");
             selector_set_interest_key(key, OP_NOOP);
             return ERROR;
         }
     }
 
-    // iniciamos la sesion pop3 sin pipelining del lado del server
-    pop3_session_init(&ATTACHMENT(key)->session, false);
+    // la sesion pop3 (sin pipelining del lado del server) se inicio en pop3_new
 
     selector_status ss = SELECTOR_SUCCESS;
 
     ss |= selector_set_interest_key(key, OP_READ);
-    ss |= selector_set_interest(key->s, ATTACHMENT(key)->client_fd, OP_NOOP);
+    ss |= selector_set_interest(key->s, ATTACHMENT(key)->client_fd, early_interest(d));
 
     return SELECTOR_SUCCESS == ss ? HELLO : ERROR;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// PARKING
+////////////////////////////////////////////////////////////////////////////////
+
+/** cada cuanto se buscan sesiones para estacionar */
+#define PARK_SWEEP_USEC 1000000
+
+/**
+ * Con -k, una sesion autenticada que pasa los segundos dados esperando al
+ * cliente, sin requests en vuelo ni DELE sin RSET, se estaciona: se le manda
+ * QUIT al origin y se cierra esa conexion, pero no la del cliente. Con el
+ * proximo comando se reconecta como con el saludo anticipado (CONNECTING,
+ * HELLO y CAPA, encolando lo que mande el cliente) y antes de atenderlo se
+ * repiten USER y PASS, cuyas respuestas no se le envian.
+ *
+ * Sin DELE el QUIT no cambia el buzon y los numeros de mensaje se mantienen,
+ * salvo que otra sesion borre mensajes mientras tanto. Solo se estacionan
+ * sesiones autenticadas con PASS.
+ *
+ * Tambien se estaciona una sesion que sigue enviando al cliente lo acumulado
+ * (ver -x) de un RETR que el origin ya termino de mandar, si no hay otras
+ * requests detras: la respuesta termina de salir desde el spill y la sesion
+ * queda esperando al cliente sin origin.
+ */
+static bool
+park_candidate(struct pop3 *p, uint64_t now) {
+    const struct request_parser *rp = &p->client.request.request_parser;
+    const struct request_ring *ring = &p->session.requests;
+
+    const bool waiting  = stm_state(&p->stm) == REQUEST && request_ring_empty(ring);
+    const bool spilling = stm_state(&p->stm) == RESPONSE && request_ring_size(ring) == 1
+                          && p->orig.response.response_parser.state == response_done
+                          && spill_pending(&p->spill) && !buffer_can_read(&p->write_buffer);
+
+    return (waiting || spilling) && !p->parked && p->origin_fd != -1
+           && p->session.state == POP3_TRANSACTION && p->session.password != NULL
+           && !p->deleted && !buffer_can_read(&p->read_buffer) && rp->state == request_cmd && rp->i == 0
+           && !p->stls_waiting && (p->tls == NULL || tls_pending(p->tls) == 0)
+           && now - p->idle_since >= (uint64_t) parameters->park_idle * 1000000;
+}
+
+static void
+park(struct pop3 *p) {
+    const char *msg = "QUIT\r\n";
+    const int fd    = p->origin_fd;
+
+    // su respuesta no se espera: no hay nada que confirmar
+    pop3_account(p, RECORD_ORIGIN_OUT, msg, send(fd, msg, strlen(msg), MSG_NOSIGNAL));
+    log_connection(false, (const struct sockaddr *) &p->client_addr,
+                   (const struct sockaddr *) &p->origin_addr);
+    selector_unregister_fd(p->s, fd);
+    close(fd);
+    p->origin_fd = -1;
+    buffer_reset(&p->write_buffer);
+    p->parked = true;
+    metricas->parks++;
+    if (stm_state(&p->stm) == RESPONSE) {
+        metricas->spill_parks++;
+    }
+    metricas->parked_sessions++;
+}
+
+void
+pop3_park_idle(void) {
+    static uint64_t last = 0;
+    if (parameters->park_idle == 0) {
+        return;
+    }
+    const uint64_t now = monotonic_usec();
+    if (now - last < PARK_SWEEP_USEC) {
+        return;
+    }
+    last = now;
+    for (struct pop3 *s = live; s != NULL; s = s->live_next) {
+        if (park_candidate(s, now)) {
+            park(s);
+        }
+    }
+}
+
+/** llego algo del cliente a una sesion estacionada: se reconecta al origin */
+static unsigned
+park_resume(struct selector_key *key) {
+    struct pop3 *p = ATTACHMENT(key);
+
+    p->parked       = false;
+    p->resuming     = true;
+    p->resume_at    = monotonic_usec();
+    metricas->parked_sessions--;
+    // el cliente ya fue saludado: lo que mande se encola hasta reanudar
+    p->early        = true;
+    p->greeted      = GREETING_LEN;
+    p->origin_ready = false;
+    // el buzon pudo cambiar mientras tanto: los listados validados y los RETR
+    // pedidos por adelantado son de la conexion anterior
+    mailbox_view_forget(&p->mailbox);
+    prefetch_close(&p->prefetch);
+    prefetch_init(&p->prefetch);
+    return origin_connect(key);
+}
+
+/** antes de lo que encolo el cliente se repiten USER y PASS */
+static int
+park_replay(struct pop3 *p) {
+    const enum pop3_cmd_id cmds[] = { user, pass };
+    const char *args[]            = { p->session.user, p->session.password };
+
+    for (unsigned i = 0; i < N(cmds); i++) {
+        struct pop3_request *r = request_ring_push(&p->session.requests, &p->arena,
+                                                   get_cmd_by_id(cmds[i]), args[i]);
+        if (r == NULL) {
+            return -1;
+        }
+        r->replay = true;
+    }
+    return 0;
+}
+
+/** se respondio un USER o PASS repetido. -1 si el origin lo rechazo */
+static int
+park_replayed(struct pop3 *p, const struct pop3_request *r) {
+    if (r->response == NULL || r->response->status != response_status_ok) {
+        return -1;
+    }
+    if (r->cmd->id == pass) {
+        const uint64_t usec = monotonic_usec() - p->resume_at;
+        p->resuming = false;
+        metricas->resumes++;
+        metricas->resume_usec += usec;
+        if (usec > metricas->resume_usec_max) {
+            metricas->resume_usec_max = usec;
+        }
+    }
+    return 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // HELLO
 ////////////////////////////////////////////////////////////////////////////////
@@ -626,6 +1285,34 @@ hello_init(const unsigned state, struct selector_key *key) {
     d->wb = &(ATTACHMENT(key)->write_buffer);
 }
 
+/**
+ * Le pide las capacidades al origin, una vez saludado el cliente. Si estan
+ * en la cache (ver -A) se pasa directo a atender al cliente.
+ */
+static unsigned
+hello_capa(struct selector_key *key) {
+    struct pop3 *p     = ATTACHMENT(key);
+    selector_status ss = SELECTOR_SUCCESS;
+
+    if (capa_cache_lookup((const struct sockaddr *) &p->origin_addr, p->origin_addr_len,
+                          &p->session.pipelining)) {
+        if (p->early) {
+            return early_done(key);
+        }
+        ss |= selector_set_interest(key->s, p->client_fd, OP_READ);
+        ss |= selector_set_interest(key->s, p->origin_fd, OP_NOOP);
+        return SELECTOR_SUCCESS == ss ? REQUEST : ERROR;
+    }
+    ss |= selector_set_interest(key->s, p->client_fd, early_interest(p));
+    ss |= selector_set_interest(key->s, p->origin_fd, OP_READ);
+    if (ss != SELECTOR_SUCCESS) {
+        return ERROR;
+    }
+    char * msg = "CAPA\r\n";
+    ACCOUNT(key, RECORD_ORIGIN_OUT, msg, send(p->origin_fd, msg, strlen(msg), 0));
+    return CAPA;
+}
+
 /** Lee todos los bytes del mensaje de tipo `hello' de server_fd */
 static unsigned
 hello_read(struct selector_key *key) {
@@ -635,20 +1322,28 @@ hello_read(struct selector_key *key) {
     size_t  count;
     ssize_t  n;
 
+    if (key->fd == ATTACHMENT(key)->client_fd) {
+        return early_read(key);
+    }
+
     ///////////////////////////////////////////////////////
     //Proxy welcome message
-    ptr = buffer_write_ptr(d->wb, &count);
-    const char * msg = "+OK Proxy server POP3 ready.\r\n";
-    n = strlen(msg);
-    strcpy((char *) ptr, msg);
-    // memccpy(ptr, msg, 0, count);
-    buffer_write_adv(d->wb, n);
+    if (!ATTACHMENT(key)->early) {
+        ptr = buffer_write_ptr(d->wb, &count);
+        n = GREETING_LEN;
+        memcpy(ptr, proxy_greeting, n);
+        buffer_write_adv(d->wb, n);
+    }
     //////////////////////////////////////////////////////
 
     ptr = buffer_write_ptr(d->wb, &count);
     n = recv(key->fd, ptr, count, 0);
+    ACCOUNT(key, RECORD_ORIGIN_IN, ptr, n);
 
-    if(n > 0) {
+    if(n > 0 && ATTACHMENT(key)->early) {
+        // el cliente ya fue saludado
+        ret = hello_capa(key);
+    } else if(n > 0) {
         buffer_write_adv(d->wb, 0);
 
         selector_status ss = SELECTOR_SUCCESS;
@@ -674,23 +1369,22 @@ hello_write(struct selector_key *key) {
     size_t  count;
     ssize_t  n;
 
+    if (ATTACHMENT(key)->early) {
+        return early_write(key);
+    }
+
     ptr = buffer_read_ptr(d->wb, &count);
-    n = send(key->fd, ptr, count, MSG_NOSIGNAL);
+    n = client_send(ATTACHMENT(key), ptr, count);
+    ACCOUNT(key, RECORD_CLIENT_OUT, ptr, n);
 
-    if(n == -1) {
+    if(client_would_block(n)) {
+        // se reintenta en el proximo aviso del selector
+    } else if(n == -1) {
         ret = ERROR;
     } else {
         buffer_read_adv(d->wb, n);
         if(!buffer_can_read(d->wb)) {
-            selector_status ss = SELECTOR_SUCCESS;
-            ss |= selector_set_interest_key(key, OP_NOOP);
-            ss |= selector_set_interest(key->s, ATTACHMENT(key)->origin_fd, OP_READ);
-            ret = SELECTOR_SUCCESS == ss ? CAPA : ERROR;
-
-            if (ret == CAPA) {
-                char * msg = "CAPA\r\n";
-                send(ATTACHMENT(key)->origin_fd, msg, strlen(msg), 0);
-            }
+            ret = hello_capa(key);
         }
     }
 
@@ -709,6 +1403,22 @@ hello_close(const unsigned state, struct selector_key *key) {
 
 void set_pipelining(struct selector_key *key, struct response_st *d);
 
+/** guarda las capacidades del origin para las sesiones siguientes (ver -A) */
+static void
+capa_store(struct selector_key *key, struct response_st *d) {
+    struct pop3 *p   = ATTACHMENT(key);
+    const char *body = d->response_parser.capa_response;
+    size_t count;
+    const uint8_t *ptr = buffer_read_ptr(d->wb, &count);
+
+    // en el buffer esta la respuesta entera: linea de estado y cuerpo
+    if (body != NULL && d->request->response->status == response_status_ok
+        && count >= strlen(body)) {
+        capa_cache_store((const struct sockaddr *) &p->origin_addr, p->origin_addr_len,
+                         ptr, count - strlen(body), body);
+    }
+}
+
 void
 capa_init(const unsigned state, struct selector_key *key) {
     struct response_st * d      = &ATTACHMENT(key)->orig.response;
@@ -716,9 +1426,9 @@ capa_init(const unsigned state, struct selector_key *key) {
     d->rb                       = &ATTACHMENT(key)->write_buffer;
     d->wb                       = &ATTACHMENT(key)->super_buffer;
 
-    struct pop3_request *r      = new_request(get_cmd("capa"), NULL);
+    pop3_request_init(&d->own_request, NULL, get_cmd("capa"), NULL);
 
-    d->request                  = r;
+    d->request                  = &d->own_request;
     d->response_parser.request  = d->request;
     response_parser_init(&d->response_parser);
 }
@@ -736,8 +1446,13 @@ capa_read(struct selector_key *key) {
     size_t  count;
     ssize_t  n;
 
+    if (key->fd == ATTACHMENT(key)->client_fd) {
+        return early_read(key);
+    }
+
     ptr = buffer_write_ptr(b, &count);
     n = recv(key->fd, ptr, count, 0);
+    ACCOUNT(key, RECORD_ORIGIN_IN, ptr, n);
 
     if(n > 0) {
         buffer_write_adv(b, n);
@@ -745,7 +1460,11 @@ capa_read(struct selector_key *key) {
         d->response_parser.first_line_done = false;
         st = response_consume(b, d->wb, &d->response_parser, &error);
         if (response_is_done(st, 0)) {
+            capa_store(key, d);
             set_pipelining(key, d);
+            if (ATTACHMENT(key)->early) {
+                return early_done(key);
+            }
             selector_status ss = SELECTOR_SUCCESS;
             ss |= selector_set_interest_key(key, OP_NOOP);
             ss |= selector_set_interest(key->s, ATTACHMENT(key)->client_fd, OP_READ);
@@ -769,13 +1488,13 @@ char * to_upper(char *str) {
 }
 
 void set_pipelining(struct selector_key *key, struct response_st *d) {
-    to_upper(d->response_parser.capa_response);
     char * capabilities = d->response_parser.capa_response;
     char * needle = "PIPELINING";
 
     struct pop3 *p = ATTACHMENT(key);
 
-    if (strstr(capabilities, needle) != NULL) {
+    // sin CAPA (-ERR) no hay cuerpo
+    if (capabilities != NULL && strstr(to_upper(capabilities), needle) != NULL) {
         p->session.pipelining = true;
     } else {
         p->session.pipelining = false;
@@ -793,16 +1512,206 @@ void set_pipelining(struct selector_key *key, struct response_st *d) {
 
 enum pop3_state request_process(struct selector_key *key, struct request_st * d);
 
-/** inicializa las variables de los estados REQUEST y RESPONSE */
+/**
+ * inicializa las variables de los estados REQUEST y RESPONSE.
+ * El parser se inicializa una unica vez en pop3_new: al volver a REQUEST
+ * puede haber un comando a medio leer de una vuelta anterior.
+ */
 static void
 request_init(const unsigned state, struct selector_key *key) {
     struct request_st * d = &ATTACHMENT(key)->client.request;
 
     d->rb              = &(ATTACHMENT(key)->read_buffer);
     d->wb              = &(ATTACHMENT(key)->write_buffer);
+}
 
-    d->request_parser.request  = &d->request;
-    request_parser_init(&d->request_parser);
+/** sin transformacion externa las respuestas a RETR se pueden guardar y responder en disco */
+static bool
+pop3_body_cacheable(const struct config *c) {
+    return !c->et_activated || c->filter_command == NULL;
+}
+
+/** RETR del mensaje que esta en la cache en disco: se envia desde el archivo */
+static bool
+pop3_body_answer(struct pop3 *p, const struct pop3_request *r) {
+    char k[BODY_CACHE_KEY_MAX];
+    if (r->cmd->id != retr
+        || mailbox_view_message_key(&p->mailbox, r->args, k, sizeof(k)) < 0) {
+        return false;
+    }
+    struct config *c = config_get();
+    const bool cacheable = pop3_body_cacheable(c);
+    config_release(c);
+    if (!cacheable || (p->body_fd = body_cache_open(k, &p->body_len)) == -1) {
+        return false;
+    }
+    p->body_offset = 0;
+    return true;
+}
+
+/**
+ * Agrega al anillo los RETR que corresponda pedir por adelantado. Sus
+ * respuestas se guardan sin transformar, asi que no se piden con una
+ * transformacion externa activa.
+ */
+static void
+pop3_prefetch_issue(struct pop3 *p) {
+    struct request_ring *ring = &p->session.requests;
+    unsigned long first;
+    const unsigned n = p->session.pipelining ? prefetch_plan(&p->prefetch, &first) : 0;
+    if (n == 0) {
+        return;
+    }
+    struct config *c = config_get();
+    const bool cacheable = pop3_body_cacheable(c);
+    config_release(c);
+    if (!cacheable) {
+        return;
+    }
+    for (unsigned i = 0; i < n && !request_ring_full(ring); i++) {
+        char arg[24];
+        snprintf(arg, sizeof(arg), "%lu", first + i);
+        struct pop3_request *r = request_ring_push(ring, &p->arena, get_cmd_by_id(retr), arg);
+        if (r == NULL) {
+            break;
+        }
+        r->prefetch = true;
+        prefetch_issued(&p->prefetch, first + i);
+    }
+}
+
+/** RETR del mensaje que ya se pidio por adelantado: se envia lo guardado */
+static bool
+pop3_prefetch_answer(struct pop3 *p, const struct pop3_request *r) {
+    struct config *c = config_get();
+    const bool cacheable = pop3_body_cacheable(c);
+    config_release(c);
+    if (!cacheable || !prefetch_take(&p->prefetch, r)) {
+        return false;
+    }
+    // mientras se envia se pide la ventana siguiente
+    pop3_prefetch_issue(p);
+    return true;
+}
+
+/**
+ * TLS puede haber descifrado bytes del cliente que ya no estan en el socket,
+ * por los que el selector no va a avisar: se pasan al buffer de lectura.
+ * Retorna si se agrego algo.
+ */
+static bool
+request_fill_pending(struct selector_key *key) {
+    struct pop3 *p = ATTACHMENT(key);
+    buffer *b      = &p->read_buffer;
+    uint8_t *ptr;
+    size_t  count;
+    ssize_t  n;
+
+    if (tls_pending(p->tls) == 0 || !buffer_can_write(b)) {
+        return false;
+    }
+    ptr = buffer_write_ptr(b, &count);
+    n = client_recv(p, ptr, count);
+    ACCOUNT(key, RECORD_CLIENT_IN, ptr, n);
+    if (n <= 0) {
+        return false;
+    }
+    buffer_write_adv(b, n);
+    return true;
+}
+
+/** CAPA del cliente antes de autenticarse, desde la cache de capacidades (ver -A) */
+static struct mailbox_blob *
+pop3_capa_answer(struct pop3 *p, const struct pop3_request *r) {
+    if (r->cmd->id != capa || p->session.state != POP3_AUTHORIZATION) {
+        return NULL;
+    }
+    return capa_cache_answer((const struct sockaddr *) &p->origin_addr, p->origin_addr_len,
+                             tls_enabled() && p->tls == NULL);
+}
+
+static unsigned pop3_stls(struct selector_key *key);
+static unsigned tls_handshake_step(struct selector_key *key);
+
+/**
+ * Parsea las requests que el cliente ya mando (estan en el buffer de lectura)
+ * mientras haya lugar en el anillo de la sesion. Si quedaron requests sin
+ * enviar se pasa a escribirlas en el origin, si no se sigue leyendo al
+ * cliente. Con el anillo lleno no se lee mas al cliente hasta que se liberen
+ * lugares.
+ */
+static unsigned
+request_parse(struct selector_key *key) {
+    struct request_st *d       = &ATTACHMENT(key)->client.request;
+    struct request_ring *ring  = &ATTACHMENT(key)->session.requests;
+    const int client_fd        = ATTACHMENT(key)->client_fd;
+    const int origin_fd        = ATTACHMENT(key)->origin_fd;
+    struct pop3 *p             = ATTACHMENT(key);
+
+    if (p->parked && (buffer_can_read(d->rb) || tls_pending(p->tls) > 0)) {
+        // el proximo comando reanuda la sesion, que repite USER y PASS antes
+        return park_resume(key);
+    }
+    if (p->stls_waiting) {
+        if (!request_ring_empty(ring)) {
+            return REQUEST;
+        }
+        p->stls_waiting = false;
+        const unsigned ret = pop3_stls(key);
+        if (ret != REQUEST) {
+            return ret;
+        }
+    }
+
+    do {
+        while (buffer_can_read(d->rb) && !request_ring_full(ring) && !p->stls_waiting) {
+            bool error = false;
+            enum request_state st = request_consume(d->rb, &d->request_parser, &error);
+            if (!request_is_done(st, 0)) {
+                // comando incompleto, queda en el parser
+                break;
+            }
+            if (d->request_parser.state == request_done && request_ring_empty(ring)) {
+                // sin requests en vuelo se puede responder desde la cache sin alterar el orden
+                struct mailbox_view *v = &ATTACHMENT(key)->mailbox;
+                v->serving = mailbox_view_answer(v, &d->request);
+                if (v->serving != NULL && ATTACHMENT(key)->warmed) {
+                    metricas->warmup_hits++;
+                }
+                if (v->serving == NULL) {
+                    v->serving = pop3_capa_answer(ATTACHMENT(key), &d->request);
+                }
+                if (v->serving != NULL || pop3_prefetch_answer(ATTACHMENT(key), &d->request)
+                    || pop3_body_answer(ATTACHMENT(key), &d->request)) {
+                    v->offset = 0;
+                    request_parser_init(&d->request_parser);
+                    selector_status ss = SELECTOR_SUCCESS;
+                    ss |= selector_set_interest(key->s, client_fd, OP_WRITE);
+                    ss |= selector_set_interest(key->s, origin_fd, OP_NOOP);
+                    return SELECTOR_SUCCESS == ss ? CACHED : ERROR;
+                }
+            }
+            enum pop3_state ret = request_process(key, d);
+            if (ret != REQUEST) {
+                return ret;
+            }
+        }
+    } while (!request_ring_full(ring) && !p->stls_waiting && request_fill_pending(key));
+
+    selector_status ss = SELECTOR_SUCCESS;
+    if (request_ring_unsent(ring) > 0) {
+        ss |= selector_set_interest(key->s, client_fd, OP_NOOP);
+        ss |= selector_set_interest(key->s, origin_fd, OP_WRITE);
+    } else {
+        ss |= selector_set_interest(key->s, client_fd, OP_READ);
+        if (origin_fd != -1) {
+            // estacionada mientras se enviaba lo acumulado no hay origin
+            ss |= selector_set_interest(key->s, origin_fd, OP_NOOP);
+        }
+        p->idle_since = monotonic_usec();
+    }
+
+    return SELECTOR_SUCCESS == ss ? REQUEST : ERROR;
 }
 
 /** Lee la request del cliente */
@@ -812,21 +1721,18 @@ request_read(struct selector_key *key) {
     enum pop3_state ret  = REQUEST;
 
     buffer *b            = d->rb;
-    bool  error          = false;
     uint8_t *ptr;
     size_t  count;
     ssize_t  n;
 
     ptr = buffer_write_ptr(b, &count);
-    n = recv(key->fd, ptr, count, 0);
+    n = client_recv(ATTACHMENT(key), ptr, count);
+    ACCOUNT(key, RECORD_CLIENT_IN, ptr, n);
 
-    if(n > 0 || buffer_can_read(b)) {
+    if(n > 0) {
         buffer_write_adv(b, n);
-        enum request_state st = request_consume(b, &d->request_parser, &error);
-        if (request_is_done(st, 0)) {
-            ret = request_process(key, d);
-        }
-    } else {
+        ret = request_parse(key);
+    } else if(!client_would_block(n)) {
         ret = ERROR;
     }
 
@@ -835,10 +1741,45 @@ request_read(struct selector_key *key) {
 
 #define MAX_CONCURRENT_INVALID_COMMANDS 3
 
+
+/**
+ * STLS (RFC 2595): lo atiende el proxy negociando TLS con el cliente; la
+ * conexion con el origin sigue como estaba. Se acepta antes de autenticarse;
+ * si hay requests en vuelo se espera a responderlas, para no desordenar las
+ * respuestas.
+ */
+static unsigned
+pop3_stls(struct selector_key *key) {
+    struct pop3 *p = ATTACHMENT(key);
+    const char *msg = NULL;
+
+    if (!tls_enabled() || p->tls != NULL) {
+        msg = "-ERR STLS not available.\r\n";
+    } else if (!request_ring_empty(&p->session.requests)) {
+        // lo que sigue no se parsea hasta atender el STLS (ver request_parse)
+        p->stls_waiting = true;
+        return REQUEST;
+    } else if (p->session.state != POP3_AUTHORIZATION) {
+        msg = "-ERR STLS not allowed now.\r\n";
+    }
+    if (msg != NULL) {
+        ACCOUNT(key, RECORD_CLIENT_OUT, msg, client_send(p, msg, strlen(msg)));
+        return REQUEST;
+    }
+    msg = "+OK Begin TLS negotiation.\r\n";
+    ACCOUNT(key, RECORD_CLIENT_OUT, msg, client_send(p, msg, strlen(msg)));
+    // lo que el cliente mando en claro detras de STLS no se atiende (inyeccion de comandos)
+    buffer_reset(&p->read_buffer);
+    p->tls = tls_new(p->client_fd);
+    if (p->tls == NULL) {
+        return ERROR;
+    }
+    return tls_handshake_step(key);
+}
+
 // procesa una request ya parseada
 enum pop3_state
 request_process(struct selector_key *key, struct request_st * d) {
-    enum pop3_state ret = REQUEST;
 
     if (d->request_parser.state >= request_error) {
         char * msg = NULL;
@@ -858,13 +1799,13 @@ request_process(struct selector_key *key, struct request_st * d) {
                 break;
         }
 
-        send(key->fd, msg, strlen(msg), 0);
+        ACCOUNT(key, RECORD_CLIENT_OUT, msg, client_send(ATTACHMENT(key), msg, strlen(msg)));
 
         ATTACHMENT(key)->session.concurrent_invalid_commands++;
         int cic = ATTACHMENT(key)->session.concurrent_invalid_commands;
         if (cic >= MAX_CONCURRENT_INVALID_COMMANDS) {
             msg = "-ERR Too many invalid commands. (POPG)\n";
-            send(key->fd, msg, strlen(msg), 0);
+            ACCOUNT(key, RECORD_CLIENT_OUT, msg, client_send(ATTACHMENT(key), msg, strlen(msg)));
             return DONE;
         }
 
@@ -876,29 +1817,30 @@ request_process(struct selector_key *key, struct request_st * d) {
 
     ATTACHMENT(key)->session.concurrent_invalid_commands = 0;
 
-    // si la request es valida la encolamos
-    struct pop3_request *r = new_request(d->request.cmd, d->request.args);
+    if (d->request.cmd->id == stls) {
+        request_parser_init(&d->request_parser);
+        return pop3_stls(key);
+    }
+
+    // si la request es valida la agregamos al anillo (request_parse se asegura de que haya lugar)
+    struct pop3_request *r = request_ring_push(&ATTACHMENT(key)->session.requests,
+                                               &ATTACHMENT(key)->arena,
+                                               d->request.cmd, d->request.args);
     if (r == NULL) {
         fprintf(stderr, "Memory error");
         return ERROR;
     }
+    mailbox_view_request(&ATTACHMENT(key)->mailbox, r);
+    prefetch_observe(&ATTACHMENT(key)->prefetch, r);
+    if (r->cmd->id == retr && !buffer_can_read(d->rb)) {
+        // el cliente espera cada respuesta antes de pedir la siguiente
+        pop3_prefetch_issue(ATTACHMENT(key));
+    }
 
-    // encolo la request
-    queue_add(ATTACHMENT(key)->session.request_queue, r);
     // reseteamos el parser
     request_parser_init(&d->request_parser);
 
-
-    // no hay mas requests por leer, entonces vamos a request write
-    if (!buffer_can_read(d->rb)) {
-        selector_status s = SELECTOR_SUCCESS;
-        s |= selector_set_interest_key(key, OP_NOOP);
-        s |= selector_set_interest(key->s, ATTACHMENT(key)->origin_fd, OP_WRITE);
-
-        ret = SELECTOR_SUCCESS == s ? ret : ERROR;
-    }
-
-    return ret;
+    return REQUEST;
 }
 
 /** Escrible la request en el server */
@@ -912,36 +1854,37 @@ request_write(struct selector_key *key) {
     size_t  count;
     ssize_t  n;
 
-    //struct pop3_request *r = &d->request;
-
-    // recorro la queue sin desencolar nada
-    struct queue *q = ATTACHMENT(key)->session.request_queue;
+    struct request_ring *ring = &ATTACHMENT(key)->session.requests;
     struct pop3_request *r;
 
-    //si el server no soporta pipelining solo mando la primer request
+    //si el server no soporta pipelining solo mando una request por vez
     if (ATTACHMENT(key)->session.pipelining == false) {
-        r = queue_peek(q);
-        if (r == NULL) {
-            fprintf(stderr, "Error empty queue");
-            return ERROR;
-        }
-        // copio la request en el buffer
-        if (-1 == request_marshall(r, b)) {
-            ret = ERROR;
-        }
-    } else {
-        // si el server soporta pipelining copio el resto de las requests y las mando todas juntas
-        while ((r = queue_get_next(q)) != NULL) {
-            //printf("%s\n", r->cmd->name);
+        if (request_ring_in_flight(ring) == 0 && (r = request_ring_unsent_peek(ring)) != NULL) {
+            // copio la request en el buffer
             if (-1 == request_marshall(r, b)) {
                 fprintf(stderr, "Request buffer error");
                 return ERROR;
             }
+            request_ring_mark_sent(ring);
+            session_record_sent(r);
+        }
+    } else {
+        // si el server soporta pipelining mando juntas todas las que entren en el buffer,
+        // el resto se manda cuando se terminen de responder estas
+        while ((r = request_ring_unsent_peek(ring)) != NULL && -1 != request_marshall(r, b)) {
+            request_ring_mark_sent(ring);
+            session_record_sent(r);
         }
     }
 
+    if (!buffer_can_read(b) && request_ring_in_flight(ring) == 0) {
+        fprintf(stderr, "Request buffer error");
+        return ERROR;
+    }
+
     ptr = buffer_read_ptr(b, &count);
     n = send(key->fd, ptr, count, MSG_NOSIGNAL);
+    ACCOUNT(key, RECORD_ORIGIN_OUT, ptr, n);
 
     if(n == -1) {
         ret = ERROR;
@@ -971,14 +1914,35 @@ request_close(const unsigned state, struct selector_key *key) {
 ////////////////////////////////////////////////////////////////////////////////
 
 enum pop3_state response_process(struct selector_key *key, struct response_st * d);
+static unsigned response_finished(struct selector_key *key);
+static unsigned response_parse(struct selector_key *key);
+static unsigned internal_parse(struct selector_key *key, enum response_state st, bool error);
+
+/** pasa a atender `request' */
+void set_request(struct selector_key *key, struct pop3_request *request) {
+    struct response_st *d = &ATTACHMENT(key)->orig.response;
 
-void set_request(struct response_st *d, struct pop3_request *request) {
     if (request == NULL) {
         fprintf(stderr, "Request is NULL");
         abort();
     }
     d->request                  = request;
     d->response_parser.request  = request;
+    d->bytes                    = 0;
+
+    config_release(d->config);
+    d->config                   = request->cmd->id == retr ? config_get() : NULL;
+
+    mailbox_view_capture_start(&ATTACHMENT(key)->mailbox, request);
+
+    struct pop3 *p = ATTACHMENT(key);
+    char k[BODY_CACHE_KEY_MAX];
+    body_capture_discard(p->body);
+    p->body = NULL;
+    if (request->cmd->id == retr && pop3_body_cacheable(d->config)
+        && mailbox_view_message_key(&p->mailbox, request->args, k, sizeof(k)) == 0) {
+        p->body = body_capture_start(k);
+    }
 }
 
 void
@@ -988,60 +1952,209 @@ response_init(const unsigned state, struct selector_key *key) {
     d->rb                       = &ATTACHMENT(key)->write_buffer;
     d->wb                       = &ATTACHMENT(key)->super_buffer;
 
-    // desencolo una request
-    set_request(d, queue_remove(ATTACHMENT(key)->session.request_queue));
-    response_parser_init(&d->response_parser);
+    // la primera request en vuelo del anillo, si no se tomo ya en response_finished
+    struct pop3_request *current = request_ring_current(&ATTACHMENT(key)->session.requests);
+    if (d->request != current) {
+        set_request(key, current);
+        response_parser_init(&d->response_parser);
+    }
 }
 
+/**
+ * Ajusta la respuesta a CAPA que se envia al cliente: siempre anuncia
+ * PIPELINING y anuncia STLS solo si el proxy puede negociarlo (`stls'), lo
+ * soporte o no el origin.
+ */
 enum pop3_state
-response_process_capa(struct response_st *d) {
-    // busco pipelinig
-    to_upper(d->response_parser.capa_response);
-    char * capabilities = d->response_parser.capa_response;
-    // siempre pasar la needle en upper case
-    char * needle = "PIPELINING";
-
-    if (strstr(capabilities, needle) != NULL) {
+response_process_capa(struct response_st *d, bool stls) {
+    const char *capabilities = d->response_parser.capa_response;
+    if (capabilities == NULL) {
         return RESPONSE;
     }
+    const size_t capa_length = strlen(capabilities);
 
-    // else
-    size_t capa_length = strlen(capabilities);
-    size_t needle_length = strlen(needle);
-
-    char * eom = "\r\n.\r\n";
-    size_t eom_length = strlen(eom);
+    // capa_response no incluye la linea de estado: en el buffer se reemplaza
+    // solo el final, sin tocar lo anterior (estado y respuestas en pipeline)
+    size_t count;
+    uint8_t *ptr = buffer_read_ptr(d->wb, &count);
+    if (count < capa_length) {
+        // parte de la respuesta ya se envio, queda como la mando el origin
+        return RESPONSE;
+    }
+    const size_t prefix = count - capa_length;
 
-    char * new_capa = calloc(capa_length - 3 + needle_length + eom_length + 1, sizeof(char));
+    char * new_capa = malloc(count + CAPA_REWRITE_EXTRA);
     if (new_capa == NULL) {
         return ERROR;
     }
-    // copio to-do menos los ultimos 3 caracteres
-    memcpy(new_capa, capabilities, capa_length - 3);
-    // agrego la needle
-    memcpy(new_capa + capa_length - 3, needle, needle_length);
-    // agrego eom
-    memcpy(new_capa + capa_length - 3 + needle_length, eom, eom_length);
+    memcpy(new_capa, ptr, prefix);
+    const size_t n = prefix + capa_rewrite(capabilities, stls, new_capa + prefix);
 
-    //printf("--%s--", new_capa);
+    //leer el buffer y copiar la nueva respuesta
+    buffer_reset(d->wb);
+    ptr = buffer_write_ptr(d->wb, &count);
+    if (count < n) {
+        free(new_capa);
+        return ERROR;
+    }
+    memcpy(ptr, new_capa, n);
+    buffer_write_adv(d->wb, n);
+    free(new_capa);
 
-    free(capabilities);
+    return RESPONSE;
+}
 
-    d->response_parser.capa_response = new_capa;
+/**
+ * Procesa los bytes de la respuesta que ya estan en el buffer de lectura del
+ * origin. Se usa tanto al leer del origin como al terminar de escribirle al
+ * cliente: con pipelining el origin puede haber mandado de una vez mas de lo
+ * que entra en el buffer de salida, o varias respuestas seguidas.
+ */
+static unsigned
+response_parse(struct selector_key *key) {
+    struct response_st *d = &ATTACHMENT(key)->orig.response;
+    unsigned  ret      = RESPONSE;
+    bool  error        = false;
+    buffer  *b         = d->rb;
+    const int client_fd = ATTACHMENT(key)->client_fd;
+    const int origin_fd = ATTACHMENT(key)->origin_fd;
 
-    //leer el buffer y copiar la nueva respuesta
-    while (buffer_can_read(d->wb)) {
-        buffer_read(d->wb);
+    // lo que ya estaba en el buffer de salida no es de esta vuelta
+    size_t pending;
+    buffer_read_ptr(d->wb, &pending);
+
+    session_record_first_byte(d->request);
+    enum response_state st = response_consume(b, d->wb, &d->response_parser, &error);
+
+    // se termino de leer la primera linea
+    if (d->response_parser.first_line_done) {
+        d->response_parser.first_line_done = false;
+
+        // si el comando era un retr y se cumplen las condiciones, disparamos la transformacion externa
+        if (st == response_mail && d->request->response->status == response_status_ok
+            && d->request->cmd->id == retr && !d->request->prefetch) {
+            if (d->config->et_activated && d->config->filter_command != NULL) {
+                selector_status ss = SELECTOR_SUCCESS;
+                ss |= selector_set_interest(key->s, client_fd, OP_NOOP);
+                ss |= selector_set_interest(key->s, origin_fd, OP_NOOP);
+
+                // consumimos la primera linea
+                while (buffer_can_read(d->wb)) {
+                    buffer_read(d->wb);
+                }
+
+                return ss == SELECTOR_SUCCESS ? EXTERNAL_TRANSFORMATION : ERROR;
+            }
+        }
+
+        //consumimos el resto de la respuesta
+        st = response_consume(b, d->wb, &d->response_parser, &error);
     }
 
-    uint8_t *ptr1;
-    size_t   count1;
+    if (d->request->prefetch || d->request->warmup || d->request->replay) {
+        return internal_parse(key, st, error);
+    }
+
+    size_t count;
+    uint8_t *ptr = buffer_read_ptr(d->wb, &count);
+    mailbox_view_capture(&ATTACHMENT(key)->mailbox, ptr + pending, count - pending);
+    body_capture_append(ATTACHMENT(key)->body, ptr + pending, count - pending);
+
+    // acumulando la respuesta (ver response_spill) el origin se sigue leyendo.
+    // Si el cliente esta al dia se le envia directo y se acumula lo que no acepte
+    struct spill *spill = &ATTACHMENT(key)->spill;
+    if (spill->active && !spill_pending(spill) && count > 0) {
+        const ssize_t n = client_send(ATTACHMENT(key), ptr, count);
+        ACCOUNT(key, RECORD_CLIENT_OUT, ptr, n);
+        if (n > 0) {
+            buffer_read_adv(d->wb, n);
+            d->bytes += n;
+            metricas->transferred_bytes += n;
+            ptr   += n;
+            count -= n;
+        } else if (n == -1 && !client_would_block(n)) {
+            error = true;
+        }
+    }
+    const bool spilled = spill_append(spill, ptr, count) == 0;
+    if (spilled) {
+        buffer_read_adv(d->wb, count);
+    }
 
-    ptr1 = buffer_write_ptr(d->wb, &count1);
-    strcpy((char *)ptr1, new_capa);
-    buffer_write_adv(d->wb, strlen(new_capa));
+    selector_status ss = SELECTOR_SUCCESS;
+    ss |= selector_set_interest(key->s, origin_fd,
+                                spilled && !response_is_done(st, 0) ? OP_READ : OP_NOOP);
+    ss |= selector_set_interest(key->s, client_fd, OP_WRITE);
+    ret = ss == SELECTOR_SUCCESS ? RESPONSE : ERROR;
+
+    if (ret == RESPONSE && response_is_done(st, 0)) {
+        spill_origin_done(spill);
+        // el origin queda libre aunque el cliente siga recibiendo (ver park_candidate)
+        ATTACHMENT(key)->idle_since = monotonic_usec();
+        log_request (d->request);
+        log_response(d->request->response);
+        mailbox_view_capture_end(&ATTACHMENT(key)->mailbox);
+        body_capture_end(ATTACHMENT(key)->body);
+        ATTACHMENT(key)->body = NULL;
+        if (d->request->cmd->id == capa) {
+            struct pop3 *p = ATTACHMENT(key);
+            response_process_capa(d, tls_enabled() && p->tls == NULL
+                                     && p->session.state == POP3_AUTHORIZATION);
+        }
+    }
 
-    return RESPONSE;
+    return error ? ERROR : ret;
+}
+
+/**
+ * Respuesta a una request que agrego el proxy (un RETR pedido por adelantado,
+ * el precalentamiento del buzon o el login al reanudar una sesion
+ * estacionada): se guarda o se descarta en vez de enviarse al cliente,
+ * consumiendo todo lo que el origin ya mando.
+ */
+static unsigned
+internal_parse(struct selector_key *key, enum response_state st, bool error) {
+    struct response_st *d = &ATTACHMENT(key)->orig.response;
+    struct pop3 *p        = ATTACHMENT(key);
+
+    for (;;) {
+        size_t count;
+        uint8_t *ptr = buffer_read_ptr(d->wb, &count);
+        if (d->request->prefetch) {
+            prefetch_append(&p->prefetch, ptr, count);
+        } else if (d->request->warmup) {
+            metricas->warmup_bytes += count;
+        }
+        mailbox_view_capture(&p->mailbox, ptr, count);
+        body_capture_append(p->body, ptr, count);
+        buffer_read_adv(d->wb, count);
+        if (error || response_is_done(st, 0) || !buffer_can_read(d->rb)) {
+            break;
+        }
+        st = response_consume(d->rb, d->wb, &d->response_parser, &error);
+    }
+    if (error) {
+        return ERROR;
+    }
+    if (response_is_done(st, 0)) {
+        if (d->request->replay && park_replayed(p, d->request) < 0) {
+            const char *msg = "-ERR Unable to log in to the origin server again.\r\n";
+            ACCOUNT(key, RECORD_CLIENT_OUT, msg, client_send(p, msg, strlen(msg)));
+            return ERROR;
+        }
+        if (d->request->prefetch) {
+            prefetch_end(&p->prefetch);
+        }
+        mailbox_view_capture_end(&p->mailbox);
+        body_capture_end(p->body);
+        p->body = NULL;
+        return response_finished(key);
+    }
+
+    selector_status ss = SELECTOR_SUCCESS;
+    ss |= selector_set_interest(key->s, p->client_fd, OP_NOOP);
+    ss |= selector_set_interest(key->s, p->origin_fd, OP_READ);
+    return ss == SELECTOR_SUCCESS ? RESPONSE : ERROR;
 }
 
 /**
@@ -1052,7 +2165,6 @@ static unsigned
 response_read(struct selector_key *key) {
     struct response_st *d = &ATTACHMENT(key)->orig.response;
     unsigned  ret      = RESPONSE;
-    bool  error        = false;
 
     buffer  *b         = d->rb;
     uint8_t *ptr;
@@ -1061,59 +2173,67 @@ response_read(struct selector_key *key) {
 
     ptr = buffer_write_ptr(b, &count);
     n = recv(key->fd, ptr, count, 0);
+    ACCOUNT(key, RECORD_ORIGIN_IN, ptr, n);
 
     if(n > 0 || buffer_can_read(b)) {
-        buffer_write_adv(b, n);
-        enum response_state st = response_consume(b, d->wb, &d->response_parser, &error);
-
-        // se termino de leer la primera linea
-        if (d->response_parser.first_line_done) {
-            d->response_parser.first_line_done = false;
-
-            // si el comando era un retr y se cumplen las condiciones, disparamos la transformacion externa
-            if (st == response_mail && d->request->response->status == response_status_ok
-                && d->request->cmd->id == retr) {
-                if (parameters->et_activated && parameters->filter_command != NULL) {   // TODO pipelining + E.T.
-                    selector_status ss = SELECTOR_SUCCESS;
-                    ss |= selector_set_interest_key(key, OP_NOOP);
-                    ss |= selector_set_interest(key->s, ATTACHMENT(key)->origin_fd, OP_NOOP);
-
-                    // consumimos la primera linea
-                    while (buffer_can_read(d->wb)) {
-                        buffer_read(d->wb);
-                    }
+        if (n > 0) {
+            buffer_write_adv(b, n);
+        }
+        ret = response_parse(key);
+    } else if (n == -1){
+        ret = ERROR;
+    }
 
-                    return ss == SELECTOR_SUCCESS ? EXTERNAL_TRANSFORMATION : ERROR;
-                }
-            }
+    return ret;
+}
 
-            //consumimos el resto de la respuesta
-            st = response_consume(b, d->wb, &d->response_parser, &error);
-        }
+/**
+ * Con spill (ver -x), pasado el primer buffer de un RETR lo que sigue se
+ * acumula: el origin se lee sin esperar a que el cliente reciba lo anterior.
+ */
+static void
+response_spill(struct pop3 *p) {
+    const struct response_st *d = &p->orig.response;
+    if (spill_enabled() && !p->spill.active && d->request->cmd->id == retr
+        && d->request->response != NULL
+        && d->request->response->status == response_status_ok) {
+        spill_start(&p->spill);
+    }
+}
 
-        selector_status ss = SELECTOR_SUCCESS;
-        ss |= selector_set_interest_key(key, OP_NOOP);
-        ss |= selector_set_interest(key->s, ATTACHMENT(key)->client_fd, OP_WRITE);
-        ret = ss == SELECTOR_SUCCESS ? RESPONSE : ERROR;
+/** Envia al cliente lo siguiente de la respuesta acumulada */
+static ssize_t
+spill_send(struct selector_key *key) {
+    struct pop3 *p = ATTACHMENT(key);
+    size_t count;
+    ssize_t n;
 
-        if (ret == RESPONSE && response_is_done(st, 0)) {
-            log_request (d->request);
-            log_response(d->request->response);
-            if (d->request->cmd->id == capa) {
-                response_process_capa(d);
-            }
+    const uint8_t *ptr = spill_mem(&p->spill, &count);
+    if (ptr != NULL) {
+        n = client_send(p, ptr, count);
+        ACCOUNT(key, RECORD_CLIENT_OUT, ptr, n);
+    } else {
+        off_t offset;
+        const int fd = spill_file(&p->spill, &offset, &count);
+        if (count > POP3_SENDFILE_CHUNK) {
+            count = POP3_SENDFILE_CHUNK;
         }
-    } else if (n == -1){
-        ret = ERROR;
+        n = p->tls == NULL ? sendfile(key->fd, fd, &offset, count)
+                           : tls_sendfile(p->tls, fd, &offset, count);
+        ACCOUNT(key, RECORD_CLIENT_OUT, NULL, n);
     }
-
-    return error ? ERROR : ret;
+    if (n > 0) {
+        spill_sent(&p->spill, (size_t) n);
+        metricas->transferred_bytes += n;
+    }
+    return n;
 }
 
-/** Escribe la respuesta en el cliente */
+/** Escribe la respuesta en el cliente, primero lo acumulado si hay */
 static unsigned
 response_write(struct selector_key *key) {
     struct response_st *d = &ATTACHMENT(key)->orig.response;
+    struct spill *spill   = &ATTACHMENT(key)->spill;
 
     enum pop3_state  ret = RESPONSE;
 
@@ -1122,24 +2242,43 @@ response_write(struct selector_key *key) {
     size_t  count;
     ssize_t  n;
 
-    ptr = buffer_read_ptr(b, &count);
-    n = send(key->fd, ptr, count, MSG_NOSIGNAL);
+    const bool spilled = spill_pending(spill);
+    if (spilled) {
+        n = spill_send(key);
+    } else {
+        ptr = buffer_read_ptr(b, &count);
+        n = client_send(ATTACHMENT(key), ptr, count);
+        ACCOUNT(key, RECORD_CLIENT_OUT, ptr, n);
+    }
 
-    if(n == -1) {
+    if(client_would_block(n)) {
+        // se reintenta en el proximo aviso del selector
+    } else if(n == -1) {
         ret = ERROR;
     } else {
-        buffer_read_adv(b, n);
-        if (!buffer_can_read(b)) {
+        if (!spilled) {
+            buffer_read_adv(b, n);
+        }
+        d->bytes += n;
+        if (!spill_pending(spill) && !buffer_can_read(b)) {
             if (d->response_parser.state != response_done) {
-                if (d->request->cmd->id == retr)
+                if (d->request->cmd->id == retr && !spilled)
                     metricas->transferred_bytes += n;
-                selector_status ss = SELECTOR_SUCCESS;
-                ss |= selector_set_interest_key(key, OP_NOOP);
-                ss |= selector_set_interest(key->s, ATTACHMENT(key)->origin_fd, OP_READ);
-                ret = ss == SELECTOR_SUCCESS ? RESPONSE : ERROR;
+                response_spill(ATTACHMENT(key));
+                if (buffer_can_read(d->rb)) {
+                    // el origin ya mando mas de la respuesta
+                    ret = response_parse(key);
+                } else {
+                    selector_status ss = SELECTOR_SUCCESS;
+                    ss |= selector_set_interest_key(key, OP_NOOP);
+                    ss |= selector_set_interest(key->s, ATTACHMENT(key)->origin_fd, OP_READ);
+                    ret = ss == SELECTOR_SUCCESS ? RESPONSE : ERROR;
+                }
             } else {
                 if (d->request->cmd->id == retr)
                     metricas->retrieved_messages++;
+                spill_close(spill);
+                session_record_done(&ATTACHMENT(key)->record, d->request, d->bytes);
                 ret = response_process(key, d);
             }
         }
@@ -1148,21 +2287,91 @@ response_write(struct selector_key *key) {
     return ret;
 }
 
+/** el usuario se autentico: su buzon se busca en la cache por usuario y origin */
+static void
+pop3_mailbox_open(struct pop3 *p) {
+    char origin[strlen(parameters->origin_server) + 8];
+    snprintf(origin, sizeof(origin), "%s:%u", parameters->origin_server,
+             (unsigned) parameters->origin_port);
+    mailbox_view_open(&p->mailbox, p->session.user, origin);
+}
+
+/**
+ * Al autenticarse la sesion, si el cliente no mando nada mas, se piden STAT,
+ * LIST y UIDL al origin mientras el cliente decide que hacer. Las respuestas
+ * no se le envian: solo llenan la cache de listados, desde donde se responden
+ * sus STAT, LIST y UIDL siguientes.
+ */
+static void
+pop3_warmup_issue(struct pop3 *p) {
+    static const enum pop3_cmd_id cmds[] = { stat, list, uidl };
+    struct request_ring *ring = &p->session.requests;
+
+    // el anillo solo tiene el PASS que se esta respondiendo
+    if (!parameters->warmup || !p->session.pipelining || p->mailbox.key == NULL
+        || request_ring_size(ring) != 1 || buffer_can_read(&p->read_buffer)
+        || memory_level() != MEMORY_OK) {
+        return;
+    }
+    for (unsigned i = 0; i < N(cmds) && !request_ring_full(ring); i++) {
+        struct pop3_request *r = request_ring_push(ring, &p->arena, get_cmd_by_id(cmds[i]),
+                                                   NULL);
+        if (r == NULL) {
+            break;
+        }
+        r->warmup = true;
+        metricas->warmup_requests++;
+        p->warmed = true;
+    }
+    if (p->warmed) {
+        metricas->warmup_sessions++;
+    }
+}
+
 enum pop3_state
 response_process(struct selector_key *key, struct response_st * d) {
-    enum pop3_state ret;
-
     switch (d->request->cmd->id) {
         case quit:
             selector_set_interest_key(key, OP_NOOP);
             ATTACHMENT(key)->session.state = POP3_UPDATE;
             return DONE;
         case user:
-            ATTACHMENT(key)->session.user = d->request->args;
+            free(ATTACHMENT(key)->session.user);
+            ATTACHMENT(key)->session.user = NULL;
+            if (d->request->args != NULL) {
+                ATTACHMENT(key)->session.user = malloc(strlen(d->request->args) + 1);
+                if (ATTACHMENT(key)->session.user == NULL) {
+                    return ERROR;
+                }
+                strcpy(ATTACHMENT(key)->session.user, d->request->args);
+            }
             break;
         case pass:
-            if (d->request->response->status == response_status_ok)
+            if (d->request->response->status == response_status_ok) {
+                // para repetirlo al reanudar la sesion si se estaciona (ver -k)
+                if (parameters->park_idle > 0 && d->request->args != NULL) {
+                    struct pop3_session *session = &ATTACHMENT(key)->session;
+                    free(session->password);
+                    session->password = malloc(strlen(d->request->args) + 1);
+                    if (session->password == NULL) {
+                        return ERROR;
+                    }
+                    strcpy(session->password, d->request->args);
+                }
                 ATTACHMENT(key)->session.state = POP3_TRANSACTION;
+                pop3_mailbox_open(ATTACHMENT(key));
+                pop3_warmup_issue(ATTACHMENT(key));
+            }
+            break;
+        case dele:
+            if (d->request->response->status == response_status_ok) {
+                ATTACHMENT(key)->deleted = true;
+            }
+            break;
+        case rset:
+            if (d->request->response->status == response_status_ok) {
+                ATTACHMENT(key)->deleted = false;
+            }
             break;
         case capa:
             break;
@@ -1170,35 +2379,51 @@ response_process(struct selector_key *key, struct response_st * d) {
             break;
     }
 
-    // si quedan mas requests/responses por procesar
-    struct queue *q = ATTACHMENT(key)->session.request_queue;
-    if (!queue_is_empty(q)) {
-        // vuelvo a response_read porque el server soporta pipelining entonces ya le mande to-do y espero respuestas
-        if (ATTACHMENT(key)->session.pipelining) {
-            set_request(d, queue_remove(q));
-            response_parser_init(&d->response_parser);
+    return response_finished(key);
+}
 
-            selector_status ss = SELECTOR_SUCCESS;
-            ss |= selector_set_interest_key(key, OP_NOOP);
-            ss |= selector_set_interest(key->s, ATTACHMENT(key)->origin_fd, OP_READ);
-            ret = ss == SELECTOR_SUCCESS ? RESPONSE : ERROR;
+/**
+ * La request actual se respondio por completo: se libera su lugar en el
+ * anillo y se decide como sigue la sesion. Si hay requests en vuelo se espera
+ * la siguiente respuesta, si hay requests sin enviar se mandan y si no se
+ * procesa lo que el cliente ya haya enviado.
+ */
+static unsigned
+response_finished(struct selector_key *key) {
+    struct response_st  *d    = &ATTACHMENT(key)->orig.response;
+    struct request_ring *ring = &ATTACHMENT(key)->session.requests;
+    const int client_fd       = ATTACHMENT(key)->client_fd;
+    const int origin_fd       = ATTACHMENT(key)->origin_fd;
+
+    request_ring_done(ring, &ATTACHMENT(key)->arena);
+    d->request                 = NULL;
+    d->response_parser.request = NULL;
+
+    selector_status ss = SELECTOR_SUCCESS;
+    if (request_ring_in_flight(ring) > 0) {
+        // el server soporta pipelining: ya le mande la siguiente y espero su respuesta
+        set_request(key, request_ring_current(ring));
+        response_parser_init(&d->response_parser);
+        if (buffer_can_read(d->rb)) {
+            // la respuesta ya llego junto con la anterior: se procesa en
+            // response_write, que corre apenas se pueda escribir al cliente
+            ss |= selector_set_interest(key->s, origin_fd, OP_NOOP);
+            ss |= selector_set_interest(key->s, client_fd, OP_WRITE);
         } else {
-            //vuelvo a request write, hay request encoladas que todavia no se mandaron
-            selector_status ss = SELECTOR_SUCCESS;
-            ss |= selector_set_interest_key(key, OP_NOOP);
-            ss |= selector_set_interest(key->s, ATTACHMENT(key)->origin_fd, OP_WRITE);
-            ret = ss == SELECTOR_SUCCESS ? REQUEST : ERROR;
+            ss |= selector_set_interest(key->s, client_fd, OP_NOOP);
+            ss |= selector_set_interest(key->s, origin_fd, OP_READ);
         }
-
-    } else {
-        // voy a request read
-        selector_status ss = SELECTOR_SUCCESS;
-        ss |= selector_set_interest_key(key, OP_READ);
-        ss |= selector_set_interest(key->s, ATTACHMENT(key)->origin_fd, OP_NOOP);
-        ret = ss == SELECTOR_SUCCESS ? REQUEST : ERROR;
+        return ss == SELECTOR_SUCCESS ? RESPONSE : ERROR;
+    }
+    if (request_ring_unsent(ring) > 0) {
+        ss |= selector_set_interest(key->s, client_fd, OP_NOOP);
+        ss |= selector_set_interest(key->s, origin_fd, OP_WRITE);
+        return ss == SELECTOR_SUCCESS ? REQUEST : ERROR;
     }
 
-    return ret;
+    // no quedan requests vivas, se recupera toda la memoria de la arena
+    arena_reset(&ATTACHMENT(key)->arena);
+    return request_parse(key);
 }
 
 static void
@@ -1214,28 +2439,22 @@ response_close(const unsigned state, struct selector_key *key) {
 enum et_status open_external_transformation(struct selector_key * key, struct pop3_session * session);
 
 /**
- * Return true if the parser finished reading the mail.
+ * Return true if the parser finished reading the mail. `scanned' counts the
+ * bytes after the read pointer that the parser already saw: only the new ones
+ * are fed, even if the reader of the buffer is behind (see mail_consumed).
  */
-bool parse_mail(buffer * b, struct parser * p, size_t * send_bytes){
-    size_t i = 0;
+bool parse_mail(buffer * b, struct parser * p, size_t * scanned, size_t * send_bytes){
     size_t count;
-    uint8_t *rp = buffer_read_ptr(b, &count);
-    uint8_t *wp = buffer_write_ptr(b, &count);
-    while (buffer_can_read(b)) {
-        i++;
-        uint8_t c = buffer_read(b);
-        const struct parser_event *e = parser_feed(p, c);
-        if (e->type == POP3_MULTI_FIN){
-            *send_bytes = i;
-            b->read  = rp;
-            b->write = wp;
-            return true;
-        }
-    }
-    b->read  = rp;
-    b->write = wp;
-    *send_bytes = 0;
-    return false;
+    const uint8_t *ptr = buffer_read_ptr(b, &count);
+    const bool fin     = pop3_multi_scan(p, ptr, count, scanned);
+    *send_bytes = fin ? *scanned : 0;
+    return fin;
+}
+
+/** se consumieron `n' bytes del buffer: el cursor de parse_mail los descuenta */
+static void
+mail_consumed(size_t * scanned, size_t n) {
+    *scanned = n > *scanned ? 0 : *scanned - n;
 }
 
 /**
@@ -1275,6 +2494,8 @@ external_transformation_init(const unsigned state, struct selector_key *key) {
 
     et->send_bytes_write   = 0;
     et->send_bytes_read   = 0;
+    et->scanned_write     = 0;
+    et->scanned_read      = 0;
 
     if (et->parser_read == NULL) {
         et->parser_read = parser_init(parser_no_classes(), pop3_multi_parser());
@@ -1287,6 +2508,8 @@ external_transformation_init(const unsigned state, struct selector_key *key) {
     parser_reset(et->parser_read);
     parser_reset(et->parser_write);
 
+    session_record_filter_start(&ATTACHMENT(key)->record);
+    ATTACHMENT(key)->orig.response.bytes = 0;
     et->status = open_external_transformation(key, &ATTACHMENT(key)->session);
 
     buffer  *b = et->wb;
@@ -1309,12 +2532,25 @@ external_transformation_init(const unsigned state, struct selector_key *key) {
     b = et->rb;
 
     log_request(ATTACHMENT(key)->orig.response.request);
-    if (parse_mail(b, et->parser_read, &et->send_bytes_read)){
+    if (parse_mail(b, et->parser_read, &et->scanned_read, &et->send_bytes_read)){
         et->finish_rd = true;
         // buffer_write_adv(b, et->send_bytes_read);
     }
 }
 
+/**
+ * El mail transformado se termino de entregar al cliente: se cierra la
+ * request y se sigue con la siguiente (ver response_finished).
+ */
+static unsigned
+external_transformation_done(struct selector_key *key) {
+    struct response_st *d = &ATTACHMENT(key)->orig.response;
+
+    log_response(d->request->response);
+    session_record_done(&ATTACHMENT(key)->record, d->request, d->bytes);
+    return response_finished(key);
+}
+
 /** Lee el mail del server */
 static unsigned
 external_transformation_read(struct selector_key *key) {
@@ -1328,30 +2564,22 @@ external_transformation_read(struct selector_key *key) {
 
     ptr = buffer_write_ptr(b, &count);
     n   = recv(*et->origin_fd, ptr, count, 0);
+    ACCOUNT(key, RECORD_ORIGIN_IN, ptr, n);
 
     if(n > 0) {
         buffer_write_adv(b, n);
-        if (parse_mail(b, et->parser_read, &et->send_bytes_read) || n == 0){
+        // lo que llega despues del terminador es de la respuesta siguiente
+        if (et->finish_rd
+            || parse_mail(b, et->parser_read, &et->scanned_read, &et->send_bytes_read)
+            || n == 0){
             if(et->error_rd){
                 buffer_read_adv(b, et->send_bytes_read);
+                mail_consumed(&et->scanned_read, et->send_bytes_read);
             }
             //log_response(ATTACHMENT(key)->orig.response.request->response);
             et->finish_rd = true;
             if (finished_et(et)){
-                struct queue *q = ATTACHMENT(key)->session.request_queue;
-
-                // vamos a response read, todavia hay respuestas por leer
-                if (!queue_is_empty(q)) {
-                    log_response(ATTACHMENT(key)->orig.response.request->response);
-                    selector_set_interest(key->s, *et->client_fd, OP_NOOP);
-                    selector_set_interest(key->s, *et->origin_fd, OP_READ);
-                    ret = RESPONSE;
-                } else {
-                    log_response(ATTACHMENT(key)->orig.response.request->response);
-                    selector_set_interest(key->s, *et->origin_fd, OP_NOOP);
-                    selector_set_interest(key->s, *et->client_fd, OP_READ);
-                    ret = REQUEST;
-                }
+                ret = external_transformation_done(key);
             }else{
                 selector_set_interest(key->s, *et->ext_write_fd, OP_WRITE);
                 selector_set_interest(key->s, *et->origin_fd, OP_NOOP);
@@ -1363,6 +2591,7 @@ external_transformation_read(struct selector_key *key) {
                 selector_set_interest(key->s, *et->origin_fd, OP_NOOP);
             }else{
                 buffer_read_adv(b, n);
+                mail_consumed(&et->scanned_read, n);
             }
         }
     }else if(n == -1){
@@ -1386,6 +2615,7 @@ external_transformation_write(struct selector_key *key) {
     if (et->error_wr && !et->did_write){
         et->write_error = true;
         buffer_reset(b);
+        et->scanned_write = 0;
         ptr = buffer_write_ptr(b, &count);
         char * err_msg = "-ERR could not open external transformation.\r\n";
         sprintf((char *) ptr, "%s", err_msg);
@@ -1404,7 +2634,8 @@ external_transformation_write(struct selector_key *key) {
     if (et->send_bytes_write != 0){
         bytes_sent = et->send_bytes_write;
     }
-    n   = send(*et->client_fd, ptr, bytes_sent, 0);
+    n   = client_send(ATTACHMENT(key), ptr, bytes_sent);
+    ACCOUNT(key, RECORD_CLIENT_OUT, ptr, n);
 
     if(n > 0) {
         if (et->send_bytes_write != 0){
@@ -1413,23 +2644,12 @@ external_transformation_write(struct selector_key *key) {
         }
         et->did_write = true;
         buffer_read_adv(b, n);
+        mail_consumed(&et->scanned_write, n);
         if (et->finish_wr)
             metricas->retrieved_messages++;
         if ((et->error_wr || et->finish_wr) && et->send_bytes_write == 0) {
             if (finished_et(et)) {
-                struct queue *q = ATTACHMENT(key)->session.request_queue;
-                // vamos a response read, todavia hay respuestas por leer
-                if (!queue_is_empty(q)) {
-                    log_response(ATTACHMENT(key)->orig.response.request->response);
-                    selector_set_interest(key->s, *et->client_fd, OP_NOOP);
-                    selector_set_interest(key->s, *et->origin_fd, OP_READ);
-                    ret = RESPONSE;
-                } else {
-                    log_response(ATTACHMENT(key)->orig.response.request->response);
-                    selector_set_interest(key->s, *et->origin_fd, OP_NOOP);
-                    selector_set_interest(key->s, *et->client_fd, OP_READ);
-                    ret = REQUEST;
-                }
+                ret = external_transformation_done(key);
             }else{
                 selector_set_interest(key->s, *et->ext_read_fd, OP_READ);
                 selector_set_interest(key->s, *et->client_fd, OP_NOOP);
@@ -1441,7 +2661,8 @@ external_transformation_write(struct selector_key *key) {
             }
         }
         metricas->transferred_bytes += n;
-    } else if (n == -1){
+        ATTACHMENT(key)->orig.response.bytes += n;
+    } else if (n == -1 && !client_would_block(n)){
         ret = ERROR;
     }
 
@@ -1451,12 +2672,140 @@ external_transformation_write(struct selector_key *key) {
 static void
 external_transformation_close(const unsigned state, struct selector_key *key) {
     struct external_transformation *et  = &ATTACHMENT(key)->et;
+
+    session_record_filter_end(&ATTACHMENT(key)->record);
     selector_unregister_fd(key->s, *et->ext_read_fd);
     close(*et->ext_read_fd);
     selector_unregister_fd(key->s, *et->ext_write_fd);
     close(*et->ext_write_fd);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// CACHED
+////////////////////////////////////////////////////////////////////////////////
+
+/** Envia al cliente la respuesta a RETR desde el archivo de la cache */
+static unsigned
+cached_body_write(struct selector_key *key) {
+    struct pop3 *p         = ATTACHMENT(key);
+    const size_t remaining = p->body_len - (size_t) p->body_offset;
+
+    const size_t chunk     = remaining < POP3_SENDFILE_CHUNK ? remaining : POP3_SENDFILE_CHUNK;
+    ssize_t n;
+
+    // con TLS el kernel cifra lo enviado si tiene kTLS; si no, se cifra aca
+    n = p->tls == NULL ? sendfile(key->fd, p->body_fd, &p->body_offset, chunk)
+                       : tls_sendfile(p->tls, p->body_fd, &p->body_offset, chunk);
+    ACCOUNT(key, RECORD_CLIENT_OUT, NULL, n);
+
+    if (client_would_block(n)) {
+        return CACHED;
+    }
+    if (n <= 0) {
+        // n == 0: el archivo se trunco por fuera del proxy
+        return ERROR;
+    }
+    metricas->transferred_bytes += n;
+    if ((size_t) p->body_offset < p->body_len) {
+        return CACHED;
+    }
+    close(p->body_fd);
+    p->body_fd = -1;
+    metricas->retrieved_messages++;
+    return request_parse(key);
+}
+
+/** Envia al cliente la respuesta a RETR pedida por adelantado */
+static unsigned
+cached_prefetch_write(struct selector_key *key) {
+    struct prefetch *pf = &ATTACHMENT(key)->prefetch;
+    const uint8_t *ptr  = pf->serving + pf->offset;
+    ssize_t n;
+
+    n = client_send(ATTACHMENT(key), ptr, pf->serving_len - pf->offset);
+    ACCOUNT(key, RECORD_CLIENT_OUT, ptr, n);
+
+    if (client_would_block(n)) {
+        return CACHED;
+    }
+    if (n == -1) {
+        return ERROR;
+    }
+    metricas->transferred_bytes += n;
+    pf->offset += n;
+    if (pf->offset < pf->serving_len) {
+        return CACHED;
+    }
+    prefetch_served(pf);
+    metricas->retrieved_messages++;
+    return request_parse(key);
+}
+
+/** Envia al cliente la respuesta tomada de la cache en request_parse */
+static unsigned
+cached_write(struct selector_key *key) {
+    if (ATTACHMENT(key)->body_fd != -1) {
+        return cached_body_write(key);
+    }
+    if (ATTACHMENT(key)->prefetch.serving != NULL) {
+        return cached_prefetch_write(key);
+    }
+    struct mailbox_view *v = &ATTACHMENT(key)->mailbox;
+    const uint8_t *ptr     = v->serving->data + v->offset;
+    ssize_t n;
+
+    n = client_send(ATTACHMENT(key), ptr, v->serving->len - v->offset);
+    ACCOUNT(key, RECORD_CLIENT_OUT, ptr, n);
+
+    if (client_would_block(n)) {
+        return CACHED;
+    }
+    if (n == -1) {
+        return ERROR;
+    }
+    v->offset += n;
+    if (v->offset < v->serving->len) {
+        return CACHED;
+    }
+    mailbox_blob_release(v->serving);
+    v->serving = NULL;
+    // sigue con lo que el cliente ya haya enviado
+    return request_parse(key);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// TLS_HANDSHAKE
+////////////////////////////////////////////////////////////////////////////////
+
+/** Avanza el handshake con el cliente, en lecturas y escrituras */
+static unsigned
+tls_handshake_step(struct selector_key *key) {
+    struct pop3 *p     = ATTACHMENT(key);
+    selector_status ss = SELECTOR_SUCCESS;
+
+    switch (tls_handshake(p->tls)) {
+        case TLS_WANT_READ:
+            ss |= selector_set_interest(key->s, p->client_fd, OP_READ);
+            break;
+        case TLS_WANT_WRITE:
+            ss |= selector_set_interest(key->s, p->client_fd, OP_WRITE);
+            break;
+        case TLS_DONE:
+            if (p->origin_fd == -1) {
+                // POP3S: recien ahora se busca el origin
+                return origin_resolv(key);
+            }
+            // STLS: se sigue atendiendo al cliente, ahora cifrado
+            return request_parse(key);
+        default:
+            return ERROR;
+    }
+    if (p->origin_fd != -1) {
+        ss |= selector_set_interest(key->s, p->origin_fd, OP_NOOP);
+    }
+    return ss == SELECTOR_SUCCESS ? TLS_HANDSHAKE : ERROR;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // EXTERNAL TRANSFORMATION HANDLERS
 ////////////////////////////////////////////////////////////////////////////////
@@ -1478,7 +2827,7 @@ void ext_read(struct selector_key * key) {
         selector_set_interest(key->s, *et->client_fd, OP_WRITE);
     } else if (n >= 0){
         buffer_write_adv(b, n);
-        if (parse_mail(b, et->parser_write, &et->send_bytes_write)){
+        if (parse_mail(b, et->parser_write, &et->scanned_write, &et->send_bytes_write)){
             //log_response(ATTACHMENT(key)->orig.response.request->response);
             selector_unregister_fd(key->s, key->fd);
         }else{
@@ -1505,12 +2854,19 @@ void ext_write(struct selector_key * key){
     if (et->send_bytes_read != 0){
         bytes_sent = et->send_bytes_read;
     }
+    if (bytes_sent == 0){
+        // la primera linea llego sola: se espera el mail del origin
+        selector_set_interest(key->s, *et->ext_write_fd, OP_NOOP);
+        selector_set_interest(key->s, *et->origin_fd, OP_READ);
+        return;
+    }
     n   = write(*et->ext_write_fd, ptr, bytes_sent);
 
     if (n > 0) {
         if (et->send_bytes_read != 0)
             et->send_bytes_read -= n;
         buffer_read_adv(b, n);
+        mail_consumed(&et->scanned_read, n);
         if (et->finish_rd && et->send_bytes_read == 0){
             selector_unregister_fd(key->s, key->fd);
         }else{
@@ -1519,10 +2875,13 @@ void ext_write(struct selector_key * key){
         }
     }else if(n == -1){
         et->status = et_status_err;
-        if (et->send_bytes_read == 0)
+        if (et->send_bytes_read == 0){
             buffer_reset(b);
-        else
+            et->scanned_read = 0;
+        }else{
             buffer_read_adv(b, et->send_bytes_read);
+            mail_consumed(&et->scanned_read, et->send_bytes_read);
+        }
         selector_unregister_fd(key->s, key->fd);
         selector_set_interest(key->s, *et->origin_fd, OP_READ);
         et->error_rd = true;
@@ -1544,11 +2903,13 @@ static const struct fd_handler ext_handler = {
 static const struct state_definition client_statbl[] = {
         {
                 .state            = ORIGIN_RESOLV,
+                .on_read_ready    = early_read,
                 .on_write_ready   = origin_resolv,
                 .on_block_ready   = origin_resolv_done,
         },{
                 .state            = CONNECTING,
                 .on_arrival       = connecting_init,
+                .on_read_ready    = early_read,
                 .on_write_ready   = connecting,
         },{
                 .state            = HELLO,
@@ -1560,6 +2921,7 @@ static const struct state_definition client_statbl[] = {
                 .state            = CAPA,
                 .on_arrival       = capa_init,
                 .on_read_ready    = capa_read,
+                .on_write_ready   = early_write,
         },{
                 .state            = REQUEST,
                 .on_arrival       = request_init,
@@ -1578,6 +2940,13 @@ static const struct state_definition client_statbl[] = {
                 .on_read_ready    = external_transformation_read,
                 .on_write_ready   = external_transformation_write,
                 .on_departure     = external_transformation_close,
+        },{
+                .state            = CACHED,
+                .on_write_ready   = cached_write,
+        },{
+                .state            = TLS_HANDSHAKE,
+                .on_read_ready    = tls_handshake_step,
+                .on_write_ready   = tls_handshake_step,
         },{
                 .state            = DONE,
 
@@ -1598,11 +2967,38 @@ pop3_describe_states(void) {
 static void
 pop3_done(struct selector_key *key);
 
+/** registra el evento atendido en `now' y la transicion (si hubo) a `st' */
+static void
+pop3_trace(struct selector_key *key, uint64_t now, enum trace_event event,
+           enum pop3_state st) {
+    struct pop3 *s = ATTACHMENT(key);
+    const uint64_t in  = s->record.bytes[RECORD_CLIENT_IN]  + s->record.bytes[RECORD_ORIGIN_IN];
+    const uint64_t out = s->record.bytes[RECORD_CLIENT_OUT] + s->record.bytes[RECORD_ORIGIN_OUT];
+    const fd_interest ci = selector_get_interest(key->s, s->client_fd);
+    const fd_interest oi = s->origin_fd == -1 ? OP_NOOP
+                                              : selector_get_interest(key->s, s->origin_fd);
+
+    trace_record(&s->trace, now, event, s->record.state, ci, oi, in, out);
+    if (st != s->record.state) {
+        trace_record(&s->trace, now, TRACE_TRANSITION, st, ci, oi, in, out);
+    }
+    session_record_state(&s->record, st);
+}
+
 static void
 pop3_read(struct selector_key *key) {
+    if (!pop3_budget_available(key) || pop3_backpressure(key)) {
+        return;
+    }
     struct state_machine *stm   = &ATTACHMENT(key)->stm;
+    const uint64_t start        = monotonic_usec();
     const enum pop3_state st    = (enum pop3_state)stm_handler_read(stm, key);
 
+    const uint64_t end          = monotonic_usec();
+
+    ATTACHMENT(key)->budget_usec += end - start;
+
+    pop3_trace(key, end, TRACE_READ, st);
     if(ERROR == st || DONE == st) {
         pop3_done(key);
     }
@@ -1610,9 +3006,18 @@ pop3_read(struct selector_key *key) {
 
 static void
 pop3_write(struct selector_key *key) {
+    if (!pop3_budget_available(key)) {
+        return;
+    }
     struct state_machine *stm   = &ATTACHMENT(key)->stm;
+    const uint64_t start        = monotonic_usec();
     const enum pop3_state st    = (enum pop3_state)stm_handler_write(stm, key);
 
+    const uint64_t end          = monotonic_usec();
+
+    ATTACHMENT(key)->budget_usec += end - start;
+
+    pop3_trace(key, end, TRACE_WRITE, st);
     if(ERROR == st || DONE == st) {
         pop3_done(key);
     }
@@ -1623,6 +3028,7 @@ pop3_block(struct selector_key *key) {
     struct state_machine *stm   = &ATTACHMENT(key)->stm;
     const enum pop3_state st    = (enum pop3_state)stm_handler_block(stm, key);
 
+    pop3_trace(key, monotonic_usec(), TRACE_BLOCK, st);
     if(ERROR == st || DONE == st) {
         pop3_done(key);
     }
@@ -1635,17 +3041,39 @@ pop3_close(struct selector_key *key) {
 
 static void
 pop3_done(struct selector_key *key) {
+    struct pop3 *s  = ATTACHMENT(key);
     const int fds[] = {
             ATTACHMENT(key)->client_fd,
             ATTACHMENT(key)->origin_fd,
     };
 
+    live_remove(s);
+    config_release(s->orig.response.config);
+    s->orig.response.config = NULL;
+    session_record_close(&s->record);
+    log_session(&s->record, pop3_state_names,
+                (const struct sockaddr *) &s->client_addr,
+                s->origin_fd != -1 || s->parked ? (const struct sockaddr *) &s->origin_addr
+                                                : NULL,
+                s->session.user);
+    if (s->parked) {
+        metricas->parked_sessions--;
+    }
+    if (s->resuming) {
+        metricas->resume_failures++;
+    }
+
+    // se conto al aceptarla, llegue o no a conectarse al origin (ver -g)
+    metricas->concurrent_connections--;
     if (ATTACHMENT(key)->origin_fd != -1) {
-        metricas->concurrent_connections--;
         log_connection(false, (const struct sockaddr *) &ATTACHMENT(key)->client_addr,
                        (const struct sockaddr *) &ATTACHMENT(key)->origin_addr);
     }
 
+    // el cierre de TLS se envia antes de cerrar el socket
+    tls_free(s->tls);
+    s->tls = NULL;
+
     for(unsigned i = 0; i < N(fds); i++) {
         if(fds[i] != -1) {
             if(SELECTOR_SUCCESS != selector_unregister_fd(key->s, fds[i])) {
@@ -1657,27 +3085,228 @@ pop3_done(struct selector_key *key) {
 
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// SESIONES VIVAS
+////////////////////////////////////////////////////////////////////////////////
+
+/** cantidad de sesiones por pagina de SESSIONS */
+#define SESSIONS_PAGE   20
+
+static const char *
+interest_name(fd_interest interest) {
+    static const char * const names[] = { "-", "r", "?", "?", "w", "rw" };
+    return interest < N(names) ? names[interest] : "?";
+}
+
+static uint64_t
+session_bytes(const struct pop3 *s) {
+    return s->record.bytes[RECORD_CLIENT_IN] + s->record.bytes[RECORD_CLIENT_OUT];
+}
+
+/** mas bytes primero */
+static int
+cmp_bytes(const void *a, const void *b) {
+    const uint64_t x = session_bytes(*(struct pop3 * const *) a);
+    const uint64_t y = session_bytes(*(struct pop3 * const *) b);
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/** mas viejas primero */
+static int
+cmp_age(const void *a, const void *b) {
+    const uint64_t x = (*(struct pop3 * const *) a)->record.started;
+    const uint64_t y = (*(struct pop3 * const *) b)->record.started;
+    return x < y ? -1 : x > y;
+}
+
+/** comando que se esta atendiendo, si lo hay */
+static const char *
+session_command(struct pop3 *s) {
+    const unsigned st = stm_state(&s->stm);
+    if ((st == RESPONSE || st == EXTERNAL_TRANSFORMATION)
+        && s->orig.response.request != NULL) {
+        return s->orig.response.request->cmd->name;
+    }
+    return "-";
+}
+
+char *
+pop3_sessions_dump(enum pop3_sessions_order order, unsigned page) {
+    struct strbuf b = { 0 };
+    struct pop3 **v = NULL;
+    size_t n = 0;
+
+    for (struct pop3 *s = live; s != NULL; s = s->live_next) {
+        n++;
+    }
+    if (n > 0) {
+        v = malloc(n * sizeof(*v));
+        if (v == NULL) {
+            return NULL;
+        }
+        n = 0;
+        for (struct pop3 *s = live; s != NULL; s = s->live_next) {
+            v[n++] = s;
+        }
+        qsort(v, n, sizeof(*v), order == POP3_SESSIONS_BY_BYTES ? cmp_bytes : cmp_age);
+    }
+
+    const unsigned pages = n == 0 ? 1 : (unsigned) ((n + SESSIONS_PAGE - 1) / SESSIONS_PAGE);
+    if (page == 0) {
+        page = 1;
+    }
+    if (strbuf_printf(&b, "%zu sessions, page %u/%u\n"
+                      "%6s %-16s %-24s %10s %12s %12s %-5s %5s %-3s %-3s %-22s %s\n",
+                      n, page, pages, "id", "user", "state", "age(ms)", "in", "out",
+                      "cmd", "queue", "cli", "ori", "client", "origin") < 0) {
+        goto fail;
+    }
+
+    const uint64_t now = monotonic_usec();
+    char cbuff[SOCKADDR_TO_HUMAN_MIN * 2 + 1];
+    char obuff[SOCKADDR_TO_HUMAN_MIN * 2 + 1];
+    for (size_t i = (size_t) (page - 1) * SESSIONS_PAGE;
+         i < n && i < (size_t) page * SESSIONS_PAGE; i++) {
+        struct pop3 *s = v[i];
+        const fd_interest ci = selector_get_interest(s->s, s->client_fd);
+        fd_interest oi = OP_NOOP;
+
+        sockaddr_to_human(cbuff, sizeof(cbuff), (const struct sockaddr *) &s->client_addr);
+        if (s->origin_fd != -1) {
+            oi = selector_get_interest(s->s, s->origin_fd);
+            sockaddr_to_human(obuff, sizeof(obuff), (const struct sockaddr *) &s->origin_addr);
+        } else {
+            strcpy(obuff, s->parked ? "parked" : "-");
+        }
+        if (strbuf_printf(&b, "%6u %-16s %-24s %10llu %12llu %12llu %-5s %5d %-3s %-3s %-22s %s\n",
+                          s->id, s->session.user == NULL ? "-" : s->session.user,
+                          pop3_state_names[stm_state(&s->stm)],
+                          (unsigned long long) (now - s->record.started) / 1000,
+                          (unsigned long long) s->record.bytes[RECORD_CLIENT_IN],
+                          (unsigned long long) s->record.bytes[RECORD_CLIENT_OUT],
+                          session_command(s), request_ring_size(&s->session.requests),
+                          interest_name(ci), interest_name(oi), cbuff, obuff) < 0) {
+            goto fail;
+        }
+    }
+    free(v);
+    return b.s;
+
+fail:
+    free(v);
+    free(b.s);
+    return NULL;
+}
+
+static struct pop3 *
+live_find(unsigned id) {
+    struct pop3 *s;
+    for (s = live; s != NULL && s->id != id; s = s->live_next) {
+        // buscamos la sesion
+    }
+    return s;
+}
+
+int
+pop3_trace_dump(unsigned id, char **out) {
+    struct pop3 *s = live_find(id);
+    *out = NULL;
+    if (s == NULL) {
+        return -1;
+    }
+
+    struct strbuf b = { 0 };
+    if (trace_dump(&s->trace, s->record.started, pop3_state_names, &b) < 0) {
+        free(b.s);
+        return 0;
+    }
+    *out = b.s;
+    return 0;
+}
+
+/**
+ * cierra la sesion desde afuera de la maquina de estados. Se sale del estado
+ * actual (ej: EXTERNAL_TRANSFORMATION libera los pipes) y se liberan ambos
+ * extremos como si la maquina hubiese llegado a DONE.
+ */
+static int
+pop3_kill_session(struct pop3 *s) {
+    if (stm_state(&s->stm) == ORIGIN_RESOLV) {
+        // hay un hilo resolviendo que todavia referencia la sesion
+        return -1;
+    }
+    struct selector_key key = {
+            .s    = s->s,
+            .fd   = s->client_fd,
+            .data = s,
+    };
+    if (stm_state(&s->stm) == REQUEST) {
+        // solo si no estamos en medio de una respuesta
+        send_error_(s, "-ERR Session closed by administrator.\r\n");
+    }
+    if (s->connecting_fd != -1) {
+        // el socket que conecta al origin tiene su propia referencia
+        const int fd     = s->connecting_fd;
+        s->connecting_fd = -1;
+        if (SELECTOR_SUCCESS != selector_unregister_fd(s->s, fd)) {
+            abort();
+        }
+        close(fd);
+    }
+    stm_handler_close(&s->stm, &key);
+    pop3_done(&key);
+    return 0;
+}
+
+int
+pop3_kill(unsigned id) {
+    struct pop3 *s = live_find(id);
+    if (s == NULL) {
+        return -1;
+    }
+    return pop3_kill_session(s) < 0 ? -2 : 0;
+}
+
+int
+pop3_kill_user(const char *user) {
+    struct pop3 *s, *next;
+    int killed = 0;
+
+    for (s = live; s != NULL; s = next) {
+        // la sesion puede liberarse al cerrarla
+        next = s->live_next;
+        if (s->session.user != NULL && strcmp(s->session.user, user) == 0
+            && pop3_kill_session(s) == 0) {
+            killed++;
+        }
+    }
+    return killed;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // EXTERNAL TRANSFORMATIONS
 ////////////////////////////////////////////////////////////////////////////////
 
 enum et_status
 open_external_transformation(struct selector_key * key, struct pop3_session * session) {
+    // configuracion tomada al comenzar el RETR
+    struct config *config       = ATTACHMENT(key)->orig.response.config;
 
-    char *medias                = get_types_list(parameters->filtered_media_types, ',');
+    const char *medias          = get_types_list(config->filtered_media_types, ',');
+    if (medias == NULL) {
+        return et_status_err;
+    }
 
-    size_t size = 14 + strlen(medias) + 13 + strlen(parameters->replacement_msg) + 23 +
+    size_t size = 14 + strlen(medias) + 13 + strlen(config->replacement_msg) + 23 +
                strlen(parameters->version) + 17 + strlen(session->user) + 15 +
                strlen(parameters->origin_server) + 2 +
-               strlen(parameters->filter_command) + 2;
+               strlen(config->filter_command) + 2;
     char * env_cat = malloc(size);
 
     sprintf(env_cat, "FILTER_MEDIAS=%s FILTER_MSG=\"%s\" "
             "POP3_FILTER_VERSION=\"%s\" POP3_USERNAME=\"%s\" POP3_SERVER=\"%s\" %s ",
-            medias, parameters->replacement_msg, parameters->version, session->user,
-            parameters->origin_server, parameters->filter_command);
-
-    free(medias);
+            medias, config->replacement_msg, parameters->version, session->user,
+            parameters->origin_server, config->filter_command);
 
     pid_t pid;
     char * args[4];
@@ -2,12 +2,83 @@
 #define TPE_PROTOS_POP3_H
 
 #include <netdb.h>
+#include <stdbool.h>
+
 #include "selector.h"
+#include "slab.h"
 
 /** handler del socket pasivo que atiende conexiones pop3 */
 void
 pop3_passive_accept(struct selector_key *key);
 
+/** handler del socket pasivo que atiende conexiones pop3 sobre TLS (POP3S) */
+void
+pop3s_passive_accept(struct selector_key *key);
+
+
+/** orden del listado de sesiones */
+enum pop3_sessions_order {
+    /** mas bytes transferidos con el cliente primero */
+    POP3_SESSIONS_BY_BYTES,
+    /** mas viejas primero */
+    POP3_SESSIONS_BY_AGE,
+};
+
+/**
+ * lista de las sesiones vivas, una por linea, paginada (la primera pagina
+ * es la 1). Retorna un string alocado que debe liberar el llamador, o NULL.
+ */
+char *
+pop3_sessions_dump(enum pop3_sessions_order order, unsigned page);
+
+/**
+ * ultimos eventos de la sesion `id'. Deja en `out' un string alocado que
+ * debe liberar el llamador (NULL si no hay memoria).
+ * Retorna -1 si no existe la sesion.
+ */
+int
+pop3_trace_dump(unsigned id, char **out);
+
+/**
+ * cierra la sesion `id'. Retorna -1 si no existe y -2 si todavia no se puede
+ * cerrar (resolviendo el nombre del origin).
+ */
+int
+pop3_kill(unsigned id);
+
+/** cierra todas las sesiones del usuario. Retorna cuantas se cerraron */
+int
+pop3_kill_user(const char *user);
+
+/** no queda ninguna sesion viva (las que terminaron ya cerraron sus sockets) */
+bool
+pop3_live_empty(void);
+
+/**
+ * vuelve a leer de los origin pausados por contrapresion (ver -b) si el uso
+ * de memoria bajo del umbral blando, o si pasado un segundo sigue arriba. Se
+ * llama en cada iteracion del selector.
+ */
+void
+pop3_backpressure_resume(void);
+
+/**
+ * estaciona las sesiones inactivas (ver -k). Se llama en cada iteracion del
+ * selector y revisa las sesiones una vez por segundo.
+ */
+void
+pop3_park_idle(void);
+
+/**
+ * crea el pool de `struct pop3' con un techo de `max' sesiones, dejando
+ * `prewarm' pre-alocadas. Sin pool las sesiones se alocan con malloc.
+ * Retorna -1 si no hay memoria.
+ */
+int
+pop3_pool_init(unsigned max, unsigned prewarm, bool hugepages);
+
+void
+pop3_pool_stats(struct slab_stats *st);
 
 /** libera pools internos */
 void
@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "pop3_multi.h"
 
 const char *
@@ -114,3 +116,23 @@ const struct parser_definition *
 pop3_multi_parser(void) {
     return &definition;
 }
+
+bool
+pop3_multi_scan(struct parser *p, const uint8_t *data, size_t n, size_t *scanned) {
+    size_t i = *scanned;
+    while (i < n) {
+        const uint8_t c = data[i++];
+        const struct parser_event *e = parser_feed(p, c);
+        if (e->type == POP3_MULTI_FIN) {
+            *scanned = i;
+            return true;
+        }
+        if (e->type == POP3_MULTI_BYTE && c != '\n') {
+            // estado BYTE: solo sale con '\r'
+            const uint8_t *cr = memchr(data + i, '\r', n - i);
+            i = cr == NULL ? n : (size_t) (cr - data);
+        }
+    }
+    *scanned = n;
+    return false;
+}
@@ -1,6 +1,8 @@
 #ifndef POP_MULTI_bf9b63c724e54ba2d17af1709493f755a54975f3
 #define POP_MULTI_bf9b63c724e54ba2d17af1709493f755a54975f3
 
+#include <stdbool.h>
+
 #include "parser.h"
 
 /**
@@ -24,4 +26,14 @@ const struct parser_definition * pop3_multi_parser(void);
 const char *
 pop3_multi_event(enum pop3_multi_type type);
 
+/**
+ * busca el final de la respuesta en `data[*scanned..n)' y deja `*scanned' en
+ * `n', o justo despues del terminador si lo encontro (retorna true). Se puede
+ * volver a llamar con los mismos datos y algunos mas: cada byte pasa por el
+ * parser una sola vez. En medio de una linea solo un '\r' cambia el estado,
+ * y hasta el proximo se saltea con memchr.
+ */
+bool
+pop3_multi_scan(struct parser *p, const uint8_t *data, size_t n, size_t *scanned);
+
 #endif
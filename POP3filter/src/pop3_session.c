@@ -1,17 +1,25 @@
 #include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
 
 #include "pop3_session.h"
 
 void pop3_session_init(struct pop3_session *s, bool pipelining) {
-    memset(s, 0, sizeof(*s));
+    // el anillo no se pone en cero, alcanza con sus posiciones
+    memset(s, 0, offsetof(struct pop3_session, requests));
 
     s->pipelining = pipelining;
     s->state = POP3_AUTHORIZATION;
 
-    s->request_queue = queue_new();
+    request_ring_init(&s->requests);
 }
 
 void pop3_session_close(struct pop3_session *s) {
-    queue_destroy(s->request_queue);
+    // los argumentos de las requests viven en la arena de la sesion
+    request_ring_init(&s->requests);
+    free(s->user);
+    s->user  = NULL;
+    free(s->password);
+    s->password = NULL;
     s->state = POP3_DONE;
 }
\ No newline at end of file
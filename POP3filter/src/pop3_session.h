@@ -3,7 +3,7 @@
 
 #include <stdbool.h>
 
-#include "queue.h"
+#include "request_ring.h"
 
 // estados independientes de la maquina de estados general
 enum pop3_session_state {
@@ -15,7 +15,7 @@ enum pop3_session_state {
 
 // representa una sesion pop3
 struct pop3_session {
-    // long maxima: 40 bytes segun rfc de pop3
+    // long maxima: 40 bytes segun rfc de pop3. Copia propia de la sesion
     char *user;
     char *password;
 
@@ -24,9 +24,13 @@ struct pop3_session {
 
     bool pipelining;
 
-    struct queue * request_queue;
+    // requests parseadas, enviadas y esperando respuesta. Debe ser el ultimo campo
+    struct request_ring requests;
 };
 
 void pop3_session_init(struct pop3_session *s, bool pipelining);
 
+/** libera los recursos de la sesion */
+void pop3_session_close(struct pop3_session *s);
+
 #endif //TPE_PROTOS_POP3_SESSION_H
@@ -0,0 +1,219 @@
+/**
+ * prefetch.c - pedido adelantado de los mensajes de una descarga secuencial
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "prefetch.h"
+#include "memory.h"
+
+#define SLOT(p, i)  (&(p)->slots[((p)->head + (i)) % PREFETCH_MAX_WINDOW])
+
+static unsigned                 max_window = 0;
+static struct prefetch_stats    stats;
+
+void
+prefetch_configure(unsigned max) {
+    max_window = max > PREFETCH_MAX_WINDOW ? PREFETCH_MAX_WINDOW : max;
+}
+
+void
+prefetch_stats(struct prefetch_stats *st) {
+    *st = stats;
+}
+
+void
+prefetch_init(struct prefetch *p) {
+    memset(p, 0, sizeof(*p));
+    p->window = 1;
+}
+
+static void
+slot_release(struct prefetch *p, struct prefetch_slot *s) {
+    memory_release(s->size);
+    p->bytes -= s->size;
+    free(s->data);
+    memset(s, 0, sizeof(*s));
+}
+
+/** descarta lo pedido: lo que sigue en vuelo se tira al llegar */
+static void
+discard(struct prefetch *p) {
+    for (unsigned i = 0; i < p->count; i++) {
+        struct prefetch_slot *s = SLOT(p, i);
+        if (!s->complete) {
+            p->discarding++;
+        }
+        slot_release(p, s);
+    }
+    stats.discarded += p->count;
+    p->head       = 0;
+    p->count      = 0;
+    p->sequential = false;
+    p->window     = p->window > 1 ? p->window / 2 : 1;
+}
+
+void
+prefetch_close(struct prefetch *p) {
+    discard(p);
+    prefetch_served(p);
+}
+
+/** numero de mensaje de RETR o DELE, 0 si no es valido */
+static unsigned long
+message_number(const char *args) {
+    if (args == NULL) {
+        return 0;
+    }
+    char *end;
+    const unsigned long n = strtoul(args, &end, 10);
+    while (*end == ' ') {
+        end++;
+    }
+    return end == args || *end != 0 ? 0 : n;
+}
+
+void
+prefetch_observe(struct prefetch *p, const struct pop3_request *r) {
+    if (r->prefetch) {
+        return;
+    }
+    const unsigned long n = message_number(r->args);
+    switch (r->cmd->id) {
+        case retr:
+            // no se pudo responder desde lo guardado
+            if (p->count > 0) {
+                discard(p);
+            }
+            p->sequential = n != 0 && n == p->last + 1;
+            p->last       = n;
+            break;
+        case dele:
+            for (unsigned i = 0; i < p->count; i++) {
+                if (SLOT(p, i)->message == n) {
+                    discard(p);
+                    break;
+                }
+            }
+            break;
+        case quit:
+            if (p->count > 0) {
+                discard(p);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+unsigned
+prefetch_plan(struct prefetch *p, unsigned long *first) {
+    if (max_window == 0 || !p->sequential || p->count > 0 || p->discarding > 0
+        || memory_level() != MEMORY_OK) {
+        return 0;
+    }
+    *first = p->last + 1;
+    return p->window < max_window ? p->window : max_window;
+}
+
+void
+prefetch_issued(struct prefetch *p, unsigned long message) {
+    if (p->count == PREFETCH_MAX_WINDOW) {
+        return;
+    }
+    struct prefetch_slot *s = SLOT(p, p->count++);
+    memset(s, 0, sizeof(*s));
+    s->message = message;
+    stats.issued++;
+}
+
+/** primera respuesta que todavia esta llegando */
+static struct prefetch_slot *
+receiving(struct prefetch *p) {
+    for (unsigned i = 0; i < p->count; i++) {
+        if (!SLOT(p, i)->complete) {
+            return SLOT(p, i);
+        }
+    }
+    return NULL;
+}
+
+void
+prefetch_append(struct prefetch *p, const uint8_t *data, size_t n) {
+    struct prefetch_slot *s = p->discarding > 0 ? NULL : receiving(p);
+    if (s == NULL || n == 0) {
+        return;
+    }
+    if (s->len + n > s->size) {
+        size_t size = s->size == 0 ? 4096 : s->size;
+        while (size < s->len + n) {
+            size *= 2;
+        }
+        uint8_t *tmp = p->bytes + size - s->size > PREFETCH_BUDGET ? NULL
+                                                                   : realloc(s->data, size);
+        if (tmp == NULL) {
+            stats.overflows++;
+            discard(p);
+            return;
+        }
+        memory_charge(size - s->size);
+        p->bytes += size - s->size;
+        s->data   = tmp;
+        s->size   = size;
+    }
+    memcpy(s->data + s->len, data, n);
+    s->len += n;
+}
+
+void
+prefetch_end(struct prefetch *p) {
+    if (p->discarding > 0) {
+        p->discarding--;
+        return;
+    }
+    struct prefetch_slot *s = receiving(p);
+    if (s != NULL) {
+        s->complete = true;
+    }
+}
+
+bool
+prefetch_take(struct prefetch *p, const struct pop3_request *r) {
+    if (p->count == 0 || r->cmd->id != retr) {
+        return false;
+    }
+    struct prefetch_slot *s = SLOT(p, 0);
+    const unsigned long n   = message_number(r->args);
+    if (!s->complete || s->message != n) {
+        return false;
+    }
+    p->serving      = s->data;
+    p->serving_len  = s->len;
+    p->serving_size = s->size;
+    p->offset       = 0;
+    // sale del presupuesto; la memoria se devuelve en prefetch_served
+    p->bytes       -= s->size;
+    memset(s, 0, sizeof(*s));
+    p->head        = (p->head + 1) % PREFETCH_MAX_WINDOW;
+    p->count--;
+
+    p->last       = n;
+    p->sequential = true;
+    if (p->count == 0 && p->window < max_window) {
+        // el cliente consumio toda la ventana
+        p->window = p->window * 2 > max_window ? max_window : p->window * 2;
+    }
+    stats.hits++;
+    return true;
+}
+
+void
+prefetch_served(struct prefetch *p) {
+    if (p->serving == NULL) {
+        return;
+    }
+    memory_release(p->serving_size);
+    free(p->serving);
+    p->serving      = NULL;
+    p->serving_size = 0;
+}
@@ -0,0 +1,118 @@
+#ifndef TPE_PROTOS_PREFETCH_H
+#define TPE_PROTOS_PREFETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "request.h"
+
+/**
+ * prefetch.c - pedido adelantado de los mensajes de una descarga secuencial.
+ *
+ * Cuando el cliente pide RETR n despues de RETR n-1 y el origin soporta
+ * pipelining, el proxy manda junto con RETR n los RETR de los `window'
+ * mensajes siguientes, como requests propias en el anillo de la sesion. Sus
+ * respuestas se guardan en memoria en vez de enviarse, y si el cliente pide
+ * el siguiente mensaje con el anillo vacio se le responde desde ahi. Al
+ * entregar la ultima respuesta guardada se pide la ventana siguiente.
+ *
+ * La ventana es adaptativa: se duplica cada vez que el cliente consume una
+ * entera (hasta el maximo configurado) y se reduce a la mitad cuando se
+ * descarta. Se descarta lo pedido ante una divergencia (un RETR de otro
+ * mensaje, o del siguiente mientras todavia esta en vuelo; un DELE de un
+ * mensaje pedido; QUIT) y cuando las respuestas superan PREFETCH_BUDGET
+ * bytes. Las respuestas que todavia estan en vuelo se descartan al llegar.
+ *
+ * Solo se usa desde el hilo del selector.
+ */
+
+/** tope de la ventana, sin importar la configuracion */
+#define PREFETCH_MAX_WINDOW     16
+/** memoria maxima de las respuestas guardadas de una sesion */
+#define PREFETCH_BUDGET         (512 * 1024)
+
+struct prefetch_slot {
+    unsigned long   message;
+    uint8_t        *data;
+    size_t          len, size;
+    bool            complete;
+};
+
+/** estado de una sesion */
+struct prefetch {
+    /** ultimo RETR del cliente (0 si ninguno) y si siguio al anterior */
+    unsigned long           last;
+    bool                    sequential;
+    /** mensajes a pedir la proxima vez */
+    unsigned                window;
+
+    /** respuestas pedidas, en el orden del anillo */
+    struct prefetch_slot    slots[PREFETCH_MAX_WINDOW];
+    unsigned                head, count;
+    /** respuestas en vuelo que se descartan al llegar */
+    unsigned                discarding;
+    size_t                  bytes;
+
+    /** respuesta que se esta enviando al cliente */
+    uint8_t                *serving;
+    size_t                  serving_len, serving_size, offset;
+};
+
+struct prefetch_stats {
+    unsigned long   issued;
+    unsigned long   hits;
+    unsigned long   discarded;
+    /** descartes por superar PREFETCH_BUDGET */
+    unsigned long   overflows;
+};
+
+/** ventana maxima. 0 desactiva el prefetch */
+void
+prefetch_configure(unsigned max_window);
+
+void
+prefetch_stats(struct prefetch_stats *st);
+
+void
+prefetch_init(struct prefetch *p);
+
+/** libera lo guardado */
+void
+prefetch_close(struct prefetch *p);
+
+/** `r' del cliente se envia al origin: sigue el patron y detecta divergencias */
+void
+prefetch_observe(struct prefetch *p, const struct pop3_request *r);
+
+/**
+ * cuantos mensajes pedir ahora por adelantado, desde `*first'. 0 si no hay
+ * patron secuencial, quedan pedidos sin consumir o falta memoria
+ */
+unsigned
+prefetch_plan(struct prefetch *p, unsigned long *first);
+
+/** se agrego al anillo el RETR adelantado de `message' */
+void
+prefetch_issued(struct prefetch *p, unsigned long message);
+
+/** bytes de la respuesta adelantada en curso */
+void
+prefetch_append(struct prefetch *p, const uint8_t *data, size_t n);
+
+/** termino la respuesta adelantada en curso */
+void
+prefetch_end(struct prefetch *p);
+
+/**
+ * si `r' es el RETR de la primera respuesta guardada la pasa a `serving'
+ * para enviarla al cliente
+ */
+bool
+prefetch_take(struct prefetch *p, const struct pop3_request *r);
+
+/** termino de enviarse `serving' */
+void
+prefetch_served(struct prefetch *p);
+
+#endif //TPE_PROTOS_PREFETCH_H
@@ -2,10 +2,11 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "request.h"
 
-#define CMD_SIZE	(capa + 1)
+#define CMD_SIZE	(stls + 1)
 
 const struct pop3_request_cmd commands[CMD_SIZE] = {
         {
@@ -60,6 +61,10 @@ const struct pop3_request_cmd commands[CMD_SIZE] = {
                 .id 	= capa,
                 .name 	= "capa",
         },
+        {
+                .id 	= stls,
+                .name 	= "stls",
+        },
 };
 
 const struct pop3_request_cmd invalid_cmd = {
@@ -97,22 +102,37 @@ const struct pop3_request_cmd * get_cmd(const char *cmd) {
     return &invalid_cmd;
 }
 
-struct pop3_request * new_request(const struct pop3_request_cmd * cmd, char * args) {
-    struct pop3_request *r = malloc(sizeof(*r));
-
-    if (r == NULL) {
+const struct pop3_request_cmd * get_cmd_by_id(enum pop3_cmd_id id) {
+    if (id < 0 || (unsigned) id >= N(commands)) {
         return NULL;
     }
+    return &commands[id];
+}
 
+int pop3_request_init(struct pop3_request *r, struct arena *a,
+                      const struct pop3_request_cmd * cmd, const char * args) {
     r->cmd      = cmd;
-    r->args     = args; // args ya fue alocado en el parser. se podria alocar aca tambien
+    r->args     = NULL;
+    if (args != NULL) {
+        r->args = arena_alloc(a, strlen(args) + 1);
+        if (r->args == NULL) {
+            return -1;
+        }
+        strcpy(r->args, args);
+    }
+    r->response = NULL;
+    r->prefetch = false;
+    r->warmup   = false;
+    r->replay   = false;
+    r->sent_at  = r->first_byte_at = 0;
     // la response no se aloca porque son genericas
 
-    return r;
+    return 0;
 }
 
-//TODO usar en algun lado!
-void destroy_request(struct pop3_request *r) {
-    free(r->args);
-    free(r);
+void pop3_request_release(struct pop3_request *r, struct arena *a) {
+    if (r->args != NULL) {
+        arena_free(a, r->args, strlen(r->args) + 1);
+        r->args = NULL;
+    }
 }
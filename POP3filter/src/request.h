@@ -1,7 +1,11 @@
 #ifndef POP3_REQUEST_H_
 #define POP3_REQUEST_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #include "response.h"
+#include "arena.h"
 
 enum pop3_cmd_id {
 
@@ -17,6 +21,9 @@ enum pop3_cmd_id {
 
     /* other */
     quit, capa,
+
+    /* lo atiende el proxy, no se envia al origin (RFC 2595) */
+    stls,
 };
 
 struct pop3_request_cmd {
@@ -29,14 +36,34 @@ struct pop3_request {
     char                            *args;
 
     const struct pop3_response      *response;
+
+    /** RETR pedido por adelantado por el proxy (ver prefetch.h) */
+    bool                            prefetch;
+    /** STAT, LIST o UIDL que pidio el proxy al autenticarse la sesion */
+    bool                            warmup;
+    /** USER o PASS que repite el proxy al reanudar una sesion estacionada */
+    bool                            replay;
+
+    /** marcas de tiempo para `session_record' (0 si no ocurrieron) */
+    uint64_t                        sent_at;
+    uint64_t                        first_byte_at;
 };
 
 
 /** Traduce un string a struct cmd */
 const struct pop3_request_cmd * get_cmd(const char *cmd);
 
-struct pop3_request * new_request(const struct pop3_request_cmd * cmd, char * args);
+/** obtiene el comando a partir de su id, NULL si no es valido */
+const struct pop3_request_cmd * get_cmd_by_id(enum pop3_cmd_id id);
+
+/**
+ * inicializa `r' copiando los argumentos en la arena de la sesion (`a' puede
+ * ser NULL si no hay argumentos). Retorna -1 si no hay memoria.
+ */
+int pop3_request_init(struct pop3_request *r, struct arena *a,
+                      const struct pop3_request_cmd * cmd, const char * args);
 
-void destroy_request(struct pop3_request *r);
+/** libera los argumentos de `r' */
+void pop3_request_release(struct pop3_request *r, struct arena *a);
 
 #endif
\ No newline at end of file
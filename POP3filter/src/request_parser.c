@@ -48,9 +48,9 @@ param(const uint8_t c, struct request_parser* p) {
             aux++;
         }
 
+        // los argumentos quedan en el parser, quien encola la request los copia
         if (count != p->j) {
-            r->args = malloc(strlen(p->param_buffer) + 1);
-            strcpy(r->args, p->param_buffer);
+            r->args = p->param_buffer;
         }
 
         if (c == '\r') {
@@ -0,0 +1,52 @@
+/**
+ * request_ring.c - requests de una sesion pop3
+ */
+#include <string.h>
+
+#include "request_ring.h"
+
+#define SLOT(r, i)  (&(r)->slots[(i) & (REQUEST_RING_SIZE - 1)])
+
+void
+request_ring_init(struct request_ring *r) {
+    r->awaiting = r->sent = r->parsed = 0;
+}
+
+struct pop3_request *
+request_ring_push(struct request_ring *r, struct arena *a,
+                  const struct pop3_request_cmd *cmd, const char *args) {
+    if (request_ring_full(r)) {
+        return NULL;
+    }
+    struct pop3_request *req = SLOT(r, r->parsed);
+    if (pop3_request_init(req, a, cmd, args) < 0) {
+        return NULL;
+    }
+    r->parsed++;
+    return req;
+}
+
+struct pop3_request *
+request_ring_unsent_peek(struct request_ring *r) {
+    return request_ring_unsent(r) == 0 ? NULL : SLOT(r, r->sent);
+}
+
+void
+request_ring_mark_sent(struct request_ring *r) {
+    if (request_ring_unsent(r) > 0) {
+        r->sent++;
+    }
+}
+
+struct pop3_request *
+request_ring_current(struct request_ring *r) {
+    return request_ring_in_flight(r) == 0 ? NULL : SLOT(r, r->awaiting);
+}
+
+void
+request_ring_done(struct request_ring *r, struct arena *a) {
+    if (request_ring_in_flight(r) > 0) {
+        pop3_request_release(SLOT(r, r->awaiting), a);
+        r->awaiting++;
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef TPE_PROTOS_REQUEST_RING_H
+#define TPE_PROTOS_REQUEST_RING_H
+
+#include <stdbool.h>
+
+#include "request.h"
+#include "arena.h"
+
+/**
+ * request_ring.c - requests de una sesion pop3.
+ *
+ * Arreglo circular de tamaño fijo (potencia de 2) con tres posiciones que
+ * solo avanzan:
+ *
+ *   awaiting <= sent <= parsed <= awaiting + REQUEST_RING_SIZE
+ *
+ * [awaiting, sent) son las requests enviadas al origin cuya respuesta todavia
+ * no se entrego por completo al cliente (la primera es la que se esta
+ * respondiendo) y [sent, parsed) las que se parsearon pero todavia no se
+ * enviaron. El tamaño acota la cantidad de comandos en vuelo por sesion:
+ * cuando se llena se deja de leer al cliente.
+ *
+ * Los argumentos de cada request se copian en la arena de la sesion.
+ */
+
+#define REQUEST_RING_SIZE   64
+
+struct request_ring {
+    struct pop3_request slots[REQUEST_RING_SIZE];
+    /** posiciones sin acotar, se usan modulo REQUEST_RING_SIZE */
+    unsigned            awaiting;
+    unsigned            sent;
+    unsigned            parsed;
+};
+
+void
+request_ring_init(struct request_ring *r);
+
+/** requests en el anillo */
+static inline unsigned
+request_ring_size(const struct request_ring *r) {
+    return r->parsed - r->awaiting;
+}
+
+static inline bool
+request_ring_empty(const struct request_ring *r) {
+    return r->parsed == r->awaiting;
+}
+
+static inline bool
+request_ring_full(const struct request_ring *r) {
+    return request_ring_size(r) == REQUEST_RING_SIZE;
+}
+
+/** requests enviadas al origin sin respuesta completa */
+static inline unsigned
+request_ring_in_flight(const struct request_ring *r) {
+    return r->sent - r->awaiting;
+}
+
+/** requests parseadas que todavia no se enviaron */
+static inline unsigned
+request_ring_unsent(const struct request_ring *r) {
+    return r->parsed - r->sent;
+}
+
+/**
+ * agrega una request al final, copiando los argumentos. Retorna NULL si el
+ * anillo esta lleno o no hay memoria.
+ */
+struct pop3_request *
+request_ring_push(struct request_ring *r, struct arena *a,
+                  const struct pop3_request_cmd *cmd, const char *args);
+
+/** primera request sin enviar, NULL si no hay */
+struct pop3_request *
+request_ring_unsent_peek(struct request_ring *r);
+
+/** marca como enviada la primera request sin enviar */
+void
+request_ring_mark_sent(struct request_ring *r);
+
+/** request que se esta respondiendo, NULL si no hay ninguna en vuelo */
+struct pop3_request *
+request_ring_current(struct request_ring *r);
+
+/** la request actual se respondio por completo: libera su lugar */
+void
+request_ring_done(struct request_ring *r, struct arena *a);
+
+#endif //TPE_PROTOS_REQUEST_RING_H
@@ -9,6 +9,7 @@
 
 #include "response_parser.h"
 #include "pop3_multi.h"
+#include "memory.h"
 
 enum response_state
 status(const uint8_t c, struct response_parser* p) {
@@ -116,6 +117,7 @@ pcapa(const uint8_t c, struct response_parser* p) {
             return response_error;
         p->capa_size += BLOCK_SIZE;
         p->capa_response = tmp;
+        memory_charge(BLOCK_SIZE);
     }
 
     p->capa_response[p->j++] = c;
@@ -128,6 +130,7 @@ pcapa(const uint8_t c, struct response_parser* p) {
                     return response_error;
                 p->capa_size++;
                 p->capa_response = tmp;
+                memory_charge(1);
             }
             p->capa_response[p->j] = 0;
             ret = response_done;
@@ -165,6 +168,7 @@ response_parser_init (struct response_parser* p) {
     parser_reset(p->pop3_multi_parser);
 
     if (p->capa_response != NULL) {
+        memory_release(p->capa_size);
         free(p->capa_response);
         p->capa_response = NULL;
     }
@@ -238,4 +242,18 @@ response_consume(buffer *b, buffer *wb, struct response_parser *p, bool *errored
 extern void
 response_parser_close(struct response_parser *p) {
     // nada que hacer
+}
+
+extern void
+response_parser_destroy(struct response_parser *p) {
+    if (p->capa_response != NULL) {
+        memory_release(p->capa_size);
+        free(p->capa_response);
+        p->capa_response = NULL;
+    }
+    p->capa_size = 0;
+    if (p->pop3_multi_parser != NULL) {
+        parser_destroy(p->pop3_multi_parser);
+        p->pop3_multi_parser = NULL;
+    }
 }
\ No newline at end of file
@@ -79,5 +79,9 @@ response_is_done(enum response_state st, bool *errored);
 void
 response_parser_close(struct response_parser *p);
 
+/** libera la respuesta a CAPA y el parser multilinea */
+void
+response_parser_destroy(struct response_parser *p);
+
 
 #endif //TPE_PROTOS_RESPONSE_PARSER_H
@@ -104,6 +104,8 @@ selector_close(void) {
 struct item {
     int                 fd;
     fd_interest         interest;
+    /** no se esperan lecturas aunque el interes las incluya */
+    bool                read_paused;
     const fd_handler   *handler;
     void *              data;
 };
@@ -157,6 +159,10 @@ struct fdselector {
      * notificados.
      */
     struct blocking_job    *resolution_jobs;
+
+    /** iteraciones de selector_select, y fd por el que empieza la siguiente */
+    unsigned long           round;
+    int                     start;
 };
 
 /** cantidad máxima de file descriptors que la plataforma puede manejar */
@@ -226,7 +232,7 @@ items_update_fdset_for_fd(fd_selector s, const struct item * item) {
     FD_CLR(item->fd, &s->master_w);
 
     if(ITEM_USED(item)) {
-        if(item->interest & OP_READ) {
+        if((item->interest & OP_READ) && !item->read_paused) {
             FD_SET(item->fd, &(s->master_r));
         }
 
@@ -357,10 +363,11 @@ selector_register(fd_selector        s,
         ret = SELECTOR_FDINUSE;
         goto finally;
     } else {
-        item->fd       = fd;
-        item->handler  = handler;
-        item->interest = interest;
-        item->data     = data;
+        item->fd          = fd;
+        item->handler     = handler;
+        item->interest    = interest;
+        item->read_paused = false;
+        item->data        = data;
 
         // actualizo colaterales
         if(fd > s->max_fd) {
@@ -441,6 +448,29 @@ selector_set_interest_key(struct selector_key *key, fd_interest i) {
     return ret;
 }
 
+selector_status
+selector_pause_read(fd_selector s, int fd, bool paused) {
+    if(NULL == s || INVALID_FD(fd) || (size_t) fd >= s->fd_size) {
+        return SELECTOR_IARGS;
+    }
+    struct item *item = s->fds + fd;
+    if(!ITEM_USED(item)) {
+        return SELECTOR_IARGS;
+    }
+    item->read_paused = paused;
+    items_update_fdset_for_fd(s, item);
+    return SELECTOR_SUCCESS;
+}
+
+fd_interest
+selector_get_interest(fd_selector s, int fd) {
+    if(NULL == s || INVALID_FD(fd) || (size_t) fd >= s->fd_size) {
+        return OP_NOOP;
+    }
+    struct item *item = s->fds + fd;
+    return ITEM_USED(item) ? item->interest : OP_NOOP;
+}
+
 /**
  * se encarga de manejar los resultados del select.
  * se encuentra separado para facilitar el testing
@@ -452,7 +482,11 @@ handle_iteration(fd_selector s) {
             .s = s,
     };
 
-    for (int i = 0; i <= n; i++) {
+    const int start = s->start > n ? 0 : s->start;
+    s->start = start + 1;
+
+    for (int j = 0; j <= n; j++) {
+        const int i = (start + j) % (n + 1);
         struct item *item = s->fds + i;
         if(ITEM_USED(item)) {
             key.fd   = item->fd;
@@ -540,6 +574,7 @@ selector_select(fd_selector s) {
     memcpy(&s->slave_t, &s->master_t, sizeof(s->slave_t));
 
     s->selector_thread = pthread_self();
+    s->round++;
 
     int fds = pselect(s->max_fd + 1, &s->slave_r, &s->slave_w, 0, &s->slave_t,
                       &emptyset);
@@ -576,6 +611,11 @@ selector_select(fd_selector s) {
     return ret;
 }
 
+unsigned long
+selector_round(fd_selector s) {
+    return s->round;
+}
+
 int
 selector_fd_set_nio(const int fd) {
     int ret = 0;
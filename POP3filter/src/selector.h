@@ -169,14 +169,34 @@ selector_set_interest(fd_selector s, int fd, fd_interest i);
 selector_status
 selector_set_interest_key(struct selector_key *key, fd_interest i);
 
+/**
+ * deja de esperar lecturas en un file descriptor (o vuelve a hacerlo) sin
+ * cambiar sus intereses, que los handlers pueden seguir modificando
+ */
+selector_status
+selector_pause_read(fd_selector s, int fd, bool paused);
+
+/** obtiene los intereses actuales de un file descriptor (OP_NOOP si no está registrado) */
+fd_interest
+selector_get_interest(fd_selector s, int fd);
+
 
 /**
  * se bloquea hasta que hay eventos disponible y los despacha.
  * Retorna luego de cada iteración, o al llegar al timeout.
+ *
+ * Cada iteración recorre los file descriptors listos empezando por uno
+ * distinto (rotando), para no favorecer siempre a los de número más bajo.
+ * Un handler puede no atender un evento (por ejemplo si su sesión ya usó su
+ * cuota de la iteración): como el fd sigue listo se atiende en la siguiente.
  */
 selector_status
 selector_select(fd_selector s);
 
+/** número de la iteración actual de `selector_select' */
+unsigned long
+selector_round(fd_selector s);
+
 /**
  * Método de utilidad que activa O_NONBLOCK en un fd.
  *
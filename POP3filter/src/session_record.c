@@ -0,0 +1,108 @@
+/**
+ * session_record.c - registro compacto de una sesion pop3
+ */
+#include <string.h>
+
+#include "session_record.h"
+#include "utils.h"
+
+void
+session_record_init(struct session_record *r, unsigned initial) {
+    memset(r, 0, sizeof(*r));
+    r->started     = monotonic_usec();
+    r->state       = initial;
+    r->state_since = r->started;
+
+    if (initial < RECORD_MAX_STATES) {
+        r->states[initial].arrivals = 1;
+    }
+}
+
+void
+session_record_state(struct session_record *r, unsigned state) {
+    if (state == r->state || state >= RECORD_MAX_STATES) {
+        return;
+    }
+    const uint64_t now = monotonic_usec();
+
+    if (r->state < RECORD_MAX_STATES) {
+        r->states[r->state].total += now - r->state_since;
+    }
+
+    struct record_state *st = &r->states[state];
+    if (st->arrivals == 0) {
+        st->first_at = now - r->started;
+    }
+    st->arrivals++;
+
+    r->state       = state;
+    r->state_since = now;
+}
+
+void
+session_record_bytes(struct session_record *r, enum record_dir dir, ssize_t n) {
+    if (n > 0 && dir < RECORD_DIRS) {
+        r->bytes[dir] += (uint64_t) n;
+    }
+}
+
+void
+session_record_sent(struct pop3_request *req) {
+    req->sent_at       = monotonic_usec();
+    req->first_byte_at = 0;
+}
+
+void
+session_record_first_byte(struct pop3_request *req) {
+    if (req->sent_at != 0 && req->first_byte_at == 0) {
+        req->first_byte_at = monotonic_usec();
+    }
+}
+
+void
+session_record_done(struct session_record *r, struct pop3_request *req,
+                    uint64_t bytes) {
+    if (req->sent_at == 0 || req->cmd->id < 0 || req->cmd->id >= RECORD_MAX_CMDS) {
+        return;
+    }
+    const uint64_t now  = monotonic_usec();
+    struct record_cmd *c = &r->cmds[req->cmd->id];
+    const uint64_t rtt  = now - req->sent_at;
+
+    c->count++;
+    c->rtt_total += rtt;
+    if (rtt > c->rtt_max) {
+        c->rtt_max = rtt;
+    }
+    if (req->first_byte_at != 0) {
+        c->origin_total += req->first_byte_at - req->sent_at;
+    }
+    c->bytes += bytes;
+
+    // una request se cierra una unica vez
+    req->sent_at = 0;
+}
+
+void
+session_record_filter_start(struct session_record *r) {
+    r->filter_since = monotonic_usec();
+}
+
+void
+session_record_filter_end(struct session_record *r) {
+    if (r->filter_since != 0) {
+        r->filter_total += monotonic_usec() - r->filter_since;
+        r->filter_count++;
+        r->filter_since  = 0;
+    }
+}
+
+void
+session_record_close(struct session_record *r) {
+    const uint64_t now = monotonic_usec();
+    if (r->state < RECORD_MAX_STATES) {
+        r->states[r->state].total += now - r->state_since;
+    }
+    r->state_since = now;
+    session_record_filter_end(r);
+}
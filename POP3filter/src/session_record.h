@@ -0,0 +1,114 @@
+#ifndef TPE_PROTOS_SESSION_RECORD_H
+#define TPE_PROTOS_SESSION_RECORD_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "request.h"
+
+/**
+ * session_record.c - registro compacto de una sesion pop3.
+ *
+ * Cada `struct pop3' acumula durante su vida los tiempos de cada estado de la
+ * maquina general, los tiempos de ida y vuelta de cada comando, los bytes en
+ * cada sentido y el tiempo de pared de las transformaciones externas.
+ * Al terminar la sesion se emite una unica linea JSON (ver `log_session').
+ *
+ * Todos los tiempos son en microsegundos de un reloj monotonico.
+ */
+
+/** cantidad maxima de estados que se registran */
+#define RECORD_MAX_STATES   16
+
+/** cantidad de comandos pop3 distintos (ver `enum pop3_cmd_id') */
+#define RECORD_MAX_CMDS     (capa + 1)
+
+/** sentido de los bytes transferidos */
+enum record_dir {
+    /** cliente -> proxy */
+    RECORD_CLIENT_IN,
+    /** proxy -> cliente */
+    RECORD_CLIENT_OUT,
+    /** origin -> proxy */
+    RECORD_ORIGIN_IN,
+    /** proxy -> origin */
+    RECORD_ORIGIN_OUT,
+
+    RECORD_DIRS,
+};
+
+struct record_state {
+    /** primer arribo al estado, relativo al inicio de la sesion */
+    uint64_t    first_at;
+    /** tiempo total acumulado en el estado */
+    uint64_t    total;
+    /** cantidad de veces que se arribo al estado */
+    unsigned    arrivals;
+};
+
+struct record_cmd {
+    unsigned    count;
+    /** desde que se envio al origin hasta el primer byte de la respuesta */
+    uint64_t    origin_total;
+    /** desde que se envio al origin hasta que el cliente recibio todo */
+    uint64_t    rtt_total;
+    uint64_t    rtt_max;
+    /** bytes de respuesta entregados al cliente */
+    uint64_t    bytes;
+};
+
+struct session_record {
+    /** inicio de la sesion (accept) */
+    uint64_t              started;
+
+    /** estado actual y desde cuando */
+    unsigned              state;
+    uint64_t              state_since;
+
+    struct record_state   states[RECORD_MAX_STATES];
+    struct record_cmd     cmds[RECORD_MAX_CMDS];
+    uint64_t              bytes[RECORD_DIRS];
+
+    /** transformaciones externas */
+    unsigned              filter_count;
+    uint64_t              filter_total;
+    uint64_t              filter_since;
+};
+
+/** inicia el registro en el estado `initial' */
+void
+session_record_init(struct session_record *r, unsigned initial);
+
+/** registra (si hubo) una transicion al estado `state' */
+void
+session_record_state(struct session_record *r, unsigned state);
+
+/** acumula `n' bytes transferidos en el sentido `dir' */
+void
+session_record_bytes(struct session_record *r, enum record_dir dir, ssize_t n);
+
+/** marca el envio de una request al origin */
+void
+session_record_sent(struct pop3_request *req);
+
+/** marca la llegada del primer byte de la respuesta a una request */
+void
+session_record_first_byte(struct pop3_request *req);
+
+/** registra que el cliente recibio la respuesta completa a `req' */
+void
+session_record_done(struct session_record *r, struct pop3_request *req,
+                    uint64_t bytes);
+
+/** inicio y fin de una transformacion externa */
+void
+session_record_filter_start(struct session_record *r);
+
+void
+session_record_filter_end(struct session_record *r);
+
+/** cierra el estado actual para que los acumulados esten completos */
+void
+session_record_close(struct session_record *r);
+
+#endif //TPE_PROTOS_SESSION_RECORD_H
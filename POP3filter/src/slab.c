@@ -0,0 +1,205 @@
+/**
+ * slab.c - alocador de objetos de tamaño fijo en bloques grandes
+ */
+// MAP_ANONYMOUS, MAP_HUGETLB y MAP_POPULATE no son POSIX
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "slab.h"
+
+/** los objetos se alinean a una linea de cache */
+#define SLAB_ALIGN          64
+
+/** objetos por bloque con paginas comunes */
+#define SLAB_CHUNK_OBJECTS  16
+
+/** tamaño de una huge page */
+#define SLAB_HUGEPAGE_SIZE  (2 * 1024 * 1024)
+
+#define ROUND_UP(x, n)      (((x) + (n) - 1) / (n) * (n))
+
+struct slab_chunk {
+    struct slab_chunk   *next;
+    size_t               size;
+    /** primer y ultimo byte de los objetos, para reconocerlos al liberar */
+    uint8_t             *start, *end;
+};
+
+/** un objeto libre guarda el siguiente de la lista en sus primeros bytes */
+struct slab_free {
+    struct slab_free    *next;
+};
+
+struct slab {
+    size_t               size;
+    unsigned             max_objects;
+    bool                 hugepages;
+
+    struct slab_chunk   *chunks;
+    struct slab_free    *free;
+
+    unsigned             capacity;
+    unsigned             free_count;
+    unsigned             overflow;
+    size_t               mapped;
+};
+
+struct slab *
+slab_new(size_t size, unsigned max_objects, bool hugepages) {
+    struct slab *s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->size        = ROUND_UP(size < sizeof(struct slab_free) ? sizeof(struct slab_free) : size,
+                              SLAB_ALIGN);
+    s->max_objects = max_objects;
+    s->hugepages   = hugepages;
+    return s;
+}
+
+/** mapea `size' bytes, con huge pages si se pidieron y hay disponibles */
+static void *
+map(struct slab *s, size_t size, bool populate) {
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS | (populate ? MAP_POPULATE : 0);
+    void *p;
+
+    if (s->hugepages) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            return p;
+        }
+        fprintf(stderr, "Huge pages not available, using regular pages\n");
+        s->hugepages = false;
+    }
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/** agrega un bloque de a lo sumo `n' objetos a la lista de libres */
+static int
+grow(struct slab *s, unsigned n, bool populate) {
+    const size_t page   = s->hugepages ? SLAB_HUGEPAGE_SIZE : (size_t) sysconf(_SC_PAGESIZE);
+    const size_t header = ROUND_UP(sizeof(struct slab_chunk), SLAB_ALIGN);
+    const size_t size   = ROUND_UP(header + s->size * n, page);
+
+    struct slab_chunk *c = map(s, size, populate);
+    if (c == NULL) {
+        return -1;
+    }
+
+    // se aprovecha el resto de la ultima pagina, sin pasar el techo
+    unsigned count = (unsigned) ((size - header) / s->size);
+    if (count > s->max_objects - s->capacity) {
+        count = s->max_objects - s->capacity;
+    }
+
+    c->size  = size;
+    c->start = (uint8_t *) c + header;
+    c->end   = c->start + (size_t) count * s->size;
+    c->next  = s->chunks;
+    s->chunks = c;
+
+    // en orden inverso para que se entreguen de menor a mayor direccion
+    for (unsigned i = count; i > 0; i--) {
+        struct slab_free *f = (struct slab_free *) (c->start + (size_t) (i - 1) * s->size);
+        f->next = s->free;
+        s->free = f;
+    }
+    s->capacity   += count;
+    s->free_count += count;
+    s->mapped     += size;
+    return 0;
+}
+
+int
+slab_reserve(struct slab *s, unsigned n) {
+    if (n > s->max_objects) {
+        n = s->max_objects;
+    }
+    while (s->capacity < n) {
+        if (grow(s, n - s->capacity, true) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void *
+slab_alloc(struct slab *s) {
+    if (s->free == NULL && s->capacity < s->max_objects) {
+        unsigned n = SLAB_CHUNK_OBJECTS;
+        if (s->hugepages) {
+            n = (unsigned) (SLAB_HUGEPAGE_SIZE / s->size);
+        }
+        if (n > s->max_objects - s->capacity) {
+            n = s->max_objects - s->capacity;
+        }
+        grow(s, n, false);
+    }
+
+    struct slab_free *f = s->free;
+    if (f == NULL) {
+        void *p = malloc(s->size);
+        if (p != NULL) {
+            s->overflow++;
+        }
+        return p;
+    }
+    s->free = f->next;
+    s->free_count--;
+    return f;
+}
+
+static bool
+owns(const struct slab *s, const void *p) {
+    const uint8_t *x = p;
+    for (const struct slab_chunk *c = s->chunks; c != NULL; c = c->next) {
+        if (x >= c->start && x < c->end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+slab_free(struct slab *s, void *p) {
+    if (p == NULL) {
+        return;
+    }
+    if (!owns(s, p)) {
+        s->overflow--;
+        free(p);
+        return;
+    }
+    struct slab_free *f = p;
+    f->next = s->free;
+    s->free = f;
+    s->free_count++;
+}
+
+void
+slab_stats(const struct slab *s, struct slab_stats *st) {
+    st->capacity  = s->capacity;
+    st->free      = s->free_count;
+    st->overflow  = s->overflow;
+    st->mapped    = s->mapped;
+    st->hugepages = s->hugepages;
+}
+
+void
+slab_destroy(struct slab *s) {
+    if (s == NULL) {
+        return;
+    }
+    struct slab_chunk *c, *next;
+    for (c = s->chunks; c != NULL; c = next) {
+        next = c->next;
+        munmap(c, c->size);
+    }
+    free(s);
+}
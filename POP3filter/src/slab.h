@@ -0,0 +1,65 @@
+#ifndef TPE_PROTOS_SLAB_H
+#define TPE_PROTOS_SLAB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * slab.c - alocador de objetos de tamaño fijo en bloques grandes.
+ *
+ * Los objetos se cortan de bloques obtenidos con mmap (opcionalmente con
+ * huge pages) y los que se liberan vuelven a una lista LIFO: el proximo
+ * `slab_alloc' entrega el ultimo liberado, que probablemente siga en cache.
+ *
+ * `max_objects' es el techo de objetos que se guardan en bloques; pasado ese
+ * numero se usa malloc/free como si no hubiera pool. Los bloques se conservan
+ * hasta `slab_destroy'.
+ */
+
+struct slab;
+
+struct slab_stats {
+    /** objetos cortados de los bloques */
+    unsigned    capacity;
+    /** objetos libres en la lista */
+    unsigned    free;
+    /** objetos entregados con malloc por haber superado el techo */
+    unsigned    overflow;
+    /** bytes mapeados */
+    size_t      mapped;
+    /** si los bloques usan huge pages */
+    bool        hugepages;
+};
+
+/**
+ * crea un slab de objetos de `size' bytes. Si `hugepages' es verdadero se
+ * intentan usar huge pages, volviendo a paginas comunes si no hay.
+ * Retorna NULL si no hay memoria.
+ */
+struct slab *
+slab_new(size_t size, unsigned max_objects, bool hugepages);
+
+/**
+ * pre-aloca `n' objetos (sin pasar el techo), tocando las paginas para que
+ * las primeras conexiones no paguen los page faults. Retorna -1 si no se
+ * pudo mapear la memoria.
+ */
+int
+slab_reserve(struct slab *s, unsigned n);
+
+/** entrega un objeto sin inicializar. NULL si no hay memoria */
+void *
+slab_alloc(struct slab *s);
+
+/** devuelve un objeto entregado por `slab_alloc' */
+void
+slab_free(struct slab *s, void *p);
+
+void
+slab_stats(const struct slab *s, struct slab_stats *st);
+
+/** libera los bloques. Los objetos entregados dejan de ser validos */
+void
+slab_destroy(struct slab *s);
+
+#endif //TPE_PROTOS_SLAB_H
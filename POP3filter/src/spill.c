@@ -0,0 +1,210 @@
+/**
+ * spill.c - respuestas a RETR acumuladas en memoria y en disco
+ */
+// mkstemp, pwrite
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "spill.h"
+#include "memory.h"
+
+/** primer bloque de memoria de una respuesta */
+#define SPILL_BLOCK     (16 * 1024)
+
+static struct {
+    const char         *dir;
+    size_t              memory;
+    struct spill_stats  stats;
+} spill_cfg;
+
+int
+spill_init(const char *dir, size_t memory, size_t disk) {
+    memset(&spill_cfg, 0, sizeof(spill_cfg));
+    if (dir == NULL) {
+        return 0;
+    }
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    spill_cfg.dir              = dir;
+    spill_cfg.memory           = memory;
+    spill_cfg.stats.disk_limit = disk;
+    return 0;
+}
+
+bool
+spill_enabled(void) {
+    return spill_cfg.dir != NULL;
+}
+
+void
+spill_stats(struct spill_stats *st) {
+    *st = spill_cfg.stats;
+}
+
+void
+spill_start(struct spill *s) {
+    memset(s, 0, sizeof(*s));
+    s->active = true;
+    s->fd     = -1;
+    spill_cfg.stats.responses++;
+}
+
+static void
+disk_release(struct spill *s) {
+    spill_cfg.stats.disk_used -= (size_t) s->file_len;
+    s->file_len  = 0;
+    s->file_sent = 0;
+}
+
+/** archivo temporal ya borrado del directorio, -1 ante error */
+static int
+file_open(void) {
+    char path[strlen(spill_cfg.dir) + sizeof("/spill-XXXXXX")];
+    snprintf(path, sizeof(path), "%s/spill-XXXXXX", spill_cfg.dir);
+    const int fd = mkstemp(path);
+    if (fd != -1) {
+        unlink(path);
+    }
+    return fd;
+}
+
+static int
+mem_append(struct spill *s, const uint8_t *data, size_t n) {
+    if (s->mem_len + n > s->mem_size) {
+        size_t size = s->mem_size == 0 ? SPILL_BLOCK : s->mem_size;
+        while (size < s->mem_len + n) {
+            size *= 2;
+        }
+        if (size > spill_cfg.memory) {
+            size = spill_cfg.memory;
+        }
+        uint8_t *tmp = realloc(s->mem, size);
+        if (tmp == NULL) {
+            return -1;
+        }
+        memory_charge(size - s->mem_size);
+        s->mem      = tmp;
+        s->mem_size = size;
+    }
+    memcpy(s->mem + s->mem_len, data, n);
+    s->mem_len += n;
+    spill_cfg.stats.mem_bytes += n;
+    return 0;
+}
+
+static int
+file_append(struct spill *s, const uint8_t *data, size_t n) {
+    struct spill_stats *st = &spill_cfg.stats;
+    if (st->disk_used + n > st->disk_limit) {
+        return -1;
+    }
+    if (s->fd == -1) {
+        if ((s->fd = file_open()) == -1) {
+            return -1;
+        }
+        st->to_disk++;
+    }
+    for (size_t done = 0; done < n; ) {
+        const ssize_t w = pwrite(s->fd, data + done, n - done, s->file_len + (off_t) done);
+        if (w <= 0) {
+            // lo escrito a medias no se cuenta: se pisa en el proximo intento
+            return -1;
+        }
+        done += (size_t) w;
+    }
+    s->file_len  += (off_t) n;
+    st->disk_used += n;
+    st->disk_bytes += n;
+    if (st->disk_used > st->disk_peak) {
+        st->disk_peak = st->disk_used;
+    }
+    return 0;
+}
+
+int
+spill_append(struct spill *s, const uint8_t *data, size_t n) {
+    if (!s->active || s->full) {
+        return -1;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    // a memoria solo mientras no haya nada en el archivo, para no desordenar
+    const int ret = s->file_len == 0 && s->mem_len + n <= spill_cfg.memory
+                    ? mem_append(s, data, n) : file_append(s, data, n);
+    if (ret < 0) {
+        s->full = true;
+        spill_cfg.stats.refused++;
+    }
+    return ret;
+}
+
+bool
+spill_pending(const struct spill *s) {
+    return s->active && (s->mem_sent < s->mem_len || s->file_sent < s->file_len);
+}
+
+const uint8_t *
+spill_mem(struct spill *s, size_t *n) {
+    *n = s->mem_len - s->mem_sent;
+    return *n == 0 ? NULL : s->mem + s->mem_sent;
+}
+
+int
+spill_file(struct spill *s, off_t *offset, size_t *n) {
+    *offset = s->file_sent;
+    *n      = (size_t) (s->file_len - s->file_sent);
+    return s->fd;
+}
+
+void
+spill_sent(struct spill *s, size_t n) {
+    if (s->mem_sent < s->mem_len) {
+        s->mem_sent += n;
+    } else {
+        s->file_sent += (off_t) n;
+    }
+    if (spill_pending(s)) {
+        return;
+    }
+    // se envio todo: lo que siga entra de nuevo desde el principio
+    s->mem_len  = 0;
+    s->mem_sent = 0;
+    if (s->file_len > 0 && ftruncate(s->fd, 0) == 0) {
+        disk_release(s);
+    }
+}
+
+void
+spill_origin_done(const struct spill *s) {
+    size_t mem;
+    off_t file;
+    if (!spill_pending(s)) {
+        return;
+    }
+    mem  = s->mem_len - s->mem_sent;
+    file = s->file_len - s->file_sent;
+    spill_cfg.stats.origin_first++;
+    spill_cfg.stats.origin_ahead += mem + (size_t) file;
+}
+
+void
+spill_close(struct spill *s) {
+    if (!s->active) {
+        return;
+    }
+    memory_release(s->mem_size);
+    free(s->mem);
+    if (s->fd != -1) {
+        disk_release(s);
+        close(s->fd);
+    }
+    memset(s, 0, sizeof(*s));
+}
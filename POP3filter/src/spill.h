@@ -0,0 +1,110 @@
+#ifndef TPE_PROTOS_SPILL_H
+#define TPE_PROTOS_SPILL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * spill.c - respuestas a RETR leidas del origin mas rapido de lo que el
+ * cliente las recibe.
+ *
+ * Sin spill el proxy lee del origin al ritmo en que el cliente vacia el
+ * buffer de salida, y con un cliente lento el origin queda ocupado durante
+ * toda la descarga. Con spill, pasado el primer buffer de un RETR lo que
+ * sigue de la respuesta se lee del origin sin esperar al cliente y se acumula
+ * aca: en memoria hasta el umbral por sesion y despues en un archivo temporal
+ * (ya borrado) del directorio configurado, desde el que se envia con
+ * sendfile. Con un cliente rapido lo acumulado se envia enseguida y la
+ * memoria se reusa desde el principio.
+ *
+ * Leer por adelantado no cierra la conexion con el origin: la sesion la
+ * conserva hasta que el cliente recibe todo, salvo que se estacione (ver -k)
+ * al terminar el origin la respuesta.
+ *
+ * Los archivos descuentan de un presupuesto global de disco. Si no alcanza,
+ * spill_append rechaza los bytes y la sesion vuelve a leer del origin al
+ * ritmo del cliente. Las escrituras al archivo son sincronicas, pero van al
+ * page cache. Solo se usa desde el hilo del selector.
+ */
+
+/** lo acumulado de una respuesta, en el orden en que se envia */
+struct spill {
+    bool            active;
+    /** se rechazo algo: no se acumula mas en esta respuesta */
+    bool            full;
+    /** primero lo de memoria y despues lo del archivo */
+    uint8_t        *mem;
+    size_t          mem_len, mem_size, mem_sent;
+    /** -1 mientras no haya archivo */
+    int             fd;
+    off_t           file_len, file_sent;
+};
+
+struct spill_stats {
+    /** respuestas que se acumularon y las que pasaron al disco */
+    unsigned long   responses;
+    unsigned long   to_disk;
+    unsigned long long mem_bytes;
+    unsigned long long disk_bytes;
+    /** bytes en disco ahora, el maximo y el presupuesto */
+    size_t          disk_used, disk_peak, disk_limit;
+    /** veces que no alcanzo el presupuesto (o fallo el archivo) */
+    unsigned long   refused;
+    /**
+     * respuestas que el origin termino de mandar antes que el cliente de
+     * recibir y los bytes que le faltaban al cliente en ese momento. No
+     * implica que se haya liberado la conexion con el origin
+     */
+    unsigned long   origin_first;
+    unsigned long long origin_ahead;
+};
+
+/**
+ * `dir' es el directorio de los archivos temporales (NULL desactiva el
+ * spill), `memory' los bytes por sesion en memoria y `disk' el presupuesto
+ * total de los archivos.
+ */
+int
+spill_init(const char *dir, size_t memory, size_t disk);
+
+bool
+spill_enabled(void);
+
+void
+spill_stats(struct spill_stats *st);
+
+/** empieza a acumular una respuesta */
+void
+spill_start(struct spill *s);
+
+/** agrega bytes al final. -1 si no hay lugar: no se agrega nada */
+int
+spill_append(struct spill *s, const uint8_t *data, size_t n);
+
+/** queda algo sin enviar */
+bool
+spill_pending(const struct spill *s);
+
+/** bytes de memoria a enviar ahora, NULL si lo siguiente esta en el archivo */
+const uint8_t *
+spill_mem(struct spill *s, size_t *n);
+
+/** lo siguiente a enviar desde el archivo: retorna su fd, desde donde y cuanto */
+int
+spill_file(struct spill *s, off_t *offset, size_t *n);
+
+/** se enviaron `n' bytes de lo que indico spill_mem o spill_file */
+void
+spill_sent(struct spill *s, size_t n);
+
+/** el origin termino la respuesta */
+void
+spill_origin_done(const struct spill *s);
+
+/** libera lo acumulado; se puede llamar aunque no este activo */
+void
+spill_close(struct spill *s);
+
+#endif //TPE_PROTOS_SPILL_H
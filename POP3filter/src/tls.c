@@ -0,0 +1,208 @@
+/**
+ * tls.c - TLS del lado del cliente (POP3S y STLS)
+ */
+// pread
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "tls.h"
+
+/** lectura de `tls_sendfile' cuando el kernel no cifra: un registro TLS */
+#define TLS_FILE_CHUNK  (16 * 1024)
+
+struct tls {
+    SSL    *ssl;
+};
+
+static SSL_CTX             *ctx = NULL;
+static struct tls_stats     stats;
+
+int
+tls_init(const char *cert, const char *key) {
+    if (cert == NULL) {
+        return 0;
+    }
+    ctx = SSL_CTX_new(TLS_server_method());
+    if (ctx == NULL) {
+        goto fail;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    // kTLS si el kernel lo soporta; sin renegociacion no hay escrituras dentro de SSL_read
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION);
+    // los buffers se reintentan con lo que quede pendiente, que puede haberse movido
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE
+                          | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
+                          | SSL_MODE_RELEASE_BUFFERS);
+    // tickets para retomar sesiones (TLS 1.3) y cache de sesiones (TLS 1.2)
+    SSL_CTX_set_num_tickets(ctx, 2);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    static const unsigned char sid_ctx[] = "pop3filter";
+    SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert) != 1
+        || SSL_CTX_use_PrivateKey_file(ctx, key == NULL ? cert : key, SSL_FILETYPE_PEM) != 1
+        || SSL_CTX_check_private_key(ctx) != 1) {
+        goto fail;
+    }
+    return 0;
+
+fail:
+    ERR_print_errors_fp(stderr);
+    tls_destroy();
+    return -1;
+}
+
+void
+tls_destroy(void) {
+    SSL_CTX_free(ctx);
+    ctx = NULL;
+}
+
+bool
+tls_enabled(void) {
+    return ctx != NULL;
+}
+
+void
+tls_stats(struct tls_stats *st) {
+    *st = stats;
+}
+
+struct tls *
+tls_new(int fd) {
+    struct tls *t = malloc(sizeof(*t));
+    if (t == NULL) {
+        return NULL;
+    }
+    t->ssl = SSL_new(ctx);
+    if (t->ssl == NULL || SSL_set_fd(t->ssl, fd) != 1) {
+        SSL_free(t->ssl);
+        free(t);
+        return NULL;
+    }
+    SSL_set_accept_state(t->ssl);
+    return t;
+}
+
+void
+tls_free(struct tls *t) {
+    if (t == NULL) {
+        return;
+    }
+    if (SSL_is_init_finished(t->ssl)) {
+        // close_notify sin esperar la respuesta del cliente
+        ERR_clear_error();
+        SSL_shutdown(t->ssl);
+    }
+    SSL_free(t->ssl);
+    free(t);
+}
+
+enum tls_status
+tls_handshake(struct tls *t) {
+    ERR_clear_error();
+    const int ret = SSL_do_handshake(t->ssl);
+    if (ret == 1) {
+        stats.handshakes++;
+        if (SSL_session_reused(t->ssl)) {
+            stats.resumed++;
+        }
+        if (BIO_get_ktls_send(SSL_get_wbio(t->ssl))) {
+            stats.ktls_send++;
+        }
+        if (BIO_get_ktls_recv(SSL_get_rbio(t->ssl))) {
+            stats.ktls_recv++;
+        }
+        return TLS_DONE;
+    }
+    switch (SSL_get_error(t->ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+            return TLS_WANT_READ;
+        case SSL_ERROR_WANT_WRITE:
+            return TLS_WANT_WRITE;
+        default:
+            stats.failures++;
+            return TLS_ERROR;
+    }
+}
+
+/** traduce el resultado de una operacion de OpenSSL a la convencion de recv/send */
+static ssize_t
+io_result(struct tls *t, int ret) {
+    if (ret > 0) {
+        return ret;
+    }
+    switch (SSL_get_error(t->ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        case SSL_ERROR_SYSCALL:
+            if (errno == 0) {
+                errno = ECONNRESET;
+            }
+            return -1;
+        default:
+            errno = EPROTO;
+            return -1;
+    }
+}
+
+ssize_t
+tls_recv(struct tls *t, void *buf, size_t n) {
+    ERR_clear_error();
+    errno = 0;
+    return io_result(t, SSL_read(t->ssl, buf, n > INT_MAX ? INT_MAX : (int) n));
+}
+
+ssize_t
+tls_send(struct tls *t, const void *buf, size_t n) {
+    if (n == 0) {
+        // SSL_write con 0 bytes falla; send(2) retorna 0
+        return 0;
+    }
+    ERR_clear_error();
+    errno = 0;
+    return io_result(t, SSL_write(t->ssl, buf, n > INT_MAX ? INT_MAX : (int) n));
+}
+
+ssize_t
+tls_sendfile(struct tls *t, int fd, off_t *offset, size_t n) {
+    ssize_t ret;
+
+    ERR_clear_error();
+    errno = 0;
+    if (BIO_get_ktls_send(SSL_get_wbio(t->ssl))) {
+        ret = SSL_sendfile(t->ssl, fd, *offset, n, 0);
+        if (ret < 0) {
+            ret = io_result(t, (int) ret);
+        }
+    } else {
+        // el archivo no cambia: si hay que reintentar se vuelve a leer lo mismo
+        uint8_t buf[TLS_FILE_CHUNK];
+        ret = pread(fd, buf, n < sizeof(buf) ? n : sizeof(buf), *offset);
+        if (ret > 0) {
+            ret = io_result(t, SSL_write(t->ssl, buf, (int) ret));
+        }
+    }
+    if (ret > 0) {
+        *offset += ret;
+    }
+    return ret;
+}
+
+size_t
+tls_pending(const struct tls *t) {
+    return t == NULL ? 0 : (size_t) SSL_pending(t->ssl);
+}
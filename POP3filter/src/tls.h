@@ -0,0 +1,89 @@
+#ifndef TPE_PROTOS_TLS_H
+#define TPE_PROTOS_TLS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * tls.c - TLS del lado del cliente: POP3S (TLS implicito en un puerto
+ * aparte) y STLS (RFC 2595) sobre la misma conexion.
+ *
+ * Se usa OpenSSL con sockets no bloqueantes: las operaciones que no pueden
+ * completarse sin esperar al socket fallan con EAGAIN (o retornan
+ * TLS_WANT_READ/TLS_WANT_WRITE en el handshake), y se reintentan cuando el
+ * selector avisa.
+ *
+ * Si el kernel lo soporta, terminado el handshake OpenSSL pasa el cifrado de
+ * registros al kernel (kTLS) y `tls_sendfile' envia los archivos de la cache
+ * con sendfile sin copiarlos al proceso. Si no, se leen y se cifran en
+ * espacio de usuario. Los clientes pueden retomar sesiones anteriores con
+ * tickets (RFC 5077 / TLS 1.3), sin repetir el intercambio de claves.
+ *
+ * Solo se usa desde el hilo del selector.
+ */
+
+struct tls;
+
+enum tls_status {
+    TLS_DONE,
+    TLS_WANT_READ,
+    TLS_WANT_WRITE,
+    TLS_ERROR,
+};
+
+struct tls_stats {
+    unsigned long   handshakes;
+    /** handshakes que retomaron una sesion anterior */
+    unsigned long   resumed;
+    unsigned long   failures;
+    /** conexiones que cifran en el kernel al enviar y al recibir */
+    unsigned long   ktls_send;
+    unsigned long   ktls_recv;
+};
+
+/**
+ * carga el certificado y la clave (PEM). `cert' NULL desactiva TLS.
+ * Retorna -1 ante error.
+ */
+int
+tls_init(const char *cert, const char *key);
+
+void
+tls_destroy(void);
+
+bool
+tls_enabled(void);
+
+void
+tls_stats(struct tls_stats *st);
+
+/** conexion TLS (como servidor) sobre `fd'. NULL si no hay memoria */
+struct tls *
+tls_new(int fd);
+
+/** envia el cierre (sin esperar) y libera. Acepta NULL */
+void
+tls_free(struct tls *t);
+
+/** avanza el handshake */
+enum tls_status
+tls_handshake(struct tls *t);
+
+/** como recv(2): 0 si el cliente cerro, -1 con errno EAGAIN si hay que esperar */
+ssize_t
+tls_recv(struct tls *t, void *buf, size_t n);
+
+/** como send(2) */
+ssize_t
+tls_send(struct tls *t, const void *buf, size_t n);
+
+/** como sendfile(2): envia hasta `n' bytes de `fd' desde `*offset' */
+ssize_t
+tls_sendfile(struct tls *t, int fd, off_t *offset, size_t n);
+
+/** bytes ya descifrados que el selector no va a avisar */
+size_t
+tls_pending(const struct tls *t);
+
+#endif //TPE_PROTOS_TLS_H
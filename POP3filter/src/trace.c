@@ -0,0 +1,46 @@
+/**
+ * trace.c - anillo de eventos por conexion
+ */
+#include "trace.h"
+
+static const char *
+event_name(unsigned event) {
+    switch (event) {
+        case TRACE_READ:        return "read";
+        case TRACE_WRITE:       return "write";
+        case TRACE_BLOCK:       return "block";
+        case TRACE_TRANSITION:  return "->";
+        default:                return "?";
+    }
+}
+
+static const char *
+interest_name(unsigned interest) {
+    static const char * const names[] = { "-", "r", "?", "?", "w", "rw" };
+    return interest < sizeof(names) / sizeof(*names) ? names[interest] : "?";
+}
+
+int
+trace_dump(const struct trace_ring *t, uint64_t started,
+           const char * const *state_names, struct strbuf *b) {
+    const unsigned n     = t->count < TRACE_SIZE ? t->count : TRACE_SIZE;
+    const unsigned first = t->count - n;
+
+    if (strbuf_printf(b, "%u events\n%12s %-6s %-24s %3s %3s %12s %12s\n", t->count,
+                      "t(ms)", "event", "state", "cli", "ori", "in", "out") < 0) {
+        return -1;
+    }
+    for (unsigned i = first; i < t->count; i++) {
+        const struct trace_entry *e = &t->entries[i & (TRACE_SIZE - 1)];
+        const double ms = (double)(e->ts - started) / 1e3;
+        if (strbuf_printf(b, "%12.3f %-6s %-24s %3s %3s %12llu %12llu\n", ms,
+                          event_name(e->event), state_names[e->state],
+                          interest_name(e->client_interest),
+                          interest_name(e->origin_interest),
+                          (unsigned long long) e->bytes_in,
+                          (unsigned long long) e->bytes_out) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef TPE_PROTOS_TRACE_H
+#define TPE_PROTOS_TRACE_H
+
+#include <stdint.h>
+
+#include "utils.h"
+
+/**
+ * trace.c - anillo de eventos por conexion.
+ *
+ * Cada `struct pop3' tiene un anillo de tamaño fijo donde se registra cada
+ * llamada a un handler y cada transicion de la maquina de estados, junto con
+ * los intereses de ambos extremos y los bytes transferidos hasta el momento.
+ *
+ * Registrar un evento no aloca memoria ni lee el reloj: el instante lo pasa
+ * quien lo registra, que ya lo tomo de `monotonic_usec' para medir el
+ * handler, y se pisan los eventos mas viejos.
+ */
+
+/** cantidad de eventos que se conservan (potencia de 2) */
+#define TRACE_SIZE  64
+
+enum trace_event {
+    TRACE_READ,
+    TRACE_WRITE,
+    TRACE_BLOCK,
+    TRACE_TRANSITION,
+};
+
+struct trace_entry {
+    /** microsegundos de monotonic_usec */
+    uint64_t    ts;
+    uint64_t    bytes_in;
+    uint64_t    bytes_out;
+    uint8_t     event;
+    uint8_t     state;
+    uint8_t     client_interest;
+    uint8_t     origin_interest;
+};
+
+struct trace_ring {
+    struct trace_entry  entries[TRACE_SIZE];
+    /** cantidad total de eventos registrados */
+    unsigned            count;
+};
+
+static inline void
+trace_record(struct trace_ring *t, uint64_t ts, enum trace_event event, unsigned state,
+             unsigned client_interest, unsigned origin_interest,
+             uint64_t bytes_in, uint64_t bytes_out) {
+    struct trace_entry *e = &t->entries[t->count++ & (TRACE_SIZE - 1)];
+    e->ts              = ts;
+    e->bytes_in        = bytes_in;
+    e->bytes_out       = bytes_out;
+    e->event           = (uint8_t) event;
+    e->state           = (uint8_t) state;
+    e->client_interest = (uint8_t) client_interest;
+    e->origin_interest = (uint8_t) origin_interest;
+}
+
+/**
+ * vuelca el anillo en `b', del evento mas viejo al mas nuevo, con tiempos
+ * relativos a `started' (de monotonic_usec, anterior al primer evento).
+ * `state_names' traduce los estados.
+ */
+int
+trace_dump(const struct trace_ring *t, uint64_t started,
+           const char * const *state_names, struct strbuf *b);
+
+#endif //TPE_PROTOS_TRACE_H
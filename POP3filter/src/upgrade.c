@@ -0,0 +1,265 @@
+/**
+ * upgrade.c - actualizacion en caliente: pasaje de los sockets pasivos
+ */
+// CMSG_SPACE
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "upgrade.h"
+#include "parameters.h"
+#include "body_cache.h"
+
+/** cuanto espera la instancia nueva los sockets de la vieja */
+#define TAKEOVER_TIMEOUT    10
+
+static struct {
+    const char *path;
+    /** socket Unix donde se atiende a la instancia siguiente */
+    int         listener;
+    /** conexion con la otra instancia mientras no se confirme el pasaje */
+    int         peer;
+    int         fds[UPGRADE_SOCKETS];
+    bool        draining;
+} up = {
+    .listener = -1,
+    .peer     = -1,
+    .fds      = { -1, -1, -1 },
+};
+
+static void handoff(struct selector_key *key);
+static void confirm_read(struct selector_key *key);
+
+static const struct fd_handler listener_handler = {
+    .handle_read  = handoff,
+};
+
+static const struct fd_handler peer_handler = {
+    .handle_read  = confirm_read,
+};
+
+static int
+unix_addr(const char *path, struct sockaddr_un *addr) {
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int
+upgrade_takeover(const char *path, int fds[UPGRADE_SOCKETS]) {
+    for (unsigned i = 0; i < UPGRADE_SOCKETS; i++) {
+        fds[i] = -1;
+    }
+    struct sockaddr_un addr;
+    if (path == NULL || unix_addr(path, &addr) < 0) {
+        return -1;
+    }
+    const int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    const struct timeval timeout = { .tv_sec = TAKEOVER_TIMEOUT };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        // no hay instancia corriendo (o quedo el archivo de una que murio)
+        close(sock);
+        return -1;
+    }
+
+    uint8_t roles[UPGRADE_SOCKETS];
+    union {
+        struct cmsghdr  header;
+        char            buf[CMSG_SPACE(sizeof(int) * UPGRADE_SOCKETS)];
+    } control;
+    struct iovec iov = {
+        .iov_base = roles,
+        .iov_len  = sizeof(roles),
+    };
+    struct msghdr msg = {
+        .msg_iov        = &iov,
+        .msg_iovlen     = 1,
+        .msg_control    = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    const ssize_t n = recvmsg(sock, &msg, 0);
+    struct cmsghdr *c = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (c == NULL || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) {
+        close(sock);
+        return -1;
+    }
+    const size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int received[UPGRADE_SOCKETS];
+    memcpy(received, CMSG_DATA(c), count * sizeof(int));
+    for (size_t i = 0; i < count; i++) {
+        if (i < (size_t) n && roles[i] < UPGRADE_SOCKETS && fds[roles[i]] == -1) {
+            fds[roles[i]] = received[i];
+        } else {
+            close(received[i]);
+        }
+    }
+    // se confirma en upgrade_listen, con los sockets ya en el selector
+    up.peer = sock;
+    return 0;
+}
+
+int
+upgrade_adopt(int fd, const struct addrinfo *addr) {
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_storage local;
+    socklen_t len = sizeof(local);
+    if (addr != NULL && getsockname(fd, (struct sockaddr *) &local, &len) == 0
+        && len == addr->ai_addrlen && memcmp(&local, addr->ai_addr, len) == 0) {
+        return fd;
+    }
+    close(fd);
+    return -1;
+}
+
+int
+upgrade_listen(fd_selector s, const char *path, const int fds[UPGRADE_SOCKETS]) {
+    if (up.peer >= 0) {
+        const char ok = '1';
+        send(up.peer, &ok, sizeof(ok), 0);
+        close(up.peer);
+        up.peer = -1;
+    }
+    struct sockaddr_un addr;
+    if (path == NULL) {
+        return 0;
+    }
+    if (unix_addr(path, &addr) < 0) {
+        return -1;
+    }
+    memcpy(up.fds, fds, sizeof(up.fds));
+    up.path     = path;
+    up.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (up.listener < 0) {
+        return -1;
+    }
+    // el archivo puede ser de la instancia anterior, que ya no lo usa
+    unlink(path);
+    if (bind(up.listener, (struct sockaddr *) &addr, sizeof(addr)) < 0
+        || listen(up.listener, 1) < 0
+        || selector_fd_set_nio(up.listener) == -1
+        || selector_register(s, up.listener, &listener_handler, OP_READ, NULL)
+           != SELECTOR_SUCCESS) {
+        close(up.listener);
+        up.listener = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/** una instancia nueva pide los sockets */
+static void
+handoff(struct selector_key *key) {
+    const int peer = accept(key->fd, NULL, NULL);
+    if (peer < 0) {
+        return;
+    }
+    if (up.peer >= 0) {
+        // ya hay un pasaje en curso
+        close(peer);
+        return;
+    }
+    // la instancia nueva la abre al recibir los sockets
+    body_cache_destroy();
+
+    uint8_t roles[UPGRADE_SOCKETS];
+    union {
+        struct cmsghdr  header;
+        char            buf[CMSG_SPACE(sizeof(int) * UPGRADE_SOCKETS)];
+    } control;
+    memset(&control, 0, sizeof(control));
+    size_t n = 0;
+    for (unsigned i = 0; i < UPGRADE_SOCKETS; i++) {
+        if (up.fds[i] >= 0) {
+            memcpy(CMSG_DATA(&control.header) + n * sizeof(int), &up.fds[i], sizeof(int));
+            roles[n++] = (uint8_t) i;
+        }
+    }
+    struct iovec iov = {
+        .iov_base = roles,
+        .iov_len  = n,
+    };
+    struct msghdr msg = {
+        .msg_iov        = &iov,
+        .msg_iovlen     = 1,
+        .msg_control    = control.buf,
+        .msg_controllen = CMSG_SPACE(n * sizeof(int)),
+    };
+    control.header.cmsg_level = SOL_SOCKET;
+    control.header.cmsg_type  = SCM_RIGHTS;
+    control.header.cmsg_len   = CMSG_LEN(n * sizeof(int));
+
+    if (sendmsg(peer, &msg, 0) != (ssize_t) n || selector_fd_set_nio(peer) == -1
+        || selector_register(key->s, peer, &peer_handler, OP_READ, NULL) != SELECTOR_SUCCESS) {
+        close(peer);
+        body_cache_init(parameters->body_cache_dir, (size_t) parameters->body_cache << 20);
+        return;
+    }
+    up.peer = peer;
+}
+
+/** la instancia nueva confirma que atiende, o murio antes de hacerlo */
+static void
+confirm_read(struct selector_key *key) {
+    char ok;
+    const ssize_t n = recv(key->fd, &ok, sizeof(ok), 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    selector_unregister_fd(key->s, key->fd);
+    close(key->fd);
+    up.peer = -1;
+    if (n != 1) {
+        // se sigue atendiendo como antes del pedido
+        body_cache_init(parameters->body_cache_dir, (size_t) parameters->body_cache << 20);
+        return;
+    }
+    for (unsigned i = 0; i < UPGRADE_SOCKETS; i++) {
+        if (up.fds[i] >= 0) {
+            selector_unregister_fd(key->s, up.fds[i]);
+            close(up.fds[i]);
+            up.fds[i] = -1;
+        }
+    }
+    // el archivo ya es de la instancia nueva
+    selector_unregister_fd(key->s, up.listener);
+    close(up.listener);
+    up.listener = -1;
+    up.draining = true;
+    printf("Listening sockets handed off, draining the remaining sessions\n");
+    fflush(stdout);
+}
+
+bool
+upgrade_draining(void) {
+    return up.draining;
+}
+
+void
+upgrade_close(void) {
+    if (up.peer >= 0) {
+        close(up.peer);
+        up.peer = -1;
+    }
+    if (up.listener >= 0) {
+        close(up.listener);
+        up.listener = -1;
+        unlink(up.path);
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef TPE_PROTOS_UPGRADE_H
+#define TPE_PROTOS_UPGRADE_H
+
+#include <stdbool.h>
+#include <netdb.h>
+
+#include "selector.h"
+
+/**
+ * upgrade.c - actualizacion en caliente del proxy.
+ *
+ * Con -u el proxy atiende en un socket Unix a la instancia que lo va a
+ * reemplazar. La instancia nueva (otro binario u otras opciones, con el mismo
+ * -u) se conecta al arrancar y recibe los sockets pasivos POP3, POP3S y de
+ * management con SCM_RIGHTS:
+ *
+ *      nueva                       vieja
+ *        connect       ------>     accept, cierra la cache de RETR
+ *                      <------     [roles: 1 byte por socket] + sockets
+ *        inicializa y
+ *        registra los sockets
+ *        "1"           ------>     deja de aceptar y cierra sus sockets
+ *
+ * Mientras la nueva se inicializa los dos procesos aceptan del mismo socket,
+ * y las conexiones que esperan en la cola de listen no se pierden. Si la nueva
+ * muere antes de confirmar, la vieja reabre la cache y sigue como estaba.
+ * Despues de confirmar, la vieja termina las sesiones que tiene (sin cortarlas)
+ * y sale.
+ *
+ * La cache de RETR en disco no se comparte: la vieja la cierra antes de pasar
+ * los sockets, esperando sus escrituras, y la nueva la abre despues.
+ */
+
+enum upgrade_socket {
+    UPGRADE_POP3,
+    UPGRADE_POP3S,
+    UPGRADE_MANAGEMENT,
+    UPGRADE_SOCKETS,
+};
+
+/**
+ * pide los sockets pasivos a la instancia que atiende en `path'. Deja en
+ * `fds' los recibidos, -1 los que no vinieron. Sin instancia corriendo
+ * retorna -1 y se arranca como siempre.
+ */
+int
+upgrade_takeover(const char *path, int fds[UPGRADE_SOCKETS]);
+
+/**
+ * socket pasivo recibido si escucha en `addr', si no lo cierra (cambio la
+ * direccion o el puerto). Retorna -1 si hay que crearlo de nuevo.
+ */
+int
+upgrade_adopt(int fd, const struct addrinfo *addr);
+
+/**
+ * confirma a la instancia vieja que se tomaron los sockets y empieza a
+ * atender en `path' a la siguiente. `fds' son los sockets pasivos propios
+ * (-1 los que no hay). Retorna -1 ante error.
+ */
+int
+upgrade_listen(fd_selector s, const char *path, const int fds[UPGRADE_SOCKETS]);
+
+/** se entregaron los sockets: solo quedan las sesiones que ya estaban */
+bool
+upgrade_draining(void);
+
+/** cierra el socket Unix (y lo borra si no lo tomo otra instancia) */
+void
+upgrade_close(void);
+
+#endif //TPE_PROTOS_UPGRADE_H
@@ -1,8 +1,13 @@
 #include <stdbool.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <errno.h>
 
 #include <unistd.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 
@@ -54,6 +59,46 @@ sockaddr_to_human(char *buff, const size_t buffsize,
     return buff;
 }
 
+uint64_t
+monotonic_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+int
+mkdir_private(const char *dir) {
+    return mkdir(dir, 0700) < 0 && errno != EEXIST ? -1 : 0;
+}
+
+int
+strbuf_printf(struct strbuf *b, const char *fmt, ...) {
+    va_list ap;
+    for (;;) {
+        size_t  avail = b->size - b->len;
+        va_start(ap, fmt);
+        int n = vsnprintf(b->s == NULL ? NULL : b->s + b->len, avail, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            return -1;
+        }
+        if ((size_t) n < avail) {
+            b->len += n;
+            return n;
+        }
+        size_t size = b->size == 0 ? 256 : b->size;
+        while (size <= b->len + (size_t) n) {
+            size *= 2;
+        }
+        char *tmp = realloc(b->s, size);
+        if (tmp == NULL) {
+            return -1;
+        }
+        b->s    = tmp;
+        b->size = size;
+    }
+}
+
 //void print_connection_status(const char * msg, struct sockaddr_storage addr) {
 //    char hoststr[NI_MAXHOST];
 //    char portstr[NI_MAXSERV];
@@ -1,6 +1,10 @@
 #ifndef TPE_PROTOS_UTILS_H
 #define TPE_PROTOS_UTILS_H
 
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
 #define SOCKADDR_TO_HUMAN_MIN (INET6_ADDRSTRLEN + 5 + 1)
 
 /**
@@ -18,6 +22,27 @@ const char *
 sockaddr_to_human(char *buff, const size_t buffsize,
                   const struct sockaddr *addr);
 
+/** microsegundos de un reloj monotonico, util para medir intervalos */
+uint64_t
+monotonic_usec(void);
+
+/** crea el directorio `dir', solo para el usuario, si no existe. -1 ante error */
+int
+mkdir_private(const char *dir);
+
+/** string que crece a demanda, util para armar respuestas de management */
+struct strbuf {
+    char   *s;
+    size_t  len, size;
+};
+
+/**
+ * agrega al final de `b' el texto formateado. Retorna -1 si no hay memoria,
+ * en cuyo caso `b' conserva lo escrito hasta el momento.
+ */
+int
+strbuf_printf(struct strbuf *b, const char *fmt, ...);
+
 // void print_connection_status(const char * msg, struct sockaddr_storage addr);
 
 #endif //TPE_PROTOS_UTILS_H
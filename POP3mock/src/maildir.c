@@ -0,0 +1,251 @@
+/**
+ * maildir.c - carga en memoria los mails que sirve pop3mock.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "maildir.h"
+
+#define UID_SIZE    70
+
+/** archivo a cargar: directorio y nombre */
+struct entry {
+    char    *path;
+    char    *name;
+};
+
+struct entries {
+    struct entry *v;
+    size_t        n, size;
+};
+
+static char *
+copy_string(const char *s) {
+    const size_t n = strlen(s) + 1;
+    char *ret = malloc(n);
+    if (ret != NULL) {
+        memcpy(ret, s, n);
+    }
+    return ret;
+}
+
+static int
+is_dir(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/** agrega a `e' los archivos regulares de `dir'. Retorna -1 ante error */
+static int
+list_dir(struct entries *e, const char *dir) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return -1;
+    }
+    int ret = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        char *path = malloc(strlen(dir) + strlen(de->d_name) + 2);
+        if (path == NULL) {
+            ret = -1;
+            break;
+        }
+        sprintf(path, "%s/%s", dir, de->d_name);
+
+        struct stat st;
+        if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+        if (e->n == e->size) {
+            const size_t size = e->size == 0 ? 16 : e->size * 2;
+            struct entry *tmp = realloc(e->v, size * sizeof(*tmp));
+            if (tmp == NULL) {
+                free(path);
+                ret = -1;
+                break;
+            }
+            e->v    = tmp;
+            e->size = size;
+        }
+        e->v[e->n].path = path;
+        e->v[e->n].name = path + strlen(dir) + 1;
+        e->n++;
+    }
+    closedir(d);
+    return ret;
+}
+
+static int
+cmp_entry(const void *a, const void *b) {
+    return strcmp(((const struct entry *) a)->name, ((const struct entry *) b)->name);
+}
+
+/**
+ * pasa `raw' al formato en el que se envia: CRLF al final de cada linea y
+ * un punto extra adelante de las lineas que empiezan con punto
+ */
+static int
+mail_wire(struct mail *m, const uint8_t *raw, size_t n) {
+    // en el peor caso cada linea es "." sin CR
+    uint8_t *out = malloc(n * 2 + 3);
+    if (out == NULL) {
+        return -1;
+    }
+    size_t len = 0, size = 0;
+    bool   header = true;
+
+    m->body = 0;
+    for (size_t i = 0; i < n; ) {
+        const uint8_t *nl = memchr(raw + i, '\n', n - i);
+        size_t end  = nl == NULL ? n : (size_t)(nl - raw);
+        size_t next = nl == NULL ? n : end + 1;
+        if (end > i && raw[end - 1] == '\r') {
+            end--;
+        }
+        const size_t line = end - i;
+
+        if (line > 0 && raw[i] == '.') {
+            out[len++] = '.';
+        }
+        memcpy(out + len, raw + i, line);
+        len += line;
+        out[len++] = '\r';
+        out[len++] = '\n';
+        size += line + 2;
+
+        if (header && line == 0) {
+            header  = false;
+            m->body = len;
+        }
+        i = next;
+    }
+    if (header) {
+        m->body = len;
+    }
+    m->data = out;
+    m->len  = len;
+    m->size = size;
+    return 0;
+}
+
+static int
+mail_load(struct mail *m, const struct entry *e) {
+    FILE *f = fopen(e->path, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+    struct stat st;
+    uint8_t *raw = NULL;
+    int ret = -1;
+
+    if (fstat(fileno(f), &st) < 0) {
+        goto finally;
+    }
+    raw = malloc(st.st_size + 1);
+    if (raw == NULL || fread(raw, 1, st.st_size, f) != (size_t) st.st_size) {
+        goto finally;
+    }
+    if (mail_wire(m, raw, st.st_size) < 0) {
+        goto finally;
+    }
+
+    char uid[UID_SIZE + 1];
+    size_t i;
+    for (i = 0; i < UID_SIZE && e->name[i] != 0 && e->name[i] != ':'; i++) {
+        // UIDL solo admite caracteres entre 0x21 y 0x7E
+        const char c = e->name[i];
+        uid[i] = c > 0x20 && c < 0x7F ? c : '_';
+    }
+    uid[i] = 0;
+    m->uid = copy_string(uid);
+    if (m->uid == NULL) {
+        free(m->data);
+        goto finally;
+    }
+    ret = 0;
+
+finally:
+    free(raw);
+    fclose(f);
+    return ret;
+}
+
+int
+maildir_load(struct maildir *md, const char *path) {
+    struct entries e = { NULL, 0, 0 };
+    int ret = -1;
+
+    memset(md, 0, sizeof(*md));
+
+    char *cur = malloc(strlen(path) + 5), *new = malloc(strlen(path) + 5);
+    if (cur == NULL || new == NULL) {
+        goto finally;
+    }
+    sprintf(cur, "%s/cur", path);
+    sprintf(new, "%s/new", path);
+
+    if (is_dir(cur) || is_dir(new)) {
+        if ((is_dir(new) && list_dir(&e, new) < 0)
+            || (is_dir(cur) && list_dir(&e, cur) < 0)) {
+            goto finally;
+        }
+    } else if (list_dir(&e, path) < 0) {
+        goto finally;
+    }
+
+    qsort(e.v, e.n, sizeof(*e.v), cmp_entry);
+
+    md->mails = calloc(e.n == 0 ? 1 : e.n, sizeof(*md->mails));
+    if (md->mails == NULL) {
+        goto finally;
+    }
+    for (size_t i = 0; i < e.n; i++) {
+        if (mail_load(&md->mails[md->count], &e.v[i]) < 0) {
+            fprintf(stderr, "%s: %s\n", e.v[i].path, strerror(errno));
+            continue;
+        }
+        md->count++;
+    }
+    ret = 0;
+
+finally:
+    for (size_t i = 0; i < e.n; i++) {
+        free(e.v[i].path);
+    }
+    free(e.v);
+    free(cur);
+    free(new);
+    if (ret < 0) {
+        maildir_free(md);
+    }
+    return ret;
+}
+
+size_t
+maildir_top(const struct mail *m, unsigned long lines) {
+    size_t i = m->body;
+    for (; lines > 0 && i < m->len; lines--) {
+        const uint8_t *nl = memchr(m->data + i, '\n', m->len - i);
+        i = nl == NULL ? m->len : (size_t)(nl - m->data) + 1;
+    }
+    return i;
+}
+
+void
+maildir_free(struct maildir *md) {
+    for (size_t i = 0; md->mails != NULL && i < md->count; i++) {
+        free(md->mails[i].uid);
+        free(md->mails[i].data);
+    }
+    free(md->mails);
+    memset(md, 0, sizeof(*md));
+}
@@ -0,0 +1,50 @@
+#ifndef POP3MOCK_MAILDIR_H
+#define POP3MOCK_MAILDIR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * maildir.c - carga en memoria los mails que sirve pop3mock.
+ *
+ * Si el directorio tiene los subdirectorios `new' y/o `cur' se toma como un
+ * maildir y se leen sus archivos; si no, se lee cada archivo regular del
+ * directorio. Los mails se ordenan por nombre para que la numeracion sea
+ * estable entre corridas.
+ *
+ * Cada mail se guarda ya listo para enviar: lineas terminadas en CRLF y con
+ * byte-stuffing, sin el ".\r\n" final.
+ */
+
+struct mail {
+    /** identificador para UIDL: el nombre del archivo hasta el ':' */
+    char       *uid;
+    /** contenido listo para enviar */
+    uint8_t    *data;
+    size_t      len;
+    /** tamaño en octetos que informan LIST y STAT (sin byte-stuffing) */
+    size_t      size;
+    /** offset del cuerpo (despues de la linea en blanco) */
+    size_t      body;
+};
+
+struct maildir {
+    struct mail *mails;
+    size_t       count;
+};
+
+/** carga los mails de `path'. Retorna -1 ante error, dejando errno */
+int
+maildir_load(struct maildir *md, const char *path);
+
+/**
+ * cantidad de bytes de `m' a enviar en un TOP: los headers, la linea en
+ * blanco y las primeras `lines' lineas del cuerpo
+ */
+size_t
+maildir_top(const struct mail *m, unsigned long lines);
+
+void
+maildir_free(struct maildir *md);
+
+#endif //POP3MOCK_MAILDIR_H
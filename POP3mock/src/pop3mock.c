@@ -0,0 +1,951 @@
+/**
+ * pop3mock.c - servidor pop3 de prueba para benchmarks y pruebas del proxy.
+ *
+ * Sirve a cualquier usuario los mails de un directorio (ver maildir.c) en un
+ * unico hilo no bloqueante, con el mismo selector y buffers que pop3filter.
+ * Permite simular origins lentos o que fallan:
+ *
+ *  - latencia por comando antes de responder
+ *  - RTT de red: cada respuesta sale un tiempo fijo despues de que llego su
+ *    comando, sin sumarse entre los comandos que llegan juntos (pipelining)
+ *  - limite de ancho de banda por conexion (token bucket)
+ *  - saludo demorado
+ *  - resets (RST) y conexiones que dejan de responder, con una probabilidad
+ *    por comando y una semilla para que las corridas sean reproducibles
+ *
+ * Los DELE se recuerdan solo durante la sesion: los archivos no se tocan.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+#include "selector.h"
+#include "buffer.h"
+#include "utils.h"
+#include "maildir.h"
+
+#define BUFFER_SIZE         4096
+/** largo maximo de un comando, incluyendo el CRLF (RFC 1939 pide 255) */
+#define MAX_LINE            512
+#define PENDING_CONNECTIONS 128
+/** resolucion de los temporizadores cuando hay demoras configuradas */
+#define TIMER_RESOLUTION_NS (1000 * 1000)
+/** comandos sin atender cuya llegada se recuerda para el RTT */
+#define ARRIVALS            64
+/** rafaga maxima del token bucket, en fraccion de segundo */
+#define BANDWIDTH_BURST     20
+
+enum mock_cmd {
+    CMD_USER,
+    CMD_PASS,
+    CMD_STAT,
+    CMD_LIST,
+    CMD_UIDL,
+    CMD_RETR,
+    CMD_TOP,
+    CMD_DELE,
+    CMD_NOOP,
+    CMD_RSET,
+    CMD_QUIT,
+    CMD_CAPA,
+    CMD_UNKNOWN,
+};
+
+static const char *cmd_names[] = {
+    "USER", "PASS", "STAT", "LIST", "UIDL", "RETR", "TOP", "DELE", "NOOP",
+    "RSET", "QUIT", "CAPA",
+};
+
+static struct {
+    const char     *address;
+    const char     *port;
+    const char     *dir;
+    bool            pipelining;
+    /** latencia de cada comando, en milisegundos */
+    unsigned        latency[CMD_UNKNOWN];
+    /** RTT simulado, en milisegundos */
+    unsigned        rtt;
+    unsigned        greeting_delay;
+    /** bytes por segundo por conexion, 0 es ilimitado */
+    unsigned        bandwidth;
+    /** probabilidades de falla por comando, en porcentaje */
+    unsigned        reset_pct;
+    unsigned        stall_pct;
+    uint32_t        seed;
+} options = {
+    .address    = "127.0.0.1",
+    .port       = "110",
+    .dir        = "mails",
+    .pipelining = true,
+    .seed       = 1,
+};
+
+static struct maildir   maildir;
+static fd_selector      selector;
+static volatile sig_atomic_t done = 0;
+
+/** porcion de la respuesta que se envia sin copiar al buffer de escritura */
+struct slice {
+    const uint8_t  *ptr;
+    size_t          n;
+};
+
+struct mock_session {
+    int                     fd;
+
+    buffer                  rb, wb;
+    uint8_t                 raw_rb[BUFFER_SIZE], raw_wb[BUFFER_SIZE];
+
+    bool                    user, authorized;
+    /** mails borrados en esta sesion */
+    bool                   *deleted;
+
+    /** se envian luego del contenido de `wb' */
+    struct slice            out[2];
+    /** memoria de `out[0]' a liberar al terminar de enviar */
+    uint8_t                *owned;
+
+    /** cerrar al vaciar la salida (QUIT), con RST si `reset' */
+    bool                    closing, reset;
+    /** no se responde mas: lo que llega se descarta */
+    bool                    stalled;
+
+    /** comando esperando su latencia, o saludo demorado */
+    char                    line[MAX_LINE];
+    bool                    delayed, greeting;
+
+    /** instantes de llegada de los comandos sin atender, para el RTT */
+    uint64_t                arrivals[ARRIVALS];
+    unsigned                arrivals_head, arrivals_count;
+
+    /** token bucket del ancho de banda */
+    double                  tokens;
+    uint64_t                refilled_at;
+
+    /** lista de sesiones dormidas */
+    uint64_t                wake_at;
+    bool                    sleeping;
+    struct mock_session    *prev, *next;
+};
+
+static struct mock_session *sleepers = NULL;
+
+/** xorshift32: alcanza para decidir fallas y es reproducible con la semilla */
+static bool
+roll(unsigned pct) {
+    if (pct == 0) {
+        return false;
+    }
+    options.seed ^= options.seed << 13;
+    options.seed ^= options.seed >> 17;
+    options.seed ^= options.seed << 5;
+    return options.seed % 100 < pct;
+}
+
+static void session_advance(struct mock_session *s);
+
+////////////////////////////////////////////////////////////////////////////////
+// temporizadores
+
+static void
+session_sleep(struct mock_session *s, uint64_t usec) {
+    if (!s->sleeping) {
+        s->next = sleepers;
+        s->prev = NULL;
+        if (sleepers != NULL) {
+            sleepers->prev = s;
+        }
+        sleepers    = s;
+        s->sleeping = true;
+    }
+    s->wake_at = monotonic_usec() + usec;
+    selector_set_interest(selector, s->fd, OP_NOOP);
+}
+
+static void
+session_wake(struct mock_session *s) {
+    if (!s->sleeping) {
+        return;
+    }
+    if (s->prev != NULL) {
+        s->prev->next = s->next;
+    } else {
+        sleepers = s->next;
+    }
+    if (s->next != NULL) {
+        s->next->prev = s->prev;
+    }
+    s->sleeping = false;
+    s->prev = s->next = NULL;
+}
+
+static void execute(struct mock_session *s, const char *line);
+static void greet(struct mock_session *s);
+
+/** despierta las sesiones cuya demora ya vencio */
+static void
+timers_run(void) {
+    const uint64_t now = monotonic_usec();
+    struct mock_session *next;
+    for (struct mock_session *s = sleepers; s != NULL; s = next) {
+        next = s->next;
+        if (s->wake_at > now) {
+            continue;
+        }
+        session_wake(s);
+        if (s->greeting) {
+            greet(s);
+        } else if (s->delayed) {
+            s->delayed = false;
+            execute(s, s->line);
+        } else {
+            session_advance(s);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// salida
+
+static bool
+output_pending(struct mock_session *s) {
+    return buffer_can_read(&s->wb) || s->out[0].n > 0 || s->out[1].n > 0;
+}
+
+static void
+session_interest(struct mock_session *s) {
+    fd_interest i = OP_NOOP;
+    if (s->sleeping) {
+        i = OP_NOOP;
+    } else if (s->stalled) {
+        i = OP_READ;
+    } else if (output_pending(s)) {
+        i = OP_WRITE;
+    } else if (!s->closing && buffer_can_write(&s->rb)) {
+        i = OP_READ;
+    }
+    selector_set_interest(selector, s->fd, i);
+}
+
+static void
+reply(struct mock_session *s, const char *fmt, ...) {
+    size_t n;
+    char *ptr = (char *) buffer_write_ptr(&s->wb, &n);
+    va_list ap;
+    va_start(ap, fmt);
+    const int len = vsnprintf(ptr, n, fmt, ap);
+    va_end(ap);
+    if (len > 0) {
+        buffer_write_adv(&s->wb, (size_t) len < n ? len : (ssize_t) n - 1);
+    }
+}
+
+static const uint8_t eom[] = ".\r\n";
+
+static void
+session_close(struct mock_session *s) {
+    selector_unregister_fd(selector, s->fd);
+}
+
+/** cierra la conexion con un RST en lugar de un FIN */
+static void
+session_reset(struct mock_session *s) {
+    const struct linger l = { .l_onoff = 1, .l_linger = 0 };
+    setsockopt(s->fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+    session_close(s);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// comandos
+
+static void
+greet(struct mock_session *s) {
+    s->greeting = false;
+    reply(s, "+OK POP3 mock ready.\r\n");
+    session_interest(s);
+}
+
+/** busca el mail `arg' (numerado desde 1) si existe y no fue borrado */
+static struct mail *
+get_mail(struct mock_session *s, const char *arg, size_t *index) {
+    char *end;
+    const unsigned long n = strtoul(arg, &end, 10);
+    if (end == arg || n == 0 || n > maildir.count || s->deleted[n - 1]) {
+        reply(s, "-ERR no such message\r\n");
+        return NULL;
+    }
+    *index = n - 1;
+    return &maildir.mails[n - 1];
+}
+
+/** respuesta multilinea de LIST y UIDL */
+static void
+listing(struct mock_session *s, bool uidl) {
+    struct strbuf b = { NULL, 0, 0 };
+    int ret = strbuf_printf(&b, "+OK\r\n");
+    for (size_t i = 0; ret >= 0 && i < maildir.count; i++) {
+        if (s->deleted[i]) {
+            continue;
+        }
+        if (uidl) {
+            ret = strbuf_printf(&b, "%zu %s\r\n", i + 1, maildir.mails[i].uid);
+        } else {
+            ret = strbuf_printf(&b, "%zu %zu\r\n", i + 1, maildir.mails[i].size);
+        }
+    }
+    if (ret < 0 || strbuf_printf(&b, ".\r\n") < 0) {
+        free(b.s);
+        reply(s, "-ERR out of memory\r\n");
+        return;
+    }
+    s->owned      = (uint8_t *) b.s;
+    s->out[0].ptr = s->owned;
+    s->out[0].n   = b.len;
+}
+
+static enum mock_cmd
+parse_cmd(const char *line, const char **arg) {
+    size_t n = strcspn(line, " ");
+    *arg = line[n] == ' ' ? line + n + 1 : line + n;
+    for (unsigned i = 0; i < CMD_UNKNOWN; i++) {
+        if (strlen(cmd_names[i]) == n && strncasecmp(line, cmd_names[i], n) == 0) {
+            return (enum mock_cmd) i;
+        }
+    }
+    return CMD_UNKNOWN;
+}
+
+static void
+transaction(struct mock_session *s, enum mock_cmd cmd, const char *arg) {
+    struct mail *m;
+    size_t i;
+
+    switch (cmd) {
+        case CMD_STAT: {
+            size_t count = 0, size = 0;
+            for (i = 0; i < maildir.count; i++) {
+                if (!s->deleted[i]) {
+                    count++;
+                    size += maildir.mails[i].size;
+                }
+            }
+            reply(s, "+OK %zu %zu\r\n", count, size);
+            break;
+        }
+        case CMD_LIST:
+        case CMD_UIDL:
+            if (*arg == 0) {
+                listing(s, cmd == CMD_UIDL);
+            } else if ((m = get_mail(s, arg, &i)) != NULL) {
+                if (cmd == CMD_UIDL) {
+                    reply(s, "+OK %zu %s\r\n", i + 1, m->uid);
+                } else {
+                    reply(s, "+OK %zu %zu\r\n", i + 1, m->size);
+                }
+            }
+            break;
+        case CMD_RETR:
+        case CMD_TOP:
+            if ((m = get_mail(s, arg, &i)) == NULL) {
+                break;
+            }
+            size_t len = m->len;
+            if (cmd == CMD_TOP) {
+                char *end;
+                const char *lines = strchr(arg, ' ');
+                const unsigned long n = lines == NULL ? 0 : strtoul(lines + 1, &end, 10);
+                if (lines == NULL || end == lines + 1) {
+                    reply(s, "-ERR missing line count\r\n");
+                    break;
+                }
+                len = maildir_top(m, n);
+                reply(s, "+OK\r\n");
+            } else {
+                reply(s, "+OK %zu octets\r\n", m->size);
+            }
+            s->out[0].ptr = m->data;
+            s->out[0].n   = len;
+            s->out[1].ptr = eom;
+            s->out[1].n   = sizeof(eom) - 1;
+            break;
+        case CMD_DELE:
+            if (get_mail(s, arg, &i) != NULL) {
+                s->deleted[i] = true;
+                reply(s, "+OK message deleted\r\n");
+            }
+            break;
+        case CMD_RSET:
+            memset(s->deleted, 0, maildir.count * sizeof(*s->deleted));
+            reply(s, "+OK\r\n");
+            break;
+        default:
+            reply(s, "-ERR already authenticated\r\n");
+            break;
+    }
+}
+
+/** ejecuta un comando ya demorado por su latencia */
+static void
+execute(struct mock_session *s, const char *line) {
+    const char *arg;
+    const enum mock_cmd cmd = parse_cmd(line, &arg);
+
+    if (roll(options.stall_pct)) {
+        s->stalled = true;
+        buffer_reset(&s->rb);
+        session_interest(s);
+        return;
+    }
+    if (roll(options.reset_pct)) {
+        if (cmd != CMD_RETR && cmd != CMD_TOP) {
+            session_reset(s);
+            return;
+        }
+        // el reset llega a mitad del mail
+        s->reset = true;
+    }
+
+    switch (cmd) {
+        case CMD_CAPA:
+            reply(s, "+OK\r\nUSER\r\nUIDL\r\nTOP\r\n%s.\r\n",
+                  options.pipelining ? "PIPELINING\r\n" : "");
+            break;
+        case CMD_NOOP:
+            reply(s, "+OK\r\n");
+            break;
+        case CMD_QUIT:
+            reply(s, "+OK bye\r\n");
+            s->closing = true;
+            break;
+        case CMD_USER:
+            if (s->authorized) {
+                transaction(s, cmd, arg);
+            } else {
+                s->user = *arg != 0;
+                reply(s, s->user ? "+OK\r\n" : "-ERR missing user\r\n");
+            }
+            break;
+        case CMD_PASS:
+            if (s->authorized) {
+                transaction(s, cmd, arg);
+            } else if (!s->user) {
+                reply(s, "-ERR USER first\r\n");
+            } else {
+                s->authorized = true;
+                reply(s, "+OK maildrop ready\r\n");
+            }
+            break;
+        case CMD_UNKNOWN:
+            reply(s, "-ERR unknown command\r\n");
+            break;
+        default:
+            if (s->authorized) {
+                transaction(s, cmd, arg);
+            } else {
+                reply(s, "-ERR authenticate first\r\n");
+            }
+            break;
+    }
+
+    if (s->reset) {
+        s->out[0].n /= 2;
+        s->out[1].n  = 0;
+    }
+    session_advance(s);
+}
+
+/**
+ * extrae la siguiente linea de `rb' sin el CRLF. Retorna 1 si hay una linea,
+ * 0 si falta que llegue y -1 si la linea es demasiado larga.
+ */
+static int
+next_line(struct mock_session *s, char *line) {
+    size_t n;
+    uint8_t *ptr = buffer_read_ptr(&s->rb, &n);
+    const uint8_t *nl = memchr(ptr, '\n', n);
+    if (nl == NULL) {
+        buffer_compact(&s->rb);
+        if (buffer_can_write(&s->rb)) {
+            return 0;
+        }
+        buffer_reset(&s->rb);
+        return -1;
+    }
+    size_t len = nl - ptr;
+    buffer_read_adv(&s->rb, len + 1);
+    if (len > 0 && ptr[len - 1] == '\r') {
+        len--;
+    }
+    if (len >= MAX_LINE) {
+        return -1;
+    }
+    memcpy(line, ptr, len);
+    line[len] = 0;
+    return 1;
+}
+
+/** registra la llegada de los comandos que terminan en `data' */
+static void
+arrivals_push(struct mock_session *s, const uint8_t *data, size_t n) {
+    const uint64_t now = monotonic_usec();
+    for (const uint8_t *p = data; (p = memchr(p, '\n', n - (p - data))) != NULL; p++) {
+        if (s->arrivals_count < ARRIVALS) {
+            s->arrivals[(s->arrivals_head + s->arrivals_count++) % ARRIVALS] = now;
+        }
+        if (p + 1 == data + n) {
+            break;
+        }
+    }
+}
+
+/** microsegundos que faltan para responder el comando siguiente segun el RTT */
+static uint64_t
+arrivals_pop(struct mock_session *s) {
+    if (s->arrivals_count == 0) {
+        return 0;
+    }
+    const uint64_t due = s->arrivals[s->arrivals_head] + options.rtt * 1000ULL;
+    const uint64_t now = monotonic_usec();
+    s->arrivals_head = (s->arrivals_head + 1) % ARRIVALS;
+    s->arrivals_count--;
+    return due > now ? due - now : 0;
+}
+
+/** atiende los comandos que ya llegaron mientras no haya salida pendiente */
+static void
+session_advance(struct mock_session *s) {
+    while (!s->sleeping && !s->stalled && !s->closing && !output_pending(s)) {
+        const int ret = next_line(s, s->line);
+        if (ret == 0) {
+            break;
+        } else if (ret < 0) {
+            reply(s, "-ERR line too long\r\n");
+            break;
+        }
+
+        const char *arg;
+        const enum mock_cmd cmd = parse_cmd(s->line, &arg);
+        uint64_t delay = options.rtt > 0 ? arrivals_pop(s) : 0;
+        if (cmd != CMD_UNKNOWN) {
+            delay += options.latency[cmd] * 1000ULL;
+        }
+        if (delay > 0) {
+            s->delayed = true;
+            session_sleep(s, delay);
+            return;
+        }
+        // `execute' vuelve a llamar a esta funcion y puede liberar `s'
+        execute(s, s->line);
+        return;
+    }
+    session_interest(s);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// handlers
+
+/** bytes que se pueden enviar ahora segun el ancho de banda */
+static size_t
+bandwidth_quota(struct mock_session *s) {
+    if (options.bandwidth == 0) {
+        return SIZE_MAX;
+    }
+    const uint64_t now   = monotonic_usec();
+    const double   burst = options.bandwidth / BANDWIDTH_BURST + 1;
+    s->tokens += (double)(now - s->refilled_at) * options.bandwidth / 1e6;
+    if (s->tokens > burst) {
+        s->tokens = burst;
+    }
+    s->refilled_at = now;
+    return (size_t) s->tokens;
+}
+
+static void
+mock_write(struct selector_key *key) {
+    struct mock_session *s = key->data;
+    const size_t quota = bandwidth_quota(s);
+    if (quota == 0) {
+        // se duerme hasta juntar una rafaga
+        const double burst = options.bandwidth / BANDWIDTH_BURST + 1;
+        session_sleep(s, (uint64_t)((burst - s->tokens) * 1e6 / options.bandwidth));
+        return;
+    }
+
+    const uint8_t *ptr;
+    size_t n;
+    struct slice *slice = NULL;
+    if (buffer_can_read(&s->wb)) {
+        ptr = buffer_read_ptr(&s->wb, &n);
+    } else {
+        slice = s->out[0].n > 0 ? &s->out[0] : &s->out[1];
+        ptr   = slice->ptr;
+        n     = slice->n;
+    }
+    if (n > quota) {
+        n = quota;
+    }
+
+    const ssize_t sent = send(key->fd, ptr, n, MSG_NOSIGNAL);
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    } else if (sent <= 0) {
+        session_close(s);
+        return;
+    }
+    if (options.bandwidth > 0) {
+        s->tokens -= sent;
+    }
+    if (slice == NULL) {
+        buffer_read_adv(&s->wb, sent);
+    } else {
+        slice->ptr += sent;
+        slice->n   -= sent;
+    }
+
+    if (output_pending(s)) {
+        return;
+    }
+    free(s->owned);
+    s->owned = NULL;
+    if (s->reset) {
+        session_reset(s);
+    } else if (s->closing) {
+        session_close(s);
+    } else {
+        session_advance(s);
+    }
+}
+
+static void
+mock_read(struct selector_key *key) {
+    struct mock_session *s = key->data;
+    size_t n;
+    uint8_t *ptr = buffer_write_ptr(&s->rb, &n);
+    const ssize_t ret = recv(key->fd, ptr, n, 0);
+    if (ret <= 0) {
+        session_close(s);
+        return;
+    }
+    if (s->stalled) {
+        return;
+    }
+    if (options.rtt > 0) {
+        arrivals_push(s, ptr, (size_t) ret);
+    }
+    buffer_write_adv(&s->rb, ret);
+    session_advance(s);
+}
+
+static void
+mock_close(struct selector_key *key) {
+    struct mock_session *s = key->data;
+    session_wake(s);
+    free(s->owned);
+    free(s->deleted);
+    free(s);
+    close(key->fd);
+}
+
+static const struct fd_handler mock_handler = {
+    .handle_read  = mock_read,
+    .handle_write = mock_write,
+    .handle_close = mock_close,
+};
+
+static void
+mock_accept(struct selector_key *key) {
+    const int fd = accept(key->fd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    struct mock_session *s = calloc(1, sizeof(*s));
+    if (s == NULL || selector_fd_set_nio(fd) < 0) {
+        goto fail;
+    }
+    // las respuestas salen en varios send: sin esto Nagle las demora
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    s->fd      = fd;
+    s->deleted = calloc(maildir.count + 1, sizeof(*s->deleted));
+    if (s->deleted == NULL) {
+        goto fail;
+    }
+    buffer_init(&s->rb, sizeof(s->raw_rb), s->raw_rb);
+    buffer_init(&s->wb, sizeof(s->raw_wb), s->raw_wb);
+    s->refilled_at = monotonic_usec();
+
+    if (selector_register(key->s, fd, &mock_handler, OP_NOOP, s) != SELECTOR_SUCCESS) {
+        goto fail;
+    }
+    if (options.greeting_delay > 0) {
+        s->greeting = true;
+        session_sleep(s, options.greeting_delay * 1000ULL);
+    } else {
+        greet(s);
+    }
+    return;
+
+fail:
+    if (s != NULL) {
+        free(s->deleted);
+    }
+    free(s);
+    close(fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// opciones
+
+static void
+print_help(void) {
+    printf("Uso: pop3mock [OPTION]\n");
+    printf("Servidor POP3 de prueba que sirve los mails de un directorio.\n");
+    printf("\n");
+    printf("Opciones:\n");
+    printf("%-30s", "\t-b bytes");
+    printf("ancho de banda por conexion en bytes por segundo (por defecto "
+           "ilimitado)\n");
+    printf("%-30s", "\t-d directorio");
+    printf("maildir o directorio con un mail por archivo (por defecto mails)\n");
+    printf("%-30s", "\t-g ms");
+    printf("demora del saludo\n");
+    printf("%-30s", "\t-h");
+    printf("imprime la ayuda y termina\n");
+    printf("%-30s", "\t-l direccion");
+    printf("direccion donde escucha (por defecto 127.0.0.1)\n");
+    printf("%-30s", "\t-L comando=ms");
+    printf("latencia antes de responder un comando; `*' los incluye a todos. "
+           "Se puede repetir\n");
+    printf("%-30s", "\t-n");
+    printf("no anuncia PIPELINING en CAPA\n");
+    printf("%-30s", "\t-p puerto");
+    printf("puerto TCP donde escucha (por defecto 110)\n");
+    printf("%-30s", "\t-r porcentaje");
+    printf("probabilidad de cortar la conexion con un RST en cada comando; en "
+           "RETR y TOP se corta a mitad del mail\n");
+    printf("%-30s", "\t-R ms");
+    printf("RTT de red simulado: cada respuesta sale ms despues de que llego "
+           "su comando, sin sumarse con pipelining\n");
+    printf("%-30s", "\t-s porcentaje");
+    printf("probabilidad de dejar de responder en cada comando\n");
+    printf("%-30s", "\t-S semilla");
+    printf("semilla de las fallas (por defecto 1)\n");
+}
+
+static unsigned
+parse_unsigned(const char *name, const char *arg, unsigned long max) {
+    char *end;
+    errno = 0;
+    const unsigned long n = strtoul(arg, &end, 10);
+    if (end == arg || *end != 0 || errno != 0 || n > max) {
+        fprintf(stderr, "%s should be an integer between 0 and %lu: %s\n",
+                name, max, arg);
+        exit(1);
+    }
+    return (unsigned) n;
+}
+
+static void
+parse_latency(const char *arg) {
+    const char *eq = strchr(arg, '=');
+    if (eq == NULL) {
+        fprintf(stderr, "Latency should be command=ms: %s\n", arg);
+        exit(1);
+    }
+    const unsigned ms = parse_unsigned("Latency", eq + 1, UINT_MAX / 1000);
+    const size_t   n  = eq - arg;
+    bool found = false;
+    for (unsigned i = 0; i < CMD_UNKNOWN; i++) {
+        if ((n == 1 && arg[0] == '*')
+            || (strlen(cmd_names[i]) == n && strncasecmp(arg, cmd_names[i], n) == 0)) {
+            options.latency[i] = ms;
+            found = true;
+        }
+    }
+    if (!found) {
+        fprintf(stderr, "Unknown command: %.*s\n", (int) n, arg);
+        exit(1);
+    }
+}
+
+static void
+parse_options(int argc, char **argv) {
+    int c;
+    opterr = 0;
+    while ((c = getopt(argc, argv, "b:d:g:hl:L:np:r:R:s:S:")) != -1) {
+        switch (c) {
+            case 'b':
+                options.bandwidth = parse_unsigned("Bandwidth", optarg, UINT_MAX);
+                break;
+            case 'd':
+                options.dir = optarg;
+                break;
+            case 'g':
+                options.greeting_delay = parse_unsigned("Greeting delay", optarg,
+                                                        UINT_MAX / 1000);
+                break;
+            case 'h':
+                print_help();
+                exit(0);
+            case 'l':
+                options.address = optarg;
+                break;
+            case 'L':
+                parse_latency(optarg);
+                break;
+            case 'n':
+                options.pipelining = false;
+                break;
+            case 'p':
+                options.port = optarg;
+                break;
+            case 'r':
+                options.reset_pct = parse_unsigned("Reset probability", optarg, 100);
+                break;
+            case 'R':
+                options.rtt = parse_unsigned("RTT", optarg, UINT_MAX / 1000);
+                break;
+            case 's':
+                options.stall_pct = parse_unsigned("Stall probability", optarg, 100);
+                break;
+            case 'S':
+                options.seed = parse_unsigned("Seed", optarg, UINT32_MAX);
+                if (options.seed == 0) {
+                    options.seed = 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "Unknown option -%c. Use -h for help.\n", optopt);
+                exit(1);
+        }
+    }
+}
+
+static bool
+timed(void) {
+    for (unsigned i = 0; i < CMD_UNKNOWN; i++) {
+        if (options.latency[i] > 0) {
+            return true;
+        }
+    }
+    return options.greeting_delay > 0 || options.bandwidth > 0 || options.rtt > 0;
+}
+
+static int
+listen_socket(void) {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_PASSIVE;
+
+    const int err = getaddrinfo(options.address, options.port, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", options.address, gai_strerror(err));
+        return -1;
+    }
+    int fd = socket(res->ai_family, SOCK_STREAM, IPPROTO_TCP);
+    const int on = 1;
+    if (fd < 0
+        || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0
+        || bind(fd, res->ai_addr, res->ai_addrlen) < 0
+        || listen(fd, PENDING_CONNECTIONS) < 0
+        || selector_fd_set_nio(fd) < 0) {
+        perror("listen");
+        if (fd >= 0) {
+            close(fd);
+        }
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static void
+sigterm_handler(const int sig) {
+    done = 1;
+}
+
+int
+main(int argc, char **argv) {
+    parse_options(argc, argv);
+
+    if (maildir_load(&maildir, options.dir) < 0) {
+        perror(options.dir);
+        return 1;
+    }
+
+    const int server = listen_socket();
+    if (server < 0) {
+        maildir_free(&maildir);
+        return 1;
+    }
+    printf("Serving %zu mails from %s on %s:%s\n", maildir.count, options.dir,
+           options.address, options.port);
+    fflush(stdout);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGTERM, sigterm_handler);
+    signal(SIGINT,  sigterm_handler);
+
+    const struct selector_init conf = {
+        .signal = SIGALRM,
+        .select_timeout = {
+            .tv_sec  = timed() ? 0 : 10,
+            .tv_nsec = timed() ? TIMER_RESOLUTION_NS : 0,
+        },
+    };
+    const char *err_msg = NULL;
+    selector_status ss = selector_init(&conf);
+    if (ss != SELECTOR_SUCCESS) {
+        err_msg = "initializing selector";
+        goto finally;
+    }
+    selector = selector_new(1024);
+    if (selector == NULL) {
+        err_msg = "unable to create selector";
+        goto finally;
+    }
+    const struct fd_handler accept_handler = {
+        .handle_read = mock_accept,
+    };
+    ss = selector_register(selector, server, &accept_handler, OP_READ, NULL);
+    if (ss != SELECTOR_SUCCESS) {
+        err_msg = "registering fd";
+        goto finally;
+    }
+
+    while (!done) {
+        ss = selector_select(selector);
+        if (ss != SELECTOR_SUCCESS) {
+            err_msg = "serving";
+            break;
+        }
+        timers_run();
+    }
+
+finally:
+    if (err_msg != NULL) {
+        fprintf(stderr, "%s: %s\n", err_msg,
+                ss == SELECTOR_IO ? strerror(errno) : selector_error(ss));
+    }
+    if (selector != NULL) {
+        selector_destroy(selector);
+    }
+    selector_close();
+    close(server);
+    maildir_free(&maildir);
+    return err_msg == NULL ? 0 : 2;
+}
@@ -0,0 +1,303 @@
+/**
+ * pop3stats.c - analizador offline de los registros de sesion de pop3filter.
+ *
+ * Lee las lineas JSON emitidas por `log_session' (archivo indicado con -a o
+ * stdout de pop3filter) y produce un desglose de latencias por estado de la
+ * maquina general, por comando y de las transformaciones externas.
+ * Las lineas que no son registros de sesion se ignoran.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MAX_LINE    8192
+#define MAX_PHASES  16
+#define MAX_CMDS    16
+#define NAME_SIZE   32
+
+/** serie de muestras para calcular percentiles */
+struct series {
+    uint64_t *v;
+    size_t    n, size;
+};
+
+struct phase {
+    char          name[NAME_SIZE];
+    struct series total;
+    struct series first_at;
+};
+
+struct cmd {
+    char          name[NAME_SIZE];
+    uint64_t      count, origin, rtt, max, bytes;
+};
+
+static struct phase phases[MAX_PHASES];
+static unsigned     nphases = 0;
+static struct cmd   cmds[MAX_CMDS];
+static unsigned     ncmds   = 0;
+
+static struct series durations;
+static uint64_t sessions = 0;
+static uint64_t bytes[4];
+static uint64_t filter_count = 0, filter_total = 0;
+
+static void
+series_add(struct series *s, uint64_t v) {
+    if (s->n == s->size) {
+        size_t size = s->size == 0 ? 64 : s->size * 2;
+        uint64_t *tmp = realloc(s->v, size * sizeof(*tmp));
+        if (tmp == NULL) {
+            fprintf(stderr, "Memory error\n");
+            exit(1);
+        }
+        s->v    = tmp;
+        s->size = size;
+    }
+    s->v[s->n++] = v;
+}
+
+static int
+cmp_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/** percentil `p' (0-100) de una serie ya ordenada */
+static double
+percentile(const struct series *s, double p) {
+    if (s->n == 0) {
+        return 0;
+    }
+    size_t i = (size_t)(p / 100.0 * (double)(s->n - 1) + 0.5);
+    return (double) s->v[i];
+}
+
+static double
+mean(const struct series *s) {
+    double sum = 0;
+    for (size_t i = 0; i < s->n; i++) {
+        sum += (double) s->v[i];
+    }
+    return s->n == 0 ? 0 : sum / (double) s->n;
+}
+
+static struct phase *
+get_phase(const char *name) {
+    for (unsigned i = 0; i < nphases; i++) {
+        if (strcmp(phases[i].name, name) == 0) {
+            return &phases[i];
+        }
+    }
+    if (nphases == MAX_PHASES) {
+        return NULL;
+    }
+    struct phase *p = &phases[nphases++];
+    strncpy(p->name, name, NAME_SIZE - 1);
+    return p;
+}
+
+static struct cmd *
+get_command(const char *name) {
+    for (unsigned i = 0; i < ncmds; i++) {
+        if (strcmp(cmds[i].name, name) == 0) {
+            return &cmds[i];
+        }
+    }
+    if (ncmds == MAX_CMDS) {
+        return NULL;
+    }
+    struct cmd *c = &cmds[ncmds++];
+    strncpy(c->name, name, NAME_SIZE - 1);
+    return c;
+}
+
+/** busca `"key":' y retorna un puntero al valor */
+static const char *
+find_key(const char *line, const char *key) {
+    char needle[NAME_SIZE + 4];
+    snprintf(needle, sizeof(needle), "\"%s\":", key);
+    const char *p = strstr(line, needle);
+    return p == NULL ? NULL : p + strlen(needle);
+}
+
+static uint64_t
+get_number(const char *line, const char *key) {
+    const char *p = find_key(line, key);
+    return p == NULL ? 0 : strtoull(p, NULL, 10);
+}
+
+/**
+ * recorre un objeto de la forma {"nombre":[n1,n2,...],...} llamando a `cb'
+ * por cada miembro. Retorna false si el formato es invalido.
+ */
+static bool
+for_each_array(const char *p, void (*cb)(const char *name, const uint64_t *v, size_t n)) {
+    if (p == NULL || *p++ != '{') {
+        return false;
+    }
+    while (*p == '"') {
+        char name[NAME_SIZE] = { 0 };
+        const char *end = strchr(++p, '"');
+        if (end == NULL || end[1] != ':' || end[2] != '[') {
+            return false;
+        }
+        size_t len = (size_t)(end - p) < NAME_SIZE - 1 ? (size_t)(end - p) : NAME_SIZE - 1;
+        memcpy(name, p, len);
+        p = end + 3;
+
+        uint64_t v[8];
+        size_t   n = 0;
+        while (*p != ']' && *p != 0) {
+            char *next;
+            uint64_t x = strtoull(p, &next, 10);
+            if (next == p) {
+                return false;
+            }
+            if (n < 8) {
+                v[n++] = x;
+            }
+            p = *next == ',' ? next + 1 : next;
+        }
+        if (*p++ != ']') {
+            return false;
+        }
+        cb(name, v, n);
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return *p == '}';
+}
+
+static void
+on_phase(const char *name, const uint64_t *v, size_t n) {
+    struct phase *p = get_phase(name);
+    if (p != NULL && n >= 2) {
+        series_add(&p->first_at, v[0]);
+        series_add(&p->total, v[1]);
+    }
+}
+
+static void
+on_cmd(const char *name, const uint64_t *v, size_t n) {
+    struct cmd *c = get_command(name);
+    if (c != NULL && n >= 5) {
+        c->count  += v[0];
+        c->origin += v[1];
+        c->rtt    += v[2];
+        c->max     = v[3] > c->max ? v[3] : c->max;
+        c->bytes  += v[4];
+    }
+}
+
+static void
+process_line(const char *line) {
+    if (line[0] != '{' || find_key(line, "phases") == NULL) {
+        return;
+    }
+    sessions++;
+    series_add(&durations, get_number(line, "duration_us"));
+    for_each_array(find_key(line, "phases"), on_phase);
+    for_each_array(find_key(line, "cmds"), on_cmd);
+
+    static const char *dirs[] = { "client_in", "client_out", "origin_in", "origin_out" };
+    for (unsigned i = 0; i < 4; i++) {
+        bytes[i] += get_number(line, dirs[i]);
+    }
+
+    const char *f = find_key(line, "filter");
+    if (f != NULL && *f == '[') {
+        char *next;
+        filter_count += strtoull(f + 1, &next, 10);
+        if (*next == ',') {
+            filter_total += strtoull(next + 1, NULL, 10);
+        }
+    }
+}
+
+static void
+process_file(FILE *f) {
+    char line[MAX_LINE];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        process_line(line);
+    }
+}
+
+#define MS(x) ((x) / 1000.0)
+
+static void
+report(void) {
+    printf("sesiones: %llu\n", (unsigned long long) sessions);
+    if (sessions == 0) {
+        return;
+    }
+
+    qsort(durations.v, durations.n, sizeof(*durations.v), cmp_u64);
+    printf("duracion (ms): media %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f\n\n",
+           MS(mean(&durations)), MS(percentile(&durations, 50)),
+           MS(percentile(&durations, 90)), MS(percentile(&durations, 99)),
+           MS(percentile(&durations, 100)));
+
+    double all = 0;
+    for (unsigned i = 0; i < nphases; i++) {
+        all += mean(&phases[i].total) * (double) phases[i].total.n;
+    }
+
+    printf("%-24s %8s %10s %10s %10s %10s %10s %7s\n", "estado", "sesiones",
+           "media(ms)", "p50", "p90", "p99", "max", "%tiempo");
+    for (unsigned i = 0; i < nphases; i++) {
+        struct series *s = &phases[i].total;
+        double share = all == 0 ? 0 : 100.0 * mean(s) * (double) s->n / all;
+        qsort(s->v, s->n, sizeof(*s->v), cmp_u64);
+        printf("%-24s %8zu %10.3f %10.3f %10.3f %10.3f %10.3f %6.1f%%\n",
+               phases[i].name, s->n, MS(mean(s)), MS(percentile(s, 50)),
+               MS(percentile(s, 90)), MS(percentile(s, 99)),
+               MS(percentile(s, 100)), share);
+    }
+
+    printf("\n%-8s %10s %14s %14s %12s %14s\n", "comando", "cantidad",
+           "origin(ms)", "rtt(ms)", "max(ms)", "bytes");
+    for (unsigned i = 0; i < ncmds; i++) {
+        struct cmd *c = &cmds[i];
+        double n = c->count == 0 ? 1 : (double) c->count;
+        printf("%-8s %10llu %14.3f %14.3f %12.3f %14llu\n", c->name,
+               (unsigned long long) c->count, MS(c->origin / n), MS(c->rtt / n),
+               MS((double) c->max), (unsigned long long) c->bytes);
+    }
+
+    printf("\ntransformaciones externas: %llu, media %.3f ms\n",
+           (unsigned long long) filter_count,
+           filter_count == 0 ? 0 : MS((double) filter_total / (double) filter_count));
+    printf("bytes: cliente->proxy %llu, proxy->cliente %llu, "
+           "origin->proxy %llu, proxy->origin %llu\n",
+           (unsigned long long) bytes[0], (unsigned long long) bytes[1],
+           (unsigned long long) bytes[2], (unsigned long long) bytes[3]);
+}
+
+int
+main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "-h") == 0) {
+        printf("Uso: pop3stats [registro ...]\n"
+               "Sin argumentos lee los registros de sesion de stdin.\n");
+        return 0;
+    }
+
+    if (argc == 1) {
+        process_file(stdin);
+    }
+    for (int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "r");
+        if (f == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        process_file(f);
+        fclose(f);
+    }
+
+    report();
+    return 0;
+}
@@ -0,0 +1,53 @@
+/**
+ * bench_churn.c - conexiones por segundo contra un pop3filter corriendo.
+ *
+ * Cada conexion lee el saludo, envia QUIT, espera la respuesta y cierra:
+ * mide el costo de crear y destruir sesiones (ver el pool de `struct pop3').
+ * Para comparar, correr pop3filter con el pool por defecto, con -S 0 (sin
+ * pool) y con -W/-H.
+ *
+ * Uso: bench_churn [host [puerto [conexiones]]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench_client.h"
+
+int
+main(int argc, char *argv[]) {
+    const char *host  = argc > 1 ? argv[1] : "127.0.0.1";
+    const char *port  = argc > 2 ? argv[2] : "1110";
+    const size_t count = argc > 3 ? strtoul(argv[3], NULL, 10) : 10000;
+
+    uint64_t *latency = malloc(count * sizeof(*latency));
+    if (latency == NULL || count == 0) {
+        fprintf(stderr, "Memory error\n");
+        return 1;
+    }
+
+    size_t done = 0, failed = 0;
+    const uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < count; i++) {
+        struct bench_conn c;
+        const uint64_t t = bench_now_ns();
+        if (bench_connect(&c, host, port) < 0) {
+            perror("connect");
+            return 1;
+        }
+        if (bench_read_status(&c) == 0 && bench_send(&c, "QUIT") == 0
+            && bench_read_status(&c) == 0) {
+            latency[done++] = bench_now_ns() - t;
+        } else {
+            failed++;
+        }
+        bench_close(&c);
+    }
+    const uint64_t elapsed = bench_now_ns() - start;
+
+    printf("connections %zu failed %zu %.0f conn/s p50 %.1f us p99 %.1f us\n",
+           done, failed, (double) done * 1e9 / (double) elapsed,
+           bench_percentile(latency, done, 50) / 1e3,
+           bench_percentile(latency, done, 99) / 1e3);
+    free(latency);
+    return failed == 0 ? 0 : 1;
+}
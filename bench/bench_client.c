@@ -0,0 +1,147 @@
+/**
+ * bench_client.c - cliente pop3 minimo para los benchmarks
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "bench_client.h"
+
+uint64_t
+bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+int
+bench_connect(struct bench_conn *c, const char *host, const char *port) {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    c->fd    = -1;
+    c->start = c->end = 0;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        return -1;
+    }
+    for (struct addrinfo *ai = res; ai != NULL && c->fd < 0; ai = ai->ai_next) {
+        c->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (c->fd >= 0 && connect(c->fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            close(c->fd);
+            c->fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (c->fd >= 0) {
+        const int one = 1;
+        setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return c->fd < 0 ? -1 : 0;
+}
+
+void
+bench_close(struct bench_conn *c) {
+    if (c->fd >= 0) {
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+int
+bench_write(struct bench_conn *c, const void *data, size_t n) {
+    const char *ptr = data;
+    size_t off = 0;
+    while (off < n) {
+        ssize_t w = send(c->fd, ptr + off, n - off, 0);
+        if (w <= 0) {
+            return -1;
+        }
+        off += (size_t) w;
+    }
+    return 0;
+}
+
+int
+bench_send(struct bench_conn *c, const char *cmd) {
+    char line[BENCH_LINE_SIZE];
+    int  n = snprintf(line, sizeof(line), "%s\r\n", cmd);
+
+    if (n < 0 || (size_t) n >= sizeof(line)) {
+        return -1;
+    }
+    return bench_write(c, line, (size_t) n);
+}
+
+ssize_t
+bench_read_line(struct bench_conn *c, char *line, size_t size) {
+    size_t len = 0;
+    for (;;) {
+        while (c->start < c->end) {
+            const char ch = c->buf[c->start++];
+            if (ch == '\n') {
+                if (len > 0 && line[len - 1] == '\r') {
+                    len--;
+                }
+                line[len] = 0;
+                return (ssize_t) len;
+            }
+            if (len + 1 < size) {
+                line[len++] = ch;
+            }
+        }
+        ssize_t n = recv(c->fd, c->buf, sizeof(c->buf), 0);
+        if (n <= 0) {
+            return -1;
+        }
+        c->start = 0;
+        c->end   = (size_t) n;
+    }
+}
+
+int
+bench_read_status(struct bench_conn *c) {
+    char line[BENCH_LINE_SIZE];
+    if (bench_read_line(c, line, sizeof(line)) < 0) {
+        return -1;
+    }
+    return strncmp(line, "+OK", 3) == 0 ? 0 : 1;
+}
+
+ssize_t
+bench_read_multiline(struct bench_conn *c) {
+    char    line[BENCH_LINE_SIZE];
+    ssize_t total = 0, n;
+
+    if (bench_read_status(c) != 0) {
+        return -1;
+    }
+    while ((n = bench_read_line(c, line, sizeof(line))) >= 0) {
+        if (strcmp(line, ".") == 0) {
+            return total;
+        }
+        total += n + 2;
+    }
+    return -1;
+}
+
+static int
+cmp_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+uint64_t
+bench_percentile(uint64_t *v, size_t n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+    qsort(v, n, sizeof(*v), cmp_u64);
+    return v[(size_t) (p / 100.0 * (double) (n - 1) + 0.5)];
+}
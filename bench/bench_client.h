@@ -0,0 +1,66 @@
+#ifndef TPE_PROTOS_BENCH_CLIENT_H
+#define TPE_PROTOS_BENCH_CLIENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+
+/**
+ * bench_client.c - cliente pop3 minimo para los benchmarks que hablan con un
+ * pop3filter corriendo. Las operaciones son bloqueantes.
+ */
+
+#define BENCH_LINE_SIZE     1024
+
+struct bench_conn {
+    int         fd;
+    /** bytes leidos del socket que todavia no se consumieron */
+    char        buf[4096];
+    size_t      start, end;
+};
+
+/** nanosegundos del reloj monotonico */
+uint64_t
+bench_now_ns(void);
+
+/** conecta a `host':`port'. Retorna -1 si falla */
+int
+bench_connect(struct bench_conn *c, const char *host, const char *port);
+
+void
+bench_close(struct bench_conn *c);
+
+/** envia los `n' bytes de `data' */
+int
+bench_write(struct bench_conn *c, const void *data, size_t n);
+
+/** envia `cmd' seguido de CRLF */
+int
+bench_send(struct bench_conn *c, const char *cmd);
+
+/**
+ * lee una linea (sin CRLF) en `line'. Retorna su longitud o -1 si se cerro
+ * la conexion.
+ */
+ssize_t
+bench_read_line(struct bench_conn *c, char *line, size_t size);
+
+/**
+ * lee una respuesta de una linea. Retorna 0 si es +OK, 1 si es -ERR y -1 si
+ * se cerro la conexion.
+ */
+int
+bench_read_status(struct bench_conn *c);
+
+/**
+ * lee una respuesta multilinea hasta el ".". Retorna los bytes leidos o -1
+ * si la respuesta no es +OK o se cerro la conexion.
+ */
+ssize_t
+bench_read_multiline(struct bench_conn *c);
+
+/** ordena `v' y retorna el percentil `p' (0-100) */
+uint64_t
+bench_percentile(uint64_t *v, size_t n, double p);
+
+#endif //TPE_PROTOS_BENCH_CLIENT_H
@@ -0,0 +1,192 @@
+/**
+ * bench_fairness.c - latencia de clientes interactivos mientras otros
+ * descargan mails grandes, contra un pop3filter corriendo.
+ *
+ * Lanza `bulk' procesos que repiten RETR de un mail grande y `interactive'
+ * procesos que repiten STAT y LIST midiendo cada comando. Al terminar
+ * reporta los percentiles de los comandos interactivos y el volumen que
+ * movieron los clientes bulk.
+ *
+ * Uso: bench_fairness [host [puerto [bulk [interactive [segundos [mail]]]]]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "bench_client.h"
+
+/** muestras que guarda cada cliente interactivo */
+#define MAX_SAMPLES     100000
+
+static const char *host, *port;
+
+static int
+login(struct bench_conn *c) {
+    if (bench_connect(c, host, port) < 0 || bench_read_status(c) != 0) {
+        return -1;
+    }
+    if (bench_send(c, "USER bench") < 0 || bench_read_status(c) != 0
+        || bench_send(c, "PASS bench") < 0 || bench_read_status(c) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/** repite RETR hasta `deadline', escribe los bytes recibidos en `out' */
+static int
+bulk(uint64_t deadline, const char *mail, int out) {
+    struct bench_conn c;
+    char cmd[64];
+    uint64_t bytes = 0;
+
+    snprintf(cmd, sizeof(cmd), "RETR %s", mail);
+    if (login(&c) < 0) {
+        return 1;
+    }
+    while (bench_now_ns() < deadline) {
+        ssize_t n;
+        if (bench_send(&c, cmd) < 0 || (n = bench_read_multiline(&c)) < 0) {
+            return 1;
+        }
+        bytes += (uint64_t) n;
+    }
+    bench_send(&c, "QUIT");
+    bench_close(&c);
+    return write(out, &bytes, sizeof(bytes)) == sizeof(bytes) ? 0 : 1;
+}
+
+/** repite STAT y LIST hasta `deadline', escribe las latencias en `out' */
+static int
+interactive(uint64_t deadline, int out) {
+    static uint64_t samples[MAX_SAMPLES];
+    struct bench_conn c;
+    size_t n = 0;
+
+    if (login(&c) < 0) {
+        return 1;
+    }
+    while (bench_now_ns() < deadline && n < MAX_SAMPLES) {
+        uint64_t t = bench_now_ns();
+        if (bench_send(&c, "STAT") < 0 || bench_read_status(&c) != 0) {
+            return 1;
+        }
+        samples[n++] = bench_now_ns() - t;
+
+        t = bench_now_ns();
+        if (bench_send(&c, "LIST") < 0 || bench_read_multiline(&c) < 0) {
+            return 1;
+        }
+        samples[n++] = bench_now_ns() - t;
+    }
+    bench_send(&c, "QUIT");
+    bench_close(&c);
+
+    // de a PIPE_BUF bytes para que las escrituras de los hijos no se mezclen
+    const size_t chunk = PIPE_BUF / sizeof(*samples);
+    for (size_t i = 0; i < n; i += chunk) {
+        const size_t size = (n - i < chunk ? n - i : chunk) * sizeof(*samples);
+        if (write(out, samples + i, size) != (ssize_t) size) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/** lee todo lo que escriban los hijos en `fd' */
+static uint8_t *
+read_all(int fd, size_t *size) {
+    size_t cap = 1 << 16, len = 0;
+    uint8_t *buf = malloc(cap);
+    ssize_t n;
+
+    while (buf != NULL && (n = read(fd, buf + len, cap - len)) > 0) {
+        len += (size_t) n;
+        if (len == cap) {
+            cap *= 2;
+            uint8_t *tmp = realloc(buf, cap);
+            if (tmp == NULL) {
+                free(buf);
+                return NULL;
+            }
+            buf = tmp;
+        }
+    }
+    *size = len;
+    return buf;
+}
+
+int
+main(int argc, char *argv[]) {
+    host = argc > 1 ? argv[1] : "127.0.0.1";
+    port = argc > 2 ? argv[2] : "1110";
+    const unsigned nbulk   = argc > 3 ? (unsigned) atoi(argv[3]) : 4;
+    const unsigned ninter  = argc > 4 ? (unsigned) atoi(argv[4]) : 16;
+    const unsigned seconds = argc > 5 ? (unsigned) atoi(argv[5]) : 10;
+    const char *mail       = argc > 6 ? argv[6] : "2";
+
+    int bulk_pipe[2], inter_pipe[2];
+    if (pipe(bulk_pipe) < 0 || pipe(inter_pipe) < 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    const uint64_t deadline = bench_now_ns() + (uint64_t) seconds * 1000000000;
+    for (unsigned i = 0; i < nbulk + ninter; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            // cada hijo se queda solo con el extremo que usa
+            close(bulk_pipe[0]);
+            close(inter_pipe[0]);
+            close(i < nbulk ? inter_pipe[1] : bulk_pipe[1]);
+            _exit(i < nbulk ? bulk(deadline, mail, bulk_pipe[1])
+                            : interactive(deadline, inter_pipe[1]));
+        }
+    }
+    close(bulk_pipe[1]);
+    close(inter_pipe[1]);
+
+    // los hijos terminan de escribir al cerrar sus extremos
+    size_t bulk_size, inter_size;
+    uint8_t *bulk_bytes = read_all(bulk_pipe[0], &bulk_size);
+    uint8_t *inter      = read_all(inter_pipe[0], &inter_size);
+
+    unsigned failed = 0;
+    int status;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed++;
+        }
+    }
+    if (bulk_bytes == NULL || inter == NULL) {
+        fprintf(stderr, "Memory error\n");
+        return 1;
+    }
+
+    uint64_t total = 0, x;
+    for (size_t i = 0; i + sizeof(x) <= bulk_size; i += sizeof(x)) {
+        memcpy(&x, bulk_bytes + i, sizeof(x));
+        total += x;
+    }
+    uint64_t *samples = (uint64_t *) (void *) inter;
+    const size_t n    = inter_size / sizeof(*samples);
+
+    printf("bulk %u clients %.1f MB/s\n", nbulk, (double) total / seconds / 1e6);
+    printf("interactive %u clients %zu commands p50 %.1f us p90 %.1f us p99 %.1f us max %.1f us\n",
+           ninter, n, bench_percentile(samples, n, 50) / 1e3,
+           bench_percentile(samples, n, 90) / 1e3, bench_percentile(samples, n, 99) / 1e3,
+           bench_percentile(samples, n, 100) / 1e3);
+    if (failed > 0) {
+        printf("%u clients failed\n", failed);
+    }
+
+    free(bulk_bytes);
+    free(inter);
+    return failed == 0 ? 0 : 1;
+}
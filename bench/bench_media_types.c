@@ -0,0 +1,126 @@
+/**
+ * bench_media_types.c - costo de las operaciones sobre los media types
+ * filtrados con listas de miles de tipos.
+ *
+ * Para cada tamaño mide la carga de la lista, consultas que aciertan, que
+ * fallan y que aciertan por wildcard, y la serializacion que se envia a la
+ * transformacion externa en cada RETR (primera vez y cacheada).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "media_types.h"
+
+#define LOOKUPS     1000000
+#define NAME_SIZE   32
+
+static uint64_t
+now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static void
+report(const char *name, size_t types, uint64_t ns, size_t ops) {
+    printf("%-24s %8zu types %12.1f ns/op\n", name, types, (double) ns / (double) ops);
+}
+
+/** evita que el compilador descarte los resultados */
+static volatile int sink;
+
+/** nombres generados de antemano para no medir su formateo */
+struct names {
+    char (*type)[NAME_SIZE];
+    char (*subtype)[NAME_SIZE];
+};
+
+static struct names
+names_new(size_t n, const char *type_fmt, const char *subtype_fmt) {
+    struct names ret = {
+            .type    = malloc(n * NAME_SIZE),
+            .subtype = malloc(n * NAME_SIZE),
+    };
+    if (ret.type == NULL || ret.subtype == NULL) {
+        fprintf(stderr, "Memory error\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < n; i++) {
+        snprintf(ret.type[i], NAME_SIZE, type_fmt, i % 64);
+        snprintf(ret.subtype[i], NAME_SIZE, subtype_fmt, i);
+    }
+    return ret;
+}
+
+static void
+names_free(struct names *names) {
+    free(names->type);
+    free(names->subtype);
+}
+
+static void
+bench(size_t n) {
+    struct media_types *mt = new_media_types();
+    struct names banned    = names_new(n, "type%zu", "Sub-Type.%zu");
+    struct names queried   = names_new(n, "TYPE%zu", "sub-type.%zu");
+    struct names other     = names_new(n, "other%zu", "sub-type.%zu");
+
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        add_media_type(mt, banned.type[i], banned.subtype[i]);
+    }
+    add_media_type(mt, "wild", "*");
+    report("add", n, now_ns() - start, n + 1);
+
+    start = now_ns();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        const size_t k = (i * 7919) % n;
+        sink += check_media_type(mt, queried.type[k], queried.subtype[k]);
+    }
+    report("check (hit)", n, now_ns() - start, LOOKUPS);
+
+    start = now_ns();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        const size_t k = (i * 7919) % n;
+        sink += check_media_type(mt, other.type[k], other.subtype[k]);
+    }
+    report("check (miss)", n, now_ns() - start, LOOKUPS);
+
+    start = now_ns();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        sink += check_media_type(mt, "Wild", other.subtype[i % n]);
+    }
+    report("check (wildcard)", n, now_ns() - start, LOOKUPS);
+
+    start = now_ns();
+    sink += get_types_list(mt, ',') != NULL;
+    report("list (serialize)", n, now_ns() - start, 1);
+
+    start = now_ns();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        sink += get_types_list(mt, ',') != NULL;
+    }
+    report("list (cached)", n, now_ns() - start, LOOKUPS);
+
+    start = now_ns();
+    for (size_t i = 0; i < 100; i++) {
+        delete_media_type(mt, banned.type[i], banned.subtype[i]);
+    }
+    report("delete", n, now_ns() - start, 100);
+
+    names_free(&banned);
+    names_free(&queried);
+    names_free(&other);
+    delete_media_types(mt);
+}
+
+int
+main(void) {
+    const size_t sizes[] = { 1000, 4000, 16000 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+        bench(sizes[i]);
+    }
+    return 0;
+}
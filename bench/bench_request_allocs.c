@@ -0,0 +1,211 @@
+/**
+ * bench_request_allocs.c - alocaciones por comando en una sesion con
+ * pipelining.
+ *
+ * Reproduce el camino de las requests de pop3.c para una sesion de 10000
+ * comandos enviados en pipeline: se parsean del buffer de lectura, se
+ * agregan al anillo de la sesion, se serializan hacia el origin y se
+ * descartan a medida que llegan las respuestas. Las llamadas a malloc se
+ * cuentan envolviendolas en el linker (-Wl,--wrap=malloc).
+ *
+ * Se compara el anillo (argumentos en la arena de la sesion) con el esquema
+ * anterior: una lista enlazada con una alocacion para la request, otra para
+ * los argumentos y otra para el nodo.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "buffer.h"
+#include "request_ring.h"
+#include "request_parser.h"
+
+#define COMMANDS        10000
+#define BUFFER_SIZE     2048
+/** requests que se envian juntas al origin antes de leer las respuestas */
+#define WINDOW          REQUEST_RING_SIZE
+
+void *__real_malloc(size_t size);
+
+static unsigned long mallocs = 0;
+
+void *
+__wrap_malloc(size_t size) {
+    mallocs++;
+    return __real_malloc(size);
+}
+
+static uint64_t
+now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+/** esquema anterior: request, argumentos y nodo alocados por separado */
+static struct pop3_request *
+legacy_request(const struct pop3_request *parsed) {
+    struct pop3_request *r = malloc(sizeof(*r));
+    *r = *parsed;
+    if (parsed->args != NULL) {
+        r->args = malloc(strlen(parsed->args) + 1);
+        strcpy(r->args, parsed->args);
+    }
+    return r;
+}
+
+static void
+legacy_destroy(struct pop3_request *r) {
+    free(r->args);
+    free(r);
+}
+
+struct legacy_node {
+    struct pop3_request *request;
+    struct legacy_node  *next;
+};
+
+struct legacy_queue {
+    struct legacy_node *first, *last;
+    unsigned            size;
+};
+
+static void
+legacy_add(struct legacy_queue *q, struct pop3_request *r) {
+    struct legacy_node *node = malloc(sizeof(*node));
+    node->request = r;
+    node->next    = NULL;
+    if (q->last == NULL) {
+        q->first = node;
+    } else {
+        q->last->next = node;
+    }
+    q->last = node;
+    q->size++;
+}
+
+static struct pop3_request *
+legacy_remove(struct legacy_queue *q) {
+    struct legacy_node *node = q->first;
+    if (node == NULL) {
+        return NULL;
+    }
+    struct pop3_request *r = node->request;
+    q->first = node->next;
+    if (q->first == NULL) {
+        q->last = NULL;
+    }
+    q->size--;
+    free(node);
+    return r;
+}
+
+static void
+run(const char *name, bool use_ring) {
+    static const char * const cmds[] = { "NOOP\r\n", "RETR 12\r\n", "LIST 3\r\n",
+                                         "UIDL 7\r\n", "TOP 4 10\r\n" };
+    uint8_t raw_in[BUFFER_SIZE], raw_out[BUFFER_SIZE];
+    buffer in, out;
+    buffer_init(&in,  BUFFER_SIZE, raw_in);
+    buffer_init(&out, BUFFER_SIZE, raw_out);
+
+    uint64_t arena_buffer[2048 / sizeof(uint64_t)];
+    struct arena arena;
+    arena_init(&arena, arena_buffer, sizeof(arena_buffer));
+
+    struct pop3_request parsed;
+    struct request_parser parser = { .request = &parsed };
+    request_parser_init(&parser);
+
+    struct legacy_queue q = { NULL, NULL, 0 };
+    static struct request_ring ring;
+    request_ring_init(&ring);
+
+    const unsigned long before = mallocs;
+    const uint64_t start = now_ns();
+    unsigned sent = 0, generated = 0, parsed_count = 0;
+
+    while (sent < COMMANDS) {
+        // el cliente escribe tantos comandos como entren en el buffer
+        size_t n;
+        uint8_t *ptr = buffer_write_ptr(&in, &n);
+        size_t written = 0;
+        for (; generated < COMMANDS; generated++) {
+            const char *c = cmds[generated % (sizeof(cmds) / sizeof(*cmds))];
+            const size_t len = strlen(c);
+            if (written + len > n) {
+                break;
+            }
+            memcpy(ptr + written, c, len);
+            written += len;
+        }
+        buffer_write_adv(&in, (ssize_t) written);
+
+        // parseo, como request_parse/request_process
+        while (buffer_can_read(&in) && (use_ring ? !request_ring_full(&ring) : q.size < WINDOW)) {
+            bool error = false;
+            if (!request_is_done(request_consume(&in, &parser, &error), 0)) {
+                break;
+            }
+            if (use_ring) {
+                request_ring_push(&ring, &arena, parsed.cmd, parsed.args);
+            } else {
+                legacy_add(&q, legacy_request(&parsed));
+            }
+            request_parser_init(&parser);
+            parsed_count++;
+        }
+        buffer_compact(&in);
+
+        // envio al origin, como request_write
+        struct pop3_request *r;
+        if (use_ring) {
+            while ((r = request_ring_unsent_peek(&ring)) != NULL) {
+                if (request_marshall(r, &out) < 0) {
+                    buffer_reset(&out);
+                    request_marshall(r, &out);
+                }
+                request_ring_mark_sent(&ring);
+            }
+        } else {
+            for (struct legacy_node *node = q.first; node != NULL; node = node->next) {
+                if (request_marshall(node->request, &out) < 0) {
+                    buffer_reset(&out);
+                    request_marshall(node->request, &out);
+                }
+            }
+        }
+        buffer_reset(&out);
+
+        // llegan las respuestas, como request_done
+        if (use_ring) {
+            while (request_ring_current(&ring) != NULL) {
+                request_ring_done(&ring, &arena);
+                sent++;
+            }
+            arena_reset(&arena);
+        } else {
+            while ((r = legacy_remove(&q)) != NULL) {
+                legacy_destroy(r);
+                sent++;
+            }
+        }
+    }
+
+    const uint64_t elapsed = now_ns() - start;
+    const unsigned long count = mallocs - before;
+    printf("%-8s commands %u mallocs %lu (%.3f/command) %.1f ns/command\n", name,
+           parsed_count, count, (double) count / parsed_count,
+           (double) elapsed / parsed_count);
+
+    arena_destroy(&arena);
+}
+
+int
+main(void) {
+    run("malloc", false);
+    run("ring", true);
+    return 0;
+}
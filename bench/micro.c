@@ -0,0 +1,65 @@
+/**
+ * micro.c - arnes de los micro-benchmarks
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "micro.h"
+#include "bench_client.h"
+
+volatile uint64_t micro_sink;
+
+static const char *suite_name;
+static const char *name_filter;
+static FILE       *out;
+
+void
+micro_init(const char *suite, const char *filter) {
+    suite_name  = suite;
+    name_filter = filter;
+    // los casos pueden redirigir stdout, los resultados van al original
+    const int fd = dup(STDOUT_FILENO);
+    out = fd < 0 ? NULL : fdopen(fd, "w");
+    if (out == NULL) {
+        perror("stdout");
+        exit(1);
+    }
+}
+
+static uint64_t
+timed(micro_fn fn, void *arg, size_t iterations) {
+    const uint64_t t = bench_now_ns();
+    fn(arg, iterations);
+    return bench_now_ns() - t;
+}
+
+double
+micro_run(const char *name, size_t bytes, micro_fn fn, void *arg) {
+    if (name_filter != NULL && strstr(name, name_filter) == NULL) {
+        return 0;
+    }
+
+    // duplica las iteraciones hasta pasar un decimo del objetivo
+    size_t iterations = 1;
+    uint64_t ns;
+    while ((ns = timed(fn, arg, iterations)) < MICRO_TARGET_NS / 10) {
+        iterations *= 2;
+    }
+    iterations = (size_t)((double) iterations * MICRO_TARGET_NS / (double) ns) + 1;
+
+    uint64_t runs[MICRO_RUNS];
+    for (unsigned i = 0; i < MICRO_RUNS; i++) {
+        runs[i] = timed(fn, arg, iterations);
+    }
+    const double median = bench_percentile(runs, MICRO_RUNS, 50) / (double) iterations;
+    const double min    = bench_percentile(runs, MICRO_RUNS, 0) / (double) iterations;
+
+    fprintf(out, "{\"suite\":\"%s\",\"name\":\"%s\",\"iterations\":%zu,"
+                 "\"ns_per_op\":%.2f,\"min_ns_per_op\":%.2f,\"mb_per_s\":%.1f}\n",
+            suite_name, name, iterations, median, min,
+            bytes == 0 ? 0 : (double) bytes * 1e3 / median);
+    fflush(out);
+    return median;
+}
@@ -0,0 +1,46 @@
+#ifndef TPE_PROTOS_MICRO_H
+#define TPE_PROTOS_MICRO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * micro.c - arnes de los micro-benchmarks.
+ *
+ * Cada caso es una funcion que repite `iterations' veces la operacion a
+ * medir. `micro_run' calibra la cantidad de iteraciones para que cada
+ * corrida dure alrededor de MICRO_TARGET_NS, la repite MICRO_RUNS veces y
+ * emite una linea JSON con la mediana y el minimo de ns por operacion:
+ *
+ *   {"suite":"pop3filter","name":"parser_feed/pop3_multi","iterations":...,
+ *    "ns_per_op":...,"min_ns_per_op":...,"mb_per_s":...}
+ *
+ * Las lineas se escriben en el stdout original del proceso aun si el caso
+ * redirige stdout (ver stripmime). `run_micro.sh' las junta en un unico
+ * documento.
+ */
+
+#define MICRO_TARGET_NS     (100 * 1000 * 1000)
+#define MICRO_RUNS          5
+
+typedef void (*micro_fn)(void *arg, size_t iterations);
+
+/**
+ * inicia el arnes. Si se pasa un `filter' solo corren los casos cuyo nombre
+ * lo contiene.
+ */
+void
+micro_init(const char *suite, const char *filter);
+
+/**
+ * mide `fn'. `bytes' es la cantidad de bytes que procesa cada operacion,
+ * para informar MB/s (0 si no aplica). Retorna la mediana de ns por
+ * operacion, o 0 si el filtro excluye el caso.
+ */
+double
+micro_run(const char *name, size_t bytes, micro_fn fn, void *arg);
+
+/** evita que el compilador descarte resultados que no se usan */
+extern volatile uint64_t micro_sink;
+
+#endif //TPE_PROTOS_MICRO_H
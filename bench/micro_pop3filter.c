@@ -0,0 +1,459 @@
+/**
+ * micro_pop3filter.c - micro-benchmarks de los parsers, buffers y el
+ * selector de pop3filter.
+ *
+ * Uso: micro_pop3filter [filtro]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "micro.h"
+#include "buffer.h"
+#include "parser.h"
+#include "pop3_multi.h"
+#include "request_parser.h"
+#include "response_parser.h"
+#include "media_types.h"
+#include "selector.h"
+#include "trace.h"
+
+#define MAIL_SIZE       (64 * 1024)
+#define PIPELINED       1000
+#define BUFFER_SIZE     4096
+/** buffers de la transformacion externa en pop3filter, y lo que lee el filtro por vez */
+#define ET_BUFFER       2048
+#define SLOW_READ       256
+/** costo maximo de registrar un evento en el anillo de la sesion */
+#define TRACE_MAX_NS    20
+
+struct corpus {
+    uint8_t    *data;
+    size_t      len;
+};
+
+/**
+ * respuesta a un RETR de unos `size' bytes: lineas de 72 caracteres, algunas
+ * con byte-stuffing, y el ".\r\n" final. Sin `status_line' solo el cuerpo.
+ */
+static struct corpus
+retr_response(size_t size, bool status_line) {
+    static const char status[] = "+OK message follows\r\n";
+    struct corpus c = { malloc(size + 256), 0 };
+    if (c.data == NULL) {
+        fprintf(stderr, "Memory error\n");
+        exit(1);
+    }
+    if (status_line) {
+        memcpy(c.data, status, sizeof(status) - 1);
+        c.len = sizeof(status) - 1;
+    }
+    for (unsigned line = 0; c.len + 80 < size; line++) {
+        if (line % 50 == 0) {
+            c.data[c.len++] = '.';
+        }
+        for (unsigned i = 0; i < 72; i++) {
+            c.data[c.len++] = (uint8_t) ('a' + (line + i) % 26);
+        }
+        c.data[c.len++] = '\r';
+        c.data[c.len++] = '\n';
+    }
+    memcpy(c.data + c.len, ".\r\n", 3);
+    c.len += 3;
+    return c;
+}
+
+/** `n' comandos como los que llegan de un cliente con pipelining */
+static struct corpus
+pipelined(unsigned n) {
+    static const char *cmds[] = {
+        "RETR 1\r\n", "LIST\r\n", "UIDL 3\r\n", "NOOP\r\n", "STAT\r\n",
+        "TOP 12 10\r\n", "DELE 7\r\n", "list 2\r\n",
+    };
+    struct corpus c = { malloc(n * 16), 0 };
+    if (c.data == NULL) {
+        fprintf(stderr, "Memory error\n");
+        exit(1);
+    }
+    for (unsigned i = 0; i < n; i++) {
+        const char *cmd = cmds[i % (sizeof(cmds) / sizeof(*cmds))];
+        memcpy(c.data + c.len, cmd, strlen(cmd));
+        c.len += strlen(cmd);
+    }
+    return c;
+}
+
+/** buffer de lectura sobre `c' sin copiarlo */
+static void
+buffer_over(buffer *b, const struct corpus *c) {
+    buffer_init(b, c->len, c->data);
+    buffer_write_adv(b, c->len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// parsers
+
+struct multi_case {
+    struct corpus   body;
+    struct parser  *parser;
+};
+
+static void
+parser_pop3_multi(void *arg, size_t iterations) {
+    struct multi_case *m = arg;
+    for (size_t it = 0; it < iterations; it++) {
+        parser_reset(m->parser);
+        for (size_t i = 0; i < m->body.len; i++) {
+            micro_sink += parser_feed(m->parser, m->body.data[i])->type;
+        }
+    }
+}
+
+/**
+ * Fin del mail con pop3_multi_scan: de una vez y de a un byte mas por llamada
+ * (el cursor no vuelve a pasar lo visto) tiene que coincidir con parser_feed.
+ */
+static void
+check_scan(const struct multi_case *m) {
+    size_t expected = 0;
+    parser_reset(m->parser);
+    for (size_t i = 0; i < m->body.len && expected == 0; i++) {
+        if (parser_feed(m->parser, m->body.data[i])->type == POP3_MULTI_FIN) {
+            expected = i + 1;
+        }
+    }
+    size_t whole = 0, step = 0;
+    parser_reset(m->parser);
+    pop3_multi_scan(m->parser, m->body.data, m->body.len, &whole);
+    parser_reset(m->parser);
+    for (size_t n = 1; n <= m->body.len; n++) {
+        if (pop3_multi_scan(m->parser, m->body.data, n, &step)) {
+            break;
+        }
+    }
+    if (expected == 0 || whole != expected || step != expected) {
+        fprintf(stderr, "pop3_multi_scan: end at %zu and %zu, expected %zu\n",
+                whole, step, expected);
+        exit(1);
+    }
+}
+
+static void
+scan_pop3_multi(void *arg, size_t iterations) {
+    struct multi_case *m = arg;
+    for (size_t it = 0; it < iterations; it++) {
+        size_t scanned = 0;
+        parser_reset(m->parser);
+        micro_sink += pop3_multi_scan(m->parser, m->body.data, m->body.len, &scanned);
+    }
+}
+
+/**
+ * Mail que pasa por un buffer de la transformacion externa hacia un filtro
+ * que lee de a SLOW_READ bytes: despues de cada lectura del origin (lo que
+ * entre en el buffer) se busca el fin del mail. Sin cursor se vuelve a pasar
+ * todo lo que el filtro no leyo todavia, como hacia parse_mail.
+ */
+static void
+slow_reader(struct multi_case *m, size_t iterations, bool cursor) {
+    uint8_t raw_et[ET_BUFFER];
+    for (size_t it = 0; it < iterations; it++) {
+        buffer b;
+        buffer_init(&b, sizeof(raw_et), raw_et);
+        parser_reset(m->parser);
+        size_t offset = 0, scanned = 0;
+        while (offset < m->body.len || buffer_can_read(&b)) {
+            size_t room, count;
+            uint8_t *ptr = buffer_write_ptr(&b, &room);
+            const size_t n = m->body.len - offset < room ? m->body.len - offset : room;
+            memcpy(ptr, m->body.data + offset, n);
+            buffer_write_adv(&b, n);
+            offset += n;
+
+            const uint8_t *rp = buffer_read_ptr(&b, &count);
+            if (cursor) {
+                micro_sink += pop3_multi_scan(m->parser, rp, count, &scanned);
+            } else {
+                for (size_t i = 0; i < count; i++) {
+                    micro_sink += parser_feed(m->parser, rp[i])->type;
+                }
+            }
+            const size_t read = count < SLOW_READ ? count : SLOW_READ;
+            buffer_read_adv(&b, read);
+            scanned = read > scanned ? 0 : scanned - read;
+            if (!buffer_can_write(&b) || offset == m->body.len) {
+                buffer_compact(&b);
+            }
+        }
+    }
+}
+
+static void
+slow_reader_rescan(void *arg, size_t iterations) {
+    slow_reader(arg, iterations, false);
+}
+
+static void
+slow_reader_cursor(void *arg, size_t iterations) {
+    slow_reader(arg, iterations, true);
+}
+
+struct response_case {
+    struct corpus           response;
+    struct response_parser  parser;
+    struct pop3_request     request;
+    uint8_t                *out;
+};
+
+static void
+response_retr(void *arg, size_t iterations) {
+    struct response_case *r = arg;
+    for (size_t it = 0; it < iterations; it++) {
+        buffer rb, wb;
+        buffer_over(&rb, &r->response);
+        buffer_init(&wb, r->response.len, r->out);
+        response_parser_init(&r->parser);
+
+        bool error = false;
+        enum response_state st;
+        do {
+            st = response_consume(&rb, &wb, &r->parser, &error);
+        } while (!response_is_done(st, &error) && buffer_can_read(&rb));
+        micro_sink += st;
+    }
+}
+
+struct request_case {
+    struct corpus           input;
+    struct request_parser   parser;
+    struct pop3_request     request;
+};
+
+static void
+request_pipelined(void *arg, size_t iterations) {
+    struct request_case *r = arg;
+    for (size_t it = 0; it < iterations; it++) {
+        buffer b;
+        buffer_over(&b, &r->input);
+        while (buffer_can_read(&b)) {
+            bool error = false;
+            request_parser_init(&r->parser);
+            micro_sink += request_consume(&b, &r->parser, &error);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// buffers
+
+static uint8_t raw[BUFFER_SIZE];
+
+static void
+buffer_bytes(void *arg, size_t iterations) {
+    buffer b;
+    buffer_init(&b, sizeof(raw), raw);
+    for (size_t it = 0; it < iterations; it++) {
+        while (buffer_can_write(&b)) {
+            buffer_write(&b, (uint8_t) it);
+        }
+        while (buffer_can_read(&b)) {
+            micro_sink += buffer_read(&b);
+        }
+    }
+}
+
+/** escrituras y lecturas de a bloques como las de recv/send */
+static void
+buffer_chunks(void *arg, size_t iterations) {
+    const size_t chunk = *(size_t *) arg;
+    buffer b;
+    buffer_init(&b, sizeof(raw), raw);
+    for (size_t it = 0; it < iterations; it++) {
+        size_t n;
+        uint8_t *ptr = buffer_write_ptr(&b, &n);
+        n = n < chunk ? n : chunk;
+        memset(ptr, 'x', n);
+        buffer_write_adv(&b, n);
+
+        ptr = buffer_read_ptr(&b, &n);
+        micro_sink += ptr[0];
+        buffer_read_adv(&b, n / 2 + 1);
+        buffer_compact(&b);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// comandos y media types
+
+static void
+lookup_cmd(void *arg, size_t iterations) {
+    static const char *names[] = {
+        "RETR", "list", "Uidl", "NOOP", "STAT", "TOP", "DELE", "QUIT", "CAPA",
+        "XYZW",
+    };
+    for (size_t it = 0; it < iterations; it++) {
+        micro_sink += get_cmd(names[it % (sizeof(names) / sizeof(*names))])->id;
+    }
+}
+
+static void
+lookup_media_type(void *arg, size_t iterations) {
+    static const char *queries[][2] = {
+        { "image", "png" }, { "TEXT", "Plain" }, { "application", "pdf" },
+        { "video", "mp4" }, { "audio", "ogg" }, { "message", "rfc822" },
+    };
+    const struct media_types *mt = arg;
+    for (size_t it = 0; it < iterations; it++) {
+        const char **q = queries[it % (sizeof(queries) / sizeof(*queries))];
+        micro_sink += check_media_type(mt, q[0], q[1]);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// trace
+
+/**
+ * un evento por handler, como pop3_trace, con una transicion cada 8. El
+ * instante es el que pop3_read y pop3_write ya toman para el presupuesto.
+ */
+static void
+trace_events(void *arg, size_t iterations) {
+    struct trace_ring *t = arg;
+    for (size_t it = 0; it < iterations; it++) {
+        trace_record(t, it / 4, it % 8 == 0 ? TRACE_TRANSITION : TRACE_READ,
+                     (unsigned) it & 15, OP_READ, OP_WRITE, it * 512, it * 256);
+    }
+    micro_sink += t->entries[t->count & (TRACE_SIZE - 1)].ts;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// selector
+
+static void
+noop_handler(struct selector_key *key) {
+    micro_sink++;
+}
+
+static const struct fd_handler noop_fd_handler = {
+    .handle_read  = noop_handler,
+    .handle_write = noop_handler,
+};
+
+static void
+selector_iteration(void *arg, size_t iterations) {
+    fd_selector s = arg;
+    for (size_t it = 0; it < iterations; it++) {
+        selector_select(s);
+    }
+}
+
+/**
+ * registra `n' sockets. Con `all' todos quedan listos (OP_WRITE); si no, solo
+ * uno tiene datos para leer y el resto espera.
+ */
+static void
+bench_selector(unsigned n, bool all) {
+    int (*pairs)[2] = malloc(n * sizeof(*pairs));
+    fd_selector s   = selector_new(1024);
+    if (pairs == NULL || s == NULL) {
+        fprintf(stderr, "Memory error\n");
+        exit(1);
+    }
+    for (unsigned i = 0; i < n; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pairs[i]) < 0) {
+            perror("socketpair");
+            exit(1);
+        }
+        selector_register(s, pairs[i][0], &noop_fd_handler, all ? OP_WRITE : OP_READ, NULL);
+    }
+    if (!all && write(pairs[n / 2][1], "x", 1) != 1) {
+        perror("write");
+        exit(1);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "selector/%s/%u", all ? "all_ready" : "one_ready", n);
+    micro_run(name, 0, selector_iteration, s);
+
+    selector_destroy(s);
+    for (unsigned i = 0; i < n; i++) {
+        close(pairs[i][0]);
+        close(pairs[i][1]);
+    }
+    free(pairs);
+}
+
+int
+main(int argc, char *argv[]) {
+    micro_init("pop3filter", argc > 1 ? argv[1] : NULL);
+
+    struct multi_case multi = {
+        .body   = retr_response(MAIL_SIZE, false),
+        .parser = parser_init(parser_no_classes(), pop3_multi_parser()),
+    };
+    micro_run("parser_feed/pop3_multi", multi.body.len, parser_pop3_multi, &multi);
+    check_scan(&multi);
+    micro_run("pop3_multi_scan", multi.body.len, scan_pop3_multi, &multi);
+    micro_run("parse_mail/slow_reader_rescan", multi.body.len, slow_reader_rescan, &multi);
+    micro_run("parse_mail/slow_reader_cursor", multi.body.len, slow_reader_cursor, &multi);
+
+    struct response_case response = { .response = retr_response(MAIL_SIZE, true) };
+    response.request.cmd   = get_cmd("RETR");
+    response.parser.request = &response.request;
+    response.out = malloc(response.response.len);
+    micro_run("response_consume/retr", response.response.len, response_retr, &response);
+
+    struct request_case request = { .input = pipelined(PIPELINED) };
+    request.parser.request = &request.request;
+    micro_run("request_consume/pipelined", request.input.len, request_pipelined, &request);
+
+    micro_run("buffer/write_read_byte", sizeof(raw), buffer_bytes, NULL);
+    size_t chunks[] = { 64, 1024 };
+    micro_run("buffer/chunks_64", chunks[0], buffer_chunks, &chunks[0]);
+    micro_run("buffer/chunks_1024", chunks[1], buffer_chunks, &chunks[1]);
+
+    micro_run("get_cmd", 0, lookup_cmd, NULL);
+
+    struct media_types *mt = new_media_types();
+    add_media_type(mt, "image", "*");
+    add_media_type(mt, "application", "pdf");
+    add_media_type(mt, "application", "zip");
+    add_media_type(mt, "text", "plain");
+    add_media_type(mt, "video", "webm");
+    micro_run("check_media_type", 0, lookup_media_type, mt);
+
+    static struct trace_ring trace;
+    const double trace_ns = micro_run("trace_record", 0, trace_events, &trace);
+    if (trace_ns > TRACE_MAX_NS) {
+        fprintf(stderr, "trace_record: %.2f ns per event, expected under %d\n",
+                trace_ns, TRACE_MAX_NS);
+        return 1;
+    }
+
+    const struct selector_init conf = {
+        .signal         = SIGALRM,
+        .select_timeout = { .tv_sec = 1, .tv_nsec = 0 },
+    };
+    if (selector_init(&conf) != SELECTOR_SUCCESS) {
+        fprintf(stderr, "selector_init failed\n");
+        return 1;
+    }
+    const unsigned fds[] = { 16, 128, 448 };
+    for (unsigned i = 0; i < sizeof(fds) / sizeof(*fds); i++) {
+        bench_selector(fds[i], true);
+        bench_selector(fds[i], false);
+    }
+    selector_close();
+
+    parser_destroy(multi.parser);
+    response_parser_destroy(&response.parser);
+    delete_media_types(mt);
+    free(multi.body.data);
+    free(response.response.data);
+    free(response.out);
+    free(request.input.data);
+    return 0;
+}
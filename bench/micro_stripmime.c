@@ -0,0 +1,275 @@
+/**
+ * micro_stripmime.c - micro-benchmarks de los parsers de stripmime y del
+ * filtro completo sobre mails MIME generados.
+ *
+ * El filtro lee de stdin y escribe en stdout: cada corrida rebobina el mail
+ * generado sobre stdin y descarta la salida en /dev/null.
+ *
+ * Uso: micro_stripmime [filtro]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "micro.h"
+#include "parser.h"
+#include "parser_utils.h"
+#include "mime_chars.h"
+#include "mime_msg.h"
+#include "mime_type.h"
+#include "stripmime.h"
+
+#define MAIL_SIZE   (64 * 1024)
+#define LINE        76
+
+struct corpus {
+    char       *data;
+    size_t      len, size;
+};
+
+static void
+append(struct corpus *c, const char *s) {
+    const size_t n = strlen(s);
+    if (c->len + n + 1 > c->size) {
+        c->size = (c->len + n + 1) * 2;
+        c->data = realloc(c->data, c->size);
+        if (c->data == NULL) {
+            fprintf(stderr, "Memory error\n");
+            exit(1);
+        }
+    }
+    memcpy(c->data + c->len, s, n + 1);
+    c->len += n;
+}
+
+/** `size' bytes de lineas de texto o de base64 */
+static void
+filler(struct corpus *c, size_t size, bool base64) {
+    static const char b64[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char line[LINE + 3];
+    for (size_t done = 0, k = 0; done < size; done += LINE + 2, k++) {
+        for (unsigned i = 0; i < LINE; i++) {
+            line[i] = base64 ? b64[(k * 7 + i) % 64]
+                             : (i % 8 == 7 ? ' ' : (char) ('a' + (k + i) % 26));
+        }
+        strcpy(line + LINE, "\r\n");
+        append(c, line);
+    }
+}
+
+static void
+headers(struct corpus *c, const char *type) {
+    append(c, "Content-Type: ");
+    append(c, type);
+    append(c, "\r\n\r\n");
+}
+
+/** mail de una sola parte text/plain */
+static struct corpus
+plain_mail(void) {
+    struct corpus c = { NULL, 0, 0 };
+    append(&c, "From: bench@example.com\r\nSubject: plain\r\nMIME-Version: 1.0\r\n");
+    headers(&c, "text/plain; charset=\"UTF-8\"");
+    filler(&c, MAIL_SIZE, false);
+    return c;
+}
+
+/** multipart/mixed con partes de texto e imagenes (filtradas) alternadas */
+static struct corpus
+multipart_mail(void) {
+    struct corpus c = { NULL, 0, 0 };
+    append(&c, "From: bench@example.com\r\nSubject: multipart\r\nMIME-Version: 1.0\r\n");
+    headers(&c, "multipart/mixed; boundary=\"frontier-0001\"");
+    for (unsigned i = 0; i < 8; i++) {
+        append(&c, "--frontier-0001\r\n");
+        headers(&c, i % 2 == 0 ? "text/plain" : "image/png");
+        filler(&c, MAIL_SIZE / 8, i % 2 == 1);
+    }
+    append(&c, "--frontier-0001--\r\n");
+    return c;
+}
+
+/** multipart/mixed con un multipart/alternative adentro y un adjunto */
+static struct corpus
+nested_mail(void) {
+    struct corpus c = { NULL, 0, 0 };
+    append(&c, "From: bench@example.com\r\nSubject: nested\r\nMIME-Version: 1.0\r\n");
+    headers(&c, "multipart/mixed; boundary=\"outer\"");
+    append(&c, "--outer\r\n");
+    headers(&c, "multipart/alternative; boundary=\"inner\"");
+    append(&c, "--inner\r\n");
+    headers(&c, "text/plain");
+    filler(&c, MAIL_SIZE / 4, false);
+    append(&c, "--inner\r\n");
+    headers(&c, "text/html");
+    filler(&c, MAIL_SIZE / 4, false);
+    append(&c, "--inner--\r\n");
+    append(&c, "--outer\r\n");
+    headers(&c, "application/pdf");
+    filler(&c, MAIL_SIZE / 2, true);
+    append(&c, "--outer--\r\n");
+    return c;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// parsers
+
+struct parser_case {
+    struct corpus   input;
+    struct parser  *parser;
+};
+
+static void
+feed(void *arg, size_t iterations) {
+    struct parser_case *p = arg;
+    for (size_t it = 0; it < iterations; it++) {
+        parser_reset(p->parser);
+        for (size_t i = 0; i < p->input.len; i++) {
+            micro_sink += parser_feed(p->parser, (uint8_t) p->input.data[i])->type;
+        }
+    }
+}
+
+/** nombres de headers contra el comparador de "content-type" */
+static void
+feed_strcmpi(void *arg, size_t iterations) {
+    static const char *names[] = {
+        "Content-Type", "Content-Transfer-Encoding", "From", "content-type",
+        "Subject", "Received", "CONTENT-TYPE", "Message-ID",
+    };
+    struct parser *p = arg;
+    for (size_t it = 0; it < iterations; it++) {
+        const char *s = names[it % (sizeof(names) / sizeof(*names))];
+        parser_reset(p);
+        for (; *s != 0; s++) {
+            micro_sink += parser_feed(p, (uint8_t) *s)->type;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// stripmime completo
+
+static char *
+copy(const char *s) {
+    char *ret = malloc(strlen(s) + 1);
+    if (ret == NULL) {
+        fprintf(stderr, "Memory error\n");
+        exit(1);
+    }
+    return strcpy(ret, s);
+}
+
+/** filtra image/png y application/pdf, como FILTER_MEDIAS */
+static struct Tree *
+filter_tree(void) {
+    static const char *medias[][2] = { { "image", "png" }, { "application", "pdf" } };
+    struct Tree *tree = tree_init();
+    for (unsigned i = 0; tree != NULL && i < 2; i++) {
+        char *type = copy(medias[i][0]), *subtype = copy(medias[i][1]);
+        switch (addNode(tree, type, subtype)) {
+            case ok:
+                break;
+            case err:
+            case both:
+                free(type);
+                free(subtype);
+                break;
+            case typ:
+                free(type);
+                break;
+            case sub:
+                free(subtype);
+                break;
+        }
+    }
+    return tree;
+}
+
+struct strip_case {
+    /** el mail como respuesta multilinea, en un archivo temporal */
+    int     fd;
+};
+
+static struct strip_case
+strip_case(struct corpus *mail) {
+    append(mail, ".\r\n");
+    FILE *f = tmpfile();
+    if (f == NULL || fwrite(mail->data, 1, mail->len, f) != mail->len || fflush(f) != 0) {
+        perror("tmpfile");
+        exit(1);
+    }
+    // el FILE queda abierto hasta el final del proceso
+    return (struct strip_case) { fileno(f) };
+}
+
+static void
+strip(void *arg, size_t iterations) {
+    const struct strip_case *s = arg;
+    for (size_t it = 0; it < iterations; it++) {
+        if (lseek(s->fd, 0, SEEK_SET) < 0 || dup2(s->fd, STDIN_FILENO) < 0) {
+            perror("stdin");
+            exit(1);
+        }
+        struct Tree *tree = filter_tree();
+        if (tree == NULL) {
+            fprintf(stderr, "Memory error\n");
+            exit(1);
+        }
+        // stripmime libera el arbol
+        micro_sink += stripmime(tree, "Parte reemplazada.");
+        fflush(stdout);
+    }
+}
+
+int
+main(int argc, char *argv[]) {
+    micro_init("stripmime", argc > 1 ? argv[1] : NULL);
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    struct corpus plain = plain_mail(), multipart = multipart_mail(),
+                  nested = nested_mail();
+
+    struct parser_case msg = {
+        .input  = multipart,
+        .parser = parser_init(init_char_class(), mime_message_parser()),
+    };
+    micro_run("parser_feed/mime_msg", msg.input.len, feed, &msg);
+
+    struct corpus types = { NULL, 0, 0 };
+    for (unsigned i = 0; i < 256; i++) {
+        append(&types, i % 2 == 0 ? "multipart/mixed; boundary=\"frontier-0001\"\r\n"
+                                  : "text/plain; charset=\"UTF-8\"\r\n");
+    }
+    struct parser_case type = {
+        .input  = types,
+        .parser = parser_init(init_char_class(), mime_type_parser()),
+    };
+    micro_run("parser_feed/mime_type", type.input.len, feed, &type);
+
+    struct parser_definition def = parser_utils_strcmpi("content-type");
+    struct parser *cmp = parser_init(parser_no_classes(), &def);
+    micro_run("parser_feed/strcmpi", 0, feed_strcmpi, cmp);
+
+    struct strip_case strip_plain = strip_case(&plain);
+    micro_run("stripmime/plain", plain.len, strip, &strip_plain);
+    struct strip_case strip_multipart = strip_case(&multipart);
+    micro_run("stripmime/multipart", multipart.len, strip, &strip_multipart);
+    struct strip_case strip_nested = strip_case(&nested);
+    micro_run("stripmime/nested", nested.len, strip, &strip_nested);
+
+    parser_destroy(msg.parser);
+    parser_destroy(type.parser);
+    parser_destroy(cmp);
+    parser_utils_strcmpi_destroy(&def);
+    free(plain.data);
+    free(multipart.data);
+    free(nested.data);
+    free(types.data);
+    return 0;
+}
@@ -0,0 +1,400 @@
+/**
+ * pop3bench.c - generador de carga contra un pop3filter corriendo.
+ *
+ * `clients' hilos abren sesiones y ejecutan uno de estos guiones:
+ *
+ *  - login:    saludo, USER, PASS y QUIT
+ *  - list:     login, UIDL, LIST y QUIT
+ *  - retr:     login, STAT y RETR de todos los mails del buzon
+ *  - pipeline: login y rafagas de `burst' comandos STAT/NOOP enviados juntos
+ *
+ * En lazo cerrado cada hilo abre una sesion nueva al terminar la anterior.
+ * En lazo abierto (-r) las sesiones arrancan a una tasa fija sin importar
+ * cuanto tarden las anteriores, y la latencia del saludo se mide desde el
+ * instante en que la sesion debia arrancar: si el proxy se atrasa, la
+ * demora se ve en los percentiles en lugar de bajar la tasa.
+ *
+ * Reporta sesiones, comandos y MB/s por segundo, y p50/p99/p99.9 por tipo
+ * de comando. Pensado para correr contra un pop3filter con pop3mock de
+ * origin (ver README).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "bench_client.h"
+
+enum bench_cmd {
+    B_CONNECT,
+    B_USER,
+    B_PASS,
+    B_STAT,
+    B_LIST,
+    B_UIDL,
+    B_RETR,
+    B_NOOP,
+    B_QUIT,
+    B_CMDS,
+};
+
+static const char *cmd_names[] = {
+    "connect", "USER", "PASS", "STAT", "LIST", "UIDL", "RETR", "NOOP", "QUIT",
+};
+
+enum workload {
+    W_LOGIN,
+    W_LIST,
+    W_RETR,
+    W_PIPELINE,
+};
+
+static const char *workload_names[] = { "login", "list", "retr", "pipeline" };
+
+static struct {
+    const char     *host;
+    const char     *port;
+    const char     *user;
+    const char     *pass;
+    unsigned        clients;
+    unsigned        seconds;
+    unsigned        burst;
+    /** sesiones por segundo en lazo abierto, 0 es lazo cerrado */
+    double          rate;
+    enum workload   workload;
+} cfg = {
+    .host     = "127.0.0.1",
+    .port     = "1110",
+    .user     = "bench",
+    .pass     = "bench",
+    .clients  = 16,
+    .seconds  = 10,
+    .burst    = 64,
+    .rate     = 0,
+    .workload = W_LOGIN,
+};
+
+struct samples {
+    uint64_t   *v;
+    size_t      n, size;
+};
+
+struct worker {
+    pthread_t       thread;
+    struct samples  latency[B_CMDS];
+    uint64_t        sessions, failed, commands, bytes;
+};
+
+static uint64_t         start, deadline;
+static pthread_mutex_t  schedule_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t         scheduled      = 0;
+
+static void
+sample(struct worker *w, enum bench_cmd cmd, uint64_t since) {
+    struct samples *s = &w->latency[cmd];
+    if (s->n == s->size) {
+        const size_t size = s->size == 0 ? 1024 : s->size * 2;
+        uint64_t *tmp = realloc(s->v, size * sizeof(*tmp));
+        if (tmp == NULL) {
+            return;
+        }
+        s->v    = tmp;
+        s->size = size;
+    }
+    s->v[s->n++] = bench_now_ns() - since;
+    w->commands++;
+}
+
+/** envia `line' y mide la respuesta, de una linea o multilinea */
+static int
+command(struct worker *w, struct bench_conn *c, enum bench_cmd cmd,
+        const char *line, bool multi) {
+    const uint64_t t = bench_now_ns();
+    if (bench_send(c, line) < 0) {
+        return -1;
+    }
+    if (multi) {
+        const ssize_t n = bench_read_multiline(c);
+        if (n < 0) {
+            return -1;
+        }
+        w->bytes += (uint64_t) n;
+    } else if (bench_read_status(c) != 0) {
+        return -1;
+    }
+    sample(w, cmd, t);
+    return 0;
+}
+
+/** conecta y se autentica; la latencia del saludo se mide desde `since' */
+static int
+login(struct worker *w, struct bench_conn *c, uint64_t since) {
+    char line[BENCH_LINE_SIZE];
+    if (bench_connect(c, cfg.host, cfg.port) < 0 || bench_read_status(c) != 0) {
+        return -1;
+    }
+    sample(w, B_CONNECT, since);
+
+    snprintf(line, sizeof(line), "USER %s", cfg.user);
+    if (command(w, c, B_USER, line, false) < 0) {
+        return -1;
+    }
+    snprintf(line, sizeof(line), "PASS %s", cfg.pass);
+    return command(w, c, B_PASS, line, false);
+}
+
+/** STAT, retorna la cantidad de mails o -1 */
+static long
+mailbox_size(struct worker *w, struct bench_conn *c) {
+    char line[BENCH_LINE_SIZE];
+    const uint64_t t = bench_now_ns();
+    if (bench_send(c, "STAT") < 0 || bench_read_line(c, line, sizeof(line)) < 0
+        || strncmp(line, "+OK ", 4) != 0) {
+        return -1;
+    }
+    sample(w, B_STAT, t);
+    return strtol(line + 4, NULL, 10);
+}
+
+/** envia `burst' comandos juntos y mide cada respuesta desde el envio */
+static int
+pipeline(struct worker *w, struct bench_conn *c) {
+    // STAT y NOOP alternados, todos de 6 bytes
+    const size_t len = cfg.burst * 6;
+    char *buf = malloc(len);
+    if (buf == NULL) {
+        return -1;
+    }
+    for (unsigned i = 0; i < cfg.burst; i++) {
+        memcpy(buf + i * 6, i % 2 == 0 ? "STAT\r\n" : "NOOP\r\n", 6);
+    }
+
+    int ret = 0;
+    while (ret == 0 && bench_now_ns() < deadline) {
+        const uint64_t t = bench_now_ns();
+        if (bench_write(c, buf, len) < 0) {
+            ret = -1;
+            break;
+        }
+        for (unsigned i = 0; i < cfg.burst; i++) {
+            if (bench_read_status(c) != 0) {
+                ret = -1;
+                break;
+            }
+            sample(w, i % 2 == 0 ? B_STAT : B_NOOP, t);
+        }
+    }
+    free(buf);
+    return ret;
+}
+
+static int
+session(struct worker *w, uint64_t since) {
+    struct bench_conn c;
+    int ret = login(w, &c, since);
+    long n;
+
+    if (ret == 0) {
+        switch (cfg.workload) {
+            case W_LOGIN:
+                break;
+            case W_LIST:
+                ret = command(w, &c, B_UIDL, "UIDL", true) < 0
+                      || command(w, &c, B_LIST, "LIST", true) < 0 ? -1 : 0;
+                break;
+            case W_RETR:
+                ret = (n = mailbox_size(w, &c)) < 0 ? -1 : 0;
+                for (long i = 1; ret == 0 && i <= n; i++) {
+                    char line[32];
+                    snprintf(line, sizeof(line), "RETR %ld", i);
+                    ret = command(w, &c, B_RETR, line, true);
+                }
+                break;
+            case W_PIPELINE:
+                ret = pipeline(w, &c);
+                break;
+        }
+    }
+    if (ret == 0) {
+        ret = command(w, &c, B_QUIT, "QUIT", false);
+    }
+    bench_close(&c);
+    return ret;
+}
+
+static void
+sleep_until(uint64_t t) {
+    const uint64_t now = bench_now_ns();
+    if (t > now) {
+        struct timespec ts = {
+            .tv_sec  = (t - now) / 1000000000,
+            .tv_nsec = (t - now) % 1000000000,
+        };
+        while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+            // sigue durmiendo
+        }
+    }
+}
+
+static void *
+run(void *arg) {
+    struct worker *w = arg;
+    for (;;) {
+        uint64_t since = bench_now_ns();
+        if (cfg.rate > 0) {
+            pthread_mutex_lock(&schedule_mutex);
+            since = start + (uint64_t)((double) scheduled++ * 1e9 / cfg.rate);
+            pthread_mutex_unlock(&schedule_mutex);
+        }
+        if (since >= deadline) {
+            break;
+        }
+        sleep_until(since);
+        if (session(w, since) == 0) {
+            w->sessions++;
+        } else {
+            w->failed++;
+        }
+    }
+    return NULL;
+}
+
+static void
+print_help(void) {
+    printf("Uso: pop3bench [OPTION]\n");
+    printf("Generador de carga POP3 contra un pop3filter corriendo.\n\n");
+    printf("%-24s%s\n", "\t-b rafaga", "comandos por rafaga en pipeline (64)");
+    printf("%-24s%s\n", "\t-c clientes", "hilos con sesiones concurrentes (16)");
+    printf("%-24s%s\n", "\t-d segundos", "duracion de la corrida (10)");
+    printf("%-24s%s\n", "\t-H host", "host del proxy (127.0.0.1)");
+    printf("%-24s%s\n", "\t-k clave", "clave para PASS (bench)");
+    printf("%-24s%s\n", "\t-p puerto", "puerto del proxy (1110)");
+    printf("%-24s%s\n", "\t-r sesiones", "lazo abierto: sesiones nuevas por segundo");
+    printf("%-24s%s\n", "\t-u usuario", "usuario para USER (bench)");
+    printf("%-24s%s\n", "\t-w guion", "login, list, retr o pipeline (login)");
+}
+
+static void
+parse_options(int argc, char *argv[]) {
+    int c;
+    while ((c = getopt(argc, argv, "b:c:d:hH:k:p:r:u:w:")) != -1) {
+        switch (c) {
+            case 'b':
+                cfg.burst = (unsigned) atoi(optarg);
+                break;
+            case 'c':
+                cfg.clients = (unsigned) atoi(optarg);
+                break;
+            case 'd':
+                cfg.seconds = (unsigned) atoi(optarg);
+                break;
+            case 'H':
+                cfg.host = optarg;
+                break;
+            case 'k':
+                cfg.pass = optarg;
+                break;
+            case 'p':
+                cfg.port = optarg;
+                break;
+            case 'r':
+                cfg.rate = atof(optarg);
+                break;
+            case 'u':
+                cfg.user = optarg;
+                break;
+            case 'w': {
+                unsigned i;
+                for (i = 0; i <= W_PIPELINE && strcmp(optarg, workload_names[i]) != 0; i++) {
+                    // busca el guion
+                }
+                if (i > W_PIPELINE) {
+                    fprintf(stderr, "Unknown workload: %s\n", optarg);
+                    exit(1);
+                }
+                cfg.workload = (enum workload) i;
+                break;
+            }
+            case 'h':
+                print_help();
+                exit(0);
+            default:
+                print_help();
+                exit(1);
+        }
+    }
+    if (cfg.clients == 0 || cfg.seconds == 0 || cfg.burst == 0) {
+        fprintf(stderr, "Clients, seconds and burst should be positive\n");
+        exit(1);
+    }
+}
+
+int
+main(int argc, char *argv[]) {
+    parse_options(argc, argv);
+
+    struct worker *workers = calloc(cfg.clients, sizeof(*workers));
+    if (workers == NULL) {
+        fprintf(stderr, "Memory error\n");
+        return 1;
+    }
+
+    start    = bench_now_ns();
+    deadline = start + (uint64_t) cfg.seconds * 1000000000;
+    for (unsigned i = 0; i < cfg.clients; i++) {
+        if (pthread_create(&workers[i].thread, NULL, run, &workers[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    struct worker total;
+    memset(&total, 0, sizeof(total));
+    for (unsigned i = 0; i < cfg.clients; i++) {
+        struct worker *w = &workers[i];
+        pthread_join(w->thread, NULL);
+        total.sessions += w->sessions;
+        total.failed   += w->failed;
+        total.commands += w->commands;
+        total.bytes    += w->bytes;
+        for (unsigned j = 0; j < B_CMDS; j++) {
+            struct samples *s = &total.latency[j];
+            const size_t n = s->n + w->latency[j].n;
+            uint64_t *tmp = n == 0 ? NULL : realloc(s->v, n * sizeof(*tmp));
+            if (tmp != NULL) {
+                memcpy(tmp + s->n, w->latency[j].v, w->latency[j].n * sizeof(*tmp));
+                s->v = tmp;
+                s->n = n;
+            }
+            free(w->latency[j].v);
+        }
+    }
+    const double elapsed = (double)(bench_now_ns() - start) / 1e9;
+
+    printf("workload %s, %s loop, %u clients, %.1f s\n",
+           workload_names[cfg.workload], cfg.rate > 0 ? "open" : "closed",
+           cfg.clients, elapsed);
+    printf("sessions %llu (%.1f/s) failed %llu, commands %llu (%.1f/s), %.2f MB/s\n",
+           (unsigned long long) total.sessions, total.sessions / elapsed,
+           (unsigned long long) total.failed, (unsigned long long) total.commands,
+           total.commands / elapsed, total.bytes / elapsed / 1e6);
+    printf("%-8s %10s %12s %12s %12s %12s\n", "command", "count", "p50(us)",
+           "p99(us)", "p99.9(us)", "max(us)");
+    for (unsigned i = 0; i < B_CMDS; i++) {
+        struct samples *s = &total.latency[i];
+        if (s->n == 0) {
+            continue;
+        }
+        printf("%-8s %10zu %12.1f %12.1f %12.1f %12.1f\n", cmd_names[i], s->n,
+               bench_percentile(s->v, s->n, 50) / 1e3,
+               bench_percentile(s->v, s->n, 99) / 1e3,
+               bench_percentile(s->v, s->n, 99.9) / 1e3,
+               bench_percentile(s->v, s->n, 100) / 1e3);
+        free(s->v);
+    }
+    free(workers);
+    return total.failed == 0 ? 0 : 1;
+}
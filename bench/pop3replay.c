@@ -0,0 +1,449 @@
+/**
+ * pop3replay.c - reproduce sesiones capturadas por pop3filter (-C) contra un
+ * pop3filter corriendo.
+ *
+ * pop3replay hace de ambos extremos: abre las conexiones de los clientes
+ * contra el proxy y atiende en `-o' las del proxy hacia el origin, que debe
+ * apuntar ahi (pop3filter -P <puerto> 127.0.0.1). Por cada sesion un hilo
+ * envia lo que habia mandado el cliente y otro lo que habia mandado el
+ * origin; lo que envia el proxy se lee y se compara solo en cantidad de
+ * bytes, en el mismo orden que en la captura.
+ *
+ * Por defecto cada envio espera al instante en que ocurrio en la captura,
+ * relativo al inicio de la sesion, para reproducir la forma del trafico
+ * (rafagas de pipelining, pausas del cliente, origins lentos). Con -f se
+ * envia todo lo antes posible.
+ *
+ * Para emparejar las dos conexiones de una sesion, la conexion del cliente y
+ * la aceptacion de la del proxy se hacen de a una sesion por vez.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/time.h>
+
+#include "bench_client.h"
+#include "capture.h"
+
+#define PENDING_CONNECTIONS 128
+
+static struct {
+    const char     *host;
+    const char     *port;
+    const char     *origin_port;
+    unsigned        clients;
+    unsigned        loops;
+    unsigned        timeout;
+    bool            fast;
+} cfg = {
+    .host        = "127.0.0.1",
+    .port        = "1110",
+    .origin_port = "2110",
+    .clients     = 1,
+    .loops       = 1,
+    .timeout     = 5,
+    .fast        = false,
+};
+
+struct samples {
+    uint64_t   *v;
+    size_t      n, size;
+};
+
+struct worker {
+    pthread_t       thread;
+    /** duracion de cada sesion y atraso respecto de la captura */
+    struct samples  duration, lag;
+    uint64_t        sessions, failed, bytes;
+};
+
+/** un extremo de una sesion reproducida */
+struct side {
+    int                         fd;
+    const struct capture_file  *capture;
+    /** lo que se envia y lo que se espera leer */
+    enum record_dir             in, out;
+    uint64_t                    start;
+    uint64_t                    bytes;
+    /** bytes que faltaron, o -1 si fallo un envio */
+    int64_t                     missing;
+};
+
+static struct capture_file *captures;
+static size_t               n_captures;
+static const char         **paths;
+
+static int                  origin_listener = -1;
+static pthread_mutex_t      pair_mutex      = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t      next_mutex      = PTHREAD_MUTEX_INITIALIZER;
+static size_t               next_job        = 0;
+
+static void
+sample(struct samples *s, uint64_t v) {
+    if (s->n == s->size) {
+        const size_t size = s->size == 0 ? 1024 : s->size * 2;
+        uint64_t *tmp = realloc(s->v, size * sizeof(*tmp));
+        if (tmp == NULL) {
+            return;
+        }
+        s->v    = tmp;
+        s->size = size;
+    }
+    s->v[s->n++] = v;
+}
+
+static void
+sleep_until(uint64_t t) {
+    const uint64_t now = bench_now_ns();
+    if (t > now) {
+        struct timespec ts = {
+            .tv_sec  = (t - now) / 1000000000,
+            .tv_nsec = (t - now) % 1000000000,
+        };
+        while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+            // sigue durmiendo
+        }
+    }
+}
+
+/** lee y descarta `n' bytes. Retorna los que faltaron leer */
+static size_t
+read_n(int fd, size_t n) {
+    char buf[16 * 1024];
+    while (n > 0) {
+        const ssize_t r = recv(fd, buf, n < sizeof(buf) ? n : sizeof(buf), 0);
+        if (r <= 0) {
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        n -= (size_t) r;
+    }
+    return n;
+}
+
+/** reproduce un extremo de la sesion */
+static void *
+side_run(void *arg) {
+    struct side *s = arg;
+    struct bench_conn c = { .fd = s->fd, .start = 0, .end = 0 };
+
+    for (size_t i = 0; i < s->capture->count; i++) {
+        const struct capture_record *r = &s->capture->records[i];
+        if (r->dir == s->in) {
+            if (!cfg.fast) {
+                sleep_until(s->start + r->at * 1000);
+            }
+            if (bench_write(&c, r->data, r->len) < 0) {
+                s->missing = -1;
+                break;
+            }
+            s->bytes += r->len;
+        } else if (r->dir == s->out) {
+            const size_t missing = read_n(s->fd, r->len);
+            s->bytes += r->len - missing;
+            if (missing > 0) {
+                s->missing = (int64_t) missing;
+                break;
+            }
+        }
+    }
+    // no se envia nada mas: el otro extremo ve el cierre como en la captura
+    shutdown(s->fd, SHUT_WR);
+    return NULL;
+}
+
+static bool
+has_origin(const struct capture_file *f) {
+    for (size_t i = 0; i < f->count; i++) {
+        if (f->records[i].dir == RECORD_ORIGIN_IN || f->records[i].dir == RECORD_ORIGIN_OUT) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+set_timeout(int fd) {
+    const struct timeval tv = { .tv_sec = cfg.timeout, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/** conecta el cliente y acepta la conexion del proxy al origin */
+static int
+pair(struct bench_conn *client, int *origin, bool with_origin) {
+    int ret = 0;
+    *origin = -1;
+    pthread_mutex_lock(&pair_mutex);
+    if (bench_connect(client, cfg.host, cfg.port) < 0) {
+        ret = -1;
+    } else if (with_origin) {
+        struct pollfd pfd = { .fd = origin_listener, .events = POLLIN };
+        if (poll(&pfd, 1, (int) cfg.timeout * 1000) <= 0
+            || (*origin = accept(origin_listener, NULL, NULL)) < 0) {
+            ret = -1;
+        }
+    }
+    pthread_mutex_unlock(&pair_mutex);
+    return ret;
+}
+
+static int
+replay(struct worker *w, const struct capture_file *f, const char *path) {
+    const bool with_origin = has_origin(f);
+    const uint64_t start   = bench_now_ns();
+    struct bench_conn client;
+    int origin;
+
+    if (pair(&client, &origin, with_origin) < 0) {
+        fprintf(stderr, "%s: could not pair connections\n", path);
+        bench_close(&client);
+        return -1;
+    }
+    set_timeout(client.fd);
+
+    struct side cs = {
+        .fd = client.fd, .capture = f, .in = RECORD_CLIENT_IN, .out = RECORD_CLIENT_OUT,
+        .start = start,
+    };
+    struct side os = {
+        .fd = origin, .capture = f, .in = RECORD_ORIGIN_IN, .out = RECORD_ORIGIN_OUT,
+        .start = start,
+    };
+    pthread_t origin_thread;
+    if (with_origin) {
+        const int one = 1;
+        setsockopt(origin, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        set_timeout(origin);
+        if (pthread_create(&origin_thread, NULL, side_run, &os) != 0) {
+            perror("pthread_create");
+            close(origin);
+            bench_close(&client);
+            return -1;
+        }
+    }
+    side_run(&cs);
+    if (with_origin) {
+        pthread_join(origin_thread, NULL);
+        close(origin);
+    }
+    bench_close(&client);
+
+    const uint64_t duration = bench_now_ns() - start;
+    const uint64_t recorded = f->count == 0 ? 0 : f->records[f->count - 1].at * 1000;
+    w->bytes += cs.bytes + os.bytes;
+    if (cs.missing != 0 || os.missing != 0) {
+        fprintf(stderr, "%s: client %lld, origin %lld bytes missing\n", path,
+                (long long) cs.missing, (long long) os.missing);
+        return -1;
+    }
+    sample(&w->duration, duration);
+    sample(&w->lag, duration > recorded ? duration - recorded : 0);
+    return 0;
+}
+
+static void *
+run(void *arg) {
+    struct worker *w = arg;
+    for (;;) {
+        pthread_mutex_lock(&next_mutex);
+        const size_t job = next_job++;
+        pthread_mutex_unlock(&next_mutex);
+        if (job >= n_captures * cfg.loops) {
+            break;
+        }
+        const size_t i = job % n_captures;
+        if (replay(w, &captures[i], paths[i]) == 0) {
+            w->sessions++;
+        } else {
+            w->failed++;
+        }
+    }
+    return NULL;
+}
+
+static int
+listen_origin(void) {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_PASSIVE;
+    if (getaddrinfo(NULL, cfg.origin_port, &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai != NULL && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        const int one = 1;
+        if (fd >= 0 && (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+                        || bind(fd, ai->ai_addr, ai->ai_addrlen) < 0
+                        || listen(fd, PENDING_CONNECTIONS) < 0)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static void
+print_help(void) {
+    printf("Uso: pop3replay [OPTION] captura...\n");
+    printf("Reproduce sesiones capturadas con pop3filter -C contra un pop3filter "
+           "corriendo.\n\n");
+    printf("%-24s%s\n", "\t-c clientes", "sesiones concurrentes (1)");
+    printf("%-24s%s\n", "\t-f", "envia todo lo antes posible, sin los tiempos capturados");
+    printf("%-24s%s\n", "\t-H host", "host del proxy (127.0.0.1)");
+    printf("%-24s%s\n", "\t-n vueltas", "veces que se reproduce cada captura (1)");
+    printf("%-24s%s\n", "\t-o puerto", "puerto donde se atiende al proxy como origin (2110)");
+    printf("%-24s%s\n", "\t-p puerto", "puerto del proxy (1110)");
+    printf("%-24s%s\n", "\t-t segundos", "espera maxima de cada lectura (5)");
+}
+
+static void
+parse_options(int argc, char *argv[]) {
+    int c;
+    while ((c = getopt(argc, argv, "c:fhH:n:o:p:t:")) != -1) {
+        switch (c) {
+            case 'c':
+                cfg.clients = (unsigned) atoi(optarg);
+                break;
+            case 'f':
+                cfg.fast = true;
+                break;
+            case 'H':
+                cfg.host = optarg;
+                break;
+            case 'n':
+                cfg.loops = (unsigned) atoi(optarg);
+                break;
+            case 'o':
+                cfg.origin_port = optarg;
+                break;
+            case 'p':
+                cfg.port = optarg;
+                break;
+            case 't':
+                cfg.timeout = (unsigned) atoi(optarg);
+                break;
+            case 'h':
+                print_help();
+                exit(0);
+            default:
+                print_help();
+                exit(1);
+        }
+    }
+    if (cfg.clients == 0 || cfg.loops == 0 || cfg.timeout == 0) {
+        fprintf(stderr, "Clients, loops and timeout should be positive\n");
+        exit(1);
+    }
+    if (optind == argc) {
+        print_help();
+        exit(1);
+    }
+}
+
+static void
+merge(struct samples *into, struct samples *from) {
+    const size_t n = into->n + from->n;
+    uint64_t *tmp = n == 0 ? NULL : realloc(into->v, n * sizeof(*tmp));
+    if (tmp != NULL) {
+        memcpy(tmp + into->n, from->v, from->n * sizeof(*tmp));
+        into->v = tmp;
+        into->n = n;
+    }
+    free(from->v);
+}
+
+static void
+print_samples(const char *name, struct samples *s) {
+    if (s->n == 0) {
+        return;
+    }
+    printf("%-10s %12.1f %12.1f %12.1f %12.1f\n", name,
+           bench_percentile(s->v, s->n, 50) / 1e6,
+           bench_percentile(s->v, s->n, 99) / 1e6,
+           bench_percentile(s->v, s->n, 99.9) / 1e6,
+           bench_percentile(s->v, s->n, 100) / 1e6);
+}
+
+int
+main(int argc, char *argv[]) {
+    parse_options(argc, argv);
+
+    n_captures = (size_t) (argc - optind);
+    paths      = (const char **) argv + optind;
+    captures   = calloc(n_captures, sizeof(*captures));
+    struct worker *workers = calloc(cfg.clients, sizeof(*workers));
+    if (captures == NULL || workers == NULL) {
+        fprintf(stderr, "Memory error\n");
+        return 1;
+    }
+    for (size_t i = 0; i < n_captures; i++) {
+        if (capture_file_load(&captures[i], paths[i]) < 0) {
+            fprintf(stderr, "%s: %s\n", paths[i], strerror(errno));
+            return 1;
+        }
+    }
+
+    origin_listener = listen_origin();
+    if (origin_listener < 0) {
+        fprintf(stderr, "Could not listen on port %s\n", cfg.origin_port);
+        return 1;
+    }
+
+    const uint64_t start = bench_now_ns();
+    for (unsigned i = 0; i < cfg.clients; i++) {
+        if (pthread_create(&workers[i].thread, NULL, run, &workers[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    struct worker total;
+    memset(&total, 0, sizeof(total));
+    for (unsigned i = 0; i < cfg.clients; i++) {
+        struct worker *w = &workers[i];
+        pthread_join(w->thread, NULL);
+        total.sessions += w->sessions;
+        total.failed   += w->failed;
+        total.bytes    += w->bytes;
+        merge(&total.duration, &w->duration);
+        merge(&total.lag, &w->lag);
+    }
+    const double elapsed = (double)(bench_now_ns() - start) / 1e9;
+
+    printf("%zu captures x %u, %s, %u clients, %.1f s\n", n_captures, cfg.loops,
+           cfg.fast ? "fast" : "recorded speed", cfg.clients, elapsed);
+    printf("sessions %llu (%.1f/s) failed %llu, %.2f MB/s\n",
+           (unsigned long long) total.sessions, total.sessions / elapsed,
+           (unsigned long long) total.failed, total.bytes / elapsed / 1e6);
+    printf("%-10s %12s %12s %12s %12s\n", "", "p50(ms)", "p99(ms)", "p99.9(ms)", "max(ms)");
+    print_samples("session", &total.duration);
+    if (!cfg.fast) {
+        print_samples("lag", &total.lag);
+    }
+
+    free(total.duration.v);
+    free(total.lag.v);
+    for (size_t i = 0; i < n_captures; i++) {
+        capture_file_free(&captures[i]);
+    }
+    free(captures);
+    free(workers);
+    close(origin_listener);
+    return total.failed == 0 ? 0 : 1;
+}
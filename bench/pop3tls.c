@@ -0,0 +1,381 @@
+/**
+ * pop3tls.c - cliente pop3 con TLS para la prueba de integracion de POP3S y
+ * STLS (ver tls_test.sh).
+ *
+ * Lee un guion de la entrada estandar: un comando por linea, y las lineas en
+ * blanco separan rafagas que se envian en una sola escritura (pipelining).
+ * Las respuestas de cada rafaga se leen en orden, sabiendo cuales son
+ * multilinea, y se escriben tal cual llegan (ya descifradas) en la salida
+ * estandar; el saludo no, porque el del proxy no es el del origin. Al final
+ * se lee hasta que se cierre la conexion, asi que cualquier respuesta de mas
+ * tambien queda en la salida.
+ *
+ * Un STLS aceptado negocia TLS en la misma conexion. Los comandos que lo
+ * siguen en su rafaga ya se enviaron en claro y no esperan respuesta: el
+ * servidor los tiene que descartar.
+ *
+ * Con -n se corre el guion en varias conexiones seguidas; de la segunda en
+ * adelante se retoma la sesion TLS de la anterior y falla si no se retoma.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "bench_client.h"
+
+/** linea mas larga que se acepta en una respuesta */
+#define TLS_LINE_SIZE   (64 * 1024)
+
+static struct {
+    const char     *host;
+    const char     *port;
+    const char     *ca;
+    unsigned        conns;
+    unsigned        timeout;
+    bool            implicit;
+} cfg = {
+    .host     = "127.0.0.1",
+    .port     = "1110",
+    .ca       = NULL,
+    .conns    = 1,
+    .timeout  = 10,
+    .implicit = false,
+};
+
+/** un comando del guion; `burst' numera la rafaga a la que pertenece */
+struct command {
+    char        line[BENCH_LINE_SIZE];
+    unsigned    burst;
+};
+
+struct script {
+    struct command *v;
+    size_t          n;
+};
+
+struct conn {
+    struct bench_conn   c;
+    /** NULL mientras la conexion esta en claro */
+    SSL                *ssl;
+};
+
+static SSL_CTX     *ctx     = NULL;
+static SSL_SESSION *session = NULL;
+
+static void
+print_help(void) {
+    printf("Uso: pop3tls [OPTION] < guion\n");
+    printf("Corre un guion pop3 (rafagas separadas por lineas en blanco) y escribe "
+           "las respuestas.\n\n");
+    printf("%-24s%s\n", "\t-c certificado", "valida al servidor contra este certificado");
+    printf("%-24s%s\n", "\t-H host", "host del servidor (127.0.0.1)");
+    printf("%-24s%s\n", "\t-n conexiones", "veces que se corre el guion, retomando la sesion TLS (1)");
+    printf("%-24s%s\n", "\t-p puerto", "puerto del servidor (1110)");
+    printf("%-24s%s\n", "\t-s", "TLS desde el inicio (POP3S)");
+    printf("%-24s%s\n", "\t-t segundos", "espera maxima de cada lectura (10)");
+}
+
+static void
+parse_options(int argc, char *argv[]) {
+    int c;
+    while ((c = getopt(argc, argv, "c:hH:n:p:st:")) != -1) {
+        switch (c) {
+            case 'c':
+                cfg.ca = optarg;
+                break;
+            case 'H':
+                cfg.host = optarg;
+                break;
+            case 'n':
+                cfg.conns = (unsigned) atoi(optarg);
+                break;
+            case 'p':
+                cfg.port = optarg;
+                break;
+            case 's':
+                cfg.implicit = true;
+                break;
+            case 't':
+                cfg.timeout = (unsigned) atoi(optarg);
+                break;
+            case 'h':
+                print_help();
+                exit(0);
+            default:
+                print_help();
+                exit(1);
+        }
+    }
+    if (cfg.conns == 0 || cfg.timeout == 0) {
+        fprintf(stderr, "Connections and timeout should be positive\n");
+        exit(1);
+    }
+}
+
+static void
+read_script(struct script *s) {
+    char line[BENCH_LINE_SIZE];
+    size_t size = 0;
+    unsigned burst = 0;
+    bool empty = true;
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == 0) {
+            burst += empty ? 0 : 1;
+            empty = true;
+            continue;
+        }
+        if (s->n == size) {
+            size = size == 0 ? 16 : size * 2;
+            struct command *tmp = realloc(s->v, size * sizeof(*tmp));
+            if (tmp == NULL) {
+                perror("realloc");
+                exit(1);
+            }
+            s->v = tmp;
+        }
+        strcpy(s->v[s->n].line, line);
+        s->v[s->n].burst = burst;
+        s->n++;
+        empty = false;
+    }
+}
+
+/** si la respuesta de `cmd' es multilinea cuando es +OK */
+static bool
+is_multiline(const char *cmd) {
+    const size_t n = strcspn(cmd, " ");
+    if ((n == 4 && strncasecmp(cmd, "LIST", 4) == 0)
+        || (n == 4 && strncasecmp(cmd, "UIDL", 4) == 0)) {
+        return cmd[n] == 0;
+    }
+    return (n == 4 && strncasecmp(cmd, "CAPA", 4) == 0)
+        || (n == 4 && strncasecmp(cmd, "RETR", 4) == 0)
+        || (n == 3 && strncasecmp(cmd, "TOP", 3) == 0);
+}
+
+static bool
+is_stls(const char *cmd) {
+    return strcasecmp(cmd, "STLS") == 0;
+}
+
+static void
+tls_fail(const char *what) {
+    fprintf(stderr, "%s failed\n", what);
+    ERR_print_errors_fp(stderr);
+    exit(1);
+}
+
+/** lee lo que haya del socket. Retorna 0 si se cerro la conexion */
+static ssize_t
+conn_fill(struct conn *c) {
+    struct bench_conn *b = &c->c;
+    if (b->start == b->end) {
+        b->start = b->end = 0;
+    }
+    ssize_t n;
+    if (c->ssl != NULL) {
+        n = SSL_read(c->ssl, b->buf + b->end, sizeof(b->buf) - b->end);
+        if (n <= 0) {
+            if (SSL_get_error(c->ssl, (int) n) == SSL_ERROR_ZERO_RETURN) {
+                return 0;
+            }
+            tls_fail("SSL_read");
+        }
+    } else {
+        n = recv(b->fd, b->buf + b->end, sizeof(b->buf) - b->end, 0);
+        if (n < 0) {
+            perror("recv");
+            exit(1);
+        }
+    }
+    b->end += (size_t) n;
+    return n;
+}
+
+static void
+conn_write(struct conn *c, const char *data, size_t n) {
+    if (c->ssl != NULL) {
+        size_t written;
+        if (SSL_write_ex(c->ssl, data, n, &written) != 1) {
+            tls_fail("SSL_write");
+        }
+    } else if (bench_write(&c->c, data, n) < 0) {
+        perror("send");
+        exit(1);
+    }
+}
+
+/**
+ * lee una linea, CRLF incluido, en `line'. Retorna su longitud o 0 si se
+ * cerro la conexion.
+ */
+static size_t
+conn_read_line(struct conn *c, char *line) {
+    struct bench_conn *b = &c->c;
+    size_t len = 0;
+    for (;;) {
+        while (b->start < b->end) {
+            const char ch = b->buf[b->start++];
+            if (len == TLS_LINE_SIZE) {
+                fprintf(stderr, "Line too long\n");
+                exit(1);
+            }
+            line[len++] = ch;
+            if (ch == '\n') {
+                return len;
+            }
+        }
+        if (conn_fill(c) == 0) {
+            if (len != 0) {
+                fprintf(stderr, "Connection closed inside a line\n");
+                exit(1);
+            }
+            return 0;
+        }
+    }
+}
+
+/** lee la respuesta a `cmd' y la copia a la salida. Retorna si fue +OK */
+static bool
+read_response(struct conn *c, const char *cmd, char *line) {
+    size_t n = conn_read_line(c, line);
+    if (n == 0) {
+        fprintf(stderr, "Connection closed waiting for %s\n", cmd);
+        exit(1);
+    }
+    fwrite(line, 1, n, stdout);
+    const bool ok = strncmp(line, "+OK", 3) == 0;
+    if (ok && is_multiline(cmd)) {
+        do {
+            n = conn_read_line(c, line);
+            if (n == 0) {
+                fprintf(stderr, "Connection closed inside the reply to %s\n", cmd);
+                exit(1);
+            }
+            fwrite(line, 1, n, stdout);
+        } while (n != 3 || strncmp(line, ".\r\n", 3) != 0);
+    }
+    return ok;
+}
+
+static void
+tls_start(struct conn *c, unsigned i) {
+    if (c->c.start != c->c.end) {
+        fprintf(stderr, "Plaintext received before the TLS handshake\n");
+        exit(1);
+    }
+    c->ssl = SSL_new(ctx);
+    if (c->ssl == NULL || SSL_set_fd(c->ssl, c->c.fd) != 1) {
+        tls_fail("SSL_new");
+    }
+    if (session != NULL) {
+        SSL_set_session(c->ssl, session);
+    }
+    if (SSL_connect(c->ssl) != 1) {
+        tls_fail("SSL_connect");
+    }
+    if (i > 0 && !SSL_session_reused(c->ssl)) {
+        fprintf(stderr, "Connection %u did not resume the TLS session\n", i + 1);
+        exit(1);
+    }
+}
+
+static void
+run(const struct script *s, unsigned i) {
+    static char line[TLS_LINE_SIZE];
+    struct conn c = { .ssl = NULL };
+
+    if (bench_connect(&c.c, cfg.host, cfg.port) < 0) {
+        fprintf(stderr, "Cannot connect to %s:%s\n", cfg.host, cfg.port);
+        exit(1);
+    }
+    const struct timeval tv = { .tv_sec = (time_t) cfg.timeout };
+    setsockopt(c.c.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (cfg.implicit) {
+        tls_start(&c, i);
+    }
+    if (conn_read_line(&c, line) == 0) {
+        fprintf(stderr, "Connection closed before the greeting\n");
+        exit(1);
+    }
+
+    for (size_t first = 0, last; first < s->n; first = last) {
+        // la rafaga va entera en una escritura
+        size_t len = 0;
+        for (last = first; last < s->n && s->v[last].burst == s->v[first].burst; last++) {
+            const size_t n = strlen(s->v[last].line);
+            memcpy(line + len, s->v[last].line, n);
+            memcpy(line + len + n, "\r\n", 2);
+            len += n + 2;
+        }
+        conn_write(&c, line, len);
+        for (size_t j = first; j < last; j++) {
+            const char *cmd = s->v[j].line;
+            if (read_response(&c, cmd, line) && is_stls(cmd) && c.ssl == NULL) {
+                // lo que sigue en la rafaga se envio en claro: sin respuesta
+                tls_start(&c, i);
+                break;
+            }
+        }
+    }
+
+    if (c.ssl != NULL) {
+        // ya llegaron los tickets de TLS 1.3, que vienen despues del handshake
+        SSL_SESSION_free(session);
+        session = SSL_get1_session(c.ssl);
+    }
+    size_t n;
+    while ((n = conn_read_line(&c, line)) != 0) {
+        fwrite(line, 1, n, stdout);
+    }
+    if (c.ssl != NULL) {
+        // sin el close_notify propio, SSL_free marca la sesion como no retomable
+        SSL_shutdown(c.ssl);
+        SSL_free(c.ssl);
+    }
+    bench_close(&c.c);
+}
+
+int
+main(int argc, char *argv[]) {
+    struct script s = { .v = NULL, .n = 0 };
+
+    parse_options(argc, argv);
+    read_script(&s);
+    // el close_notify final puede escribirse sobre una conexion ya cerrada
+    signal(SIGPIPE, SIG_IGN);
+
+    ctx = SSL_CTX_new(TLS_client_method());
+    if (ctx == NULL) {
+        tls_fail("SSL_CTX_new");
+    }
+    // un cierre sin close_notify es el fin de la sesion, no un error
+    SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+    if (cfg.ca != NULL) {
+        if (SSL_CTX_load_verify_locations(ctx, cfg.ca, NULL) != 1) {
+            tls_fail("SSL_CTX_load_verify_locations");
+        }
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+    }
+
+    for (unsigned i = 0; i < cfg.conns; i++) {
+        run(&s, i);
+    }
+    fflush(stdout);
+
+    SSL_SESSION_free(session);
+    SSL_CTX_free(ctx);
+    free(s.v);
+    return 0;
+}
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Corre los micro-benchmarks y junta sus lineas JSON en un unico documento.
+#
+# Uso: run_micro.sh [directorio-de-los-binarios [filtro]] > resultados.json
+dir=${1:-$(dirname "$0")}
+filter=$2
+
+echo "{"
+echo "  \"date\": \"$(date -u +%Y-%m-%dT%H:%M:%SZ)\","
+echo "  \"host\": \"$(uname -n)\","
+echo "  \"benchmarks\": ["
+for b in micro_pop3filter micro_stripmime; do
+    "$dir/$b" $filter || exit 1
+done | sed -e 's/^/    /' -e '$!s/$/,/'
+echo "  ]"
+echo "}"
@@ -0,0 +1,138 @@
+#!/bin/sh
+# Prueba de integracion de TLS (-T/-K/-s): genera un certificado con openssl,
+# corre el mismo guion directo contra pop3mock y a traves del proxy por POP3S
+# y por STLS, y compara las respuestas byte a byte. El guion incluye un RETR
+# de varios MB con lineas que empiezan con "." (byte-stuffing) y rafagas con
+# pipelining. Tambien prueba un STLS con un pedido en vuelo y texto en claro
+# inyectado despues (que se descarta), los STLS rechazados y que las
+# conexiones POP3S siguientes retomen la sesion TLS.
+#
+# Uso: tls_test.sh [directorio-de-los-binarios [directorio-de-mails]]
+#
+# Se corre desde el directorio de secret.txt, como pop3filter.
+dir=${1:-.}
+mails=${2:-mails}
+case $mails in
+    /*) ;;
+    *) mails=$(pwd)/$mails ;;
+esac
+
+tmp=$(mktemp -d) || exit 1
+status=0
+
+fail() {
+    echo "tls: FAIL ($1)"
+    status=1
+}
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+    -keyout "$tmp/key.pem" -out "$tmp/cert.pem" > "$tmp/openssl.log" 2>&1 \
+    || { cat "$tmp/openssl.log"; rm -rf "$tmp"; exit 1; }
+
+# los mails del repo y uno de ~4MB con lineas que empiezan con "."
+mkdir "$tmp/mails"
+cp "$mails"/* "$tmp/mails/"
+awk 'BEGIN {
+    printf "From: tls@example.com\r\nSubject: big\r\n\r\n"
+    for (i = 0; i < 50000; i++) {
+        if (i % 7 == 0) {
+            printf ".%07d line with a leading dot\r\n", i
+        } else {
+            printf "%07d abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789\r\n", i
+        }
+    }
+    printf ".\r\n"
+}' > "$tmp/mails/big"
+
+cat > "$tmp/session.txt" << EOF
+USER tls
+PASS tls
+STAT
+LIST
+UIDL
+
+RETR 1
+RETR 2
+TOP 1 3
+LIST 2
+
+RETR 2
+NOOP
+QUIT
+EOF
+
+"$dir/pop3mock" -p 2192 -d "$tmp/mails" > /dev/null 2>&1 &
+mock=$!
+"$dir/pop3filter" -p 1192 -o 9192 -P 2192 -s 9992 \
+    -T "$tmp/cert.pem" -K "$tmp/key.pem" 127.0.0.1 > "$tmp/filter.log" 2>&1 &
+filter=$!
+sleep 1
+
+tls="$dir/bench/pop3tls -c $tmp/cert.pem"
+crlf() {
+    printf '%s\r\n' "$@"
+}
+
+# referencia: el mismo guion directo contra el origin
+$tls -p 2192 < "$tmp/session.txt" > "$tmp/ref.out" 2> "$tmp/ref.log" \
+    || fail "the reference session against pop3mock failed"
+[ "$(wc -c < "$tmp/ref.out")" -gt 4000000 ] || fail "the reference transcript is too short"
+
+# POP3S, tres conexiones: la segunda y la tercera retoman la sesion TLS
+cat "$tmp/ref.out" "$tmp/ref.out" "$tmp/ref.out" > "$tmp/pop3s.exp"
+$tls -p 9992 -s -n 3 < "$tmp/session.txt" > "$tmp/pop3s.out" 2> "$tmp/pop3s.log" \
+    || fail "POP3S session failed"
+cmp -s "$tmp/pop3s.exp" "$tmp/pop3s.out" || fail "POP3S transcript differs"
+
+# STLS solo en su rafaga
+{ printf 'STLS\n\n'; cat "$tmp/session.txt"; } > "$tmp/stls.txt"
+{ crlf "+OK Begin TLS negotiation."; cat "$tmp/ref.out"; } > "$tmp/stls.exp"
+$tls -p 1192 < "$tmp/stls.txt" > "$tmp/stls.out" 2> "$tmp/stls.log" \
+    || fail "STLS session failed"
+cmp -s "$tmp/stls.exp" "$tmp/stls.out" || fail "STLS transcript differs"
+
+# STLS con un pedido en vuelo delante y texto en claro detras, en la misma
+# rafaga: el NOOP se responde en claro y el USER inyectado no se responde
+{ printf 'NOOP\nSTLS\nUSER injected\n\n'; cat "$tmp/session.txt"; } > "$tmp/pipelined.txt"
+{ printf 'NOOP\n\n'; cat "$tmp/session.txt"; } > "$tmp/noop.txt"
+$tls -p 2192 < "$tmp/noop.txt" > "$tmp/noop.out" 2>> "$tmp/ref.log" \
+    || fail "the reference NOOP session against pop3mock failed"
+{
+    head -n 1 "$tmp/noop.out"
+    crlf "+OK Begin TLS negotiation."
+    tail -n +2 "$tmp/noop.out"
+} > "$tmp/pipelined.exp"
+$tls -p 1192 < "$tmp/pipelined.txt" > "$tmp/pipelined.out" 2> "$tmp/pipelined.log" \
+    || fail "pipelined STLS session failed"
+cmp -s "$tmp/pipelined.exp" "$tmp/pipelined.out" || fail "pipelined STLS transcript differs"
+
+# STLS rechazados: despues de autenticarse y sobre POP3S. La sesion sigue.
+printf 'USER tls\nPASS tls\nSTLS\nQUIT\n' > "$tmp/late.txt"
+printf 'USER tls\nPASS tls\nQUIT\n' | $tls -p 2192 > "$tmp/late.ref" 2>> "$tmp/ref.log"
+{
+    head -n 2 "$tmp/late.ref"
+    crlf "-ERR STLS not allowed now."
+    tail -n +3 "$tmp/late.ref"
+} > "$tmp/late.exp"
+$tls -p 1192 < "$tmp/late.txt" > "$tmp/late.out" 2> "$tmp/late.log" \
+    || fail "STLS after authentication broke the session"
+cmp -s "$tmp/late.exp" "$tmp/late.out" || fail "STLS after authentication was not refused"
+
+{ printf 'STLS\n'; cat "$tmp/session.txt"; } > "$tmp/twice.txt"
+{ crlf "-ERR STLS not available."; cat "$tmp/ref.out"; } > "$tmp/twice.exp"
+$tls -p 9992 -s < "$tmp/twice.txt" > "$tmp/twice.out" 2> "$tmp/twice.log" \
+    || fail "STLS over POP3S broke the session"
+cmp -s "$tmp/twice.exp" "$tmp/twice.out" || fail "STLS over POP3S was not refused"
+
+kill -0 $filter 2> /dev/null || fail "pop3filter is not running"
+kill $filter $mock 2> /dev/null
+wait 2> /dev/null
+# pop3filter se compila con -fsanitize=address
+! grep -q "Sanitizer" "$tmp/filter.log" || fail "pop3filter reported memory errors"
+if [ $status -eq 0 ]; then
+    echo "tls: ok"
+else
+    cat "$tmp"/*.log
+fi
+rm -rf "$tmp"
+exit $status
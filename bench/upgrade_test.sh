@@ -0,0 +1,71 @@
+#!/bin/sh
+# Prueba de integracion de la actualizacion en caliente (pop3filter -u): corre
+# pop3bench contra un proxy, arranca una instancia nueva a mitad de la corrida
+# y verifica que no fallo ninguna sesion, que la instancia vieja salio sola al
+# terminar las suyas y que la nueva sigue atendiendo. Antes de la carga, la
+# vieja (con -B 1) rechaza conexiones por memoria: no deben impedir que salga.
+#
+# Uso: upgrade_test.sh [directorio-de-los-binarios [directorio-de-mails]]
+#
+# Se corre desde el directorio de secret.txt, como pop3filter.
+dir=${1:-.}
+mails=${2:-mails}
+case $mails in
+    /*) ;;
+    *) mails=$(pwd)/$mails ;;
+esac
+
+tmp=$(mktemp -d) || exit 1
+opts="-p 1190 -o 9190 -P 2190 -u $tmp/upgrade.sock"
+status=0
+
+fail() {
+    echo "upgrade: FAIL ($1)"
+    status=1
+}
+
+"$dir/pop3mock" -p 2190 -d "$mails" -R 5 > /dev/null 2>&1 &
+mock=$!
+"$dir/pop3filter" $opts -B 1 127.0.0.1 > "$tmp/old.log" 2>&1 &
+old=$!
+sleep 1
+
+# en lazo abierto las sesiones se acumulan y pasan el limite de -B
+"$dir/bench/pop3bench" -p 1190 -w retr -r 500 -c 64 -d 1 > "$tmp/reject.log" 2>&1
+grep -q "failed [1-9]" "$tmp/reject.log" || fail "no connection was rejected"
+
+"$dir/bench/pop3bench" -p 1190 -w retr -c 16 -d 6 > "$tmp/load.log" 2>&1 &
+load=$!
+sleep 2
+"$dir/pop3filter" $opts 127.0.0.1 > "$tmp/new.log" 2>&1 &
+new=$!
+
+wait $load || fail "sessions failed during the upgrade"
+grep "^sessions" "$tmp/load.log"
+
+# la vieja termina sus sesiones y sale sola
+i=0
+while kill -0 $old 2> /dev/null && [ $i -lt 50 ]; do
+    sleep 0.2
+    i=$((i + 1))
+done
+if kill -0 $old 2> /dev/null; then
+    fail "the old instance did not drain"
+    kill $old
+fi
+wait $old || fail "the old instance exited with an error"
+grep -q "handed off" "$tmp/old.log" || fail "the old instance did not hand off its sockets"
+
+kill -0 $new 2> /dev/null || fail "the new instance is not running"
+"$dir/bench/pop3bench" -p 1190 -w login -c 2 -d 1 > "$tmp/after.log" 2>&1 \
+    || fail "the new instance does not serve sessions"
+
+kill $new $mock 2> /dev/null
+wait 2> /dev/null
+if [ $status -eq 0 ]; then
+    echo "upgrade: ok"
+else
+    cat "$tmp"/*.log
+fi
+rm -rf "$tmp"
+exit $status